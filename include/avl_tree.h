@@ -18,5 +18,6 @@ AVLNode* avl_find(AVLNode *root, struct Cell *cell, int (*cmp)(struct Cell*, str
 void avl_traverse(AVLNode *root, void (*callback)(struct Cell*, void*), void *data);
 void avl_free(AVLNode *root);
 int avl_cell_compare(struct Cell *a, struct Cell *b);
+AVLNode* avl_build_sorted(struct Cell **cells, long count);
 
 #endif  // AVL_TREE_H
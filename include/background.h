@@ -0,0 +1,65 @@
+#ifndef BACKGROUND_H
+#define BACKGROUND_H
+
+#include <pthread.h>
+#include "spreadsheet.h"
+
+/* Progressive recalculation at the interactive prompt.  An edit there does not wait for its
+   cascade: propagateChange lays out a plan, every cell the synchronous path would recompute in
+   one order that respects both edges and ranges, and hands it to a background thread that
+   works through it while the prompt waits for the next command.
+
+   The worker and the prompt share the sheets through one lock, which the worker gives up after
+   every cell once the prompt asks for it, so a command waits for at most one recalc_cell.
+   While it holds the lock the prompt may run any plan step itself:
+
+     - printSpreadsheet first settles the steps of the cells in view, together with the pending
+       steps they read (backgroundSettle), and leaves the rest to the worker;
+     - an edit plans its own cascade together with the steps still pending, so a cell both need
+       is recomputed once, in the order of the new plan; the old plan is dropped;
+     - any other command, which may read or write any cell, first finishes the plan
+       (backgroundFinish).
+
+   Script, server and embedded use recalculate synchronously, as does the prompt while the
+   change feed or the trace is recording (neither is thread-safe). */
+
+/*
+ * A plan is a list of steps; step i recomputes cells[i] on owners[i].  Steps before next are
+ * done; after it, state[] tells done steps from pending ones.  index maps a cell to its step
+ * (open-addressed, indexCapacity slots, -1 for free).
+ */
+typedef struct BackgroundRecalc {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int wantLock;               // set (atomically) while the prompt waits for the lock
+    int stop;
+    Cell **cells;
+    Spreadsheet **owners;
+    unsigned char *state;
+    long count;
+    long next;
+    long pending;
+    long *index;
+    long indexCapacity;
+    long *stack;                // scratch for backgroundSettle
+} BackgroundRecalc;
+
+BackgroundRecalc *createBackgroundRecalc(void);
+void freeBackgroundRecalc(BackgroundRecalc *background);
+void backgroundPause(BackgroundRecalc *background);
+void backgroundResume(BackgroundRecalc *background);
+long backgroundStep(const BackgroundRecalc *background, const Cell *cell);
+void backgroundSetPlan(BackgroundRecalc *background, Cell **cells, Spreadsheet **owners, long count);
+void backgroundFinish(BackgroundRecalc *background);
+void backgroundSettle(BackgroundRecalc *background, Spreadsheet *sheet,
+                      int row1, int col1, int row2, int col2);
+
+/*
+ * backgroundPending reports whether a plan still has steps to run.
+ */
+static inline int backgroundPending(const BackgroundRecalc *background) {
+    return background && background->pending > 0;
+}
+
+#endif  // BACKGROUND_H
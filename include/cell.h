@@ -8,6 +8,7 @@
 
 /* Forward declaration for AVLNode */
 typedef struct AVLNode AVLNode;
+struct Spreadsheet;
 
 /* Operation codes */
 #define OP_NONE       0
@@ -24,9 +25,13 @@ typedef struct AVLNode AVLNode;
 #define OP_SLEEP      10
 
 typedef struct Cell {
+    // value and error come first: range scans read nothing else, and so touch one cache line.
     int value;
+    int error;
     int op;
     int row1, col1, row2, col2;
+    int component;          // connected component id (see components.h); 0 for none
+    struct Spreadsheet *rangeSheet;    // sheet the range lies on when it is not the cell's own
     /* For simple formulas */
     int operand1IsLiteral;
     int operand1Literal;
@@ -40,12 +45,11 @@ typedef struct Cell {
     AVLNode *dependents;    // cells that depend on this cell.
     int selfRow;
     int selfCol;
-    int error;
 } Cell;
 
 void initCell(Cell *cell,int selfrow,int selfcol);
 
 void freeCell(Cell *cell);
-void parseCellReference(const char *ref, int *row, int *col);
+int parseCellReference(const char *ref, int *row, int *col);
 
 #endif  // CELL_H
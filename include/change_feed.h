@@ -0,0 +1,94 @@
+#ifndef CHANGE_FEED_H
+#define CHANGE_FEED_H
+
+#include "spreadsheet.h"
+
+/* Change feed.  Subscribers learn which cells changed value or error, once per commit: a
+   command, a batch of server-mode commands, or an embedding API call (sheet_api.h) -- the same
+   points at which values are published to the value plane.  While a commit runs, every cell
+   that recalculation or an assignment changes is recorded once, together with what it showed
+   before the commit; at the end, cells that are back where they started are dropped and the
+   rest are delivered together.  A commit that changes nothing is not delivered.  When a sheet
+   is replaced wholesale (a snapshot load), or a commit changes more than FEED_MAX_PENDING
+   cells, the commit is delivered as a reset instead: the consumer rescans.
+
+   A subscriber is either a callback, run on the engine thread, or a stream ("watch <path>")
+   to which each commit is written as text in a single write:
+
+     commit 12 2                  commit 13 reset
+     Sheet1!A1=5
+     Sheet1!B2=ERR
+
+   A stream path may name a file, a FIFO (which must already have a reader) or a listening
+   Unix-domain socket.  Writes block, so a consumer that stops reading holds up the engine;
+   one that goes away is unsubscribed.  Nothing is recorded while nobody subscribes. */
+
+// Most cells one commit may list before it is delivered as a reset.
+#define FEED_MAX_PENDING     (1L << 20)
+#define FEED_MAX_SUBSCRIBERS 16
+
+typedef struct CellChange {
+    Spreadsheet *sheet;
+    int row, col;
+    int value;
+    int error;
+} CellChange;
+
+typedef void (*ChangeCallback)(unsigned long commit, const CellChange *changes, long count,
+                               int reset, void *data);
+
+typedef struct PendingChange {
+    Cell *cell;
+    Spreadsheet *sheet;
+    int oldValue;
+    int oldError;
+    long slot;                  // position in ChangeFeed.slots
+} PendingChange;
+
+typedef struct Subscriber {
+    ChangeCallback callback;    // NULL for a stream and for a free slot
+    void *data;
+    int fd;                     // stream descriptor, -1 otherwise
+} Subscriber;
+
+typedef struct ChangeFeed {
+    Subscriber subscribers[FEED_MAX_SUBSCRIBERS];
+    int subscriberCount;
+    PendingChange *pending;     // cells recorded during the current commit
+    long pendingCount;
+    long pendingCapacity;
+    long *slots;                // open-addressed index into pending (position + 1, 0 if free)
+    long slotCount;
+    int reset;
+    unsigned long commits;      // number of the last delivered commit
+    CellChange *changes;        // delivery buffer
+    long changesCapacity;
+    char *text;                 // stream encoding of the commit
+    size_t textCapacity;
+} ChangeFeed;
+
+int changeFeedSubscribe(Spreadsheet *spreadsheet, ChangeCallback callback, void *data);
+int changeFeedWatch(Spreadsheet *spreadsheet, const char *path);
+void changeFeedUnsubscribe(Spreadsheet *spreadsheet, int id);
+void changeFeedUnwatchAll(Spreadsheet *spreadsheet);
+void changeFeedRecord(ChangeFeed *feed, Spreadsheet *sheet, Cell *cell, int oldValue, int oldError);
+void changeFeedReset(ChangeFeed *feed);
+void changeFeedCommit(Spreadsheet *home);
+void freeChangeFeed(ChangeFeed *feed);
+
+/*
+ * cellShowsChange reports whether a cell now shows something other than before: an error
+ * hides its value, so only the flag is compared then.
+ */
+static inline int cellShowsChange(int value, int error, int oldValue, int oldError) {
+    return error != oldError || (!error && value != oldValue);
+}
+
+/*
+ * changeFeedActive reports whether feed has subscribers, i.e. whether changes must be recorded.
+ */
+static inline int changeFeedActive(const ChangeFeed *feed) {
+    return feed && feed->subscriberCount > 0;
+}
+
+#endif  // CHANGE_FEED_H
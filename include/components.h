@@ -0,0 +1,70 @@
+#ifndef COMPONENTS_H
+#define COMPONENTS_H
+
+#include "spreadsheet.h"
+#include "workbook.h"
+
+/* Connected components of the dependency graph.  A sheet often holds many independent models
+   side by side; a change in one of them cannot affect the others, so cycle checks, the pass
+   over the advanced formulas and recalcAll work one component at a time.
+
+   Components are kept in a union-find forest shared by the whole workbook.  A cell that takes
+   part in nothing has id 0; it gets an id of its own once it is linked or changes, and joins
+   the component of every range formula over it.  Two cells are put in one component when an
+   edge joins them, and a range formula is put in the component of every cell of its range that
+   has an id.  So a change can only reach cells and range formulas of its own component.
+
+   Union-find cannot split a component when an edge goes away, so removals only make components
+   too coarse, which is never wrong.  Once more than COMPONENTS_REBUILD_MIN (or, if larger, as
+   many as there are ids) removals have piled up, or the graph was changed in bulk (deferRecalc,
+   a snapshot load), the table is marked stale and rebuilt from the edges in one pass the next
+   time it is needed.  While it is stale, nothing is confined.
+
+   recalcAll of a large lone sheet runs one task per component on the shared thread pool
+   (unless the change feed or the trace is recording, which are not thread-safe). */
+
+#define COMPONENTS_REBUILD_MIN 4096
+// Materialized cells before recalcAll hands components to the thread pool.
+#define COMPONENTS_PARALLEL_MIN 4096
+
+typedef struct Components {
+    int *parent;                // parent[id] == id for a root; id 0 is "no component"
+    int *size;                  // cells under a root, for union by size
+    int count;                  // ids handed out, including 0
+    int capacity;
+    long removals;              // edges and range formulas dropped since the last rebuild
+    int stale;
+    unsigned long rebuilds;
+} Components;
+
+void componentsRefresh(Spreadsheet *spreadsheet);
+int componentOf(Spreadsheet *spreadsheet, Cell *cell);
+int componentsSeparate(Spreadsheet *spreadsheet, const Cell *a, const Cell *b);
+void componentsLink(Spreadsheet *spreadsheet, Cell *target, Cell *source);
+void componentsLinkRange(Spreadsheet *spreadsheet, Cell *formula, const Spreadsheet *rangeSheet);
+void componentsNoteRemoval(Spreadsheet *spreadsheet);
+void componentsInvalidate(Spreadsheet *spreadsheet);
+void freeComponents(Components *components);
+
+/*
+ * componentFind returns the root of id, halving the path on the way.
+ */
+static inline int componentFind(Components *components, int id) {
+    int *parent = components->parent;
+    while (parent[id] != id) {
+        parent[id] = parent[parent[id]];
+        id = parent[id];
+    }
+    return id;
+}
+
+/*
+ * componentsUsable returns the table of spreadsheet's workbook if its ids can be trusted, or
+ * NULL while it is stale or was never created.
+ */
+static inline Components *componentsUsable(Spreadsheet *spreadsheet) {
+    Components *components = homeSheet(spreadsheet)->components;
+    return (components && !components->stale) ? components : NULL;
+}
+
+#endif  // COMPONENTS_H
@@ -0,0 +1,19 @@
+#ifndef CSV_H
+#define CSV_H
+
+#include "spreadsheet.h"
+
+/* One CSV line per sheet row, one field per column.  A field is empty (cell left alone),
+   an integer literal, or a formula starting with '=' written as it would be typed
+   after "A1=", e.g. "=B2*3" or "=SUM(A1:C4)". */
+
+// Files are split into chunks of about this size for parallel parsing.
+#define CSV_CHUNK_BYTES   (1 << 20)
+// Size of the buffer export_csv fills before each write().
+#define CSV_WRITE_BUFFER  (1 << 20)
+
+int importCsv(Spreadsheet *spreadsheet, const char *path, long *rejected);
+int exportCsv(Spreadsheet *spreadsheet, const char *path, int valuesOnly);
+int exportCsvAsync(Spreadsheet *spreadsheet, const char *path);
+
+#endif  // CSV_H
@@ -0,0 +1,96 @@
+#ifndef INDEX_MAP_H
+#define INDEX_MAP_H
+
+#include <stddef.h>
+
+/* Logical-to-physical index maps for rows and columns.  Cells never move: inserting or
+   deleting rows only changes which physical row of the tile store each logical row (the row
+   the user sees as "5") lies on.  A map is a permutation of 0..size-1 kept as runs, stretches
+   of logical indices that lie on consecutive physical ones, so a map costs a few runs per
+   structural edit instead of an entry per row.  The identity map is NULL, and lookups through
+   it cost one test.  Runs are kept twice, in logical and in physical order, so both
+   directions are a binary search.
+
+   A map is one allocation of indexMapBytes(map) bytes and is never changed in place:
+   indexMapRotate builds a new one, so a copy published to readers (see value_plane.h) stays
+   valid for as long as they hold it. */
+
+typedef struct IndexRun {
+    int logical;
+    int physical;
+    int length;
+} IndexRun;
+
+typedef struct IndexMap {
+    int size;
+    int count;
+    IndexRun *runs;             // by logical index, together covering 0..size-1
+    IndexRun *inverse;          // the same runs by physical index
+} IndexMap;
+
+IndexMap *indexMapRotate(IndexMap *map, int size, int first, int middle, int last, int tag);
+IndexMap *indexMapCopy(const IndexMap *map, int tag);
+int indexMapRestore(IndexMap **out, const IndexRun *runs, int count, int size, int tag);
+void indexMapFree(IndexMap *map, int tag);
+
+/*
+ * indexMapBytes returns the size of the allocation holding map.
+ */
+static inline size_t indexMapBytes(const IndexMap *map) {
+    return sizeof(IndexMap) + 2 * (size_t) map->count * sizeof(IndexRun);
+}
+
+/*
+ * indexRunFind returns the run of runs that holds index; runs (count of them) are sorted by
+ * physical index if physical is set, by logical index otherwise.
+ */
+static inline const IndexRun *indexRunFind(const IndexRun *runs, int count, int index, int physical) {
+    int lo = 0, hi = count - 1;
+    while (lo < hi) {
+        int mid = lo + (hi - lo + 1) / 2;
+        if ((physical ? runs[mid].physical : runs[mid].logical) <= index)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return &runs[lo];
+}
+
+/*
+ * indexMapPhysical returns the physical index of logical index.
+ */
+static inline int indexMapPhysical(const IndexMap *map, int logical) {
+    if (!map)
+        return logical;
+    const IndexRun *run = indexRunFind(map->runs, map->count, logical, 0);
+    return run->physical + (logical - run->logical);
+}
+
+/*
+ * indexMapLogical returns the logical index of physical index.
+ */
+static inline int indexMapLogical(const IndexMap *map, int physical) {
+    if (!map)
+        return physical;
+    const IndexRun *run = indexRunFind(map->inverse, map->count, physical, 1);
+    return run->logical + (physical - run->physical);
+}
+
+/*
+ * indexMapSpan sets *physical to the physical index of logical and returns how many logical
+ * indices from there, up to last, lie on consecutive physical ones.  A range is walked as
+ * one rectangle of the store per pair of spans.
+ */
+static inline int indexMapSpan(const IndexMap *map, int logical, int last, int *physical) {
+    if (!map) {
+        *physical = logical;
+        return last - logical + 1;
+    }
+    const IndexRun *run = indexRunFind(map->runs, map->count, logical, 0);
+    int offset = logical - run->logical;
+    *physical = run->physical + offset;
+    int span = run->length - offset;
+    return span < last - logical + 1 ? span : last - logical + 1;
+}
+
+#endif  // INDEX_MAP_H
@@ -0,0 +1,107 @@
+#ifndef INGEST_H
+#define INGEST_H
+
+#include <stdint.h>
+#include "spreadsheet.h"
+#include "sheet_api.h"
+
+/* Streaming ingest ("--ingest <path> [--tick <ms>]", with --serve).  External feeds write one
+   value per line to path:
+
+     A1=42
+     Sheet2!B7=-3
+
+   If path is an existing FIFO it is read; otherwise a Unix-domain socket is created there and
+   any number of producers may connect to it.
+
+   Updates are not applied one by one.  They are coalesced per cell until the tick ends, tick
+   milliseconds after the first of them arrived: a later value for a cell replaces an earlier
+   one, so a cell is written at most once per tick and always with its freshest value.  The
+   tick is then handed to the server's writer thread as one batch (sheet_apply_batch), queued
+   behind the commands already waiting: one cascade over every cell it changes, one publish,
+   one change-feed commit.
+
+   Backpressure: while a batch is being applied the next tick keeps coalescing (the tick is
+   counted as lagged) and is handed over as soon as the writer is done.  Once
+   INGEST_MAX_PENDING distinct cells wait, producers are no longer read until the batch is
+   handed over, so their writes block in the kernel.  Nothing is dropped.  The counters are
+   reported by "ingest_stats".  Ingested values are not journaled. */
+
+#define INGEST_TICK_MS      10
+// Longest tick "--tick" accepts: a minute of coalescing.
+#define INGEST_TICK_MAX_MS  60000
+// Distinct cells waiting for the writer before producers stop being read.
+#define INGEST_MAX_PENDING  (1L << 16)
+// Longest accepted update line.
+#define INGEST_MAX_LINE     64
+// Distinct sheet names the lines of one run may use.
+#define INGEST_MAX_SHEETS   64
+
+typedef struct IngestEntry {
+    uint64_t key;               // sheet index, row and column, plus 1; 0 for a free slot
+    int value;
+} IngestEntry;
+
+/*
+ * IngestBatch holds the coalesced updates of one tick.  The event loop fills it; once handed
+ * over, only the writer touches it until it comes back through ingestApplied.
+ */
+typedef struct IngestBatch {
+    IngestEntry *entries;       // open-addressed by key
+    long capacity;
+    long count;
+    double firstArrival;
+    SheetUpdate *updates;       // the writer's buffer for one sheet's updates
+    long updatesCapacity;
+    long rejected;              // set by the writer
+    double applySeconds;
+} IngestBatch;
+
+typedef struct IngestProducer {
+    int fd;
+    struct IngestProducer *prev, *next;
+    char in[4096];
+    size_t inUsed;
+    int discarding;             // skipping the rest of an overlong line
+} IngestProducer;
+
+typedef struct IngestStats {
+    unsigned long lines;        // update lines received
+    unsigned long malformed;    // lines that are not "[Sheet!]Cell=value"
+    unsigned long coalesced;    // updates replaced by a later one of the same tick
+    unsigned long applied;      // cell writes applied
+    unsigned long rejected;     // updates naming a missing sheet or a cell outside it
+    unsigned long ticks;        // batches applied
+    unsigned long lagged;       // ticks that ended while the previous batch was being applied
+    unsigned long pauses;       // times producers stopped being read
+    long maxBatch;
+    double lastDelay, maxDelay; // first arrival of a batch to its publication
+    double applySeconds;
+} IngestStats;
+
+typedef struct Ingest {
+    char path[108];             // room of sockaddr_un.sun_path
+    int epollFd;                // polled by the server loop
+    int listenFd;               // -1 when reading a FIFO
+    int timerFd;
+    IngestProducer *producers;
+    int producerCount;
+    IngestBatch batches[2];
+    int filling;                // batch receiving updates
+    int inFlight;               // the other batch is with the writer
+    int due;                    // the tick ended while the writer had the other batch
+    int paused;
+    int tickMillis;
+    char names[INGEST_MAX_SHEETS][SHEET_NAME_MAX];  // sheets named by lines; index + 1 in keys
+    int nameCount;
+    IngestStats stats;
+} Ingest;
+
+Ingest *openIngest(const char *path, int tickMillis);
+IngestBatch *ingestPoll(Ingest *ingest);
+void ingestApply(Ingest *ingest, IngestBatch *batch, Spreadsheet *home);
+IngestBatch *ingestApplied(Ingest *ingest, IngestBatch *batch);
+int formatIngestStats(const Ingest *ingest, char *buffer, size_t size);
+void closeIngest(Ingest *ingest);
+
+#endif  // INGEST_H
@@ -5,6 +5,6 @@
 #include "spreadsheet.h"
 #include <time.h>
 
-int parseInput(char *input, Spreadsheet *spreadsheet, clock_t start);
+int parseInput(char *input, Spreadsheet *spreadsheet, double start);
 
 #endif // INPUT_PARSER_H
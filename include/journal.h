@@ -0,0 +1,31 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <pthread.h>
+#include "spreadsheet.h"
+
+#define JOURNAL_HEADER          "#journal v1"
+#define JOURNAL_SNAPSHOT_MARK   "#snapshot "
+// Longest time an accepted command may wait for its batch to be fsynced.
+#define JOURNAL_GROUP_COMMIT_MS 5
+
+typedef struct Journal {
+    int fd;
+    char *path;
+    pthread_t flusher;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;        // signalled when records are waiting to be synced
+    pthread_cond_t synced;      // broadcast after every completed fdatasync
+    unsigned long appended;     // records written to the file
+    unsigned long durable;      // records covered by a completed fdatasync
+    unsigned long syncs;        // number of fdatasync calls (one per group)
+    int stop;
+} Journal;
+
+Journal *openJournal(const char *path, Spreadsheet *spreadsheet, const char *loadedFrom);
+void journalAppend(Journal *journal, const char *command);
+void journalSync(Journal *journal);
+int journalCheckpoint(Journal *journal, Spreadsheet *spreadsheet, const char *snapshotPath);
+void closeJournal(Journal *journal);
+
+#endif  // JOURNAL_H
@@ -0,0 +1,53 @@
+#ifndef MEM_TRACK_H
+#define MEM_TRACK_H
+
+#include <stdlib.h>
+
+/* Memory accounting by subsystem.  Engine allocations go through the wrappers below with a tag
+   naming their owner; frees pass the size that was allocated, so no per-block header is needed.
+   With SHEET_STATS (see stats.h) every tag keeps live bytes, peak bytes and allocation counts,
+   which the "mem" command and the benchmark report.  Without it the wrappers are plain
+   malloc/calloc/realloc/free. */
+
+enum {
+    MEM_CELLS,      // Spreadsheet structure, tile directory and cell tiles
+    MEM_PACKED,     // values of packed tiles
+    MEM_EDGES,      // AVL nodes of the dependency and dependent sets, and their components
+    MEM_ADVANCED,   // the advancedFormulas list
+    MEM_RECALC,     // BFS queue nodes, affected sets and topological-sort arrays
+    MEM_VISITED,    // visited buffers of the cycle checks
+    MEM_RENDER,     // viewport labels and frame buffers
+    MEM_IO,         // snapshot, journal, CSV and server buffers
+    MEM_VERSIONS,   // published value plane versions and retired blocks
+    MEM_FEED,       // change feed: pending changes and delivery buffers
+    MEM_OTHER,
+    MEM_TAG_COUNT
+};
+
+#ifdef SHEET_STATS
+
+typedef struct {
+    long long liveBytes;
+    long long peakBytes;
+    unsigned long long allocs;
+    unsigned long long frees;
+} MemTagStats;
+
+void *memAlloc(int tag, size_t size);
+void *memCalloc(int tag, size_t count, size_t size);
+void *memRealloc(int tag, void *ptr, size_t oldSize, size_t newSize);
+void memFree(int tag, void *ptr, size_t size);
+void memSnapshot(MemTagStats out[MEM_TAG_COUNT], long long *totalPeak);
+const char *memTagName(int tag);
+void memPrint(void);
+
+#else
+
+#define memAlloc(tag, size)                      ((void) (tag), malloc(size))
+#define memCalloc(tag, count, size)              ((void) (tag), calloc(count, size))
+#define memRealloc(tag, ptr, oldSize, newSize)   ((void) (tag), (void) (oldSize), realloc(ptr, newSize))
+#define memFree(tag, ptr, size)                  ((void) (tag), (void) (size), free(ptr))
+
+#endif  // SHEET_STATS
+
+#endif  // MEM_TRACK_H
@@ -0,0 +1,51 @@
+#ifndef RENDER_H
+#define RENDER_H
+
+#include "spreadsheet.h"
+
+/* Size of the visible window printed after every command. */
+#define VIEW_ROWS        10
+#define VIEW_COLS        10
+
+/* Column widths used by the frame layout. */
+#define ROW_LABEL_WIDTH  4
+#define CELL_WIDTH       12
+
+/* Upper bound on one frame: header plus VIEW_ROWS rows, each line at most
+   a row label, VIEW_COLS padded cells and a newline. */
+#define RENDER_LINE_MAX  (16 + VIEW_COLS * CELL_WIDTH + 2)
+#define RENDER_FRAME_MAX ((VIEW_ROWS + 1) * RENDER_LINE_MAX)
+
+typedef struct Renderer {
+    /* Precomputed column labels ("A".."ZZZ"), 4 bytes per column. */
+    char (*labels)[4];
+    unsigned char *labelLengths;
+    int labelCount;
+
+    /* Two frame buffers: the one being built and the last one emitted. */
+    char *frame;
+    char *prevFrame;
+    int lineStart[VIEW_ROWS + 2];
+    int prevLineStart[VIEW_ROWS + 2];
+    int lineCount;
+    int prevLineCount;
+
+    /* Viewport of the previous frame, used by delta rendering. */
+    int prevStartRow;
+    int prevStartCol;
+    int prevValid;
+
+    /* When set, only lines that changed since the last frame are emitted. */
+    int deltaMode;
+
+    /* Scratch buffer for the bytes actually written in delta mode. */
+    char *out;
+} Renderer;
+
+Renderer *createRenderer(int cols);
+void freeRenderer(Renderer *renderer);
+void setDeltaRendering(Spreadsheet *spreadsheet, int enabled);
+void getColumnLabel(int colIndex, char *label);
+int formatInt(char *out, int value);
+
+#endif  // RENDER_H
@@ -0,0 +1,9 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include "spreadsheet.h"
+
+// Replay a command file through the engine without prompts or rendering.
+int runScript(const char *path, Spreadsheet *spreadsheet);
+
+#endif  // SCRIPT_H
@@ -0,0 +1,37 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "spreadsheet.h"
+
+/* Server mode ("--serve <socket>").  Clients connect to a Unix-domain stream socket and send
+   one command per line; every line gets exactly one response line, in order:
+
+     A1=B1+2, scroll_to A5, save s.snap, ...   any interactive command; the response is its
+                                               status message, e.g. "ok" or "Error: ..."
+     get A1 | get A1:C3                        "ok v,v,v;v,v,v" from the home sheet, rows
+                                               separated by ';', errors as ERR
+     q                                         closes the connection
+     watch <path>                              streams the cells each later batch changes to
+                                               path (see change_feed.h)
+     ingest_stats                              the counters of --ingest (see ingest.h)
+
+   Commands go to a single writer thread, which takes everything queued at once and runs it as
+   one batch: values are published (see value_plane.h) once the batch is done, then the batch
+   is answered.  Reads are answered by a pool of reader threads from the last published
+   version and never wait for the writer.  A read waits for the earlier commands of its own
+   connection, so a client always sees its own writes.  One epoll loop owns all sockets. */
+
+// Longest accepted request line.
+#define SERVER_MAX_LINE       256
+// Most commands the writer runs before publishing.
+#define SERVER_MAX_BATCH      256
+// Requests a connection may have waiting before the server stops reading from it.
+#define SERVER_MAX_PENDING    1024
+// Most cells one "get" may return.
+#define SERVER_MAX_GET_CELLS  4096
+#define SERVER_READER_THREADS 4
+
+int runServer(const char *socketPath, Spreadsheet *spreadsheet, int readerThreads,
+              const char *ingestPath, int tickMillis);
+
+#endif  // SERVER_H
@@ -0,0 +1,73 @@
+#ifndef SHEET_API_H
+#define SHEET_API_H
+
+#include "spreadsheet.h"
+#include "change_feed.h"
+
+/* Embedding API, built as libspreadsheet.a by "make lib".  A program that links the engine
+   reads and writes cells through typed calls instead of command strings: nothing is parsed or
+   printed, and every call returns one of the SHEET_* codes below.  Rows and columns count
+   from 0 (A1 is row 0, col 0); formula operations are the OP_* codes of cell.h.
+
+   A write behaves like the equivalent command (same cycle checks, same propagation).  Unless
+   deferPublish is set, it is then published to the value plane and delivered to change
+   subscribers (change_feed.h).  Writes are not journaled.  All calls belong to the thread
+   that owns the sheet; other threads read through a SheetView (value_plane.h).
+
+     cc app.c -Iinclude target/release/libspreadsheet.a -lm -pthread */
+
+#define SHEET_OK            0
+#define SHEET_ERR_ARGUMENT  -1     // NULL pointer, bad count or unsupported operation
+#define SHEET_ERR_BOUNDS    -2     // a cell or range lies outside its sheet
+#define SHEET_ERR_RANGE     -3     // range corners are not top-left:bottom-right
+#define SHEET_ERR_SHEET     -4     // an operand's sheet is not in the target's workbook
+#define SHEET_ERR_CYCLE     -5     // the formula would create a cyclic dependency
+#define SHEET_ERR_CELL      -6     // the cell holds an error value (shown as ERR)
+#define SHEET_ERR_REFERENCED -7    // rows or columns to delete are read from outside them
+#define SHEET_ERR_OCCUPIED  -8     // an insert would push content off the sheet
+
+// One operand of a formula: a cell, or a literal when isCell is 0.
+typedef struct SheetOperand {
+    int isCell;
+    int row, col;
+    int literal;
+    Spreadsheet *sheet;         // sheet of a cell operand; NULL for the formula's own sheet
+} SheetOperand;
+
+/*
+ * SheetFormula is a parsed right-hand side.  op is OP_NONE for "=operand1", OP_ADD..OP_DIV for
+ * "=operand1 <op> operand2", or OP_ADV_SUM..OP_ADV_STDEV over the inclusive range
+ * (row1, col1)..(row2, col2) of rangeSheet (NULL for the formula's own sheet).
+ */
+typedef struct SheetFormula {
+    int op;
+    SheetOperand operand1;
+    SheetOperand operand2;
+    Spreadsheet *rangeSheet;
+    int row1, col1, row2, col2;
+} SheetFormula;
+
+// One write of a batch: formula, or value when formula is NULL.
+typedef struct SheetUpdate {
+    int row, col;
+    const SheetFormula *formula;
+    int value;
+} SheetUpdate;
+
+Spreadsheet *sheet_open(int rows, int cols);
+void sheet_close(Spreadsheet *sheet);
+int sheet_set_value(Spreadsheet *sheet, int row, int col, int value);
+int sheet_set_formula(Spreadsheet *sheet, int row, int col, const SheetFormula *formula);
+long sheet_apply_batch(Spreadsheet *sheet, const SheetUpdate *updates, long count, int *results);
+int sheet_insert_rows(Spreadsheet *sheet, int row, int count);
+int sheet_delete_rows(Spreadsheet *sheet, int row, int count);
+int sheet_insert_cols(Spreadsheet *sheet, int col, int count);
+int sheet_delete_cols(Spreadsheet *sheet, int col, int count);
+int sheet_get_value(const Spreadsheet *sheet, int row, int col, int *value);
+int sheet_get_range(const Spreadsheet *sheet, int row1, int col1, int row2, int col2,
+                    int *values, unsigned char *errors);
+int sheet_subscribe(Spreadsheet *sheet, ChangeCallback callback, void *data);
+void sheet_unsubscribe(Spreadsheet *sheet, int id);
+const char *sheet_strerror(int code);
+
+#endif  // SHEET_API_H
@@ -0,0 +1,94 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include "spreadsheet.h"
+
+#define SNAPSHOT_MAGIC      "SHEETSNP"
+#define SNAPSHOT_VERSION    3
+#define SNAPSHOT_PAGE_SIZE  4096
+
+/* Formula flag bits stored in SnapshotFormula.flags. */
+#define SNAP_OP1_LITERAL    0x1
+#define SNAP_OP2_LITERAL    0x2
+#define SNAP_OP1_REF        0x4
+#define SNAP_OP2_REF        0x8
+
+/* Location of one section inside the file; offsets are multiples of SNAPSHOT_PAGE_SIZE. */
+typedef struct SnapshotSection {
+    uint64_t offset;
+    uint64_t length;
+} SnapshotSection;
+
+/*
+ * The header occupies the first page.  Sections follow in this order:
+ *   tiles         SnapshotTile[tileCount]       materialized tiles, sorted by (row0, col0)
+ *   values        int32_t[cellCount]            cell values, tile by tile, row-major inside a tile
+ *   errors        uint64_t[(cellCount+63)/64]   error bitmap in the same order
+ *   formulas      SnapshotFormula[formulaCount] in the same order
+ *   dependents    SnapshotEdge[edgeCount]       grouped by from: "to depends on from"
+ *   dependencies  SnapshotEdge[edgeCount]       same edges grouped by to
+ *   advanced      uint64_t[advancedCount]       advanced formula list in engine order
+ *   layout        SnapshotRun[rowRunCount + colRunCount]  the row index map, then the column one
+ * Cells are named by their sheet index row * cols + col, in store coordinates.  cellCount counts
+ * the cells of the stored tiles only; every other cell of the sheet is empty.  A map without
+ * runs is the identity.
+ */
+typedef struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t pageSize;
+    int32_t rows;
+    int32_t cols;
+    int32_t startRow;
+    int32_t startCol;
+    int32_t tileRows;       // TILE_ROWS and TILE_COLS of the writer
+    int32_t tileCols;
+    uint64_t tileCount;
+    uint64_t cellCount;
+    uint64_t formulaCount;
+    uint64_t edgeCount;
+    uint64_t advancedCount;
+    uint64_t rowRunCount;
+    uint64_t colRunCount;
+    SnapshotSection tiles;
+    SnapshotSection values;
+    SnapshotSection errors;
+    SnapshotSection formulas;
+    SnapshotSection dependents;
+    SnapshotSection dependencies;
+    SnapshotSection advanced;
+    SnapshotSection layout;
+} SnapshotHeader;
+
+typedef struct SnapshotTile {
+    int32_t row0;
+    int32_t col0;
+} SnapshotTile;
+
+typedef struct SnapshotFormula {
+    uint64_t cell;
+    int32_t op;
+    int32_t flags;
+    int32_t literal1;
+    int32_t literal2;
+    uint64_t ref1;
+    uint64_t ref2;
+    int32_t row1, col1, row2, col2;
+} SnapshotFormula;
+
+typedef struct SnapshotEdge {
+    uint64_t from;
+    uint64_t to;
+} SnapshotEdge;
+
+typedef struct SnapshotRun {
+    int32_t logical;
+    int32_t physical;
+    int32_t length;
+} SnapshotRun;
+
+int saveSnapshot(Spreadsheet *spreadsheet, const char *path);
+int loadSnapshot(Spreadsheet *spreadsheet, const char *path);
+
+#endif  // SNAPSHOT_H
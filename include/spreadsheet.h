@@ -2,7 +2,23 @@
 #define SPREADSHEET_H
 
 #include "cell.h"
+#include "tile_store.h"
+#include "index_map.h"
 #include <time.h>
+
+// Largest sheet accepted: 2^20 rows and columns A to ZZZ.
+#define SHEET_MAX_ROWS 1048576
+#define SHEET_MAX_COLS 18278
+// Longest sheet name, including the terminator.
+#define SHEET_NAME_MAX 32
+
+struct Renderer;
+struct Journal;
+struct Workbook;
+struct ValuePlane;
+struct ChangeFeed;
+struct Components;
+
 typedef struct Spreadsheet {
     int display;
     int rows;
@@ -10,16 +26,135 @@ typedef struct Spreadsheet {
     float time;
     int startRow;
     int startCol;
-    Cell **table;
+    // Sparse cell storage; see tile_store.h.
+    TileStore store;
+    // Physical row and column of every logical one (see index_map.h); NULL until rows or
+    // columns are first inserted or deleted.  Coordinates given to the sheet, range bounds and
+    // the viewport are logical; selfRow and selfCol of a cell, and tiles, are physical.
+    IndexMap *rowMap;
+    IndexMap *colMap;
     // Global list for advanced (range) formulas.
     Cell **advancedFormulas;
     int advancedFormulasCount;
     int advancedFormulasCapacity;
+    // Buffered viewport renderer (see render.h).
+    struct Renderer *renderer;
+    // Script mode: suppress frames and status lines.
+    int quiet;
+    // Number of commands answered with anything other than "ok".
+    long rejectedCount;
+    // Bulk mode: skip per-command propagation (and SLEEP delays); call recalcAll afterwards.
+    int deferRecalc;
+    // Write-ahead journal of accepted commands (NULL when journaling is off).
+    struct Journal *journal;
+    // Command currently being executed; journaled once its result is emitted.
+    const char *pendingCommand;
+    // Server mode (see server.h): status messages are copied into statusOut instead of being
+    // printed, and values are published once per batch of commands instead of after each one.
+    char *statusOut;
+    size_t statusOutSize;
+    int deferPublish;
+    // Name used in "Name!A1" references, and the workbook the sheet belongs to (NULL while
+    // it is the only sheet; see workbook.h).
+    char name[SHEET_NAME_MAX];
+    struct Workbook *workbook;
+    // Values published for reader threads (see value_plane.h).
+    struct ValuePlane *plane;
+    // Change subscribers (see change_feed.h); only the home sheet's is used, NULL until the
+    // first subscription.
+    struct ChangeFeed *feed;
+    // Connected components of the dependency graph (see components.h); only the home sheet's
+    // is used, NULL until the first propagation.
+    struct Components *components;
+    // Progressive recalculation at the interactive prompt (see background.h); only the home
+    // sheet's is used, NULL unless the prompt started it.
+    struct BackgroundRecalc *background;
 } Spreadsheet;
 
 Spreadsheet *initializeSpreadsheet(int rows, int cols);
 void printSpreadsheet(Spreadsheet *spreadsheet);
 void freeSpreadsheet(Spreadsheet *spreadsheet);
-void handleOperation(const char *input, Spreadsheet *spreadsheet, clock_t start);
+void adoptSpreadsheet(Spreadsheet *target, Spreadsheet *source);
+void packIdleTiles(Spreadsheet *home);
+void recalcAll(Spreadsheet *spreadsheet);
+void propagateChanges(Spreadsheet *spreadsheet, Cell *const *cells, long count, double start);
+void recalc_cell(Cell *cell, Spreadsheet *spreadsheet);
+void coverRange(Spreadsheet *spreadsheet, const Cell *cell, int delta);
+void setCellLiteral(Spreadsheet *spreadsheet, Cell *cell, int value);
+int checkCycleNew(Spreadsheet *spreadsheet, Cell *operand, Cell *target);
+int checkAdvancedFormulaCycleNew(Cell *target, const Spreadsheet *rangeSheet,
+                                 int rStart, int cStart, int rEnd, int cEnd);
+void assignLiteral(Spreadsheet *spreadsheet, Cell *target, int value, double start);
+void assignReference(Spreadsheet *spreadsheet, Cell *target, Cell *source, double start);
+void assignBinary(Spreadsheet *spreadsheet, Cell *target, int op,
+                  Cell *operand1, int literal1, Cell *operand2, int literal2, double start);
+void assignRange(Spreadsheet *spreadsheet, Cell *target, int op, Spreadsheet *rangeSheet,
+                 int rStart, int cStart, int rEnd, int cEnd, double start);
+void commitPendingCommand(Spreadsheet *spreadsheet);
+void handleOperation(const char *input, Spreadsheet *spreadsheet, double start);
+void printStatus(Spreadsheet *spreadsheet, const char *fmt, ...);
+void reportStatus(Spreadsheet *spreadsheet, double start, const char *fmt, ...);
+double monotonicSeconds(void);
+
+/*
+ * sheetPhysicalRow returns the row of the tile store that logical row lies on; sheetLogicalRow
+ * is the inverse, e.g. for the selfRow of a cell of the sheet.  The Col pair is the same for
+ * columns.
+ */
+static inline int sheetPhysicalRow(const Spreadsheet *spreadsheet, int row) {
+    return indexMapPhysical(spreadsheet->rowMap, row);
+}
+
+static inline int sheetPhysicalCol(const Spreadsheet *spreadsheet, int col) {
+    return indexMapPhysical(spreadsheet->colMap, col);
+}
+
+static inline int sheetLogicalRow(const Spreadsheet *spreadsheet, int row) {
+    return indexMapLogical(spreadsheet->rowMap, row);
+}
+
+static inline int sheetLogicalCol(const Spreadsheet *spreadsheet, int col) {
+    return indexMapLogical(spreadsheet->colMap, col);
+}
+
+/*
+ * sheetCell returns the cell at (row, col), materializing it if it has never been touched.
+ * Use it for cells that are about to be written or linked into the dependency graph; the cell
+ * is marked for publication to the value plane.
+ */
+static inline Cell *sheetCell(Spreadsheet *spreadsheet, int row, int col) {
+    Cell *cell = tileStoreGet(&spreadsheet->store, sheetPhysicalRow(spreadsheet, row),
+                              sheetPhysicalCol(spreadsheet, col));
+    tileStoreTouch(&spreadsheet->store, cell);
+    return cell;
+}
+
+/*
+ * sheetPeek returns the cell at (row, col), or NULL if it was never materialized and so
+ * still reads as an empty 0.
+ */
+static inline const Cell *sheetPeek(const Spreadsheet *spreadsheet, int row, int col) {
+    return tileStorePeek(&spreadsheet->store, sheetPhysicalRow(spreadsheet, row),
+                         sheetPhysicalCol(spreadsheet, col));
+}
+
+/*
+ * sheetOwns reports whether cell belongs to spreadsheet.  Cells carry no sheet pointer, so this
+ * checks that the sheet's cell at the same position is this very cell.
+ */
+static inline int sheetOwns(const Spreadsheet *spreadsheet, const Cell *cell) {
+    return cell->selfRow < spreadsheet->rows && cell->selfCol < spreadsheet->cols &&
+           tileStorePeek(&spreadsheet->store, cell->selfRow, cell->selfCol) == cell;
+}
+
+/*
+ * sheetRangeHolds reports whether cell is a cell of spreadsheet inside the range
+ * (row1, col1)..(row2, col2).
+ */
+static inline int sheetRangeHolds(const Spreadsheet *spreadsheet, const Cell *cell,
+                                  int row1, int col1, int row2, int col2) {
+    int row = sheetLogicalRow(spreadsheet, cell->selfRow), col = sheetLogicalCol(spreadsheet, cell->selfCol);
+    return row >= row1 && row <= row2 && col >= col1 && col <= col2 && sheetOwns(spreadsheet, cell);
+}
 
 #endif  // SPREADSHEET_H
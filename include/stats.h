@@ -0,0 +1,66 @@
+#ifndef STATS_H
+#define STATS_H
+
+/* Hot-path instrumentation.  Built with -DSHEET_STATS (the default in the Makefile; "make STATS=0"
+   turns it off), every command is split into exclusive per-phase wall time and a few work
+   counters, which the "stats" command prints.  Without SHEET_STATS all macros below expand to
+   nothing and the engine carries no instrumentation at all. */
+
+/* Phases are exclusive: entering a phase pauses the enclosing one.  Time not spent in any
+   named phase (parsing, validation, bookkeeping) is charged to STATS_PHASE_PARSE. */
+enum {
+    STATS_PHASE_PARSE,
+    STATS_PHASE_CYCLE_CHECK,
+    STATS_PHASE_TOPO_RECALC,
+    STATS_PHASE_ADVANCED_RECALC,
+    STATS_PHASE_RENDER,
+    STATS_PHASE_COUNT
+};
+
+enum {
+    STATS_CELLS_RECOMPUTED,
+    STATS_EDGES_TRAVERSED,
+    STATS_BFS_VISITED,
+    STATS_RANGE_CELLS_SCANNED,
+    STATS_TILES_PUBLISHED,
+    STATS_TILES_PACKED,
+    STATS_TILES_UNPACKED,
+    STATS_COUNTER_COUNT
+};
+
+#ifdef SHEET_STATS
+
+typedef struct {
+    unsigned long long commands;
+    unsigned long long phaseNanos[STATS_PHASE_COUNT];
+    unsigned long long phaseCalls[STATS_PHASE_COUNT];
+    unsigned long long counters[STATS_COUNTER_COUNT];
+} SheetStats;
+
+extern SheetStats statsLast;
+extern SheetStats statsTotal;
+
+void statsBeginCommand(void);
+void statsEndCommand(void);
+int statsEnter(int phase);
+void statsLeave(int previous);
+void statsPrint(void);
+
+#define STATS_BEGIN_COMMAND()   statsBeginCommand()
+#define STATS_END_COMMAND()     statsEndCommand()
+#define STATS_ENTER(phase)      int statsPrevious_ = statsEnter(phase)
+#define STATS_LEAVE()           statsLeave(statsPrevious_)
+#define STATS_COUNT(counter, n) \
+    do { statsLast.counters[counter] += (n); statsTotal.counters[counter] += (n); } while (0)
+
+#else
+
+#define STATS_BEGIN_COMMAND()   ((void) 0)
+#define STATS_END_COMMAND()     ((void) 0)
+#define STATS_ENTER(phase)      ((void) 0)
+#define STATS_LEAVE()           ((void) 0)
+#define STATS_COUNT(counter, n) ((void) 0)
+
+#endif  // SHEET_STATS
+
+#endif  // STATS_H
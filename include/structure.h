@@ -0,0 +1,26 @@
+#ifndef STRUCTURE_H
+#define STRUCTURE_H
+
+#include "spreadsheet.h"
+
+/* Inserting and deleting rows and columns.  No cell moves: an edit rotates the sheet's index
+   map (index_map.h) so that the logical rows after it lie on other physical rows, and adjusts
+   the bounds of the ranges that read the sheet.  References are Cell pointers and follow
+   their cells without being rewritten.  The sheet keeps its size, so an insert pushes the
+   last rows (or columns) off the end and a delete brings empty ones in at the end.
+
+   An edit that would lose a formula's input is refused: a delete when a cell outside the
+   deleted block refers to one inside it or a range lies wholly inside it, an insert when the
+   rows pushed off hold anything. */
+
+#define STRUCTURE_OK               0
+#define STRUCTURE_ERR_BOUNDS      -1     // the rows or columns do not all exist
+#define STRUCTURE_ERR_REFERENCED  -2     // deleted cells are read from outside the block
+#define STRUCTURE_ERR_OCCUPIED    -3     // an insert would push content off the sheet
+
+int insertRows(Spreadsheet *spreadsheet, int row, int count, double start);
+int deleteRows(Spreadsheet *spreadsheet, int row, int count, double start);
+int insertColumns(Spreadsheet *spreadsheet, int col, int count, double start);
+int deleteColumns(Spreadsheet *spreadsheet, int col, int count, double start);
+
+#endif  // STRUCTURE_H
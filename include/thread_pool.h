@@ -0,0 +1,32 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <pthread.h>
+
+// Task body for threadPoolRun: called once for every index in [0, count).
+typedef void (*ThreadPoolTask)(void *arg, long index);
+
+typedef struct ThreadPool {
+    pthread_t *threads;
+    int threadCount;
+    pthread_mutex_t lock;
+    pthread_cond_t workReady;
+    pthread_cond_t workDone;
+    // Current job; a new generation wakes the workers.
+    ThreadPoolTask task;
+    void *arg;
+    long count;
+    long next;
+    long finished;
+    int active;
+    unsigned long generation;
+    int stop;
+} ThreadPool;
+
+ThreadPool *createThreadPool(int threadCount);
+void threadPoolRun(ThreadPool *pool, long count, ThreadPoolTask task, void *arg);
+void freeThreadPool(ThreadPool *pool);
+ThreadPool *sharedThreadPool(void);
+int threadPoolSize(ThreadPool *pool);
+
+#endif  // THREAD_POOL_H
@@ -0,0 +1,54 @@
+#ifndef TILE_BACKING_H
+#define TILE_BACKING_H
+
+#include <stddef.h>
+
+/* File-backed tiles for sheets larger than memory (--spill).  Instead of the heap, the cells of
+   every tile of a store live in a shared mapping of a file in the spill directory, unlinked as
+   soon as it is created.  Tiles keep their addresses, so Cell pointers stay valid, but the
+   kernel can write their pages back to the file and drop them rather than swap them out.
+
+   Each store also holds its tiles to a resident budget with the clock algorithm.  A tile is
+   admitted when it is next used (tileStoreUse) and every use sets its referenced bit; when an
+   admission goes over budget, the hand sweeps the resident tiles, clearing referenced bits,
+   and lets go of the first tile whose bit was already clear (MADV_DONTNEED: its contents stay
+   in the file).  The tiles in view, the ones being edited and the ones range formulas read
+   are used again before the hand comes round, so they stay.
+
+   Cells reached through pointers (operands, dependents) are not seen as uses, so the budget
+   is kept only approximately; past it, the kernel reclaims the file pages under pressure.
+   Headers and summaries stay on the heap, so a range that covers a cold tile whole does not
+   page it in. */
+
+// Mappings grow by this much at a time.
+#define TILE_BACKING_CHUNK     (64L << 20)
+// Room for one tile (a whole one is 48 KB).  The kernel maps cached pages around a fault in
+// aligned 64 KB windows; with a window per slot, a fault does not map in a neighbouring tile.
+#define TILE_BACKING_SLOT      (64L << 10)
+// Resident budget of a store, in megabytes of cells, unless --resident says otherwise.
+#define TILE_BACKING_DEFAULT_MB  256
+
+struct Tile;
+
+typedef struct TileBacking {
+    int fd;
+    size_t pageSize;
+    char **chunks;              // TILE_BACKING_CHUNK bytes each, mapped at fd offset i * CHUNK
+    int chunkCount;
+    int chunkCapacity;
+    size_t chunkUsed;           // bytes handed out from the last chunk, whole slots
+    struct Tile **resident;     // the resident set, budget slots, swept by the clock hand
+    long residentCount;
+    long budget;
+    long hand;
+} TileBacking;
+
+int tileBackingConfigure(const char *directory, long residentMegabytes);
+TileBacking *createTileBacking(void);
+void freeTileBacking(TileBacking *backing);
+void *tileBackingAlloc(TileBacking *backing);
+void tileBackingAdmit(TileBacking *backing, struct Tile *tile);
+void tileBackingDrop(TileBacking *backing, const struct Tile *tile);
+void tileBackingPrefetch(TileBacking *backing, const struct Tile *tile);
+
+#endif  // TILE_BACKING_H
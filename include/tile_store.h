@@ -0,0 +1,218 @@
+#ifndef TILE_STORE_H
+#define TILE_STORE_H
+
+#include <stdint.h>
+#include "cell.h"
+#include "tile_backing.h"
+
+/* Sparse cell storage.  The sheet is cut into tiles of TILE_ROWS x TILE_COLS cells; a tile is
+   allocated the first time one of its cells is written or referenced, and never moves, so
+   Cell pointers stay valid for the life of the sheet.  Tiles at the bottom and right edges are
+   clipped to the sheet, which makes a small sheet a single tile exactly its own size.
+   Lookups go through a two-level directory: one pointer per band of TILE_ROWS rows, and one
+   tile pointer per TILE_COLS columns inside an allocated band.  Cells that were never
+   materialized read as empty (value 0, no error, no formula).
+
+   Every tile carries a summary of its values for range formulas, which combine the summaries
+   of the tiles a range covers whole and scan only the tiles it cuts.  tileStoreTouch, which
+   every write goes through, marks the summary stale; it is recomputed when next read.
+
+   The store also counts, per tile, the range formulas whose range overlaps it (tileStoreCover,
+   kept up by the advanced formula list).  A change to a cell of an uncovered tile cannot reach
+   any range formula.
+
+   With a spill directory configured, the cells of the tiles live in a file instead of on the
+   heap (see tile_backing.h); whatever reads or writes the cells of a tile first passes it to
+   tileStoreUse.
+
+   A tile that holds nothing but plain values (no formula, no edge, no error) and has gone
+   unused for a while is packed: its cells are given up for a TilePacked, every value stored as
+   an offset from the smallest one in just enough bits.  tileStoreCompact, run after each
+   commit, finds such tiles with a clock hand over the tiles that moves as the sheet is
+   written, so a sheet left alone keeps its tiles as they are; tileStoreUse unpacks a tile
+   before its cells are handed out.  Packed tiles are read in place by the bulk readers (range
+   scans, publication, snapshots, exports), and their summaries never go stale. */
+
+#define TILE_ROW_BITS  5
+#define TILE_COL_BITS  4
+#define TILE_ROWS      (1 << TILE_ROW_BITS)
+#define TILE_COLS      (1 << TILE_COL_BITS)
+
+// Largest |value| for which the squares in a summary are exact in a double.
+#define TILE_SUMMARY_EXACT_MAX  (1 << 20)
+
+// Tiles the pack hand looks at for every tile a commit writes, and passes a tile must go unused
+// before it is packed.
+#define TILE_PACK_SWEEP  4
+#define TILE_PACK_IDLE   16
+// Tile.idle of a tile found unpackable; it is looked at again once it has been used.
+#define TILE_IDLE_PINNED (-1)
+
+typedef struct TileSummary {
+    long sum;
+    double sumSquares;
+    int min;
+    int max;
+    int errors;         // cells showing an error
+    int exact;          // every |value| is at most TILE_SUMMARY_EXACT_MAX
+    int stale;
+} TileSummary;
+
+typedef struct TilePacked {
+    int base;           // smallest value
+    int width;          // bits per offset from base; 0 when every value is base
+    uint64_t bits[];    // rows * cols offsets, row-major, packed back to back
+} TilePacked;
+
+typedef struct Tile {
+    int row0;           // top-left cell
+    int col0;
+    int rows;           // clipped at the sheet edge
+    int cols;
+    long ordinal;       // position of cells[0] among all materialized cells
+    int dirty;          // changed since the value plane last published it (see value_plane.h)
+    int resident;       // cells mapped in; always set on the heap
+    int referenced;     // used since the clock hand last passed (file-backed stores only)
+    int idle;           // passes of the pack hand since last used, or TILE_IDLE_PINNED
+    TileSummary summary;
+    Cell *cells;        // rows * cols, row-major; NULL on the heap while packed
+    TilePacked *packed; // the values while packed, NULL otherwise
+} Tile;
+
+typedef struct TileStore {
+    int rows;
+    int cols;
+    int bandCount;          // tile rows
+    int tilesPerBand;       // tile columns
+    Tile ***bands;          // bands[b] stays NULL until a tile in band b exists
+    Tile **tiles;           // every tile, in allocation order
+    long tileCount;
+    long tileCapacity;
+    long cellCount;         // materialized cells
+    Tile **dirty;           // tiles with dirty set, in the order they were first touched
+    long dirtyCount;
+    long dirtyCapacity;
+    TileBacking *backing;   // NULL: tiles live on the heap
+    long packHand;          // next tile the pack hand looks at
+    long packDue;           // tiles marked dirty since the hand last moved
+    int packAll;            // tileStoreMarkCold: the next sweep packs whatever it can
+    int **coverage;         // coverage[b][t]: ranges over tile t of band b; rows appear on first use
+} TileStore;
+
+void tileStoreInit(TileStore *store, int rows, int cols);
+void tileStoreFree(TileStore *store);
+Tile *tileStoreMaterialize(TileStore *store, int tileRow, int tileCol);
+void tileStoreMarkDirty(TileStore *store, Tile *tile);
+void tileStoreSummarize(const TileStore *store, Tile *tile);
+void tileStoreUnpack(const TileStore *store, Tile *tile);
+void tileStoreCompact(TileStore *store);
+void tileStoreMarkCold(TileStore *store);
+void tileStoreCover(TileStore *store, int row1, int col1, int row2, int col2, int delta);
+
+/*
+ * tileStoreTile returns the tile with the given tile coordinates, or NULL if it does not exist.
+ */
+static inline Tile *tileStoreTile(const TileStore *store, int tileRow, int tileCol) {
+    Tile **band = store->bands[tileRow];
+    return band ? band[tileCol] : NULL;
+}
+
+/*
+ * tileStoreUse records that the cells of tile are about to be read or written, unpacking them
+ * or admitting them to the resident set of a file-backed store.  Not thread-safe.
+ */
+static inline void tileStoreUse(const TileStore *store, Tile *tile) {
+    tile->idle = 0;
+    if (tile->packed) {
+        tileStoreUnpack(store, tile);
+    } else if (store->backing) {
+        tile->referenced = 1;
+        if (!tile->resident)
+            tileBackingAdmit(store->backing, tile);
+    }
+}
+
+/*
+ * tilePackedValue returns the value of cell index (as in tileCellIndex) of a packed tile.
+ */
+static inline int tilePackedValue(const Tile *tile, long index) {
+    const TilePacked *packed = tile->packed;
+    if (packed->width == 0)
+        return packed->base;
+    uint64_t bit = (uint64_t) index * (uint64_t) packed->width;
+    int shift = (int) (bit & 63);
+    uint64_t offset = packed->bits[bit >> 6] >> shift;
+    if (shift + packed->width > 64)
+        offset |= packed->bits[(bit >> 6) + 1] << (64 - shift);
+    offset &= ((uint64_t) 1 << packed->width) - 1;
+    return (int) ((uint32_t) packed->base + (uint32_t) offset);
+}
+
+/*
+ * tileCellIndex returns the position of (row, col) in the cells of tile, which must hold it.
+ * Every lookup of a cell by its coordinates goes through here.
+ */
+static inline long tileCellIndex(const Tile *tile, int row, int col) {
+    return (long) (row - tile->row0) * tile->cols + (col - tile->col0);
+}
+
+/*
+ * tileStorePeek returns the cell at (row, col) if its tile exists, NULL otherwise.
+ */
+static inline Cell *tileStorePeek(const TileStore *store, int row, int col) {
+    Tile *tile = tileStoreTile(store, row >> TILE_ROW_BITS, col >> TILE_COL_BITS);
+    if (!tile)
+        return NULL;
+    tileStoreUse(store, tile);
+    return &tile->cells[tileCellIndex(tile, row, col)];
+}
+
+/*
+ * tileStoreGet returns the cell at (row, col), allocating its tile if needed.
+ */
+static inline Cell *tileStoreGet(TileStore *store, int row, int col) {
+    Tile *tile = tileStoreTile(store, row >> TILE_ROW_BITS, col >> TILE_COL_BITS);
+    if (!tile)
+        tile = tileStoreMaterialize(store, row >> TILE_ROW_BITS, col >> TILE_COL_BITS);
+    tileStoreUse(store, tile);
+    return &tile->cells[tileCellIndex(tile, row, col)];
+}
+
+/*
+ * tileStoreTouch records that a cell of the store may have changed since the last publication
+ * and since its tile was last summarized.
+ */
+static inline void tileStoreTouch(TileStore *store, const Cell *cell) {
+    Tile *tile = tileStoreTile(store, cell->selfRow >> TILE_ROW_BITS, cell->selfCol >> TILE_COL_BITS);
+    tileStoreUse(store, tile);
+    tile->summary.stale = 1;
+    if (!tile->dirty)
+        tileStoreMarkDirty(store, tile);
+}
+
+/*
+ * tileStoreOrdinal returns a dense index in [0, cellCount) for a materialized cell.
+ */
+static inline long tileStoreOrdinal(const TileStore *store, const Cell *cell) {
+    Tile *tile = tileStoreTile(store, cell->selfRow >> TILE_ROW_BITS, cell->selfCol >> TILE_COL_BITS);
+    return tile->ordinal + tileCellIndex(tile, cell->selfRow, cell->selfCol);
+}
+
+/*
+ * tileStoreSummary returns the summary of tile, recomputing it if it is stale.
+ */
+static inline const TileSummary *tileStoreSummary(const TileStore *store, Tile *tile) {
+    if (tile->summary.stale)
+        tileStoreSummarize(store, tile);
+    return &tile->summary;
+}
+
+/*
+ * tileStoreCovered reports whether the range of some range formula overlaps the tile of (row, col).
+ */
+static inline int tileStoreCovered(const TileStore *store, int row, int col) {
+    const int *band = store->coverage[row >> TILE_ROW_BITS];
+    return band && band[col >> TILE_COL_BITS] > 0;
+}
+
+#endif  // TILE_STORE_H
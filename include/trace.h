@@ -0,0 +1,40 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Span tracing of recalculation cascades.  Built with SHEET_STATS (see stats.h) and switched on
+   at run time with "trace_on [events]": commands, cycle checks, each wave of a topological
+   recalculation, every recomputed cell and every aggregate range scan are recorded as spans in
+   a ring buffer that keeps the most recent events.  "trace_dump <file>" writes them as Chrome
+   trace JSON (chrome://tracing, ui.perfetto.dev).  While tracing is off, each trace point costs
+   one predictable branch on traceEnabled; without SHEET_STATS the macros expand to nothing. */
+
+#define TRACE_DEFAULT_EVENTS (1L << 16)
+
+#ifdef SHEET_STATS
+
+extern int traceEnabled;
+
+unsigned long long traceNow(void);
+void traceSpan(const char *name, unsigned long long startNanos, int row, int col, long count);
+void traceCommand(unsigned long long startNanos, const char *text);
+int traceStart(long capacity);
+void traceStop(void);
+int traceDump(const char *path, long *written);
+
+#define TRACE_ACTIVE()                          __builtin_expect(traceEnabled, 0)
+#define TRACE_BEGIN(var)                        unsigned long long var = TRACE_ACTIVE() ? traceNow() : 0
+#define TRACE_SPAN(var, name, row, col, count) \
+    do { if (TRACE_ACTIVE()) traceSpan(name, var, row, col, count); } while (0)
+#define TRACE_COMMAND(var, text) \
+    do { if (TRACE_ACTIVE()) traceCommand(var, text); } while (0)
+
+#else
+
+#define TRACE_ACTIVE()                          0
+#define TRACE_BEGIN(var)                        ((void) 0)
+#define TRACE_SPAN(var, name, row, col, count)  ((void) 0)
+#define TRACE_COMMAND(var, text)                ((void) 0)
+
+#endif  // SHEET_STATS
+
+#endif  // TRACE_H
@@ -0,0 +1,97 @@
+#ifndef VALUE_PLANE_H
+#define VALUE_PLANE_H
+
+#include "spreadsheet.h"
+
+/* Published values for readers on other threads.  The engine recalculates in place, so a
+   thread reading cells directly could see a cascade half done.  Instead every sheet keeps a
+   value plane: an immutable copy of each tile's values, grouped into numbered versions.  After
+   each command the tiles it changed are copied into a new version, which is then published
+   with a single atomic store; readers pin the version they started with and never take a lock
+   or wait for the writer.  A version shares every unchanged tile with the one before it.
+
+   Replaced tiles are retired with the number of the version that replaced them and freed once
+   no reader is pinned to an older version.  Only the engine thread publishes.
+
+   Tiles are published in store coordinates, so a version also carries the sheet's index maps
+   as they were when it was published; a row or column edit publishes new maps and shares the
+   tiles. */
+
+// Maximum number of views open at the same time.
+#define PLANE_READER_SLOTS 64
+
+// CellValue.flags
+#define VALUE_ERROR    0x1
+#define VALUE_FORMULA  0x2      // the cell holds a formula, so it is written even when 0
+
+typedef struct CellValue {
+    int value;
+    int flags;
+} CellValue;
+
+typedef struct TileValues {
+    int row0;
+    int col0;
+    int rows;
+    int cols;
+    CellValue cells[];          // rows * cols, row-major, as in Tile
+} TileValues;
+
+typedef struct PlaneVersion {
+    unsigned long number;
+    int rows;
+    int cols;
+    int bandCount;
+    int tilesPerBand;
+    TileValues ***bands;        // same directory shape as TileStore; NULL reads as empty
+    IndexMap *rowMap;           // copies of the sheet's maps, shared by versions until they change
+    IndexMap *colMap;
+} PlaneVersion;
+
+typedef struct RetiredBlock {
+    void *block;
+    size_t size;
+    unsigned long epoch;        // number of the version that stopped referencing it
+} RetiredBlock;
+
+typedef struct ValuePlane {
+    PlaneVersion *current;
+    unsigned long epoch;                        // number of current, published after it
+    unsigned long pins[PLANE_READER_SLOTS];     // version pinned by each open view, 0 if free
+    int rebuild;                                // publish every tile, e.g. after a snapshot load
+    int relayout;                               // publish the index maps, after a row or column edit
+    RetiredBlock *retired;
+    long retiredCount;
+    long retiredCapacity;
+} ValuePlane;
+
+typedef struct SheetView {
+    ValuePlane *plane;
+    const PlaneVersion *version;
+    int slot;
+} SheetView;
+
+ValuePlane *createValuePlane(int rows, int cols);
+void freeValuePlane(ValuePlane *plane);
+void publishValues(Spreadsheet *spreadsheet);
+void publishWorkbookValues(Spreadsheet *home);
+void openView(ValuePlane *plane, SheetView *view);
+void closeView(SheetView *view);
+
+/*
+ * viewCell returns the published value of (row, col) in the version the view is pinned to.
+ */
+static inline CellValue viewCell(const SheetView *view, int row, int col) {
+    const PlaneVersion *version = view->version;
+    row = indexMapPhysical(version->rowMap, row);
+    col = indexMapPhysical(version->colMap, col);
+    TileValues **band = version->bands[row >> TILE_ROW_BITS];
+    const TileValues *tile = band ? band[col >> TILE_COL_BITS] : NULL;
+    if (!tile) {
+        CellValue empty = { 0, 0 };
+        return empty;
+    }
+    return tile->cells[(row - tile->row0) * tile->cols + (col - tile->col0)];
+}
+
+#endif  // VALUE_PLANE_H
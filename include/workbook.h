@@ -0,0 +1,47 @@
+#ifndef WORKBOOK_H
+#define WORKBOOK_H
+
+#include "spreadsheet.h"
+
+/* A workbook is the set of named sheets served by one process.  The sheet main creates is the
+   home sheet ("Sheet1"); "sheet_add <name> [<rows> <cols>]" adds sheets and "sheet <name>"
+   switches the sheet that commands act on.  Formulas in any sheet may read "Name!A1" and
+   "SUM(Name!A1:B9)"; those references are ordinary edges in the shared dependency graph, so
+   cycle checks and recalculation see the whole workbook.  Sheets are never removed, so the
+   Spreadsheet pointers held by formulas stay valid.  The command parser, thread pool and
+   allocator accounting are shared by all sheets.
+
+   The workbook is created with the second sheet; a process that never adds one pays nothing.
+   Session state (output mode, quiet flag, status counters, journal) belongs to the home sheet
+   and is lent to the active sheet while it runs a command. */
+
+typedef struct Workbook {
+    Spreadsheet **sheets;       // sheets[0] is the home sheet
+    int count;
+    int capacity;
+    Spreadsheet *active;
+} Workbook;
+
+Spreadsheet *workbookAddSheet(Spreadsheet *home, const char *name, int rows, int cols);
+Spreadsheet *workbookFindSheet(Spreadsheet *spreadsheet, const char *name, size_t length);
+Spreadsheet *workbookOwner(Spreadsheet *hint, const Cell *cell);
+int workbookSheetLinked(Spreadsheet *spreadsheet);
+int validSheetName(const char *name);
+void workbookLendSession(Spreadsheet *to, const Spreadsheet *from);
+void freeWorkbook(Workbook *workbook, Spreadsheet *home);
+
+/*
+ * homeSheet returns the home sheet of the workbook spreadsheet belongs to.
+ */
+static inline Spreadsheet *homeSheet(Spreadsheet *spreadsheet) {
+    return spreadsheet->workbook ? spreadsheet->workbook->sheets[0] : spreadsheet;
+}
+
+/*
+ * activeSheet returns the sheet that commands given to home currently act on.
+ */
+static inline Spreadsheet *activeSheet(Spreadsheet *home) {
+    return home->workbook ? home->workbook->active : home;
+}
+
+#endif  // WORKBOOK_H
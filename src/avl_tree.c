@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include "mem_track.h"
 
 int avl_height(AVLNode *node) {
     return node ? node->height : 0;
@@ -16,7 +17,7 @@ static int max(int a, int b) {
 }
 
 static AVLNode* create_node(struct Cell *cell) {
-    AVLNode *node = (AVLNode*) malloc(sizeof(AVLNode));
+    AVLNode *node = (AVLNode*) memAlloc(MEM_EDGES, sizeof(AVLNode));
     if (!node) {
         perror("Failed to allocate AVLNode");
         exit(EXIT_FAILURE);
@@ -104,7 +105,7 @@ AVLNode* avl_delete(AVLNode *root, struct Cell *cell, int (*cmp)(struct Cell*, s
             } else {
                 *root = *temp;
             }
-            free(temp);
+            memFree(MEM_EDGES, temp, sizeof(AVLNode));
         } else {
             AVLNode *temp = min_value_node(root->right);
             root->cell = temp->cell;
@@ -158,7 +159,7 @@ void avl_free(AVLNode *root) {
     if (root) {
         avl_free(root->left);
         avl_free(root->right);
-        free(root);
+        memFree(MEM_EDGES, root, sizeof(AVLNode));
     }
 }
 
@@ -167,3 +168,18 @@ int avl_cell_compare(struct Cell *a, struct Cell *b) {
     else if ((uintptr_t)a > (uintptr_t)b) return 1;
     else return 0;
 }
+
+/*
+ * avl_build_sorted builds a perfectly balanced tree from cells already sorted by avl_cell_compare.
+ * It runs in O(count) and is used when restoring dependency sets in bulk.
+ */
+AVLNode* avl_build_sorted(struct Cell **cells, long count) {
+    if (count <= 0)
+        return NULL;
+    long mid = count / 2;
+    AVLNode *node = create_node(cells[mid]);
+    node->left = avl_build_sorted(cells, mid);
+    node->right = avl_build_sorted(cells + mid + 1, count - mid - 1);
+    node->height = 1 + max(avl_height(node->left), avl_height(node->right));
+    return node;
+}
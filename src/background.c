@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "background.h"
+#include "avl_tree.h"
+#include "mem_track.h"
+
+/*
+   ---------------- Background recalculation ----------------
+
+   The plan arrays are charged to MEM_RECALC and belong to the BackgroundRecalc from
+   backgroundSetPlan on; they are released as soon as the last step has run.  Every field
+   except wantLock is only touched with the lock held.
+*/
+
+#define STEP_PENDING 0
+#define STEP_NEEDED  1          // pending, and marked by backgroundSettle
+#define STEP_DONE    2
+
+static unsigned long hashStep(const Cell *cell) {
+    unsigned long long x = (unsigned long long) (uintptr_t) cell;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (unsigned long) x;
+}
+
+/*
+ * releasePlan frees the arrays of the current plan, if any.
+ */
+static void releasePlan(BackgroundRecalc *background) {
+    long count = background->count;
+    if (count > 0) {
+        memFree(MEM_RECALC, background->cells, count * sizeof(Cell *));
+        memFree(MEM_RECALC, background->owners, count * sizeof(Spreadsheet *));
+        memFree(MEM_RECALC, background->state, count);
+        memFree(MEM_RECALC, background->stack, count * sizeof(long));
+        memFree(MEM_RECALC, background->index, background->indexCapacity * sizeof(long));
+    }
+    background->cells = NULL;
+    background->owners = NULL;
+    background->state = NULL;
+    background->stack = NULL;
+    background->index = NULL;
+    background->indexCapacity = 0;
+    background->count = background->next = background->pending = 0;
+}
+
+/*
+ * runStep recomputes the cell of pending step i.  The plan is released once no step is left.
+ */
+static void runStep(BackgroundRecalc *background, long i) {
+    recalc_cell(background->cells[i], background->owners[i]);
+    background->state[i] = STEP_DONE;
+    background->pending--;
+    while (background->next < background->count && background->state[background->next] == STEP_DONE)
+        background->next++;
+    if (background->pending == 0)
+        releasePlan(background);
+}
+
+static void *backgroundMain(void *arg) {
+    BackgroundRecalc *background = (BackgroundRecalc *) arg;
+    pthread_mutex_lock(&background->lock);
+    while (1) {
+        while (!background->stop &&
+               (background->pending == 0 || __atomic_load_n(&background->wantLock, __ATOMIC_ACQUIRE)))
+            pthread_cond_wait(&background->wake, &background->lock);
+        if (background->stop)
+            break;
+        runStep(background, background->next);
+    }
+    pthread_mutex_unlock(&background->lock);
+    return NULL;
+}
+
+/*
+ * createBackgroundRecalc starts the worker with nothing to do.
+ */
+BackgroundRecalc *createBackgroundRecalc(void) {
+    BackgroundRecalc *background = memCalloc(MEM_OTHER, 1, sizeof(BackgroundRecalc));
+    if (!background) {
+        perror("Failed to allocate BackgroundRecalc");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&background->lock, NULL);
+    pthread_cond_init(&background->wake, NULL);
+    if (pthread_create(&background->thread, NULL, backgroundMain, background) != 0) {
+        perror("Failed to start background recalculation");
+        exit(EXIT_FAILURE);
+    }
+    return background;
+}
+
+/*
+ * freeBackgroundRecalc stops the worker, dropping whatever it had not reached.
+ */
+void freeBackgroundRecalc(BackgroundRecalc *background) {
+    if (!background)
+        return;
+    pthread_mutex_lock(&background->lock);
+    background->stop = 1;
+    pthread_cond_signal(&background->wake);
+    pthread_mutex_unlock(&background->lock);
+    pthread_join(background->thread, NULL);
+    releasePlan(background);
+    pthread_mutex_destroy(&background->lock);
+    pthread_cond_destroy(&background->wake);
+    memFree(MEM_OTHER, background, sizeof(BackgroundRecalc));
+}
+
+/*
+ * backgroundPause takes the sheets from the worker, which lets go after its current cell.
+ * Every command runs between backgroundPause and backgroundResume.
+ */
+void backgroundPause(BackgroundRecalc *background) {
+    if (!background)
+        return;
+    __atomic_store_n(&background->wantLock, 1, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&background->lock);
+}
+
+/*
+ * backgroundResume hands the sheets back to the worker.
+ */
+void backgroundResume(BackgroundRecalc *background) {
+    if (!background)
+        return;
+    __atomic_store_n(&background->wantLock, 0, __ATOMIC_RELEASE);
+    pthread_cond_signal(&background->wake);
+    pthread_mutex_unlock(&background->lock);
+}
+
+/*
+ * backgroundStep returns the pending step that recomputes cell, or -1 if there is none.
+ */
+long backgroundStep(const BackgroundRecalc *background, const Cell *cell) {
+    if (!backgroundPending(background))
+        return -1;
+    unsigned long mask = (unsigned long) background->indexCapacity - 1;
+    for (unsigned long i = hashStep(cell) & mask; background->index[i] != -1; i = (i + 1) & mask) {
+        long step = background->index[i];
+        if (background->cells[step] == cell)
+            return background->state[step] == STEP_DONE ? -1 : step;
+    }
+    return -1;
+}
+
+/*
+ * backgroundSetPlan replaces the current plan with count steps, which must include every step
+ * of it still pending.  cells and owners (count entries each, MEM_RECALC) are taken over.
+ */
+void backgroundSetPlan(BackgroundRecalc *background, Cell **cells, Spreadsheet **owners, long count) {
+    releasePlan(background);
+    if (count == 0)
+        return;
+    long capacity = 64;
+    while (capacity < 2 * count)
+        capacity *= 2;
+    background->cells = cells;
+    background->owners = owners;
+    background->state = memCalloc(MEM_RECALC, count, 1);
+    background->stack = memAlloc(MEM_RECALC, count * sizeof(long));
+    background->index = memAlloc(MEM_RECALC, capacity * sizeof(long));
+    if (!background->state || !background->stack || !background->index) {
+        perror("Failed to allocate recalculation plan");
+        exit(EXIT_FAILURE);
+    }
+    background->indexCapacity = capacity;
+    for (long i = 0; i < capacity; i++)
+        background->index[i] = -1;
+    for (long step = 0; step < count; step++) {
+        unsigned long i = hashStep(cells[step]) & (unsigned long) (capacity - 1);
+        while (background->index[i] != -1)
+            i = (i + 1) & (unsigned long) (capacity - 1);
+        background->index[i] = step;
+    }
+    background->count = count;
+    background->pending = count;
+}
+
+/*
+ * backgroundFinish runs every pending step, in plan order.
+ */
+void backgroundFinish(BackgroundRecalc *background) {
+    while (backgroundPending(background))
+        runStep(background, background->next);
+}
+
+/*
+   ---------------- Settling the viewport ----------------
+
+   A step is settled together with the pending steps it reads: those of its dependencies and,
+   for a range formula, those of the cells of its range.  Plan order puts all of them before
+   it, so running the marked steps in plan order gives every one of them its final value.
+*/
+
+typedef struct {
+    BackgroundRecalc *background;
+    long top;
+    long last;                  // highest marked step
+} SettleMarks;
+
+static void markStep(SettleMarks *marks, long step) {
+    BackgroundRecalc *background = marks->background;
+    if (step < 0 || background->state[step] != STEP_PENDING)
+        return;
+    background->state[step] = STEP_NEEDED;
+    background->stack[marks->top++] = step;
+    if (step > marks->last)
+        marks->last = step;
+}
+
+static void mark_dependency_callback(Cell *dependency, void *data) {
+    SettleMarks *marks = (SettleMarks *) data;
+    markStep(marks, backgroundStep(marks->background, dependency));
+}
+
+/*
+ * backgroundSettle gives every cell of sheet in rows row1..row2 and columns col1..col2 its
+ * final value, leaving the rest of the plan to the worker.
+ */
+void backgroundSettle(BackgroundRecalc *background, Spreadsheet *sheet,
+                      int row1, int col1, int row2, int col2) {
+    if (!backgroundPending(background))
+        return;
+    SettleMarks marks = { background, 0, -1 };
+    for (int r = row1; r <= row2; r++) {
+        for (int c = col1; c <= col2; c++) {
+            const Cell *cell = sheetPeek(sheet, r, c);
+            if (cell)
+                markStep(&marks, backgroundStep(background, cell));
+        }
+    }
+    while (marks.top > 0) {
+        long step = background->stack[--marks.top];
+        Cell *cell = background->cells[step];
+        if (cell->dependencies)
+            avl_traverse(cell->dependencies, mark_dependency_callback, &marks);
+        if (cell->op < OP_ADV_SUM || cell->op > OP_ADV_STDEV)
+            continue;
+        const Spreadsheet *rangeSheet = cell->rangeSheet ? cell->rangeSheet : background->owners[step];
+        for (long i = background->next; i < step; i++) {
+            const Cell *input = background->cells[i];
+            if (background->state[i] == STEP_PENDING &&
+                sheetRangeHolds(rangeSheet, input, cell->row1, cell->col1, cell->row2, cell->col2))
+                markStep(&marks, i);
+        }
+    }
+    long last = marks.last;
+    for (long i = background->next; backgroundPending(background) && i <= last; i++) {
+        if (background->state[i] == STEP_NEEDED)
+            runStep(background, i);
+    }
+}
@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "spreadsheet.h"
+#include "input_parser.h"
+#include "mem_track.h"
+
+/*
+   ---------------- Benchmark harness ----------------
+
+   bench replays command files (by default every .txt file in test-cases/) against the engine at several
+   sheet sizes.  Each (workload, size) run happens in a forked child so its peak RSS can be read
+   from wait4() and a crash in one workload does not end the whole run.  The child times every
+   command with CLOCK_MONOTONIC and sends a BenchResult back through a pipe; the parent prints
+   one JSON document with latency percentiles, throughput and peak RSS per run.
+
+   With SHEET_STATS the result also carries the tracked memory per subsystem (see mem_track.h):
+   live bytes when the last command finished and the peak over setup and run.
+
+   Frames and status lines are suppressed (as in --script mode), and SLEEP commands are skipped
+   so the numbers measure the engine rather than sleep(3).
+*/
+
+#define BENCH_MAX_LINE     256
+#define BENCH_MAX_SIZES    16
+#define BENCH_DEFAULT_DIR  "test-cases"
+#define BENCH_DEFAULT_SIZES "100x100,999x702,999x18278"
+
+typedef struct {
+    long commands;
+    long rejected;
+    long skipped;
+    double setupSeconds;
+    double totalSeconds;
+    double p50Micros;
+    double p99Micros;
+    double maxMicros;
+    double meanMicros;
+#ifdef SHEET_STATS
+    MemTagStats memory[MEM_TAG_COUNT];
+    long long memoryPeak;
+#endif
+} BenchResult;
+
+typedef struct {
+    int rows;
+    int cols;
+} BenchSize;
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * percentile returns the nearest-rank percentile of an ascending array.
+ */
+static double percentile(const double *sorted, long count, double p) {
+    if (count == 0)
+        return 0.0;
+    long rank = (long) ceil(p * count);
+    if (rank < 1)
+        rank = 1;
+    return sorted[rank - 1];
+}
+
+/*
+ * readLines loads a command file into an array of lines (newlines stripped).
+ */
+static char **readLines(const char *path, long *count) {
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return NULL;
+    long capacity = 1024;
+    char **lines = malloc(capacity * sizeof(char *));
+    if (!lines) {
+        perror("Failed to allocate lines");
+        exit(EXIT_FAILURE);
+    }
+    char buffer[BENCH_MAX_LINE];
+    *count = 0;
+    while (fgets(buffer, sizeof(buffer), file)) {
+        buffer[strcspn(buffer, "\r\n")] = '\0';
+        if (*count == capacity) {
+            capacity *= 2;
+            lines = realloc(lines, capacity * sizeof(char *));
+            if (!lines) {
+                perror("Failed to allocate lines");
+                exit(EXIT_FAILURE);
+            }
+        }
+        lines[(*count)++] = strdup(buffer);
+    }
+    fclose(file);
+    return lines;
+}
+
+/*
+ * runWorkload replays the lines on a fresh sheet and fills in the timing part of the result.
+ */
+static void runWorkload(char **lines, long lineCount, BenchSize size, BenchResult *result) {
+    memset(result, 0, sizeof(*result));
+    double *latencies = malloc((lineCount + 1) * sizeof(double));
+    if (!latencies) {
+        perror("Failed to allocate latencies");
+        exit(EXIT_FAILURE);
+    }
+    double setupStart = monotonicSeconds();
+    Spreadsheet *spreadsheet = initializeSpreadsheet(size.rows, size.cols);
+    spreadsheet->quiet = 1;
+    result->setupSeconds = monotonicSeconds() - setupStart;
+
+    char command[BENCH_MAX_LINE];
+    double runStart = monotonicSeconds();
+    for (long i = 0; i < lineCount; i++) {
+        if (strstr(lines[i], "SLEEP(")) {
+            result->skipped++;
+            continue;
+        }
+        strcpy(command, lines[i]);
+        double start = monotonicSeconds();
+        int running = parseInput(command, spreadsheet, start);
+        latencies[result->commands++] = (monotonicSeconds() - start) * 1e6;
+        if (!running)
+            break;
+    }
+    result->totalSeconds = monotonicSeconds() - runStart;
+    result->rejected = spreadsheet->rejectedCount;
+#ifdef SHEET_STATS
+    memSnapshot(result->memory, &result->memoryPeak);
+#endif
+
+    double sum = 0.0;
+    for (long i = 0; i < result->commands; i++)
+        sum += latencies[i];
+    qsort(latencies, result->commands, sizeof(double), compareDoubles);
+    result->p50Micros = percentile(latencies, result->commands, 0.50);
+    result->p99Micros = percentile(latencies, result->commands, 0.99);
+    result->maxMicros = result->commands ? latencies[result->commands - 1] : 0.0;
+    result->meanMicros = result->commands ? sum / result->commands : 0.0;
+    free(latencies);
+    freeSpreadsheet(spreadsheet);
+}
+
+/*
+ * runIsolated forks a child for one run.  Returns 0 and fills result and peakRss (KiB) on success,
+ * otherwise the signal or exit status of the failed child.
+ */
+static int runIsolated(char **lines, long lineCount, BenchSize size, BenchResult *result, long *peakRss) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        BenchResult childResult;
+        runWorkload(lines, lineCount, size, &childResult);
+        ssize_t written = write(fds[1], &childResult, sizeof(childResult));
+        _exit(written == (ssize_t) sizeof(childResult) ? 0 : 1);
+    }
+    close(fds[1]);
+    ssize_t got = read(fds[0], result, sizeof(*result));
+    close(fds[0]);
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) {
+        perror("wait4");
+        exit(EXIT_FAILURE);
+    }
+    *peakRss = usage.ru_maxrss;
+    if (WIFSIGNALED(status))
+        return WTERMSIG(status);
+    if (got != (ssize_t) sizeof(*result) || WEXITSTATUS(status) != 0)
+        return -1;
+    return 0;
+}
+
+static int parseSizes(const char *spec, BenchSize *sizes) {
+    int count = 0;
+    const char *p = spec;
+    while (*p && count < BENCH_MAX_SIZES) {
+        int rows, cols, used;
+        if (sscanf(p, "%dx%d%n", &rows, &cols, &used) != 2 || rows <= 0 || cols <= 0)
+            return -1;
+        sizes[count].rows = rows;
+        sizes[count].cols = cols;
+        count++;
+        p += used;
+        if (*p == ',')
+            p++;
+    }
+    return count;
+}
+
+static int compareNames(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/*
+ * listWorkloads returns the sorted *.txt names in dir, or the comma separated names in filter.
+ */
+static char **listWorkloads(const char *dir, const char *filter, int *count) {
+    char **names = NULL;
+    int capacity = 0;
+    *count = 0;
+    if (filter) {
+        char *copy = strdup(filter);
+        for (char *name = strtok(copy, ","); name; name = strtok(NULL, ",")) {
+            if (*count == capacity) {
+                capacity = capacity ? capacity * 2 : 16;
+                names = realloc(names, capacity * sizeof(char *));
+            }
+            names[(*count)++] = strdup(name);
+        }
+        free(copy);
+        return names;
+    }
+    DIR *d = opendir(dir);
+    if (!d)
+        return NULL;
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len <= 4 || strcmp(entry->d_name + len - 4, ".txt") != 0)
+            continue;
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            names = realloc(names, capacity * sizeof(char *));
+        }
+        names[*count] = strdup(entry->d_name);
+        names[*count][len - 4] = '\0';
+        (*count)++;
+    }
+    closedir(d);
+    qsort(names, *count, sizeof(char *), compareNames);
+    return names;
+}
+
+static void printUsage(const char *program) {
+    fprintf(stderr, "Usage: %s [--dir <dir>] [--workloads a,b,...] [--sizes RxC,...] [--out <file.json>]\n", program);
+}
+
+/*
+ * printMemory writes the "memory" member of one result; nothing without SHEET_STATS.
+ */
+static void printMemory(FILE *out, const BenchResult *result) {
+#ifdef SHEET_STATS
+    fprintf(out, ", \"memory\": {\"peak_bytes\": %lld, \"tags\": {", result->memoryPeak);
+    for (int i = 0; i < MEM_TAG_COUNT; i++) {
+        const MemTagStats *tag = &result->memory[i];
+        fprintf(out, "%s\"%s\": {\"live_bytes\": %lld, \"peak_bytes\": %lld, \"allocs\": %llu, \"frees\": %llu}",
+                i ? ", " : "", memTagName(i), tag->liveBytes, tag->peakBytes, tag->allocs, tag->frees);
+    }
+    fprintf(out, "}}");
+#else
+    (void) out;
+    (void) result;
+#endif
+}
+
+int main(int argc, char *argv[]) {
+    const char *dir = BENCH_DEFAULT_DIR;
+    const char *filter = NULL;
+    const char *sizeSpec = BENCH_DEFAULT_SIZES;
+    const char *outPath = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (strcmp(argv[i], "--workloads") == 0 && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (strcmp(argv[i], "--sizes") == 0 && i + 1 < argc) {
+            sizeSpec = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            outPath = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    BenchSize sizes[BENCH_MAX_SIZES];
+    int sizeCount = parseSizes(sizeSpec, sizes);
+    if (sizeCount <= 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    int workloadCount;
+    char **workloads = listWorkloads(dir, filter, &workloadCount);
+    if (!workloads) {
+        fprintf(stderr, "bench: cannot read %s\n", dir);
+        return 1;
+    }
+    FILE *out = outPath ? fopen(outPath, "w") : stdout;
+    if (!out) {
+        perror(outPath);
+        return 1;
+    }
+
+    fprintf(out, "{\n  \"clock\": \"CLOCK_MONOTONIC\",\n  \"results\": [");
+    int first = 1;
+    for (int w = 0; w < workloadCount; w++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s.txt", dir, workloads[w]);
+        long lineCount;
+        char **lines = readLines(path, &lineCount);
+        if (!lines) {
+            fprintf(stderr, "bench: cannot read %s\n", path);
+            continue;
+        }
+        for (int s = 0; s < sizeCount; s++) {
+            BenchResult result;
+            long peakRss = 0;
+            int failure = runIsolated(lines, lineCount, sizes[s], &result, &peakRss);
+            fprintf(out, "%s\n    {\"workload\": \"%s\", \"rows\": %d, \"cols\": %d, ",
+                    first ? "" : ",", workloads[w], sizes[s].rows, sizes[s].cols);
+            first = 0;
+            if (failure != 0) {
+                fprintf(out, "\"status\": \"failed\", \"signal\": %d, \"peak_rss_kb\": %ld}", failure > 0 ? failure : 0, peakRss);
+                fprintf(stderr, "%-24s %5dx%-5d FAILED (%s)\n", workloads[w], sizes[s].rows, sizes[s].cols,
+                        failure > 0 ? strsignal(failure) : "no result");
+                continue;
+            }
+            double throughput = result.totalSeconds > 0 ? result.commands / result.totalSeconds : 0.0;
+            fprintf(out, "\"status\": \"ok\", \"commands\": %ld, \"rejected\": %ld, \"skipped\": %ld, "
+                         "\"setup_s\": %.6f, \"total_s\": %.6f, \"throughput_cmd_per_s\": %.1f, "
+                         "\"latency_us\": {\"p50\": %.2f, \"p99\": %.2f, \"max\": %.2f, \"mean\": %.2f}, "
+                         "\"peak_rss_kb\": %ld",
+                    result.commands, result.rejected, result.skipped, result.setupSeconds, result.totalSeconds,
+                    throughput, result.p50Micros, result.p99Micros, result.maxMicros, result.meanMicros, peakRss);
+            printMemory(out, &result);
+            fprintf(out, "}");
+            fprintf(stderr, "%-24s %5dx%-5d %6ld cmds %10.1f cmd/s  p50 %9.1f us  p99 %10.1f us  max %11.1f us  rss %8ld KiB\n",
+                    workloads[w], sizes[s].rows, sizes[s].cols, result.commands, throughput,
+                    result.p50Micros, result.p99Micros, result.maxMicros, peakRss);
+        }
+        for (long i = 0; i < lineCount; i++)
+            free(lines[i]);
+        free(lines);
+    }
+    fprintf(out, "\n  ]\n}\n");
+    if (out != stdout)
+        fclose(out);
+    for (int w = 0; w < workloadCount; w++)
+        free(workloads[w]);
+    free(workloads);
+    return 0;
+}
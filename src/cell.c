@@ -1,6 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <limits.h>
 #include "cell.h"
 #include "avl_tree.h"  
 
@@ -8,6 +9,7 @@ void initCell(Cell *cell,int selfrow,int selfcol) {
     cell->value = 0;
     cell->op = OP_NONE;
     cell->row1 = cell->col1 = cell->row2 = cell->col2 = -1;
+    cell->rangeSheet = NULL;
     cell->dependencies = NULL;
     cell->dependents = NULL;
     cell->operand1IsLiteral = 0;
@@ -19,6 +21,7 @@ void initCell(Cell *cell,int selfrow,int selfcol) {
     cell->selfRow=selfrow;
     cell->selfCol=selfcol;
     cell->error=0;
+    cell->component=0;
 }
 
 void freeCell(Cell *cell) {
@@ -32,20 +35,31 @@ void freeCell(Cell *cell) {
     }
 }
 
-void parseCellReference(const char *ref, int *row, int *col) {
-    *col = 0;
-    int i = 0;
-    while (isalpha(ref[i])) {
-        *col = *col * 26 + (toupper(ref[i]) - 'A' + 1);
+/*
+ * parseCellReference parses a reference such as "B12" into 0-based row and col.
+ * The column is 1 to 3 letters (either case) and the row is decimal digits only.
+ * It returns 0 on success and -1 for a malformed reference or one whose row does not fit
+ * an int; the caller still has to check the result against the sheet size.
+ */
+int parseCellReference(const char *ref, int *row, int *col) {
+    int i = 0, column = 0;
+    while (isalpha((unsigned char) ref[i])) {
+        if (i == 3)
+            return -1;
+        column = column * 26 + (toupper((unsigned char) ref[i]) - 'A' + 1);
         i++;
     }
-    if (!isdigit(ref[i])) {
-        *row=20000;
-    }
-    char *endptr;
-    *row = strtol(ref + i, &endptr, 10) - 1;  
-    *col = *col - 1;  // Convert from 1-based to 0-based.
-    if (*endptr != '\0') {
-        *row=20000;
+    if (i == 0 || !isdigit((unsigned char) ref[i]))
+        return -1;
+    long number = 0;
+    for (; isdigit((unsigned char) ref[i]); i++) {
+        number = number * 10 + (ref[i] - '0');
+        if (number > INT_MAX)
+            return -1;
     }
+    if (ref[i] != '\0' || number == 0)
+        return -1;
+    *row = (int) number - 1;
+    *col = column - 1;
+    return 0;
 }
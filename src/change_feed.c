@@ -0,0 +1,360 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "change_feed.h"
+#include "workbook.h"
+#include "render.h"
+#include "mem_track.h"
+
+/*
+   ---------------- Change feed ----------------
+
+   The cells recorded during a commit are kept in arrival order in pending, with an
+   open-addressed index on the cell pointer so that a cell recomputed many times in one
+   cascade is listed once, with the value it had before its first change.  Clearing after a
+   commit walks the recorded entries, not the whole index; an index grown past
+   FEED_KEEP_SLOTS by a large commit is released instead of kept.  All of it is accounted under
+   MEM_FEED.
+*/
+
+#define FEED_INITIAL_SLOTS 1024
+#define FEED_KEEP_SLOTS    (1L << 16)
+// Longest stream line: "<sheet>!<column><row>=<value>\n".
+#define FEED_LINE_MAX      (SHEET_NAME_MAX + 32)
+
+static ChangeFeed *feedOf(Spreadsheet *spreadsheet, int create) {
+    Spreadsheet *home = homeSheet(spreadsheet);
+    if (!home->feed && create) {
+        home->feed = memCalloc(MEM_FEED, 1, sizeof(ChangeFeed));
+        if (!home->feed) {
+            perror("Failed to allocate change feed");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < FEED_MAX_SUBSCRIBERS; i++)
+            home->feed->subscribers[i].fd = -1;
+    }
+    return home->feed;
+}
+
+static long slotOf(const ChangeFeed *feed, const Cell *cell) {
+    uint64_t key = (uint64_t) (uintptr_t) cell / sizeof(Cell);
+    key *= 0x9E3779B97F4A7C15ULL;
+    return (long) ((key ^ (key >> 32)) & (uint64_t) (feed->slotCount - 1));
+}
+
+/*
+ * growSlots doubles the index and re-inserts every recorded cell.
+ */
+static void growSlots(ChangeFeed *feed) {
+    long oldCount = feed->slotCount;
+    long newCount = oldCount ? 2 * oldCount : FEED_INITIAL_SLOTS;
+    long *slots = memCalloc(MEM_FEED, newCount, sizeof(long));
+    if (!slots) {
+        perror("Failed to grow change feed index");
+        exit(EXIT_FAILURE);
+    }
+    if (feed->slots)
+        memFree(MEM_FEED, feed->slots, oldCount * sizeof(long));
+    feed->slots = slots;
+    feed->slotCount = newCount;
+    for (long i = 0; i < feed->pendingCount; i++) {
+        long slot = slotOf(feed, feed->pending[i].cell);
+        while (slots[slot])
+            slot = (slot + 1) & (newCount - 1);
+        slots[slot] = i + 1;
+        feed->pending[i].slot = slot;
+    }
+}
+
+static void clearPending(ChangeFeed *feed) {
+    if (feed->slotCount > FEED_KEEP_SLOTS) {
+        memFree(MEM_FEED, feed->slots, feed->slotCount * sizeof(long));
+        memFree(MEM_FEED, feed->pending, feed->pendingCapacity * sizeof(PendingChange));
+        feed->slots = NULL;
+        feed->slotCount = 0;
+        feed->pending = NULL;
+        feed->pendingCapacity = 0;
+    } else {
+        for (long i = 0; i < feed->pendingCount; i++)
+            feed->slots[feed->pending[i].slot] = 0;
+    }
+    feed->pendingCount = 0;
+}
+
+/*
+ * changeFeedRecord notes that cell of sheet, which showed oldValue/oldError, is being changed.
+ * Only the first note of a cell in a commit is kept.
+ */
+void changeFeedRecord(ChangeFeed *feed, Spreadsheet *sheet, Cell *cell, int oldValue, int oldError) {
+    if (feed->reset)
+        return;
+    if (2 * (feed->pendingCount + 1) > feed->slotCount)
+        growSlots(feed);
+    long slot = slotOf(feed, cell);
+    for (; feed->slots[slot]; slot = (slot + 1) & (feed->slotCount - 1)) {
+        if (feed->pending[feed->slots[slot] - 1].cell == cell)
+            return;
+    }
+    if (feed->pendingCount == FEED_MAX_PENDING) {
+        changeFeedReset(feed);
+        return;
+    }
+    if (feed->pendingCount == feed->pendingCapacity) {
+        long capacity = feed->pendingCapacity ? 2 * feed->pendingCapacity : FEED_INITIAL_SLOTS / 2;
+        feed->pending = memRealloc(MEM_FEED, feed->pending, feed->pendingCapacity * sizeof(PendingChange),
+                                   capacity * sizeof(PendingChange));
+        if (!feed->pending) {
+            perror("Failed to grow pending changes");
+            exit(EXIT_FAILURE);
+        }
+        feed->pendingCapacity = capacity;
+    }
+    PendingChange *entry = &feed->pending[feed->pendingCount++];
+    entry->cell = cell;
+    entry->sheet = sheet;
+    entry->oldValue = oldValue;
+    entry->oldError = oldError;
+    entry->slot = slot;
+    feed->slots[slot] = feed->pendingCount;
+}
+
+/*
+ * changeFeedReset turns the current commit into a reset, e.g. because the cells recorded so far
+ * are about to be freed.
+ */
+void changeFeedReset(ChangeFeed *feed) {
+    feed->reset = 1;
+    clearPending(feed);
+}
+
+/*
+   ---------------- Subscriptions ----------------
+*/
+
+static int addSubscriber(ChangeFeed *feed, ChangeCallback callback, void *data, int fd) {
+    for (int i = 0; i < FEED_MAX_SUBSCRIBERS; i++) {
+        Subscriber *subscriber = &feed->subscribers[i];
+        if (subscriber->callback || subscriber->fd >= 0)
+            continue;
+        subscriber->callback = callback;
+        subscriber->data = data;
+        subscriber->fd = fd;
+        feed->subscriberCount++;
+        return i;
+    }
+    return -1;
+}
+
+/*
+ * changeFeedSubscribe registers a callback for the commits of the workbook of spreadsheet.
+ * Returns its id for changeFeedUnsubscribe, or -1 if all slots are taken.
+ */
+int changeFeedSubscribe(Spreadsheet *spreadsheet, ChangeCallback callback, void *data) {
+    if (!callback)
+        return -1;
+    return addSubscriber(feedOf(spreadsheet, 1), callback, data, -1);
+}
+
+/*
+ * openStream opens path for writing: a Unix-domain socket is connected to, anything else is
+ * opened for appending.  A FIFO without a reader fails (ENXIO) instead of blocking.
+ */
+static int openStream(const char *path) {
+    struct stat info;
+    if (stat(path, &info) == 0 && S_ISSOCK(info.st_mode)) {
+        struct sockaddr_un address;
+        if (strlen(path) >= sizeof(address.sun_path))
+            return -1;
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0)
+            return -1;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strcpy(address.sun_path, path);
+        if (connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+    int fd = open(path, O_WRONLY | O_APPEND | O_CREAT | O_NONBLOCK | O_CLOEXEC, 0644);
+    if (fd >= 0)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    return fd;
+}
+
+/*
+ * changeFeedWatch subscribes a stream to path.  Returns its id, or -1 if path cannot be opened
+ * or all slots are taken.
+ */
+int changeFeedWatch(Spreadsheet *spreadsheet, const char *path) {
+    int fd = openStream(path);
+    if (fd < 0)
+        return -1;
+    // A consumer that goes away must cost its subscription, not the process.
+    signal(SIGPIPE, SIG_IGN);
+    int id = addSubscriber(feedOf(spreadsheet, 1), NULL, NULL, fd);
+    if (id < 0)
+        close(fd);
+    return id;
+}
+
+void changeFeedUnsubscribe(Spreadsheet *spreadsheet, int id) {
+    ChangeFeed *feed = feedOf(spreadsheet, 0);
+    if (!feed || id < 0 || id >= FEED_MAX_SUBSCRIBERS)
+        return;
+    Subscriber *subscriber = &feed->subscribers[id];
+    if (!subscriber->callback && subscriber->fd < 0)
+        return;
+    if (subscriber->fd >= 0)
+        close(subscriber->fd);
+    subscriber->callback = NULL;
+    subscriber->data = NULL;
+    subscriber->fd = -1;
+    if (--feed->subscriberCount == 0)
+        clearPending(feed);
+}
+
+/*
+ * changeFeedUnwatchAll closes every stream subscription; callbacks stay.
+ */
+void changeFeedUnwatchAll(Spreadsheet *spreadsheet) {
+    ChangeFeed *feed = feedOf(spreadsheet, 0);
+    for (int i = 0; feed && i < FEED_MAX_SUBSCRIBERS; i++) {
+        if (feed->subscribers[i].fd >= 0)
+            changeFeedUnsubscribe(spreadsheet, i);
+    }
+}
+
+/*
+   ---------------- Delivery ----------------
+*/
+
+/*
+ * encodeCommit writes the stream form of a commit into feed->text and returns its length.
+ */
+static size_t encodeCommit(ChangeFeed *feed, const CellChange *changes, long count, int reset) {
+    size_t needed = (size_t) (count + 1) * FEED_LINE_MAX;
+    if (needed > feed->textCapacity) {
+        feed->text = memRealloc(MEM_FEED, feed->text, feed->textCapacity, needed);
+        if (!feed->text) {
+            perror("Failed to grow change stream buffer");
+            exit(EXIT_FAILURE);
+        }
+        feed->textCapacity = needed;
+    }
+    char *p = feed->text;
+    if (reset)
+        p += sprintf(p, "commit %lu reset\n", feed->commits);
+    else
+        p += sprintf(p, "commit %lu %ld\n", feed->commits, count);
+    for (long i = 0; i < count; i++) {
+        size_t nameLength = strlen(changes[i].sheet->name);
+        memcpy(p, changes[i].sheet->name, nameLength);
+        p += nameLength;
+        *p++ = '!';
+        getColumnLabel(changes[i].col, p);
+        p += strlen(p);
+        p += formatInt(p, changes[i].row + 1);
+        *p++ = '=';
+        if (changes[i].error) {
+            memcpy(p, "ERR", 3);
+            p += 3;
+        } else {
+            p += formatInt(p, changes[i].value);
+        }
+        *p++ = '\n';
+    }
+    return (size_t) (p - feed->text);
+}
+
+static int writeStream(int fd, const char *text, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(fd, text, length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        text += n;
+        length -= (size_t) n;
+    }
+    return 0;
+}
+
+/*
+ * changeFeedCommit ends the current commit of the workbook of home: the cells that show
+ * something new are handed to every subscriber, and recording starts over.
+ */
+void changeFeedCommit(Spreadsheet *home) {
+    ChangeFeed *feed = home->feed;
+    if (!feed)
+        return;
+    int reset = feed->reset;
+    long count = 0;
+    if (!reset && feed->pendingCount > feed->changesCapacity) {
+        if (feed->changes)
+            memFree(MEM_FEED, feed->changes, feed->changesCapacity * sizeof(CellChange));
+        feed->changes = memAlloc(MEM_FEED, feed->pendingCount * sizeof(CellChange));
+        if (!feed->changes) {
+            perror("Failed to allocate change list");
+            exit(EXIT_FAILURE);
+        }
+        feed->changesCapacity = feed->pendingCount;
+    }
+    for (long i = 0; !reset && i < feed->pendingCount; i++) {
+        const PendingChange *entry = &feed->pending[i];
+        const Cell *cell = entry->cell;
+        if (!cellShowsChange(cell->value, cell->error, entry->oldValue, entry->oldError))
+            continue;
+        CellChange *change = &feed->changes[count++];
+        change->sheet = entry->sheet;
+        change->row = sheetLogicalRow(entry->sheet, cell->selfRow);
+        change->col = sheetLogicalCol(entry->sheet, cell->selfCol);
+        change->value = cell->error ? 0 : cell->value;
+        change->error = cell->error;
+    }
+    clearPending(feed);
+    feed->reset = 0;
+    if ((!reset && count == 0) || feed->subscriberCount == 0)
+        return;
+
+    feed->commits++;
+    size_t length = 0;
+    for (int i = 0; i < FEED_MAX_SUBSCRIBERS; i++) {
+        Subscriber *subscriber = &feed->subscribers[i];
+        if (subscriber->callback) {
+            subscriber->callback(feed->commits, feed->changes, count, reset, subscriber->data);
+        } else if (subscriber->fd >= 0) {
+            if (length == 0)
+                length = encodeCommit(feed, feed->changes, count, reset);
+            if (writeStream(subscriber->fd, feed->text, length) != 0)
+                changeFeedUnsubscribe(home, i);
+        }
+    }
+}
+
+void freeChangeFeed(ChangeFeed *feed) {
+    if (!feed)
+        return;
+    for (int i = 0; i < FEED_MAX_SUBSCRIBERS; i++) {
+        if (feed->subscribers[i].fd >= 0)
+            close(feed->subscribers[i].fd);
+    }
+    if (feed->slots)
+        memFree(MEM_FEED, feed->slots, feed->slotCount * sizeof(long));
+    if (feed->pending)
+        memFree(MEM_FEED, feed->pending, feed->pendingCapacity * sizeof(PendingChange));
+    if (feed->changes)
+        memFree(MEM_FEED, feed->changes, feed->changesCapacity * sizeof(CellChange));
+    if (feed->text)
+        memFree(MEM_FEED, feed->text, feed->textCapacity);
+    memFree(MEM_FEED, feed, sizeof(ChangeFeed));
+}
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "components.h"
+#include "workbook.h"
+#include "avl_tree.h"
+#include "mem_track.h"
+
+/*
+   ---------------- Connected components ----------------
+
+   Ids are handed out on demand and never reused before a rebuild.  The table lives on the home
+   sheet and is charged to MEM_EDGES together with the edges it summarizes.  It is created
+   stale, so the first refresh builds it from whatever the sheets already hold (e.g. a loaded
+   snapshot).
+*/
+
+#define COMPONENTS_MIN_CAPACITY 64
+
+static int newId(Components *components) {
+    if (components->count == components->capacity) {
+        int capacity = components->capacity ? 2 * components->capacity : COMPONENTS_MIN_CAPACITY;
+        components->parent = memRealloc(MEM_EDGES, components->parent, components->capacity * sizeof(int),
+                                        capacity * sizeof(int));
+        components->size = memRealloc(MEM_EDGES, components->size, components->capacity * sizeof(int),
+                                      capacity * sizeof(int));
+        if (!components->parent || !components->size) {
+            perror("Failed to grow component table");
+            exit(EXIT_FAILURE);
+        }
+        components->capacity = capacity;
+    }
+    int id = components->count++;
+    components->parent[id] = id;
+    components->size[id] = 1;
+    return id;
+}
+
+static void unite(Components *components, int a, int b) {
+    a = componentFind(components, a);
+    b = componentFind(components, b);
+    if (a == b)
+        return;
+    if (components->size[a] < components->size[b]) {
+        int swap = a;
+        a = b;
+        b = swap;
+    }
+    components->parent[b] = a;
+    components->size[a] += components->size[b];
+}
+
+/*
+ * forEachSheet calls visit for every sheet of the workbook of home.
+ */
+static void forEachSheet(Spreadsheet *home, void (*visit)(Spreadsheet *sheet, void *data), void *data) {
+    if (!home->workbook) {
+        visit(home, data);
+        return;
+    }
+    for (int i = 0; i < home->workbook->count; i++)
+        visit(home->workbook->sheets[i], data);
+}
+
+static const Spreadsheet *rangeSheetOf(const Spreadsheet *owner, const Cell *formula) {
+    return formula->rangeSheet ? formula->rangeSheet : owner;
+}
+
+/*
+ * uniteInRect puts formula in the component of every cell with an id in rows row1..row2 and
+ * columns col1..col2 of store.
+ */
+static void uniteInRect(Components *components, Cell *formula, const TileStore *store,
+                        int row1, int col1, int row2, int col2) {
+    for (int tileRow = row1 >> TILE_ROW_BITS; tileRow <= row2 >> TILE_ROW_BITS; tileRow++) {
+        if (!store->bands[tileRow])
+            continue;
+        for (int tileCol = col1 >> TILE_COL_BITS; tileCol <= col2 >> TILE_COL_BITS; tileCol++) {
+            Tile *tile = store->bands[tileRow][tileCol];
+            if (!tile || tile->packed)
+                continue;
+            tileStoreUse(store, tile);
+            long count = (long) tile->rows * tile->cols;
+            for (long i = 0; i < count; i++) {
+                const Cell *cell = &tile->cells[i];
+                if (cell->component && cell->selfRow >= row1 && cell->selfRow <= row2 &&
+                    cell->selfCol >= col1 && cell->selfCol <= col2)
+                    unite(components, formula->component, cell->component);
+            }
+        }
+    }
+}
+
+/*
+ * unitePresentInRange puts formula in the component of every cell of the range that has an id.
+ * Cells without one join the formula when they get it (see assignId).
+ */
+static void unitePresentInRange(Components *components, Cell *formula, const Spreadsheet *rangeSheet) {
+    for (int r = formula->row1; r <= formula->row2; ) {
+        int row, rows = indexMapSpan(rangeSheet->rowMap, r, formula->row2, &row);
+        for (int c = formula->col1; c <= formula->col2; ) {
+            int col, cols = indexMapSpan(rangeSheet->colMap, c, formula->col2, &col);
+            uniteInRect(components, formula, &rangeSheet->store, row, col, row + rows - 1, col + cols - 1);
+            c += cols;
+        }
+        r += rows;
+    }
+}
+
+typedef struct {
+    Components *components;
+    const Spreadsheet *sheet;
+    Cell *cell;
+} RangeJoin;
+
+static void join_ranges_visit(Spreadsheet *sheet, void *data) {
+    RangeJoin *join = (RangeJoin *) data;
+    for (int i = 0; i < sheet->advancedFormulasCount; i++) {
+        Cell *formula = sheet->advancedFormulas[i];
+        if (rangeSheetOf(sheet, formula) != join->sheet ||
+            !sheetRangeHolds(join->sheet, join->cell, formula->row1, formula->col1, formula->row2, formula->col2))
+            continue;
+        if (!formula->component)
+            formula->component = newId(join->components);
+        unite(join->components, formula->component, join->cell->component);
+    }
+}
+
+/*
+ * assignId gives cell, which lies on sheet, an id and puts it in the component of every range
+ * formula over it.  This costs a pass over the advanced formulas, once per cell.
+ */
+static void assignId(Components *components, Spreadsheet *sheet, Cell *cell) {
+    cell->component = newId(components);
+    RangeJoin join = { components, sheet, cell };
+    forEachSheet(homeSheet(sheet), join_ranges_visit, &join);
+}
+
+/*
+ * componentsFor returns the table to update for a change made on spreadsheet, or NULL if there
+ * is none to keep.  A bulk change only marks the table stale: it ends in recalcAll, which
+ * rebuilds it once.
+ */
+static Components *componentsFor(Spreadsheet *spreadsheet) {
+    Components *components = componentsUsable(spreadsheet);
+    if (components && spreadsheet->deferRecalc) {
+        components->stale = 1;
+        return NULL;
+    }
+    return components;
+}
+
+/*
+   ---------------- Rebuild ----------------
+*/
+
+static void clear_ids_visit(Spreadsheet *sheet, void *data) {
+    (void) data;
+    TileStore *store = &sheet->store;
+    for (long t = 0; t < store->tileCount; t++) {
+        Tile *tile = store->tiles[t];
+        if (tile->packed)
+            continue;
+        tileStoreUse(store, tile);
+        long count = (long) tile->rows * tile->cols;
+        for (long i = 0; i < count; i++)
+            tile->cells[i].component = 0;
+    }
+}
+
+static void formula_ids_visit(Spreadsheet *sheet, void *data) {
+    Components *components = (Components *) data;
+    for (int i = 0; i < sheet->advancedFormulasCount; i++)
+        sheet->advancedFormulas[i]->component = newId(components);
+}
+
+typedef struct {
+    Components *components;
+    Cell *target;
+} EdgeJoin;
+
+static void join_edge_callback(Cell *source, void *data) {
+    EdgeJoin *join = (EdgeJoin *) data;
+    if (!source->component)
+        source->component = newId(join->components);
+    unite(join->components, join->target->component, source->component);
+}
+
+static void edges_visit(Spreadsheet *sheet, void *data) {
+    Components *components = (Components *) data;
+    TileStore *store = &sheet->store;
+    for (long t = 0; t < store->tileCount; t++) {
+        Tile *tile = store->tiles[t];
+        if (tile->packed)
+            continue;
+        tileStoreUse(store, tile);
+        long count = (long) tile->rows * tile->cols;
+        for (long i = 0; i < count; i++) {
+            Cell *cell = &tile->cells[i];
+            if (!cell->dependencies)
+                continue;
+            if (!cell->component)
+                cell->component = newId(components);
+            EdgeJoin join = { components, cell };
+            avl_traverse(cell->dependencies, join_edge_callback, &join);
+        }
+    }
+}
+
+static void ranges_visit(Spreadsheet *sheet, void *data) {
+    Components *components = (Components *) data;
+    for (int i = 0; i < sheet->advancedFormulasCount; i++) {
+        Cell *formula = sheet->advancedFormulas[i];
+        unitePresentInRange(components, formula, rangeSheetOf(sheet, formula));
+    }
+}
+
+/*
+ * rebuild recomputes every id of the workbook from its edges and range formulas.  Range
+ * formulas get their ids first, so a formula inside another's range is found by the range pass.
+ */
+static void rebuild(Spreadsheet *home, Components *components) {
+    forEachSheet(home, clear_ids_visit, NULL);
+    components->count = 0;
+    newId(components);
+    forEachSheet(home, formula_ids_visit, components);
+    forEachSheet(home, edges_visit, components);
+    forEachSheet(home, ranges_visit, components);
+    components->removals = 0;
+    components->stale = 0;
+    components->rebuilds++;
+}
+
+/*
+   ---------------- Interface ----------------
+*/
+
+/*
+ * componentsRefresh makes the ids of spreadsheet's workbook usable, creating or rebuilding the
+ * table if needed.  Call it where a change is propagated, never while deferRecalc is set.
+ */
+void componentsRefresh(Spreadsheet *spreadsheet) {
+    Spreadsheet *home = homeSheet(spreadsheet);
+    Components *components = home->components;
+    if (!components) {
+        components = memCalloc(MEM_EDGES, 1, sizeof(Components));
+        if (!components) {
+            perror("Failed to allocate component table");
+            exit(EXIT_FAILURE);
+        }
+        components->stale = 1;
+        home->components = components;
+    }
+    if (components->stale)
+        rebuild(home, components);
+}
+
+/*
+ * componentOf returns the component of cell, a cell of spreadsheet, giving it an id if it has
+ * none.  Returns 0 while the table is not usable.
+ */
+int componentOf(Spreadsheet *spreadsheet, Cell *cell) {
+    Components *components = componentsFor(spreadsheet);
+    if (!components)
+        return 0;
+    if (!cell->component)
+        assignId(components, spreadsheet, cell);
+    return componentFind(components, cell->component);
+}
+
+/*
+ * componentsSeparate reports whether a and b are known to lie in different components, so that
+ * no path of edges can lead from one to the other.
+ */
+int componentsSeparate(Spreadsheet *spreadsheet, const Cell *a, const Cell *b) {
+    Components *components = componentsUsable(spreadsheet);
+    if (!components || a == b)
+        return 0;
+    // While the table is usable, every cell with an edge has an id.
+    if (!a->component || !b->component)
+        return 1;
+    return componentFind(components, a->component) != componentFind(components, b->component);
+}
+
+/*
+ * componentsLink records the edge from source to target; target lies on spreadsheet, source may
+ * lie on another sheet of its workbook.
+ */
+void componentsLink(Spreadsheet *spreadsheet, Cell *target, Cell *source) {
+    Components *components = componentsFor(spreadsheet);
+    if (!components)
+        return;
+    if (!target->component)
+        assignId(components, spreadsheet, target);
+    if (!source->component)
+        assignId(components, spreadsheet->workbook ? workbookOwner(spreadsheet, source) : spreadsheet, source);
+    unite(components, target->component, source->component);
+}
+
+/*
+ * componentsLinkRange records the range formula, a cell of spreadsheet, whose range lies on
+ * rangeSheet.
+ */
+void componentsLinkRange(Spreadsheet *spreadsheet, Cell *formula, const Spreadsheet *rangeSheet) {
+    Components *components = componentsFor(spreadsheet);
+    if (!components)
+        return;
+    if (!formula->component)
+        assignId(components, spreadsheet, formula);
+    unitePresentInRange(components, formula, rangeSheet);
+}
+
+/*
+ * componentsNoteRemoval counts an edge or range formula that went away, and marks the table
+ * for a rebuild once removals have piled up.
+ */
+void componentsNoteRemoval(Spreadsheet *spreadsheet) {
+    Components *components = componentsUsable(spreadsheet);
+    if (!components)
+        return;
+    components->removals++;
+    if (components->removals > COMPONENTS_REBUILD_MIN && components->removals > components->count)
+        components->stale = 1;
+}
+
+/*
+ * componentsInvalidate marks the table for a rebuild, e.g. after a sheet was replaced.
+ */
+void componentsInvalidate(Spreadsheet *spreadsheet) {
+    Components *components = homeSheet(spreadsheet)->components;
+    if (components)
+        components->stale = 1;
+}
+
+void freeComponents(Components *components) {
+    if (!components)
+        return;
+    memFree(MEM_EDGES, components->parent, components->capacity * sizeof(int));
+    memFree(MEM_EDGES, components->size, components->capacity * sizeof(int));
+    memFree(MEM_EDGES, components, sizeof(Components));
+}
@@ -0,0 +1,665 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include "csv.h"
+#include "render.h"
+#include "thread_pool.h"
+#include "avl_tree.h"
+#include "mem_track.h"
+#include "workbook.h"
+#include "value_plane.h"
+#include "journal.h"
+
+/*
+   ---------------- CSV import / export ----------------
+
+   Import maps the file, cuts it into chunks at line boundaries and parses the chunks on the
+   shared thread pool: a first pass counts lines so every chunk knows its starting row, a
+   second pass turns fields into literal or formula records.  The records are then applied in
+   file order with recalculation deferred, so the whole file costs one recalcAll instead of
+   one propagation per cell.  Export streams only populated cells through one large buffer.
+
+   While a journal is open, an import is journaled as the assignments it applied, not as
+   "import_csv <file>": recovery must not depend on the file still holding what it held, and
+   a partial import is replayed as exactly the part that was accepted.
+*/
+
+/*
+ * CsvField is one non-empty field: a literal value, or the formula text that follows '='
+ * (pointing into the mapped file).
+ */
+typedef struct {
+    int row;
+    int col;
+    int value;
+    const char *text;
+    int length;
+} CsvField;
+
+typedef struct {
+    const char *begin;
+    const char *end;
+    long firstRow;
+    long lines;
+    CsvField *fields;
+    long count;
+    long capacity;
+    long invalid;
+} CsvChunk;
+
+typedef struct {
+    Spreadsheet *spreadsheet;
+    CsvChunk *chunks;
+} CsvJob;
+
+// Longest formula text accepted; the command built from it must fit handleOperation's buffers.
+#define CSV_FORMULA_MAX 90
+
+static const char *const advancedNames[] = { "SUM", "MIN", "MAX", "AVG", "STDEV" };
+
+/*
+ * countLinesTask counts the line breaks in one chunk.
+ */
+static void countLinesTask(void *arg, long index) {
+    CsvChunk *chunk = &((CsvJob *) arg)->chunks[index];
+    long lines = 0;
+    const char *p = chunk->begin;
+    while (p < chunk->end && (p = memchr(p, '\n', chunk->end - p)) != NULL) {
+        lines++;
+        p++;
+    }
+    chunk->lines = lines;
+}
+
+static void pushField(CsvChunk *chunk, CsvField field) {
+    if (chunk->count == chunk->capacity) {
+        long capacity = chunk->capacity ? chunk->capacity * 2 : 1024;
+        chunk->fields = memRealloc(MEM_IO, chunk->fields, chunk->capacity * sizeof(CsvField),
+                                   capacity * sizeof(CsvField));
+        chunk->capacity = capacity;
+        if (!chunk->fields) {
+            perror("Failed to allocate CSV fields");
+            exit(EXIT_FAILURE);
+        }
+    }
+    chunk->fields[chunk->count++] = field;
+}
+
+/*
+ * parseLiteral parses an optionally signed decimal integer that spans the whole field.
+ */
+static int parseLiteral(const char *p, const char *end, int *value) {
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+    if (p == end)
+        return 0;
+    long long magnitude = 0;
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9')
+            return 0;
+        magnitude = magnitude * 10 + (*p - '0');
+        if (magnitude > (long long) INT_MAX + 1)
+            return 0;
+    }
+    if (!negative && magnitude > INT_MAX)
+        return 0;
+    *value = (int) (negative ? -magnitude : magnitude);
+    return 1;
+}
+
+/*
+ * parseChunkTask splits the lines of one chunk into fields and records every non-empty one.
+ * Fields outside the sheet and malformed fields are only counted.
+ */
+static void parseChunkTask(void *arg, long index) {
+    CsvJob *job = (CsvJob *) arg;
+    CsvChunk *chunk = &job->chunks[index];
+    int rows = job->spreadsheet->rows;
+    int cols = job->spreadsheet->cols;
+    long row = chunk->firstRow;
+    const char *p = chunk->begin;
+    while (p < chunk->end) {
+        const char *lineEnd = memchr(p, '\n', chunk->end - p);
+        if (!lineEnd)
+            lineEnd = chunk->end;
+        long col = 0;
+        while (1) {
+            const char *fieldEnd = memchr(p, ',', lineEnd - p);
+            if (!fieldEnd)
+                fieldEnd = lineEnd;
+            const char *a = p, *b = fieldEnd;
+            while (a < b && (*a == ' ' || *a == '\t'))
+                a++;
+            while (b > a && (b[-1] == ' ' || b[-1] == '\t' || b[-1] == '\r'))
+                b--;
+            if (b - a >= 2 && *a == '"' && b[-1] == '"') {
+                a++;
+                b--;
+            }
+            if (a < b) {
+                CsvField field = { (int) row, (int) col, 0, NULL, 0 };
+                if (row >= rows || col >= cols) {
+                    chunk->invalid++;
+                } else if (*a == '=') {
+                    if (b - a - 1 < 1 || b - a - 1 > CSV_FORMULA_MAX) {
+                        chunk->invalid++;
+                    } else {
+                        field.text = a + 1;
+                        field.length = (int) (b - a - 1);
+                        pushField(chunk, field);
+                    }
+                } else if (parseLiteral(a, b, &field.value)) {
+                    pushField(chunk, field);
+                } else {
+                    chunk->invalid++;
+                }
+            }
+            col++;
+            if (fieldEnd == lineEnd)
+                break;
+            p = fieldEnd + 1;
+        }
+        p = lineEnd + 1;
+        row++;
+    }
+}
+
+/*
+ * ImportLog collects the assignments an import applied, one per line, for a single journal
+ * append once the import is done.
+ */
+typedef struct {
+    char *buffer;
+    size_t used;
+    size_t capacity;
+} ImportLog;
+
+static void logAssignment(ImportLog *log, const char *command, size_t len) {
+    if (log->used + len + 2 > log->capacity) {
+        size_t capacity = log->capacity ? log->capacity : 4096;
+        while (log->used + len + 2 > capacity)
+            capacity *= 2;
+        log->buffer = memRealloc(MEM_IO, log->buffer, log->capacity, capacity);
+        if (!log->buffer) {
+            perror("Failed to grow import log");
+            exit(EXIT_FAILURE);
+        }
+        log->capacity = capacity;
+    }
+    if (log->used > 0)
+        log->buffer[log->used++] = '\n';
+    memcpy(log->buffer + log->used, command, len);
+    log->used += len;
+    log->buffer[log->used] = '\0';
+}
+
+/*
+ * importCsv loads a CSV file into the sheet.  Literals are stored directly; formulas go through
+ * handleOperation so they get the usual validation and cycle checks.  What was applied is
+ * journaled before it returns.  Returns -1 if the file cannot be read, otherwise 0 with the
+ * number of rejected fields in *rejected.
+ */
+int importCsv(Spreadsheet *spreadsheet, const char *path, long *rejected) {
+    *rejected = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t) st.st_size;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return -1;
+    madvise((void *) data, size, MADV_SEQUENTIAL);
+
+    long chunkCount = (long) ((size + CSV_CHUNK_BYTES - 1) / CSV_CHUNK_BYTES);
+    CsvChunk *chunks = memCalloc(MEM_IO, chunkCount, sizeof(CsvChunk));
+    if (!chunks) {
+        perror("Failed to allocate CSV chunks");
+        exit(EXIT_FAILURE);
+    }
+    const char *end = data + size;
+    const char *p = data;
+    for (long i = 0; i < chunkCount; i++) {
+        const char *cut = data + (size_t) ((double) size * (i + 1) / chunkCount);
+        if (cut < p)
+            cut = p;
+        if (i == chunkCount - 1) {
+            cut = end;
+        } else {
+            const char *newline = memchr(cut, '\n', end - cut);
+            cut = newline ? newline + 1 : end;
+        }
+        chunks[i].begin = p;
+        chunks[i].end = cut;
+        p = cut;
+    }
+
+    CsvJob job = { spreadsheet, chunks };
+    ThreadPool *pool = sharedThreadPool();
+    threadPoolRun(pool, chunkCount, countLinesTask, &job);
+    long row = 0;
+    for (long i = 0; i < chunkCount; i++) {
+        chunks[i].firstRow = row;
+        row += chunks[i].lines;
+    }
+    threadPoolRun(pool, chunkCount, parseChunkTask, &job);
+
+    int savedQuiet = spreadsheet->quiet;
+    int savedDefer = spreadsheet->deferRecalc;
+    long savedRejected = spreadsheet->rejectedCount;
+    spreadsheet->quiet = 1;
+    spreadsheet->deferRecalc = 1;
+    char command[128];
+    ImportLog log = { NULL, 0, 0 };
+    for (long i = 0; i < chunkCount; i++) {
+        *rejected += chunks[i].invalid;
+        for (long j = 0; j < chunks[i].count; j++) {
+            CsvField *field = &chunks[i].fields[j];
+            Cell *cell = sheetCell(spreadsheet, field->row, field->col);
+            getColumnLabel(field->col, command);
+            int len = (int) strlen(command);
+            len += formatInt(command + len, field->row + 1);
+            command[len++] = '=';
+            if (!field->text) {
+                setCellLiteral(spreadsheet, cell, field->value);
+                if (spreadsheet->journal)
+                    logAssignment(&log, command, (size_t) (len + formatInt(command + len, field->value)));
+                continue;
+            }
+            memcpy(command + len, field->text, field->length);
+            command[len + field->length] = '\0';
+            long before = spreadsheet->rejectedCount;
+            handleOperation(command, spreadsheet, monotonicSeconds());
+            *rejected += spreadsheet->rejectedCount - before;
+            if (spreadsheet->journal && spreadsheet->rejectedCount == before)
+                logAssignment(&log, command, (size_t) (len + field->length));
+        }
+        memFree(MEM_IO, chunks[i].fields, chunks[i].capacity * sizeof(CsvField));
+    }
+    if (log.used > 0)
+        journalAppend(spreadsheet->journal, log.buffer);
+    memFree(MEM_IO, log.buffer, log.capacity);
+    memFree(MEM_IO, chunks, chunkCount * sizeof(CsvChunk));
+    munmap((void *) data, size);
+
+    spreadsheet->rejectedCount = savedRejected;
+    spreadsheet->quiet = savedQuiet;
+    spreadsheet->deferRecalc = savedDefer;
+    if (!savedDefer)
+        recalcAll(spreadsheet);
+    tileStoreMarkCold(&spreadsheet->store);
+    return 0;
+}
+
+/*
+   ---------------- Export ----------------
+*/
+
+typedef struct {
+    int fd;
+    char *buffer;
+    size_t used;
+    int failed;
+} CsvWriter;
+
+static void flushWriter(CsvWriter *writer) {
+    size_t done = 0;
+    while (done < writer->used && !writer->failed) {
+        ssize_t n = write(writer->fd, writer->buffer + done, writer->used - done);
+        if (n < 0)
+            writer->failed = 1;
+        else
+            done += (size_t) n;
+    }
+    writer->used = 0;
+}
+
+/*
+ * reserve makes room for len more bytes and returns where they go.
+ */
+static char *reserve(CsvWriter *writer, size_t len) {
+    if (writer->used + len > CSV_WRITE_BUFFER)
+        flushWriter(writer);
+    return writer->buffer + writer->used;
+}
+
+static void putChar(CsvWriter *writer, char ch) {
+    *reserve(writer, 1) = ch;
+    writer->used++;
+}
+
+/*
+ * isPopulated reports whether a cell differs from a freshly initialized one.
+ */
+static int isPopulated(const Cell *cell) {
+    return cell->value != 0 || cell->error || cell->op != OP_NONE || cell->dependencies != NULL;
+}
+
+/*
+ * writeRef writes a cell reference, prefixed with "Name!" when sheet is not the one being exported.
+ * row and col are logical.
+ */
+static char *writeRef(char *p, const Spreadsheet *exported, const Spreadsheet *sheet, int row, int col) {
+    if (sheet && sheet != exported) {
+        size_t nameLen = strlen(sheet->name);
+        memcpy(p, sheet->name, nameLen);
+        p += nameLen;
+        *p++ = '!';
+    }
+    char label[4];
+    getColumnLabel(col, label);
+    size_t len = strlen(label);
+    memcpy(p, label, len);
+    p += len;
+    return p + formatInt(p, row + 1);
+}
+
+/*
+ * writeCellRef writes a reference to ref, wherever it lies in the workbook.
+ */
+static char *writeCellRef(char *p, Spreadsheet *exported, const Cell *ref) {
+    const Spreadsheet *owner = workbookOwner(exported, ref);
+    return writeRef(p, exported, owner, sheetLogicalRow(owner, ref->selfRow), sheetLogicalCol(owner, ref->selfCol));
+}
+
+static char *writeOperand(char *p, Spreadsheet *exported, int isLiteral, int literal, const Cell *ref) {
+    if (isLiteral || !ref)
+        return p + formatInt(p, literal);
+    return writeCellRef(p, exported, ref);
+}
+
+/*
+ * writeCell writes one field: the formula (as typed after "A1=") or the literal value.
+ */
+static char *writeCell(char *p, Spreadsheet *exported, const Cell *cell) {
+    if (cell->op == OP_NONE && !cell->dependencies) {
+        if (cell->error) {
+            memcpy(p, "ERR", 3);
+            return p + 3;
+        }
+        return p + formatInt(p, cell->value);
+    }
+    *p++ = '=';
+    if (cell->op >= OP_ADV_SUM && cell->op <= OP_ADV_STDEV) {
+        const char *name = advancedNames[cell->op - OP_ADV_SUM];
+        size_t len = strlen(name);
+        memcpy(p, name, len);
+        p += len;
+        *p++ = '(';
+        p = writeRef(p, exported, cell->rangeSheet, cell->row1, cell->col1);
+        *p++ = ':';
+        p = writeRef(p, exported, NULL, cell->row2, cell->col2);
+        *p++ = ')';
+    } else if (cell->op == OP_SLEEP) {
+        memcpy(p, "SLEEP(", 6);
+        p += 6;
+        if (cell->dependencies)
+            p = writeCellRef(p, exported, cell->dependencies->cell);
+        else
+            p += formatInt(p, cell->value);
+        *p++ = ')';
+    } else if (cell->op == OP_NONE) {
+        p = writeOperand(p, exported, 0, 0, cell->operand1);
+    } else {
+        static const char opChars[] = { 0, '+', '-', '*', '/' };
+        p = writeOperand(p, exported, cell->operand1IsLiteral, cell->operand1Literal, cell->operand1);
+        *p++ = opChars[cell->op];
+        p = writeOperand(p, exported, cell->operand2IsLiteral, cell->operand2Literal, cell->operand2);
+    }
+    return p;
+}
+
+/*
+ * lastPopulatedCol returns the last populated column of a logical row, or -1 if the row is
+ * empty.  Only materialized tiles are looked at, right to left; once columns have been
+ * inserted or deleted the physical order is not the logical one, so every tile is.
+ */
+static int lastPopulatedCol(const Spreadsheet *spreadsheet, int row) {
+    const TileStore *store = &spreadsheet->store;
+    row = sheetPhysicalRow(spreadsheet, row);
+    int band = row >> TILE_ROW_BITS;
+    if (!store->bands[band])
+        return -1;
+    int last = -1;
+    for (int t = store->tilesPerBand - 1; t >= 0; t--) {
+        Tile *tile = store->bands[band][t];
+        if (!tile)
+            continue;
+        long index = tileCellIndex(tile, row, tile->col0);
+        if (!tile->packed)
+            tileStoreUse(store, tile);
+        for (int c = tile->cols - 1; c >= 0; c--) {
+            if (tile->packed ? tilePackedValue(tile, index + c) != 0 : isPopulated(&tile->cells[index + c])) {
+                int col = sheetLogicalCol(spreadsheet, tile->col0 + c);
+                if (!spreadsheet->colMap)
+                    return col;
+                if (col > last)
+                    last = col;
+            }
+        }
+    }
+    return last;
+}
+
+// Upper bound on one written field plus its separator.
+#define CSV_FIELD_MAX 96
+
+/*
+ * beginExport opens a temporary file next to path for writer.  Returns the temporary name,
+ * or NULL if it cannot be created.
+ */
+static char *beginExport(CsvWriter *writer, const char *path) {
+    size_t pathLen = strlen(path);
+    char *tmpPath = malloc(pathLen + 5);
+    if (!tmpPath) {
+        perror("Failed to allocate path");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(tmpPath, path, pathLen);
+    memcpy(tmpPath + pathLen, ".tmp", 5);
+    writer->fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    writer->used = 0;
+    writer->failed = 0;
+    if (writer->fd < 0) {
+        free(tmpPath);
+        return NULL;
+    }
+    writer->buffer = memAlloc(MEM_IO, CSV_WRITE_BUFFER);
+    if (!writer->buffer) {
+        perror("Failed to allocate CSV buffer");
+        exit(EXIT_FAILURE);
+    }
+    return tmpPath;
+}
+
+/*
+ * finishExport flushes and syncs the file and renames it into place.  Returns 0 on success, -1
+ * on failure.
+ */
+static int finishExport(CsvWriter *writer, const char *path, char *tmpPath) {
+    flushWriter(writer);
+    memFree(MEM_IO, writer->buffer, CSV_WRITE_BUFFER);
+    if (fsync(writer->fd) != 0)
+        writer->failed = 1;
+    if (close(writer->fd) != 0)
+        writer->failed = 1;
+    if (writer->failed || rename(tmpPath, path) != 0) {
+        unlink(tmpPath);
+        free(tmpPath);
+        return -1;
+    }
+    free(tmpPath);
+    return 0;
+}
+
+/*
+ * lastPublishedCol is lastPopulatedCol for a published version.
+ */
+static int lastPublishedCol(const PlaneVersion *version, int row) {
+    row = indexMapPhysical(version->rowMap, row);
+    TileValues **band = version->bands[row >> TILE_ROW_BITS];
+    if (!band)
+        return -1;
+    int last = -1;
+    for (int t = version->tilesPerBand - 1; t >= 0; t--) {
+        const TileValues *tile = band[t];
+        if (!tile)
+            continue;
+        const CellValue *cells = &tile->cells[(row - tile->row0) * tile->cols];
+        for (int c = tile->cols - 1; c >= 0; c--) {
+            if (cells[c].value != 0 || cells[c].flags) {
+                int col = indexMapLogical(version->colMap, tile->col0 + c);
+                if (!version->colMap)
+                    return col;
+                if (col > last)
+                    last = col;
+            }
+        }
+    }
+    return last;
+}
+
+/*
+ * exportView writes the values of a published version, laid out as exportCsv does.  It reads
+ * only the view, so it may run on any thread while the engine keeps working.
+ */
+static int exportView(const SheetView *view, const char *path) {
+    CsvWriter writer;
+    char *tmpPath = beginExport(&writer, path);
+    if (!tmpPath)
+        return -1;
+    long pendingLines = 0;
+    for (int r = 0; r < view->version->rows && !writer.failed; r++) {
+        int last = lastPublishedCol(view->version, r);
+        if (last < 0) {
+            pendingLines++;
+            continue;
+        }
+        for (; pendingLines > 0; pendingLines--)
+            putChar(&writer, '\n');
+        for (int c = 0; c <= last; c++) {
+            char *p = reserve(&writer, CSV_FIELD_MAX);
+            char *start = p;
+            if (c > 0)
+                *p++ = ',';
+            CellValue cell = viewCell(view, r, c);
+            if (cell.flags & VALUE_ERROR) {
+                memcpy(p, "ERR", 3);
+                p += 3;
+            } else if (cell.value != 0 || cell.flags) {
+                p += formatInt(p, cell.value);
+            }
+            writer.used += p - start;
+        }
+        putChar(&writer, '\n');
+    }
+    return finishExport(&writer, path, tmpPath);
+}
+
+/*
+ * exportCsv writes the sheet as CSV: rows after the last populated one and empty cells after the
+ * last populated cell of each row are left out.  The file is written under a temporary name and
+ * renamed into place.  Values-only exports read the published values (see value_plane.h).
+ * Returns 0 on success, -1 on failure.
+ */
+int exportCsv(Spreadsheet *spreadsheet, const char *path, int valuesOnly) {
+    if (valuesOnly) {
+        SheetView view;
+        publishValues(spreadsheet);
+        openView(spreadsheet->plane, &view);
+        int result = exportView(&view, path);
+        closeView(&view);
+        return result;
+    }
+    CsvWriter writer;
+    char *tmpPath = beginExport(&writer, path);
+    if (!tmpPath)
+        return -1;
+    long pendingLines = 0;
+    for (int r = 0; r < spreadsheet->rows && !writer.failed; r++) {
+        int last = lastPopulatedCol(spreadsheet, r);
+        if (last < 0) {
+            pendingLines++;
+            continue;
+        }
+        for (; pendingLines > 0; pendingLines--)
+            putChar(&writer, '\n');
+        for (int c = 0; c <= last; c++) {
+            char *p = reserve(&writer, CSV_FIELD_MAX);
+            char *start = p;
+            if (c > 0)
+                *p++ = ',';
+            int row = sheetPhysicalRow(spreadsheet, r), col = sheetPhysicalCol(spreadsheet, c);
+            const Tile *tile = tileStoreTile(&spreadsheet->store, row >> TILE_ROW_BITS, col >> TILE_COL_BITS);
+            if (tile && tile->packed) {
+                int value = tilePackedValue(tile, tileCellIndex(tile, row, col));
+                if (value != 0)
+                    p += formatInt(p, value);
+            } else {
+                const Cell *cell = sheetPeek(spreadsheet, r, c);
+                if (cell && isPopulated(cell))
+                    p = writeCell(p, spreadsheet, cell);
+            }
+            writer.used += p - start;
+        }
+        putChar(&writer, '\n');
+    }
+    return finishExport(&writer, path, tmpPath);
+}
+
+typedef struct {
+    SheetView view;
+    char *path;
+} ExportJob;
+
+static void *exportJobMain(void *arg) {
+    ExportJob *job = (ExportJob *) arg;
+    if (exportView(&job->view, job->path) != 0)
+        fprintf(stderr, "[export] could not write %s\n", job->path);
+    closeView(&job->view);
+    free(job->path);
+    memFree(MEM_IO, job, sizeof(ExportJob));
+    return NULL;
+}
+
+/*
+ * exportCsvAsync writes the values the sheet has now to path on a background thread and
+ * returns at once.  Commands that follow do not show up in the file.  Failures of the
+ * background write are reported on stderr.  Returns -1 if the thread cannot be started.
+ */
+int exportCsvAsync(Spreadsheet *spreadsheet, const char *path) {
+    ExportJob *job = memAlloc(MEM_IO, sizeof(ExportJob));
+    if (!job || !(job->path = strdup(path))) {
+        perror("Failed to allocate export job");
+        exit(EXIT_FAILURE);
+    }
+    publishValues(spreadsheet);
+    openView(spreadsheet->plane, &job->view);
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, exportJobMain, job) != 0) {
+        closeView(&job->view);
+        free(job->path);
+        memFree(MEM_IO, job, sizeof(ExportJob));
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
@@ -0,0 +1,149 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "index_map.h"
+#include "mem_track.h"
+
+/*
+   ---------------- Index maps ----------------
+
+   Every change builds the runs of the new map in a scratch array, merging neighbours that
+   continue each other, and then allocates the map at its final size.  Structural edits are
+   rare next to lookups, so nothing is spent on making them cheaper than O(runs).
+*/
+
+static int compare_physical(const void *a, const void *b) {
+    int x = ((const IndexRun *) a)->physical, y = ((const IndexRun *) b)->physical;
+    return (x > y) - (x < y);
+}
+
+/*
+ * buildMap returns the map made of count runs in logical order (inverse filled in here), or
+ * NULL if they are the identity.
+ */
+static IndexMap *buildMap(const IndexRun *runs, int count, int size, int tag) {
+    if (count == 1 && runs[0].physical == 0)
+        return NULL;
+    IndexMap *map = memAlloc(tag, sizeof(IndexMap) + 2 * (size_t) count * sizeof(IndexRun));
+    if (!map) {
+        perror("Failed to allocate index map");
+        exit(EXIT_FAILURE);
+    }
+    map->size = size;
+    map->count = count;
+    map->runs = (IndexRun *) (map + 1);
+    map->inverse = map->runs + count;
+    memcpy(map->runs, runs, count * sizeof(IndexRun));
+    memcpy(map->inverse, runs, count * sizeof(IndexRun));
+    qsort(map->inverse, count, sizeof(IndexRun), compare_physical);
+    return map;
+}
+
+/*
+ * appendRun adds a run at the end of runs, extending the last one if it continues it.
+ */
+static void appendRun(IndexRun *runs, int *count, int logical, int physical, int length) {
+    IndexRun *last = *count > 0 ? &runs[*count - 1] : NULL;
+    if (last && last->logical + last->length == logical && last->physical + last->length == physical) {
+        last->length += length;
+        return;
+    }
+    IndexRun run = { logical, physical, length };
+    runs[(*count)++] = run;
+}
+
+/*
+ * appendPiece appends the runs of map for logical indices from..to-1, renumbered to start at
+ * logical index at.
+ */
+static void appendPiece(const IndexMap *map, int from, int to, int at, IndexRun *runs, int *count) {
+    while (from < to) {
+        int physical;
+        int span = indexMapSpan(map, from, to - 1, &physical);
+        appendRun(runs, count, at, physical, span);
+        from += span;
+        at += span;
+    }
+}
+
+/*
+ * indexMapRotate returns map (of size indices; NULL for the identity) with the logical indices
+ * first..last-1 rotated so that middle comes first, as std::rotate does: inserting k rows at
+ * r is a rotation of r..size-1 that brings the last k rows to r, and deleting k rows at r one
+ * that sends rows r..r+k-1 to the end.  map itself is freed.
+ */
+IndexMap *indexMapRotate(IndexMap *map, int size, int first, int middle, int last, int tag) {
+    int capacity = (map ? map->count : 1) + 4;
+    IndexRun *runs = memAlloc(tag, capacity * sizeof(IndexRun));
+    if (!runs) {
+        perror("Failed to allocate index runs");
+        exit(EXIT_FAILURE);
+    }
+    int count = 0;
+    appendPiece(map, 0, first, 0, runs, &count);
+    appendPiece(map, middle, last, first, runs, &count);
+    appendPiece(map, first, middle, first + (last - middle), runs, &count);
+    appendPiece(map, last, size, last, runs, &count);
+    IndexMap *rotated = buildMap(runs, count, size, tag);
+    memFree(tag, runs, capacity * sizeof(IndexRun));
+    indexMapFree(map, tag);
+    return rotated;
+}
+
+/*
+ * indexMapCopy returns a copy of map charged to tag.
+ */
+IndexMap *indexMapCopy(const IndexMap *map, int tag) {
+    return map ? buildMap(map->runs, map->count, map->size, tag) : NULL;
+}
+
+/*
+ * indexMapRestore sets *out to the map of size indices made of count runs in logical order,
+ * e.g. read back from a snapshot.  It returns -1, leaving *out alone, unless the runs are
+ * non-empty, follow each other from 0 to size-1 and together hit every physical index once.
+ */
+int indexMapRestore(IndexMap **out, const IndexRun *runs, int count, int size, int tag) {
+    if (count < 1 || count > size)
+        return -1;
+    int next = 0;
+    for (int i = 0; i < count; i++) {
+        if (runs[i].logical != next || runs[i].length < 1 || runs[i].length > size - next ||
+            runs[i].physical < 0 || runs[i].physical > size - runs[i].length)
+            return -1;
+        next += runs[i].length;
+    }
+    if (next != size)
+        return -1;
+    IndexRun *sorted = memAlloc(tag, count * sizeof(IndexRun));
+    if (!sorted) {
+        perror("Failed to allocate index runs");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(sorted, runs, count * sizeof(IndexRun));
+    qsort(sorted, count, sizeof(IndexRun), compare_physical);
+    int valid = 1;
+    for (int i = 0, at = 0; i < count; i++) {
+        valid &= sorted[i].physical == at;
+        at += sorted[i].length;
+    }
+    memFree(tag, sorted, count * sizeof(IndexRun));
+    if (!valid)
+        return -1;
+    // Rebuilt run by run, so that runs written unmerged still give the canonical map.
+    IndexRun *merged = memAlloc(tag, count * sizeof(IndexRun));
+    if (!merged) {
+        perror("Failed to allocate index runs");
+        exit(EXIT_FAILURE);
+    }
+    int mergedCount = 0;
+    for (int i = 0; i < count; i++)
+        appendRun(merged, &mergedCount, runs[i].logical, runs[i].physical, runs[i].length);
+    *out = buildMap(merged, mergedCount, size, tag);
+    memFree(tag, merged, count * sizeof(IndexRun));
+    return 0;
+}
+
+void indexMapFree(IndexMap *map, int tag) {
+    if (map)
+        memFree(tag, map, indexMapBytes(map));
+}
@@ -0,0 +1,516 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include "ingest.h"
+#include "workbook.h"
+#include "mem_track.h"
+
+/*
+   ---------------- Streaming ingest ----------------
+
+   The ingest owns an epoll set of its own (listener or FIFO, producers, tick timer), which the
+   server loop polls like any other descriptor and drains with ingestPoll.  Of the two batches,
+   one fills while the other is with the writer.  A key packs the sheet index (0 for the home
+   sheet, otherwise index into names + 1), the row and the column.  Buffers are accounted under
+   MEM_IO.
+*/
+
+#define INGEST_MIN_CAPACITY 1024
+#define INGEST_EVENTS       64
+#define KEY_COL_BITS        15
+#define KEY_ROW_BITS        20
+
+static uint64_t packKey(int sheet, int row, int col) {
+    return (((uint64_t) sheet << (KEY_ROW_BITS + KEY_COL_BITS)) | ((uint64_t) row << KEY_COL_BITS) | (uint64_t) col) + 1;
+}
+
+static void unpackKey(uint64_t key, int *sheet, int *row, int *col) {
+    key--;
+    *col = (int) (key & ((1u << KEY_COL_BITS) - 1));
+    *row = (int) ((key >> KEY_COL_BITS) & ((1u << KEY_ROW_BITS) - 1));
+    *sheet = (int) (key >> (KEY_ROW_BITS + KEY_COL_BITS));
+}
+
+static long slotOf(uint64_t key, long capacity) {
+    return (long) ((key * 0x9E3779B97F4A7C15ULL) >> 32) & (capacity - 1);
+}
+
+/*
+   ---------------- Coalescing ----------------
+*/
+
+static void growBatch(IngestBatch *batch) {
+    long capacity = batch->capacity ? batch->capacity * 2 : INGEST_MIN_CAPACITY;
+    IngestEntry *entries = memCalloc(MEM_IO, capacity, sizeof(IngestEntry));
+    if (!entries) {
+        perror("Failed to grow ingest batch");
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < batch->capacity; i++) {
+        if (!batch->entries[i].key)
+            continue;
+        long slot = slotOf(batch->entries[i].key, capacity);
+        while (entries[slot].key)
+            slot = (slot + 1) & (capacity - 1);
+        entries[slot] = batch->entries[i];
+    }
+    memFree(MEM_IO, batch->entries, batch->capacity * sizeof(IngestEntry));
+    batch->entries = entries;
+    batch->capacity = capacity;
+}
+
+/*
+ * coalesce stores value for key, replacing what the batch held for the same cell.  Returns 1
+ * if it replaced an update.
+ */
+static int coalesce(IngestBatch *batch, uint64_t key, int value) {
+    if ((batch->count + 1) * 2 > batch->capacity)
+        growBatch(batch);
+    long slot = slotOf(key, batch->capacity);
+    while (batch->entries[slot].key && batch->entries[slot].key != key)
+        slot = (slot + 1) & (batch->capacity - 1);
+    IngestEntry *entry = &batch->entries[slot];
+    entry->value = value;
+    if (entry->key)
+        return 1;
+    entry->key = key;
+    batch->count++;
+    return 0;
+}
+
+static void clearBatch(IngestBatch *batch) {
+    if (batch->count > 0)
+        memset(batch->entries, 0, batch->capacity * sizeof(IngestEntry));
+    batch->count = 0;
+    batch->rejected = 0;
+    batch->applySeconds = 0;
+}
+
+static void freeBatch(IngestBatch *batch) {
+    memFree(MEM_IO, batch->entries, batch->capacity * sizeof(IngestEntry));
+    memFree(MEM_IO, batch->updates, batch->updatesCapacity * sizeof(SheetUpdate));
+}
+
+/*
+ * sheetIndex returns the key index of a sheet name (length bytes), adding it on first use, or
+ * -1 if the name is invalid or the table is full.
+ */
+static int sheetIndex(Ingest *ingest, const char *name, size_t length) {
+    char copy[SHEET_NAME_MAX];
+    if (length >= sizeof(copy))
+        return -1;
+    memcpy(copy, name, length);
+    copy[length] = '\0';
+    for (int i = 0; i < ingest->nameCount; i++) {
+        if (strcmp(ingest->names[i], copy) == 0)
+            return i + 1;
+    }
+    if (!validSheetName(copy) || ingest->nameCount == INGEST_MAX_SHEETS)
+        return -1;
+    strcpy(ingest->names[ingest->nameCount++], copy);
+    return ingest->nameCount;
+}
+
+/*
+ * parseUpdate reads "[Sheet!]Cell=value" into a key and a value.  The sheet itself and the
+ * bounds of the cell are checked by the writer, which owns the workbook.
+ */
+static int parseUpdate(Ingest *ingest, const char *line, size_t length, uint64_t *key, int *value) {
+    const char *equals = memchr(line, '=', length);
+    if (!equals)
+        return -1;
+    const char *ref = line;
+    int sheet = 0;
+    const char *bang = memchr(line, '!', equals - line);
+    if (bang) {
+        sheet = sheetIndex(ingest, line, bang - line);
+        if (sheet < 0)
+            return -1;
+        ref = bang + 1;
+    }
+    char cellRef[16];
+    size_t refLength = equals - ref;
+    if (refLength == 0 || refLength >= sizeof(cellRef))
+        return -1;
+    memcpy(cellRef, ref, refLength);
+    cellRef[refLength] = '\0';
+    int row, col;
+    if (parseCellReference(cellRef, &row, &col) != 0 || row >= SHEET_MAX_ROWS || col >= SHEET_MAX_COLS)
+        return -1;
+
+    char number[16];
+    size_t numberLength = line + length - (equals + 1);
+    if (numberLength == 0 || numberLength >= sizeof(number))
+        return -1;
+    memcpy(number, equals + 1, numberLength);
+    number[numberLength] = '\0';
+    char *end;
+    errno = 0;
+    long parsed = strtol(number, &end, 10);
+    if (*end != '\0' || errno != 0 || parsed < INT_MIN || parsed > INT_MAX)
+        return -1;
+    *key = packKey(sheet, row, col);
+    *value = (int) parsed;
+    return 0;
+}
+
+static void addLine(Ingest *ingest, const char *line, size_t length) {
+    if (length > 0 && line[length - 1] == '\r')
+        length--;
+    if (length == 0)
+        return;
+    uint64_t key;
+    int value;
+    ingest->stats.lines++;
+    if (parseUpdate(ingest, line, length, &key, &value) != 0) {
+        ingest->stats.malformed++;
+        return;
+    }
+    IngestBatch *batch = &ingest->batches[ingest->filling];
+    if (batch->count == 0) {
+        // The tick starts with its first update.
+        struct itimerspec tick = { .it_value = { ingest->tickMillis / 1000, (ingest->tickMillis % 1000) * 1000000L } };
+        batch->firstArrival = monotonicSeconds();
+        timerfd_settime(ingest->timerFd, 0, &tick, NULL);
+    }
+    if (coalesce(batch, key, value))
+        ingest->stats.coalesced++;
+}
+
+/*
+   ---------------- Producers ----------------
+*/
+
+static void setProducerEvents(Ingest *ingest, IngestProducer *producer) {
+    struct epoll_event event = { .events = ingest->paused ? 0 : EPOLLIN, .data.ptr = producer };
+    epoll_ctl(ingest->epollFd, EPOLL_CTL_MOD, producer->fd, &event);
+}
+
+/*
+ * setPaused stops or resumes reading every producer.
+ */
+static void setPaused(Ingest *ingest, int paused) {
+    if (ingest->paused == paused)
+        return;
+    ingest->paused = paused;
+    if (paused)
+        ingest->stats.pauses++;
+    for (IngestProducer *producer = ingest->producers; producer; producer = producer->next)
+        setProducerEvents(ingest, producer);
+}
+
+static IngestProducer *addProducer(Ingest *ingest, int fd) {
+    IngestProducer *producer = memCalloc(MEM_IO, 1, sizeof(IngestProducer));
+    if (!producer) {
+        perror("Failed to allocate ingest producer");
+        exit(EXIT_FAILURE);
+    }
+    producer->fd = fd;
+    struct epoll_event event = { .events = ingest->paused ? 0 : EPOLLIN, .data.ptr = producer };
+    if (epoll_ctl(ingest->epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        memFree(MEM_IO, producer, sizeof(IngestProducer));
+        return NULL;
+    }
+    producer->next = ingest->producers;
+    if (producer->next)
+        producer->next->prev = producer;
+    ingest->producers = producer;
+    ingest->producerCount++;
+    return producer;
+}
+
+static void closeProducer(Ingest *ingest, IngestProducer *producer) {
+    epoll_ctl(ingest->epollFd, EPOLL_CTL_DEL, producer->fd, NULL);
+    close(producer->fd);
+    if (producer->prev)
+        producer->prev->next = producer->next;
+    else
+        ingest->producers = producer->next;
+    if (producer->next)
+        producer->next->prev = producer->prev;
+    ingest->producerCount--;
+    memFree(MEM_IO, producer, sizeof(IngestProducer));
+}
+
+/*
+ * readProducer reads one buffer's worth and coalesces the complete lines in it.  A producer
+ * that is ready again is reported again by the level-triggered set, so one busy feed cannot
+ * starve the others or the rest of the server loop.
+ */
+static void readProducer(Ingest *ingest, IngestProducer *producer) {
+    ssize_t n = read(producer->fd, producer->in + producer->inUsed, sizeof(producer->in) - producer->inUsed);
+    if (n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    if (n <= 0) {
+        closeProducer(ingest, producer);
+        return;
+    }
+    producer->inUsed += (size_t) n;
+    char *line = producer->in, *end = producer->in + producer->inUsed, *newline;
+    while ((newline = memchr(line, '\n', end - line)) != NULL) {
+        size_t length = newline - line;
+        if (producer->discarding)
+            producer->discarding = 0;
+        else if (length > INGEST_MAX_LINE) {
+            ingest->stats.lines++;
+            ingest->stats.malformed++;
+        } else
+            addLine(ingest, line, length);
+        line = newline + 1;
+    }
+    size_t rest = end - line;
+    if (rest > INGEST_MAX_LINE && !producer->discarding) {
+        ingest->stats.lines++;
+        ingest->stats.malformed++;
+        producer->discarding = 1;
+    }
+    if (producer->discarding)
+        rest = 0;
+    memmove(producer->in, line, rest);
+    producer->inUsed = rest;
+    // Past the limit only the lines already read are taken; the rest waits in the kernel.
+    if (ingest->batches[ingest->filling].count >= INGEST_MAX_PENDING)
+        setPaused(ingest, 1);
+}
+
+static void acceptProducers(Ingest *ingest) {
+    for (;;) {
+        int fd = accept(ingest->listenFd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("accept");
+            return;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        if (!addProducer(ingest, fd))
+            close(fd);
+    }
+}
+
+/*
+   ---------------- Ticks ----------------
+*/
+
+/*
+ * handOver gives the filling batch to the writer and starts filling the other one.
+ */
+static IngestBatch *handOver(Ingest *ingest) {
+    IngestBatch *batch = &ingest->batches[ingest->filling];
+    ingest->filling ^= 1;
+    ingest->inFlight = 1;
+    ingest->due = 0;
+    if (batch->count > ingest->stats.maxBatch)
+        ingest->stats.maxBatch = batch->count;
+    setPaused(ingest, 0);
+    return batch;
+}
+
+static IngestBatch *endTick(Ingest *ingest) {
+    uint64_t expirations;
+    if (read(ingest->timerFd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        perror("Failed to read ingest timer");
+    if (ingest->batches[ingest->filling].count == 0)
+        return NULL;
+    if (ingest->inFlight) {
+        ingest->stats.lagged++;
+        ingest->due = 1;
+        return NULL;
+    }
+    return handOver(ingest);
+}
+
+/*
+ * ingestPoll handles whatever is ready in the ingest's epoll set.  It returns a batch to run on
+ * the writer thread when a tick has ended, or NULL.
+ */
+IngestBatch *ingestPoll(Ingest *ingest) {
+    struct epoll_event events[INGEST_EVENTS];
+    IngestBatch *ready = NULL;
+    int count = epoll_wait(ingest->epollFd, events, INGEST_EVENTS, 0);
+    for (int i = 0; i < count; i++) {
+        void *token = events[i].data.ptr;
+        if (token == &ingest->listenFd)
+            acceptProducers(ingest);
+        else if (token == &ingest->timerFd)
+            ready = endTick(ingest);
+        else
+            readProducer(ingest, (IngestProducer *) token);
+    }
+    return ready;
+}
+
+/*
+ * ingestApply writes a batch to the workbook of home on the writer thread, one sheet_apply_batch
+ * per sheet named in it.  Publication is left to the caller, which runs it with deferPublish set.
+ */
+void ingestApply(Ingest *ingest, IngestBatch *batch, Spreadsheet *home) {
+    double start = monotonicSeconds();
+    if (batch->updatesCapacity < batch->count) {
+        memFree(MEM_IO, batch->updates, batch->updatesCapacity * sizeof(SheetUpdate));
+        batch->updates = memAlloc(MEM_IO, batch->count * sizeof(SheetUpdate));
+        if (!batch->updates) {
+            perror("Failed to allocate ingest updates");
+            exit(EXIT_FAILURE);
+        }
+        batch->updatesCapacity = batch->count;
+    }
+    // Lines name few sheets, so each is gathered by its own pass over the entries.
+    long remaining = batch->count;
+    for (int index = 0; remaining > 0; index++) {
+        long count = 0;
+        for (long i = 0; i < batch->capacity; i++) {
+            int sheetIndex, row, col;
+            if (!batch->entries[i].key)
+                continue;
+            unpackKey(batch->entries[i].key, &sheetIndex, &row, &col);
+            if (sheetIndex != index)
+                continue;
+            SheetUpdate *update = &batch->updates[count++];
+            update->row = row;
+            update->col = col;
+            update->formula = NULL;
+            update->value = batch->entries[i].value;
+        }
+        if (count == 0)
+            continue;
+        remaining -= count;
+        const char *name = index > 0 ? ingest->names[index - 1] : NULL;
+        Spreadsheet *sheet = name ? workbookFindSheet(home, name, strlen(name)) : home;
+        batch->rejected += sheet ? sheet_apply_batch(sheet, batch->updates, count, NULL) : count;
+    }
+    batch->applySeconds = monotonicSeconds() - start;
+}
+
+/*
+ * ingestApplied takes a batch back from the writer once it has been published.  If a tick
+ * ended meanwhile, the next batch is returned to be handed over at once.
+ */
+IngestBatch *ingestApplied(Ingest *ingest, IngestBatch *batch) {
+    IngestStats *stats = &ingest->stats;
+    double delay = monotonicSeconds() - batch->firstArrival;
+    stats->ticks++;
+    stats->applied += batch->count - batch->rejected;
+    stats->rejected += batch->rejected;
+    stats->applySeconds += batch->applySeconds;
+    stats->lastDelay = delay;
+    if (delay > stats->maxDelay)
+        stats->maxDelay = delay;
+    clearBatch(batch);
+    ingest->inFlight = 0;
+    if (ingest->due && ingest->batches[ingest->filling].count > 0)
+        return handOver(ingest);
+    return NULL;
+}
+
+int formatIngestStats(const Ingest *ingest, char *buffer, size_t size) {
+    const IngestStats *stats = &ingest->stats;
+    return snprintf(buffer, size,
+                    "ok lines=%lu malformed=%lu coalesced=%lu applied=%lu rejected=%lu ticks=%lu "
+                    "lagged=%lu pauses=%lu pending=%ld producers=%d max_batch=%ld apply_ms=%.1f "
+                    "last_delay_ms=%.1f max_delay_ms=%.1f",
+                    stats->lines, stats->malformed, stats->coalesced, stats->applied, stats->rejected,
+                    stats->ticks, stats->lagged, stats->pauses, ingest->batches[ingest->filling].count,
+                    ingest->producerCount, stats->maxBatch, stats->applySeconds * 1000.0,
+                    stats->lastDelay * 1000.0, stats->maxDelay * 1000.0);
+}
+
+/*
+   ---------------- Setup ----------------
+*/
+
+/*
+ * openSource opens path as a FIFO if it is one, or else creates a listening socket there.
+ */
+static int openSource(Ingest *ingest, const char *path) {
+    struct stat info;
+    if (stat(path, &info) == 0 && S_ISFIFO(info.st_mode)) {
+        // Opened for writing too, so the FIFO never reports end of input between producers.
+        int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd < 0 || !addProducer(ingest, fd)) {
+            if (fd >= 0)
+                close(fd);
+            return -1;
+        }
+        return 0;
+    }
+    struct sockaddr_un address;
+    if (strlen(path) >= sizeof(address.sun_path))
+        return -1;
+    // A socket left by an earlier run is replaced; any other file is not touched.
+    if (lstat(path, &info) == 0) {
+        if (!S_ISSOCK(info.st_mode))
+            return -1;
+        unlink(path);
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = &ingest->listenFd };
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0 ||
+        epoll_ctl(ingest->epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        close(fd);
+        return -1;
+    }
+    ingest->listenFd = fd;
+    return 0;
+}
+
+/*
+ * openIngest starts reading updates from path.  Returns NULL if path can be neither read as a
+ * FIFO nor bound as a socket.
+ */
+Ingest *openIngest(const char *path, int tickMillis) {
+    Ingest *ingest = memCalloc(MEM_IO, 1, sizeof(Ingest));
+    if (!ingest) {
+        perror("Failed to allocate ingest");
+        exit(EXIT_FAILURE);
+    }
+    if (strlen(path) >= sizeof(ingest->path)) {
+        memFree(MEM_IO, ingest, sizeof(Ingest));
+        return NULL;
+    }
+    strcpy(ingest->path, path);
+    ingest->tickMillis = tickMillis > 0 ? tickMillis : INGEST_TICK_MS;
+    ingest->listenFd = -1;
+    ingest->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    ingest->timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = &ingest->timerFd };
+    if (ingest->epollFd < 0 || ingest->timerFd < 0 ||
+        epoll_ctl(ingest->epollFd, EPOLL_CTL_ADD, ingest->timerFd, &event) != 0 ||
+        openSource(ingest, path) != 0) {
+        closeIngest(ingest);
+        return NULL;
+    }
+    return ingest;
+}
+
+void closeIngest(Ingest *ingest) {
+    if (!ingest)
+        return;
+    while (ingest->producers)
+        closeProducer(ingest, ingest->producers);
+    if (ingest->listenFd >= 0) {
+        close(ingest->listenFd);
+        unlink(ingest->path);
+    }
+    if (ingest->timerFd >= 0)
+        close(ingest->timerFd);
+    if (ingest->epollFd >= 0)
+        close(ingest->epollFd);
+    freeBatch(&ingest->batches[0]);
+    freeBatch(&ingest->batches[1]);
+    memFree(MEM_IO, ingest, sizeof(Ingest));
+}
@@ -1,107 +1,310 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <limits.h>
 #include <string.h>
 #include "input_parser.h"
 #include "spreadsheet.h"
 #include "scrolling.h"
+#include "render.h"
+#include "snapshot.h"
+#include "journal.h"
+#include "csv.h"
+#include "stats.h"
+#include "mem_track.h"
+#include "trace.h"
+#include "workbook.h"
+#include "value_plane.h"
+#include "change_feed.h"
+#include "background.h"
+#include "structure.h"
 #include <ctype.h>
 #include <time.h>
 
-int isNumber(const char *str) {
-    if (str == NULL || *str == '\0') return 0;  // Empty string is not a number
-    for (int i = 0; str[i] != '\0'; i++) {
-        if (!isdigit(str[i])) return 0;  // If any character is not a digit, return false
+/*
+ * handleSheetCommand handles "sheet_add <name> [<rows> <cols>]", "sheet <name>" and "sheets".
+ * New sheets default to the size of the active one.
+ */
+static int handleSheetCommand(char *input, Spreadsheet *spreadsheet, double start) {
+    Spreadsheet *home = homeSheet(spreadsheet);
+    char name[SHEET_NAME_MAX + 1], extra[2];
+    if (strcmp(input, "sheets") == 0) {
+        Spreadsheet **sheets = home->workbook ? home->workbook->sheets : &home;
+        int count = home->workbook ? home->workbook->count : 1;
+        if (!spreadsheet->quiet) {
+            for (int i = 0; i < count; i++)
+                printf("%c %-*s %7d x %d\n", sheets[i] == spreadsheet ? '*' : ' ', SHEET_NAME_MAX - 1,
+                       sheets[i]->name, sheets[i]->rows, sheets[i]->cols);
+        }
+        reportStatus(spreadsheet, start, "ok");
+        return 1;
+    }
+    if (strncmp(input, "sheet_add ", 10) == 0) {
+        long rows = spreadsheet->rows, cols = spreadsheet->cols;
+        int fields = sscanf(input + 10, "%32s %ld %ld %1s", name, &rows, &cols, extra);
+        if (fields != 1 && fields != 3) {
+            reportStatus(spreadsheet, start, "Error: Use sheet_add <name> [<rows> <cols>].");
+            return 1;
+        }
+        if (!validSheetName(name)) {
+            reportStatus(spreadsheet, start, "Error: Invalid sheet name %s.", name);
+            return 1;
+        }
+        if (rows <= 0 || rows > SHEET_MAX_ROWS || cols <= 0 || cols > SHEET_MAX_COLS) {
+            reportStatus(spreadsheet, start, "Error: Sheet size should be within %dx%d.", SHEET_MAX_ROWS, SHEET_MAX_COLS);
+            return 1;
+        }
+        if (!workbookAddSheet(home, name, (int) rows, (int) cols)) {
+            reportStatus(spreadsheet, start, "Error: Sheet %s already exists.", name);
+            return 1;
+        }
+        spreadsheet->pendingCommand = input;
+        reportStatus(spreadsheet, start, "ok");
+        spreadsheet->pendingCommand = NULL;
+        return 1;
+    }
+    if (sscanf(input + 5, "%32s %1s", name, extra) != 1) {
+        reportStatus(spreadsheet, start, "Error: Use sheet <name>.");
+        return 1;
     }
+    Spreadsheet *target = workbookFindSheet(home, name, strlen(name));
+    if (!target) {
+        reportStatus(spreadsheet, start, "Error: Unknown sheet %s.", name);
+        return 1;
+    }
+    if (target != spreadsheet) {
+        // The session moves with the active sheet; parseInput takes it back from the new one.
+        workbookLendSession(target, spreadsheet);
+        setDeltaRendering(target, spreadsheet->renderer->deltaMode);
+        home->workbook->active = target;
+    }
+    target->pendingCommand = input;
+    printSpreadsheet(target);
+    reportStatus(target, start, "ok");
+    target->pendingCommand = NULL;
     return 1;
 }
 
-clock_t end;
-double cpu_time_used;
-
-int columnToIndex(const char *col) {
-    int index = 0;
-    while (*col) {
-        if (!isalpha(*col)) return -1;
-        index = index * 26 + (toupper(*col) - 'A' + 1);
-        col++;
+/*
+ * handleStructureCommand handles "insert_row <row> [<count>]" and "delete_row <row> [<count>]",
+ * with rows numbered from 1, and "insert_col"/"delete_col" with a column label (see
+ * structure.h).  Inserted rows go above <row>, inserted columns left of <col>.
+ */
+static int handleStructureCommand(char *input, Spreadsheet *spreadsheet, double start) {
+    int insert = input[0] == 'i';
+    int columns = strncmp(input + 7, "col ", 4) == 0;
+    if (!columns && strncmp(input + 7, "row ", 4) != 0) {
+        reportStatus(spreadsheet, start, "Error: Use insert_row, delete_row, insert_col or delete_col.");
+        return 1;
+    }
+    char at[16], extra[2];
+    long count = 1;
+    int fields = sscanf(input + 11, "%15s %ld %1s", at, &count, extra);
+    if (fields != 1 && fields != 2) {
+        reportStatus(spreadsheet, start, "Error: Use %.10s <%s> [<count>].", input, columns ? "col" : "row");
+        return 1;
     }
-    return index;
+    int index = -1, row;
+    if (columns) {
+        // A label is parsed as the reference to its first row.
+        char ref[sizeof(at) + 1];
+        size_t len = strspn(at, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz");
+        snprintf(ref, sizeof(ref), "%s1", at);
+        if (len == 0 || at[len] != '\0' || parseCellReference(ref, &row, &index) != 0)
+            index = -1;
+    } else {
+        char *end;
+        long number = strtol(at, &end, 10);
+        if (*end == '\0' && number >= 1 && number <= spreadsheet->rows)
+            index = (int) number - 1;
+    }
+    int size = columns ? spreadsheet->cols : spreadsheet->rows;
+    if (index < 0 || index >= size || count < 1 || count > size - index) {
+        reportStatus(spreadsheet, start, "Error: %s out of bounds.", columns ? "Columns" : "Rows");
+        return 1;
+    }
+    int status = columns ? (insert ? insertColumns : deleteColumns)(spreadsheet, index, (int) count, start)
+                         : (insert ? insertRows : deleteRows)(spreadsheet, index, (int) count, start);
+    if (status == STRUCTURE_ERR_REFERENCED) {
+        reportStatus(spreadsheet, start, "Error: Deleted cells are referenced from outside.");
+        return 1;
+    }
+    if (status == STRUCTURE_ERR_OCCUPIED) {
+        reportStatus(spreadsheet, start, "Error: Cells would be pushed off the sheet.");
+        return 1;
+    }
+    spreadsheet->pendingCommand = input;
+    printSpreadsheet(spreadsheet);
+    reportStatus(spreadsheet, start, "ok");
+    spreadsheet->pendingCommand = NULL;
+    return 1;
 }
 
-
-// function to parse and handle user input.
-int parseInput(char *input, Spreadsheet *spreadsheet, clock_t start) {
-
-    input[strcspn(input, "\n")] = '\0';
+// Executes one command; parseInput wraps it with the per-command instrumentation.
+static int dispatchInput(char *input, Spreadsheet *spreadsheet, double start) {
 
     // Exit command.
     if (strcmp(input, "q") == 0) {
-        end = clock();
-        cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
-        spreadsheet->time = cpu_time_used;
         // printf("Exiting the spreadsheet. Goodbye!  %.2f\n",spreadsheet->time );
         return 0;
     }
     if (strcmp(input, "disable_output") == 0) {
-        end = clock();
-        cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
-        spreadsheet->time = cpu_time_used;
         // printf("Disabled output: Please Type \"enable_output\" to enable output! %.2f \n",spreadsheet->time );
-        printf("[%.1f] (ok) ", spreadsheet->time);
+        reportStatus(spreadsheet, start, "ok");
         spreadsheet->display=1;
         return 1;
     }
     if (strcmp(input, "enable_output") == 0) {
 
-        end = clock();
-        cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
-        spreadsheet->time = cpu_time_used;
         // printf("Output enabled!  %.2f \n",spreadsheet->time );
 
         spreadsheet->display=0;
         printSpreadsheet(spreadsheet);
-        printf("[%.1f] (ok) ", spreadsheet->time);
+        reportStatus(spreadsheet, start, "ok");
+        return 1;
+    }
+
+    if (strcmp(input, "enable_delta_output") == 0 || strcmp(input, "disable_delta_output") == 0) {
+        setDeltaRendering(spreadsheet, input[0] == 'e');
+        printSpreadsheet(spreadsheet);
+        reportStatus(spreadsheet, start, "ok");
         return 1;
     }
 
     // Scroll commands.
     if (strcmp(input, "w") == 0) {
         scrollUp(spreadsheet);
-        end = clock();
-        cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
-        spreadsheet->time = cpu_time_used;
         // printf("Scrolled Up  %.2f\n",spreadsheet->time );
 
         printSpreadsheet(spreadsheet);
-        printf("[%.1f] (ok) ", spreadsheet->time);
+        reportStatus(spreadsheet, start, "ok");
         return 1;
     } else if (strcmp(input, "s") == 0) {
         scrollDown(spreadsheet);
-        end = clock();
-        cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
-        spreadsheet->time = cpu_time_used;
         // printf("Scrolled Up  %.2f\n",spreadsheet->time );
         printSpreadsheet(spreadsheet);
-        printf("[%.1f] (ok) ", spreadsheet->time);
+        reportStatus(spreadsheet, start, "ok");
         return 1;
     } else if (strcmp(input, "a") == 0) {
         scrollLeft(spreadsheet);
-        end = clock();
-        cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
-        spreadsheet->time = cpu_time_used;
         // printf("Scrolled Left  %.2f\n",spreadsheet->time );
         printSpreadsheet(spreadsheet);
-        printf("[%.1f] (ok) ", spreadsheet->time);
+        reportStatus(spreadsheet, start, "ok");
         return 1;
     } else if (strcmp(input, "d") == 0) {
         scrollRight(spreadsheet);
-        end = clock();
-        cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
-        spreadsheet->time = cpu_time_used;
         // printf("Scrolled Right  %.2f\n",spreadsheet->time );
         printSpreadsheet(spreadsheet);
-        printf("[%.1f] (ok) ", spreadsheet->time);
+        reportStatus(spreadsheet, start, "ok");
+        return 1;
+    }
+
+    if (strcmp(input, "sheets") == 0 || strncmp(input, "sheet ", 6) == 0 || strncmp(input, "sheet_add ", 10) == 0)
+        return handleSheetCommand(input, spreadsheet, start);
+
+    // Snapshot commands.
+    if (strncmp(input, "save ", 5) == 0 || strncmp(input, "load ", 5) == 0) {
+        const char *path = input + 5;
+        while (*path == ' ') path++;
+        if (*path == '\0') {
+            reportStatus(spreadsheet, start, "Error: Missing snapshot file name.");
+            return 1;
+        }
+        // A snapshot holds one sheet, so it cannot carry references to or from other sheets.
+        if (workbookSheetLinked(spreadsheet)) {
+            reportStatus(spreadsheet, start, "Error: Sheet %s is linked to other sheets.", spreadsheet->name);
+            return 1;
+        }
+        if (input[0] == 's' && saveSnapshot(spreadsheet, path) != 0) {
+            reportStatus(spreadsheet, start, "Error: Could not save snapshot %s.", path);
+            return 1;
+        }
+        if (input[0] == 'l' && loadSnapshot(spreadsheet, path) != 0) {
+            reportStatus(spreadsheet, start, "Error: Could not load snapshot %s.", path);
+            return 1;
+        }
+        // The sheet now matches the snapshot, so the journal restarts from it (by absolute path),
+        // unless other sheets exist: their history stays in the journal, and a load is recorded
+        // with the absolute path instead, so recovery does not depend on the current directory.
+        char loadCommand[PATH_MAX + 8];
+        if (spreadsheet->journal && !spreadsheet->workbook &&
+            journalCheckpoint(spreadsheet->journal, spreadsheet, path) != 0) {
+            reportStatus(spreadsheet, start, "Error: Could not checkpoint journal.");
+            return 1;
+        }
+        if (spreadsheet->journal && spreadsheet->workbook && input[0] == 'l') {
+            char absolute[PATH_MAX];
+            if (!realpath(path, absolute)) {
+                reportStatus(spreadsheet, start, "Error: Could not resolve snapshot %s.", path);
+                return 1;
+            }
+            snprintf(loadCommand, sizeof(loadCommand), "load %s", absolute);
+            spreadsheet->pendingCommand = loadCommand;
+        }
+        printSpreadsheet(spreadsheet);
+        reportStatus(spreadsheet, start, "ok");
+        spreadsheet->pendingCommand = NULL;
+        return 1;
+    }
+
+    // CSV commands: import_csv <file>, export_csv <file> (formulas), export_csv_values <file>,
+    // and export_csv_values_async <file>, which writes the current values in the background.
+    if (strncmp(input, "import_csv ", 11) == 0 || strncmp(input, "export_csv ", 11) == 0 ||
+        strncmp(input, "export_csv_values ", 18) == 0 || strncmp(input, "export_csv_values_async ", 24) == 0) {
+        const char *path = strchr(input, ' ');
+        while (*path == ' ') path++;
+        if (*path == '\0') {
+            reportStatus(spreadsheet, start, "Error: Missing CSV file name.");
+            return 1;
+        }
+        if (strncmp(input, "export_csv_values_async ", 24) == 0) {
+            if (exportCsvAsync(spreadsheet, path) != 0) {
+                reportStatus(spreadsheet, start, "Error: Could not start export of %s.", path);
+                return 1;
+            }
+            reportStatus(spreadsheet, start, "ok");
+            return 1;
+        }
+        if (input[0] == 'e') {
+            if (exportCsv(spreadsheet, path, input[10] == '_') != 0) {
+                reportStatus(spreadsheet, start, "Error: Could not export CSV %s.", path);
+                return 1;
+            }
+            reportStatus(spreadsheet, start, "ok");
+            return 1;
+        }
+        // importCsv journals the assignments it applied itself, so the file is not needed again.
+        long rejected;
+        if (importCsv(spreadsheet, path, &rejected) != 0) {
+            reportStatus(spreadsheet, start, "Error: Could not import CSV %s.", path);
+            return 1;
+        }
+        printSpreadsheet(spreadsheet);
+        if (rejected > 0)
+            reportStatus(spreadsheet, start, "Error: %ld CSV fields rejected.", rejected);
+        else
+            reportStatus(spreadsheet, start, "ok");
+        return 1;
+    }
+
+    if (strncmp(input, "insert_", 7) == 0 || strncmp(input, "delete_", 7) == 0)
+        return handleStructureCommand(input, spreadsheet, start);
+
+    // Change feed: "watch <path>" streams the cells each later command changes (see
+    // change_feed.h); "unwatch" closes every stream.  Neither is journaled.
+    if (strncmp(input, "watch ", 6) == 0) {
+        const char *path = input + 6;
+        while (*path == ' ') path++;
+        if (*path == '\0' || changeFeedWatch(spreadsheet, path) < 0) {
+            reportStatus(spreadsheet, start, "Error: Could not watch %s.", path);
+            return 1;
+        }
+        reportStatus(spreadsheet, start, "ok");
+        return 1;
+    }
+    if (strcmp(input, "unwatch") == 0) {
+        changeFeedUnwatchAll(spreadsheet);
+        reportStatus(spreadsheet, start, "ok");
         return 1;
     }
 
@@ -111,82 +314,154 @@ int parseInput(char *input, Spreadsheet *spreadsheet, clock_t start) {
 
         token = strtok(NULL, " ");
         if (token == NULL) {
-            end = clock();
-            cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
-            spreadsheet->time = cpu_time_used;
             // printf("Invalid format! Use: scroll_to <CellRef>  %.2f\n", spreadsheet->time );
-            printf("[%.1f] (Error) ", spreadsheet->time);
+            reportStatus(spreadsheet, start, "Error");
             return 1;
         }
         cellRef = token;
 
         token = strtok(NULL, " ");
         if (token != NULL) {
-            end = clock();
-            cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
-            spreadsheet->time = cpu_time_used;
             // printf("Too many arguments! Use: scroll_to <CellRef>  %.2f\n", spreadsheet->time );
-            printf("[%.1f] (Error) ", spreadsheet->time);
+            reportStatus(spreadsheet, start, "Error");
             return 1;
         }
 
-        int i = 0;
-        while (isalpha(cellRef[i])) i++;
-        if (i == 0 || i > 3) {
-            end = clock();
-            cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
-            spreadsheet->time = cpu_time_used;
-            //printf(" Invalid column format! Use: scroll_to <A1 - ZZZ999> %.2f\n", spreadsheet->time );
-            printf("[%.1f] (Error) ", spreadsheet->time);
+        int row, col;
+        if (parseCellReference(cellRef, &row, &col) != 0 ||
+            row >= spreadsheet->rows || col >= spreadsheet->cols) {
+            // printf("Invalid cell! Use: scroll_to <A1 - ZZZ1048576> %.2f\n", spreadsheet->time );
+            reportStatus(spreadsheet, start, "Error");
             return 1;
         }
 
-        char colPart[4];
-        strncpy(colPart, cellRef, i);
-        colPart[i] = '\0';
+        scrollTo(spreadsheet, row + 1, col + 1);
 
-        char *rowPart = &cellRef[i];
-        if (!isNumber(rowPart)) {
-            end = clock();
-            cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
-            spreadsheet->time = cpu_time_used;
-            // printf("Invalid row format! Use: scroll_to <A1 - ZZZ999> %.2f\n", spreadsheet->time );
-            printf("[%.1f] (Error) ", spreadsheet->time);
-            return 1;
-        }
+        // printf("Scrolled to %s %.2f\n", cellRef, spreadsheet->time);
+        printSpreadsheet(spreadsheet);
+        reportStatus(spreadsheet, start, "ok");
+        return 1;
+    }
 
-        int col = columnToIndex(colPart);
-        int row = atoi(rowPart);
+    spreadsheet->pendingCommand = input;
+    handleOperation(input, spreadsheet, start);
+    spreadsheet->pendingCommand = NULL;
+
+    return 1;
+}
 
-        if (row > spreadsheet->rows || row <= 0) {
-            end = clock();
-            cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
-            spreadsheet->time = cpu_time_used;
-            // printf("Row should be in range (1, %d) %.2f \n" ,spreadsheet->rows , spreadsheet->time);
-            printf("[%.1f] (Error) ", spreadsheet->time);
+/*
+ * handleTraceCommand handles "trace_on [events]", "trace_off" and "trace_dump <file>".
+ * Like "stats", these commands are not traced themselves.
+ */
+static int handleTraceCommand(char *input, Spreadsheet *spreadsheet, double start) {
+#ifdef SHEET_STATS
+    if (strcmp(input, "trace_on") == 0 || strncmp(input, "trace_on ", 9) == 0) {
+        long events = TRACE_DEFAULT_EVENTS;
+        if (input[8] == ' ' && sscanf(input + 9, "%ld", &events) != 1)
+            events = 0;
+        if (traceStart(events) != 0) {
+            reportStatus(spreadsheet, start, "Error: Invalid trace buffer size.");
             return 1;
         }
-        if (col > spreadsheet->cols || col <= 0) {
-            end = clock();
-            cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
-            spreadsheet->time = cpu_time_used;
-            // printf(" Column should be in range (A - %c)\n %.2f" , 'A' + spreadsheet->cols - 1, spreadsheet->time);
-            printf("[%.1f] (Error) ", spreadsheet->time);
+        reportStatus(spreadsheet, start, "ok");
+        return 1;
+    }
+    if (strcmp(input, "trace_off") == 0) {
+        traceStop();
+        reportStatus(spreadsheet, start, "ok");
+        return 1;
+    }
+    if (strncmp(input, "trace_dump ", 11) == 0) {
+        const char *path = input + 11;
+        while (*path == ' ') path++;
+        long written = 0;
+        if (*path == '\0' || traceDump(path, &written) != 0) {
+            reportStatus(spreadsheet, start, "Error: Could not write trace %s.", path);
             return 1;
         }
+        reportStatus(spreadsheet, start, "ok");
+        return 1;
+    }
+    reportStatus(spreadsheet, start, "Error: Unknown trace command.");
+#else
+    (void) input;
+    reportStatus(spreadsheet, start, "Error: Tracing is not compiled in (build with -DSHEET_STATS).");
+#endif
+    return 1;
+}
 
-        scrollTo(spreadsheet, row, col);
+/*
+ * keepsPlan reports whether a command may run while a background plan is pending: an edit,
+ * which plans its cascade together with it, or a command that only shows cells, which settle
+ * first.  Anything else may read or write any cell.  SLEEP reads its operand while assigning.
+ */
+static int keepsPlan(const char *input) {
+    if (isupper((unsigned char) input[0]) && strchr(input, '='))
+        return strstr(input, "SLEEP") == NULL;
+    return strcmp(input, "w") == 0 || strcmp(input, "a") == 0 || strcmp(input, "s") == 0 ||
+           strcmp(input, "d") == 0 || strncmp(input, "scroll_to ", 10) == 0 ||
+           strcmp(input, "enable_output") == 0 || strcmp(input, "disable_output") == 0 ||
+           strcmp(input, "q") == 0;
+}
 
-        end = clock();
-        cpu_time_used = ((double) (end - start)) / CLOCKS_PER_SEC;
-        spreadsheet->time = cpu_time_used;
-        // printf("Scrolled to %s %.2f\n", cellRef, spreadsheet->time);
-        printSpreadsheet(spreadsheet);
-        printf("[%.1f] (ok) ", spreadsheet->time);
+static int runCommand(char *input, Spreadsheet *spreadsheet, double start) {
+    // "stats" and "mem" report on the commands before them, so they are not instrumented themselves.
+    if (strcmp(input, "stats") == 0) {
+#ifdef SHEET_STATS
+        statsPrint();
+        reportStatus(spreadsheet, start, "ok");
+#else
+        reportStatus(spreadsheet, start, "Error: Statistics are not compiled in (build with -DSHEET_STATS).");
+#endif
+        return 1;
+    }
+    if (strcmp(input, "mem") == 0) {
+#ifdef SHEET_STATS
+        memPrint();
+        reportStatus(spreadsheet, start, "ok");
+#else
+        reportStatus(spreadsheet, start, "Error: Memory accounting is not compiled in (build with -DSHEET_STATS).");
+#endif
         return 1;
     }
 
-    handleOperation(input, spreadsheet, start);
+    if (strncmp(input, "trace_", 6) == 0)
+        return handleTraceCommand(input, spreadsheet, start);
 
-    return 1;
+    // In a workbook the command runs on the active sheet, which borrows the session for it.
+    Spreadsheet *sheet = activeSheet(spreadsheet);
+    if (sheet != spreadsheet)
+        workbookLendSession(sheet, spreadsheet);
+    STATS_BEGIN_COMMAND();
+    TRACE_BEGIN(traceMark);
+    int running = dispatchInput(input, sheet, start);
+    TRACE_COMMAND(traceMark, input);
+    sheet = activeSheet(spreadsheet);
+    if (sheet != spreadsheet)
+        workbookLendSession(spreadsheet, sheet);
+    // Readers on other threads and change subscribers see the effect of the command from here
+    // on (in server mode, from the end of its batch).
+    if (!spreadsheet->deferPublish) {
+        publishWorkbookValues(spreadsheet);
+        changeFeedCommit(spreadsheet);
+        packIdleTiles(spreadsheet);
+    }
+    STATS_END_COMMAND();
+    return running;
+}
+
+// function to parse and handle user input.
+int parseInput(char *input, Spreadsheet *spreadsheet, double start) {
+
+    input[strcspn(input, "\n")] = '\0';
+
+    // The command has the sheets to itself; the background worker resumes after it.
+    BackgroundRecalc *background = spreadsheet->background;
+    backgroundPause(background);
+    if (backgroundPending(background) && !keepsPlan(input))
+        backgroundFinish(background);
+    int running = runCommand(input, spreadsheet, start);
+    backgroundResume(background);
+    return running;
 }
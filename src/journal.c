@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "journal.h"
+#include "input_parser.h"
+#include "snapshot.h"
+#include "mem_track.h"
+
+/*
+   ---------------- Write-ahead command journal ----------------
+
+   Every accepted command is appended to the journal with write() before any of its results
+   reach the user, so a crash of the process never loses an acknowledged command.  Making the
+   records durable against an OS crash is left to a flusher thread that fdatasyncs whatever has
+   accumulated at most every JOURNAL_GROUP_COMMIT_MS, so a burst of commands shares one fsync
+   and no fsync ever sits on a command's latency path.
+
+   Layout (plain text, one record per line):
+       #journal v1 <rows> <cols>
+       #snapshot <absolute path>      optional: the state the records below start from
+       A1=5
+       B1=A1+1
+       ...
+
+   Saving a snapshot while journaling starts a new journal generation containing only the
+   header and a marker for that snapshot.  Recovery loads the marked snapshot and replays the
+   tail with recalculation deferred to a single pass at the end.
+*/
+
+/*
+ * writeFully writes the whole buffer, retrying short writes and EINTR.
+ */
+static int writeFully(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += written;
+        len -= (size_t) written;
+    }
+    return 0;
+}
+
+/*
+ * writeGeneration atomically replaces the journal at path with a fresh header and,
+ * when snapshotPath is given, a marker naming the snapshot the new generation starts from.
+ */
+static int writeGeneration(const char *path, int rows, int cols, const char *snapshotPath) {
+    size_t pathLen = strlen(path);
+    char *tmpPath = malloc(pathLen + 5);
+    if (!tmpPath)
+        return -1;
+    memcpy(tmpPath, path, pathLen);
+    memcpy(tmpPath + pathLen, ".tmp", 5);
+
+    int fd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        free(tmpPath);
+        return -1;
+    }
+    char header[64];
+    int len = snprintf(header, sizeof(header), "%s %d %d\n", JOURNAL_HEADER, rows, cols);
+    int failed = writeFully(fd, header, (size_t) len) != 0;
+    if (!failed && snapshotPath) {
+        failed = writeFully(fd, JOURNAL_SNAPSHOT_MARK, strlen(JOURNAL_SNAPSHOT_MARK)) != 0 ||
+                 writeFully(fd, snapshotPath, strlen(snapshotPath)) != 0 ||
+                 writeFully(fd, "\n", 1) != 0;
+    }
+    if (fsync(fd) != 0)
+        failed = 1;
+    close(fd);
+    if (failed || rename(tmpPath, path) != 0) {
+        unlink(tmpPath);
+        free(tmpPath);
+        return -1;
+    }
+    free(tmpPath);
+
+    /* Make the rename itself durable. */
+    char *dirCopy = strdup(path);
+    if (dirCopy) {
+        char *slash = strrchr(dirCopy, '/');
+        const char *dir = ".";
+        if (slash) {
+            *slash = '\0';
+            dir = (slash == dirCopy) ? "/" : dirCopy;
+        }
+        int dirFd = open(dir, O_RDONLY);
+        if (dirFd >= 0) {
+            fsync(dirFd);
+            close(dirFd);
+        }
+        free(dirCopy);
+    }
+    return 0;
+}
+
+/*
+ * recoverJournal restores the sheet from an existing journal: it loads the last snapshot marker
+ * (or starts from an empty sheet of the recorded size) and replays the remaining records in bulk.
+ * A torn final record is discarded.  It returns the length of the valid prefix, or -1 on failure.
+ */
+static long recoverJournal(const char *path, Spreadsheet *spreadsheet) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return (errno == ENOENT) ? 0 : -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t) st.st_size;
+    if (size == 0) {
+        close(fd);
+        return 0;
+    }
+    char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+
+    /* Only newline-terminated records are complete. */
+    size_t valid = size;
+    while (valid > 0 && map[valid - 1] != '\n')
+        valid--;
+
+    int rows = 0, cols = 0;
+    if (valid == 0 || sscanf(map, JOURNAL_HEADER " %d %d", &rows, &cols) != 2 || rows <= 0 || cols <= 0 ||
+        rows > SHEET_MAX_ROWS || cols > SHEET_MAX_COLS) {
+        fprintf(stderr, "[journal] %s is not a journal\n", path);
+        munmap(map, size);
+        return -1;
+    }
+
+    /* Find where replay starts: after the last snapshot marker, or after the header. */
+    const char *replayFrom = (const char *) memchr(map, '\n', valid) + 1;
+    const char *end = map + valid;
+    char snapshotPath[PATH_MAX];
+    snapshotPath[0] = '\0';
+    size_t markLen = strlen(JOURNAL_SNAPSHOT_MARK);
+    for (const char *line = replayFrom; line < end; ) {
+        const char *newline = memchr(line, '\n', end - line);
+        size_t len = newline - line;
+        if (len > markLen && len - markLen < sizeof(snapshotPath) &&
+            memcmp(line, JOURNAL_SNAPSHOT_MARK, markLen) == 0) {
+            memcpy(snapshotPath, line + markLen, len - markLen);
+            snapshotPath[len - markLen] = '\0';
+            replayFrom = newline + 1;
+        }
+        line = newline + 1;
+    }
+
+    if (snapshotPath[0] != '\0') {
+        if (loadSnapshot(spreadsheet, snapshotPath) != 0) {
+            fprintf(stderr, "[journal] cannot load snapshot %s named by %s\n", snapshotPath, path);
+            munmap(map, size);
+            return -1;
+        }
+    } else if (rows != spreadsheet->rows || cols != spreadsheet->cols) {
+        adoptSpreadsheet(spreadsheet, initializeSpreadsheet(rows, cols));
+    }
+
+    int wasQuiet = spreadsheet->quiet;
+    spreadsheet->quiet = 1;
+    spreadsheet->deferRecalc = 1;
+    size_t capacity = 256;
+    char *buffer = memAlloc(MEM_IO, capacity);
+    if (!buffer) {
+        perror("Failed to allocate journal replay buffer");
+        exit(EXIT_FAILURE);
+    }
+    long replayed = 0;
+    for (const char *line = replayFrom; line < end; ) {
+        const char *newline = memchr(line, '\n', end - line);
+        size_t len = newline - line;
+        if (len > 0 && line[0] != '#') {
+            if (len + 1 > capacity) {
+                buffer = memRealloc(MEM_IO, buffer, capacity, len + 1);
+                capacity = len + 1;
+                if (!buffer) {
+                    perror("Failed to grow journal replay buffer");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            memcpy(buffer, line, len);
+            buffer[len] = '\0';
+            parseInput(buffer, spreadsheet, monotonicSeconds());
+            replayed++;
+        }
+        line = newline + 1;
+    }
+    memFree(MEM_IO, buffer, capacity);
+    spreadsheet->deferRecalc = 0;
+    recalcAll(spreadsheet);
+    spreadsheet->quiet = wasQuiet;
+    munmap(map, size);
+
+    fprintf(stderr, "[journal] recovered %ld commands from %s%s%s\n", replayed, path,
+            snapshotPath[0] ? " on top of " : "", snapshotPath);
+    return (long) valid;
+}
+
+/*
+ * flusherMain is the group-commit loop: it waits for unsynced records, lets a short window pass
+ * so that more records join the group, then fdatasyncs them all at once.
+ */
+static void *flusherMain(void *arg) {
+    Journal *journal = (Journal *) arg;
+    pthread_mutex_lock(&journal->lock);
+    while (1) {
+        while (!journal->stop && journal->durable == journal->appended)
+            pthread_cond_wait(&journal->wake, &journal->lock);
+        if (journal->durable == journal->appended)
+            break;
+        if (!journal->stop) {
+            pthread_mutex_unlock(&journal->lock);
+            struct timespec window = { 0, JOURNAL_GROUP_COMMIT_MS * 1000000L };
+            nanosleep(&window, NULL);
+            pthread_mutex_lock(&journal->lock);
+        }
+        unsigned long target = journal->appended;
+        int fd = journal->fd;
+        pthread_mutex_unlock(&journal->lock);
+        fdatasync(fd);
+        pthread_mutex_lock(&journal->lock);
+        journal->durable = target;
+        journal->syncs++;
+        pthread_cond_broadcast(&journal->synced);
+    }
+    pthread_mutex_unlock(&journal->lock);
+    return NULL;
+}
+
+/*
+ * openJournal recovers the sheet from the journal at path if it exists, then opens it for appending
+ * and starts the flusher.  When a new journal is created, loadedFrom (may be NULL) names the snapshot
+ * the current sheet came from, so that it becomes the journal's base.  Returns NULL on failure.
+ */
+Journal *openJournal(const char *path, Spreadsheet *spreadsheet, const char *loadedFrom) {
+    long valid = recoverJournal(path, spreadsheet);
+    if (valid < 0)
+        return NULL;
+    if (valid == 0) {
+        char base[PATH_MAX];
+        const char *marker = (loadedFrom && realpath(loadedFrom, base)) ? base : NULL;
+        if (writeGeneration(path, spreadsheet->rows, spreadsheet->cols, marker) != 0)
+            return NULL;
+    } else if (truncate(path, valid) != 0) {
+        return NULL;
+    }
+
+    Journal *journal = memCalloc(MEM_IO, 1, sizeof(Journal));
+    if (!journal) {
+        perror("Failed to allocate Journal");
+        exit(EXIT_FAILURE);
+    }
+    journal->fd = open(path, O_WRONLY | O_APPEND);
+    journal->path = strdup(path);
+    if (journal->fd < 0 || !journal->path) {
+        if (journal->fd >= 0)
+            close(journal->fd);
+        free(journal->path);
+        memFree(MEM_IO, journal, sizeof(Journal));
+        return NULL;
+    }
+    pthread_mutex_init(&journal->lock, NULL);
+    pthread_cond_init(&journal->wake, NULL);
+    pthread_cond_init(&journal->synced, NULL);
+    if (pthread_create(&journal->flusher, NULL, flusherMain, journal) != 0) {
+        perror("Failed to start journal flusher");
+        exit(EXIT_FAILURE);
+    }
+    return journal;
+}
+
+/*
+ * journalAppend writes one command record.  It returns as soon as the record is in the file;
+ * durability follows within one group-commit window.
+ */
+void journalAppend(Journal *journal, const char *command) {
+    struct iovec parts[2];
+    parts[0].iov_base = (void *) command;
+    parts[0].iov_len = strlen(command);
+    parts[1].iov_base = "\n";
+    parts[1].iov_len = 1;
+    pthread_mutex_lock(&journal->lock);
+    if (writev(journal->fd, parts, 2) < 0)
+        perror("Failed to append to journal");
+    journal->appended++;
+    pthread_cond_signal(&journal->wake);
+    pthread_mutex_unlock(&journal->lock);
+}
+
+/*
+ * journalSync blocks until every record appended so far is durable.
+ */
+void journalSync(Journal *journal) {
+    pthread_mutex_lock(&journal->lock);
+    unsigned long target = journal->appended;
+    pthread_cond_signal(&journal->wake);
+    while (journal->durable < target)
+        pthread_cond_wait(&journal->synced, &journal->lock);
+    pthread_mutex_unlock(&journal->lock);
+}
+
+/*
+ * journalCheckpoint starts a new journal generation based on a snapshot that was just saved.
+ * Until the rename completes the old generation stays valid, so a crash at any point still
+ * recovers to the same state.  Returns 0 on success and -1 on failure.
+ */
+int journalCheckpoint(Journal *journal, Spreadsheet *spreadsheet, const char *snapshotPath) {
+    char absolute[PATH_MAX];
+    if (!realpath(snapshotPath, absolute))
+        return -1;
+    journalSync(journal);
+    if (writeGeneration(journal->path, spreadsheet->rows, spreadsheet->cols, absolute) != 0)
+        return -1;
+    int fd = open(journal->path, O_WRONLY | O_APPEND);
+    if (fd < 0)
+        return -1;
+    pthread_mutex_lock(&journal->lock);
+    close(journal->fd);
+    journal->fd = fd;
+    pthread_mutex_unlock(&journal->lock);
+    return 0;
+}
+
+/*
+ * closeJournal makes every record durable, stops the flusher and releases the journal.
+ */
+void closeJournal(Journal *journal) {
+    if (!journal)
+        return;
+    pthread_mutex_lock(&journal->lock);
+    journal->stop = 1;
+    pthread_cond_signal(&journal->wake);
+    pthread_mutex_unlock(&journal->lock);
+    pthread_join(journal->flusher, NULL);
+    close(journal->fd);
+    pthread_mutex_destroy(&journal->lock);
+    pthread_cond_destroy(&journal->wake);
+    pthread_cond_destroy(&journal->synced);
+    free(journal->path);
+    memFree(MEM_IO, journal, sizeof(Journal));
+}
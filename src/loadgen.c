@@ -0,0 +1,285 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+   ---------------- Load generator for server mode ----------------
+
+   loadgen opens --clients connections to a "--serve" socket and drives each from its own
+   thread for --seconds.  A client keeps --pipeline requests outstanding: "get <cell>" reads
+   with probability --reads percent, otherwise writes of a literal or of a reference to a cell
+   in an earlier row (so the writes never form a cycle).  Responses come back in request order,
+   so each one is timed against the send time of the oldest outstanding request.  At the end
+   the sustained throughput and the latency percentiles over all clients are printed.
+   It shares no code with the engine.
+*/
+
+#define LOAD_MAX_LINE     64
+#define LOAD_MAX_PIPELINE 1024
+#define LOAD_BUFFER       65536
+
+typedef struct {
+    const char *socketPath;
+    int rows;
+    int cols;
+    int pipeline;
+    int readPercent;
+    double seconds;
+} LoadConfig;
+
+typedef struct {
+    const LoadConfig *config;
+    unsigned long long rng;
+    double *latencies;          // microseconds, one per answered request
+    long count;
+    long capacity;
+    long errors;
+    int failed;
+} LoadClient;
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long long nextRandom(LoadClient *client) {
+    client->rng ^= client->rng << 13;
+    client->rng ^= client->rng >> 7;
+    client->rng ^= client->rng << 17;
+    return client->rng;
+}
+
+static int randomBelow(LoadClient *client, int n) {
+    return (int) (nextRandom(client) % (unsigned long long) n);
+}
+
+static int cellName(int row, int col, char *out) {
+    char letters[8];
+    int len = 0;
+    for (int c = col + 1; c > 0; c = (c - 1) / 26)
+        letters[len++] = (char) ('A' + (c - 1) % 26);
+    for (int i = 0; i < len; i++)
+        out[i] = letters[len - 1 - i];
+    return len + sprintf(out + len, "%d", row + 1);
+}
+
+/*
+ * makeRequest writes the next request line (with its newline) and returns its length.
+ */
+static int makeRequest(LoadClient *client, char *out) {
+    const LoadConfig *config = client->config;
+    int row = randomBelow(client, config->rows), col = randomBelow(client, config->cols);
+    int len;
+    if (randomBelow(client, 100) < config->readPercent) {
+        memcpy(out, "get ", 4);
+        len = 4 + cellName(row, col, out + 4);
+    } else {
+        len = cellName(row, col, out);
+        out[len++] = '=';
+        if (row > 0 && randomBelow(client, 4) == 0) {
+            len += cellName(randomBelow(client, row), randomBelow(client, config->cols), out + len);
+            len += sprintf(out + len, "+%d", randomBelow(client, 10));
+        } else {
+            len += sprintf(out + len, "%d", randomBelow(client, 1000));
+        }
+    }
+    out[len++] = '\n';
+    return len;
+}
+
+static void recordLatency(LoadClient *client, double micros) {
+    if (client->count == client->capacity) {
+        client->capacity = client->capacity ? 2 * client->capacity : 65536;
+        client->latencies = realloc(client->latencies, client->capacity * sizeof(double));
+        if (!client->latencies) {
+            perror("Failed to grow latency buffer");
+            exit(EXIT_FAILURE);
+        }
+    }
+    client->latencies[client->count++] = micros;
+}
+
+static int connectTo(const char *socketPath) {
+    struct sockaddr_un address;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socketPath, sizeof(address.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * clientMain runs one connection: it tops the pipeline up, then waits for responses.
+ */
+static void *clientMain(void *arg) {
+    LoadClient *client = (LoadClient *) arg;
+    const LoadConfig *config = client->config;
+    int fd = connectTo(config->socketPath);
+    if (fd < 0) {
+        client->failed = 1;
+        return NULL;
+    }
+    double sentAt[LOAD_MAX_PIPELINE];
+    int first = 0, outstanding = 0;
+    char out[LOAD_MAX_PIPELINE * LOAD_MAX_LINE];
+    char in[LOAD_BUFFER];
+    size_t inUsed = 0;
+    double deadline = nowSeconds() + config->seconds;
+    while (outstanding > 0 || nowSeconds() < deadline) {
+        size_t outUsed = 0;
+        double now = nowSeconds();
+        while (now < deadline && outstanding < config->pipeline) {
+            outUsed += makeRequest(client, out + outUsed);
+            sentAt[(first + outstanding) % LOAD_MAX_PIPELINE] = now;
+            outstanding++;
+        }
+        for (size_t done = 0; done < outUsed; ) {
+            ssize_t n = write(fd, out + done, outUsed - done);
+            if (n <= 0) {
+                client->failed = 1;
+                close(fd);
+                return NULL;
+            }
+            done += (size_t) n;
+        }
+        ssize_t n = read(fd, in + inUsed, sizeof(in) - inUsed);
+        if (n <= 0) {
+            client->failed = 1;
+            break;
+        }
+        inUsed += (size_t) n;
+        now = nowSeconds();
+        char *line = in, *end = in + inUsed, *newline;
+        while ((newline = memchr(line, '\n', end - line)) != NULL) {
+            if (strncmp(line, "ok", 2) != 0)
+                client->errors++;
+            recordLatency(client, (now - sentAt[first]) * 1e6);
+            first = (first + 1) % LOAD_MAX_PIPELINE;
+            outstanding--;
+            line = newline + 1;
+        }
+        inUsed = end - line;
+        memmove(in, line, inUsed);
+    }
+    close(fd);
+    return NULL;
+}
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * percentile returns the nearest-rank percentile of an ascending array.
+ */
+static double percentile(const double *sorted, long count, double p) {
+    if (count == 0)
+        return 0.0;
+    long rank = (long) ceil(p * count);
+    if (rank < 1)
+        rank = 1;
+    return sorted[rank - 1];
+}
+
+static void printUsage(const char *program) {
+    fprintf(stderr, "Usage: %s <socket> [--clients <n>] [--seconds <s>] [--pipeline <n>] [--reads <percent>]\n"
+                    "       [--rows <n>] [--cols <n>]\n", program);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argv[1][0] == '-') {
+        printUsage(argv[0]);
+        return 1;
+    }
+    LoadConfig config = { argv[1], 100, 26, 16, 90, 5.0 };
+    int clients = 8;
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        if (strcmp(argv[i], "--clients") == 0)
+            clients = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--seconds") == 0)
+            config.seconds = atof(argv[++i]);
+        else if (strcmp(argv[i], "--pipeline") == 0)
+            config.pipeline = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--reads") == 0)
+            config.readPercent = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--rows") == 0)
+            config.rows = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--cols") == 0)
+            config.cols = atoi(argv[++i]);
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (clients < 1 || config.pipeline < 1 || config.pipeline > LOAD_MAX_PIPELINE || config.rows < 1 ||
+        config.cols < 1 || config.readPercent < 0 || config.readPercent > 100 || config.seconds <= 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    LoadClient *states = calloc(clients, sizeof(LoadClient));
+    pthread_t *threads = malloc(clients * sizeof(pthread_t));
+    if (!states || !threads) {
+        perror("Failed to allocate clients");
+        return 1;
+    }
+    double begin = nowSeconds();
+    for (int i = 0; i < clients; i++) {
+        states[i].config = &config;
+        states[i].rng = 88172645463325252ULL + 7919ULL * i;
+        pthread_create(&threads[i], NULL, clientMain, &states[i]);
+    }
+    long total = 0, errors = 0;
+    int failed = 0;
+    for (int i = 0; i < clients; i++) {
+        pthread_join(threads[i], NULL);
+        total += states[i].count;
+        errors += states[i].errors;
+        failed += states[i].failed;
+    }
+    double elapsed = nowSeconds() - begin;
+
+    double *all = malloc((total > 0 ? total : 1) * sizeof(double));
+    if (!all) {
+        perror("Failed to allocate latencies");
+        return 1;
+    }
+    long filled = 0;
+    for (int i = 0; i < clients; i++) {
+        memcpy(all + filled, states[i].latencies, states[i].count * sizeof(double));
+        filled += states[i].count;
+        free(states[i].latencies);
+    }
+    qsort(all, total, sizeof(double), compareDoubles);
+
+    printf("loadgen: %d clients, pipeline %d, %d%% reads, %dx%d cells, %.1f s\n",
+           clients, config.pipeline, config.readPercent, config.rows, config.cols, elapsed);
+    printf("  requests   %ld (%ld errors, %d clients failed)\n", total, errors, failed);
+    printf("  throughput %.1f ops/s\n", elapsed > 0 ? total / elapsed : 0.0);
+    printf("  latency    p50 %.1f us  p99 %.1f us  p99.9 %.1f us  max %.1f us\n",
+           percentile(all, total, 0.50), percentile(all, total, 0.99), percentile(all, total, 0.999),
+           total ? all[total - 1] : 0.0);
+    free(all);
+    free(states);
+    free(threads);
+    return failed ? 1 : 0;
+}
@@ -186,8 +186,8 @@ void exportSpreadsheetToExcel(Spreadsheet *spreadsheet, const char *filename) {
     for (int r = 0; r < spreadsheet->rows; r++) {
         for (int c = 0; c < spreadsheet->cols; c++) {
             // Assuming each cell contains a numeric or string value
-            Cell *cell = &spreadsheet->table[r][c];
-            worksheet_write_number(worksheet, r, c, cell->value, NULL);
+            const Cell *cell = sheetPeek(spreadsheet, r, c);
+            worksheet_write_number(worksheet, r, c, cell ? cell->value : 0, NULL);
         }
     }
 
@@ -223,12 +223,12 @@ int main(int argc, char *argv[]) {
 
     int rows = atoi(argv[1]);
     int cols = atoi(argv[2]);
-    if (rows >= 1000 || rows <= 0) {
-        printf("Error: Rows should be in the range 1 to 1000 inclusive\n");
+    if (rows > SHEET_MAX_ROWS || rows <= 0) {
+        printf("Error: Rows should be in the range 1 to %d inclusive\n", SHEET_MAX_ROWS);
         return 1;
     }
-    if (cols >= 18279 || cols <= 0) {
-        printf("Error: Cols should be in the range 1 to 18278 inclusive\n");
+    if (cols > SHEET_MAX_COLS || cols <= 0) {
+        printf("Error: Cols should be in the range 1 to %d inclusive\n", SHEET_MAX_COLS);
         return 1;
     }
 
@@ -258,7 +258,7 @@ int main(int argc, char *argv[]) {
 
     char input[MAX_INPUT_SIZE];
     while (fgets(input, sizeof(input), file)) {
-        clock_t start = clock();
+        double start = monotonicSeconds();
 
         if (!parseInput(input, spreadsheet, start)) {
             break;
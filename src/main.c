@@ -1,56 +1,162 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "spreadsheet.h"
 #include "input_parser.h"
-#include <time.h>
+#include "script.h"
+#include "snapshot.h"
+#include "journal.h"
+#include "server.h"
+#include "ingest.h"
+#include "background.h"
+#include "value_plane.h"
 
 #define MAX_INPUT_SIZE 100
 
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        printf("[0.0] (Usage: %s <rows> <cols>)\n", argv[0]);
-        return 1;
-    }
-
+static void printUsage(const char *program) {
+    printf("[0.0] (Usage: %s <rows> <cols> [--load <snapshot>] [--journal <file>] [--script <file>]\n"
+           "       [--serve <socket> [--readers <n>] [--ingest <path> [--tick <ms>]]]\n"
+           "       [--spill <dir> [--resident <MB>]])\n", program);
+}
 
+/*
+ * parseOption reads the whole of text as an integer in min..max into *value; it returns -1,
+ * leaving *value alone, if text is anything else.
+ */
+static int parseOption(const char *text, long min, long max, int *value) {
     char *endptr;
-    int rows = strtol(argv[1], &endptr, 10);
-    if (*endptr != '\0') {
-        printf("[0.0] (Invalid input: %s is not a valid integer.)\n", argv[1]);
+    long parsed = strtol(text, &endptr, 10);
+    if (endptr == text || *endptr != '\0' || parsed < min || parsed > max)
+        return -1;
+    *value = (int) parsed;
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *scriptPath = NULL;
+    const char *loadPath = NULL;
+    const char *journalPath = NULL;
+    const char *servePath = NULL;
+    const char *ingestPath = NULL;
+    int readerThreads = SERVER_READER_THREADS;
+    int tickMillis = INGEST_TICK_MS;
+    const char *spillPath = NULL;
+    long residentMegabytes = 0;
+    char *positional[2];
+    int positionalCount = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--script") == 0 && i + 1 < argc) {
+            scriptPath = argv[++i];
+        } else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc) {
+            loadPath = argv[++i];
+        } else if (strcmp(argv[i], "--journal") == 0 && i + 1 < argc) {
+            journalPath = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            servePath = argv[++i];
+        } else if (strcmp(argv[i], "--readers") == 0 && i + 1 < argc) {
+            if (parseOption(argv[++i], 1, PLANE_READER_SLOTS, &readerThreads) != 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--ingest") == 0 && i + 1 < argc) {
+            ingestPath = argv[++i];
+        } else if (strcmp(argv[i], "--tick") == 0 && i + 1 < argc) {
+            if (parseOption(argv[++i], 1, INGEST_TICK_MAX_MS, &tickMillis) != 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--spill") == 0 && i + 1 < argc) {
+            spillPath = argv[++i];
+        } else if (strcmp(argv[i], "--resident") == 0 && i + 1 < argc) {
+            residentMegabytes = atol(argv[++i]);
+        } else if (positionalCount < 2 && strncmp(argv[i], "--", 2) != 0) {
+            positional[positionalCount++] = argv[i];
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if ((ingestPath && !servePath) || (residentMegabytes && !spillPath)) {
+        printUsage(argv[0]);
         return 1;
     }
-    int cols = strtol(argv[2], &endptr, 10);
-    if (*endptr != '\0') {
-        printf("[0.0] (Invalid input: %s is not a valid integer.)\n", argv[1]);
+    // The dimensions may be omitted when they come from a snapshot or a journal.
+    if (positionalCount != 2 && !(positionalCount == 0 && (loadPath || journalPath))) {
+        printUsage(argv[0]);
         return 1;
     }
-    if (rows >= 1000 || rows <= 0)
-    {
-        printf("[0.0] (Error: Rows should be in the range 1 to 1000 inclusive)");
+
+    long rows = 1, cols = 1;
+    if (positionalCount == 2) {
+        char *endptr;
+        rows = strtol(positional[0], &endptr, 10);
+        if (*endptr != '\0') {
+            printf("[0.0] (Invalid input: %s is not a valid integer.)\n", positional[0]);
+            return 1;
+        }
+        cols = strtol(positional[1], &endptr, 10);
+        if (*endptr != '\0') {
+            printf("[0.0] (Invalid input: %s is not a valid integer.)\n", positional[0]);
+            return 1;
+        }
+        if (rows > SHEET_MAX_ROWS || rows <= 0)
+        {
+            printf("[0.0] (Error: Rows should be in the range 1 to %d inclusive)", SHEET_MAX_ROWS);
+            return 1;
+        }
+        if (cols > SHEET_MAX_COLS || cols <= 0)
+        {
+            printf("[0.0] (Error: Cols should be in the range 1 to %d inclusive)", SHEET_MAX_COLS);
+            return 1;
+        }
+    }
+
+    // Tiles go to the spill directory from the first store on, the one of a loaded snapshot included.
+    if (spillPath && tileBackingConfigure(spillPath, residentMegabytes) != 0) {
+        printf("[0.0] (Error: Cannot spill tiles to %s.)\n", spillPath);
         return 1;
     }
-    if (cols >= 18279 || cols <= 0)
-    {
-        printf("[0.0] (Error: Cols should be in the range 1 to 18278 inclusive)");
+
+    Spreadsheet *spreadsheet = initializeSpreadsheet((int) rows, (int) cols);
+
+    if (loadPath && loadSnapshot(spreadsheet, loadPath) != 0) {
+        printf("[0.0] (Error: Could not load snapshot %s.)\n", loadPath);
+        freeSpreadsheet(spreadsheet);
         return 1;
     }
 
+    // An existing journal is replayed first; from then on every accepted command is appended to it.
+    if (journalPath) {
+        spreadsheet->journal = openJournal(journalPath, spreadsheet, loadPath);
+        if (!spreadsheet->journal) {
+            printf("[0.0] (Error: Could not open journal %s.)\n", journalPath);
+            freeSpreadsheet(spreadsheet);
+            return 1;
+        }
+    }
 
-    Spreadsheet *spreadsheet = initializeSpreadsheet(rows, cols);
+    if (scriptPath || servePath) {
+        int status = scriptPath ? runScript(scriptPath, spreadsheet) : runServer(servePath, spreadsheet, readerThreads, ingestPath, tickMillis);
+        closeJournal(spreadsheet->journal);
+        freeSpreadsheet(spreadsheet);
+        return status;
+    }
 
     printSpreadsheet(spreadsheet);
     printf("[0.0] (ok) ");
 
+    // From here on a cascade runs in the background while the prompt waits (see background.h).
+    spreadsheet->background = createBackgroundRecalc();
+
     char input[MAX_INPUT_SIZE];
     while (1) {
-        clock_t start;
-        start = clock();
-
         printf("> ");
         if (!fgets(input, sizeof(input), stdin)) {
             printf("[0.0] (unrecognized cmd) ");
             break;
         }
+        // Wall-clock timing starts once the command has been read, not while waiting for it.
+        double start = monotonicSeconds();
 
         // Parse the input and handle commands
         if (!parseInput(input, spreadsheet, start)) {
@@ -58,6 +164,7 @@ int main(int argc, char *argv[]) {
         }
     }
 
+    closeJournal(spreadsheet->journal);
     freeSpreadsheet(spreadsheet);
     return 0;
 }
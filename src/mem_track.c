@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include "mem_track.h"
+
+#ifdef SHEET_STATS
+
+/*
+   ---------------- Memory accounting ----------------
+
+   One set of counters per tag plus a total.  CSV import allocates from pool workers, so the
+   counters are updated with relaxed atomics; peaks are raised with a compare-and-swap loop.
+*/
+
+static MemTagStats tagStats[MEM_TAG_COUNT];
+static long long totalLive;
+static long long totalPeak;
+
+static const char *const tagNames[MEM_TAG_COUNT] = {
+    "cells", "packed", "edges", "advanced", "recalc", "visited", "render", "io", "versions", "feed", "other"
+};
+
+static void raisePeak(long long *peak, long long live) {
+    long long seen = __atomic_load_n(peak, __ATOMIC_RELAXED);
+    while (live > seen &&
+           !__atomic_compare_exchange_n(peak, &seen, live, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/*
+ * account adds delta bytes to tag (negative on free) and counts one allocation or free.
+ */
+static void account(int tag, long long delta, int isFree) {
+    MemTagStats *stats = &tagStats[tag];
+    long long live = __atomic_add_fetch(&stats->liveBytes, delta, __ATOMIC_RELAXED);
+    long long total = __atomic_add_fetch(&totalLive, delta, __ATOMIC_RELAXED);
+    if (isFree) {
+        __atomic_add_fetch(&stats->frees, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_add_fetch(&stats->allocs, 1, __ATOMIC_RELAXED);
+    raisePeak(&stats->peakBytes, live);
+    raisePeak(&totalPeak, total);
+}
+
+void *memAlloc(int tag, size_t size) {
+    void *ptr = malloc(size);
+    if (ptr)
+        account(tag, (long long) size, 0);
+    return ptr;
+}
+
+void *memCalloc(int tag, size_t count, size_t size) {
+    void *ptr = calloc(count, size);
+    if (ptr)
+        account(tag, (long long) (count * size), 0);
+    return ptr;
+}
+
+/*
+ * memRealloc resizes a tracked block.  A successful resize counts as one allocation of the
+ * difference; growing from NULL is a plain allocation.
+ */
+void *memRealloc(int tag, void *ptr, size_t oldSize, size_t newSize) {
+    void *grown = realloc(ptr, newSize);
+    if (grown)
+        account(tag, (long long) newSize - (long long) (ptr ? oldSize : 0), 0);
+    return grown;
+}
+
+void memFree(int tag, void *ptr, size_t size) {
+    if (!ptr)
+        return;
+    free(ptr);
+    account(tag, -(long long) size, 1);
+}
+
+/*
+ * memSnapshot copies the per-tag counters and the peak of all tags together.
+ */
+void memSnapshot(MemTagStats out[MEM_TAG_COUNT], long long *peak) {
+    for (int i = 0; i < MEM_TAG_COUNT; i++) {
+        out[i].liveBytes = __atomic_load_n(&tagStats[i].liveBytes, __ATOMIC_RELAXED);
+        out[i].peakBytes = __atomic_load_n(&tagStats[i].peakBytes, __ATOMIC_RELAXED);
+        out[i].allocs = __atomic_load_n(&tagStats[i].allocs, __ATOMIC_RELAXED);
+        out[i].frees = __atomic_load_n(&tagStats[i].frees, __ATOMIC_RELAXED);
+    }
+    if (peak)
+        *peak = __atomic_load_n(&totalPeak, __ATOMIC_RELAXED);
+}
+
+const char *memTagName(int tag) {
+    return tagNames[tag];
+}
+
+/*
+ * memPrint writes live and peak bytes and allocation counts per tag to stdout.
+ */
+void memPrint(void) {
+    MemTagStats stats[MEM_TAG_COUNT];
+    long long peak;
+    memSnapshot(stats, &peak);
+    long long live = 0;
+    unsigned long long allocs = 0, frees = 0;
+    printf("%-12s %16s %16s %14s %14s\n", "tag", "live_bytes", "peak_bytes", "allocs", "frees");
+    for (int i = 0; i < MEM_TAG_COUNT; i++) {
+        printf("%-12s %16lld %16lld %14llu %14llu\n", tagNames[i],
+               stats[i].liveBytes, stats[i].peakBytes, stats[i].allocs, stats[i].frees);
+        live += stats[i].liveBytes;
+        allocs += stats[i].allocs;
+        frees += stats[i].frees;
+    }
+    printf("%-12s %16lld %16lld %14llu %14llu\n", "total", live, peak, allocs, frees);
+}
+
+#else
+
+/* ISO C forbids an empty translation unit. */
+typedef int memTrackDisabled;
+
+#endif  // SHEET_STATS
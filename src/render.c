@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "render.h"
+#include "stats.h"
+#include "mem_track.h"
+#include "trace.h"
+#include "workbook.h"
+#include "background.h"
+
+/*
+   ---------------- Buffered viewport renderer ----------------
+
+   Every command re-renders the visible window.  Instead of issuing one printf per cell,
+   the whole frame is formatted into a reusable buffer with a hand-rolled integer formatter
+   and precomputed column labels, and then emitted with a single write().
+*/
+
+/*
+ * getColumnLabel generates a column label (like A, B, AA, etc.) based on a zero-indexed column number.
+ * It converts the number into letters and stores the result in the provided buffer.
+ */
+void getColumnLabel(int colIndex, char *label) {
+    int i = 0;
+    char temp[4];
+    while (colIndex >= 0) {
+        temp[i++] = 'A' + (colIndex % 26);
+        colIndex = (colIndex / 26) - 1;
+    }
+    temp[i] = '\0';
+    int len = strlen(temp);
+    for (int j = 0; j < len; j++) {
+        label[j] = temp[len - j - 1];
+    }
+    label[len] = '\0';
+}
+
+/*
+ * formatInt writes the decimal representation of value into out (no terminator)
+ * and returns the number of characters written.  It handles INT_MIN correctly.
+ */
+int formatInt(char *out, int value) {
+    char temp[12];
+    int len = 0;
+    unsigned int magnitude = (value < 0) ? 0u - (unsigned int) value : (unsigned int) value;
+    do {
+        temp[len++] = (char) ('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    int n = 0;
+    if (value < 0)
+        out[n++] = '-';
+    while (len > 0)
+        out[n++] = temp[--len];
+    return n;
+}
+
+/*
+ * putPadded right-aligns len bytes of text in a field of the given width,
+ * matching printf's "%<width>s" behaviour, and returns the new write position.
+ */
+static char *putPadded(char *p, const char *text, int len, int width) {
+    if (len < width) {
+        memset(p, ' ', width - len);
+        p += width - len;
+    }
+    memcpy(p, text, len);
+    return p + len;
+}
+
+/*
+ * writeAll writes the whole buffer to stdout, retrying on short writes and EINTR.
+ * Anything still sitting in stdio's buffer is flushed first so output stays ordered.
+ */
+static void writeAll(const char *buf, size_t len) {
+    fflush(stdout);
+    while (len > 0) {
+        ssize_t written = write(STDOUT_FILENO, buf, len);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        buf += written;
+        len -= (size_t) written;
+    }
+}
+
+/*
+ * createRenderer allocates the frame buffers and builds the column label table
+ * for a sheet with the given number of columns.
+ */
+Renderer *createRenderer(int cols) {
+    Renderer *renderer = memCalloc(MEM_RENDER, 1, sizeof(Renderer));
+    if (!renderer) {
+        perror("Failed to allocate Renderer");
+        exit(EXIT_FAILURE);
+    }
+    renderer->labels = memAlloc(MEM_RENDER, cols * sizeof(*renderer->labels));
+    renderer->labelLengths = memAlloc(MEM_RENDER, cols);
+    renderer->frame = memAlloc(MEM_RENDER, RENDER_FRAME_MAX);
+    renderer->prevFrame = memAlloc(MEM_RENDER, RENDER_FRAME_MAX);
+    renderer->out = memAlloc(MEM_RENDER, RENDER_FRAME_MAX);
+    if (!renderer->labels || !renderer->labelLengths || !renderer->frame ||
+        !renderer->prevFrame || !renderer->out) {
+        perror("Failed to allocate renderer buffers");
+        exit(EXIT_FAILURE);
+    }
+    renderer->labelCount = cols;
+    for (int col = 0; col < cols; col++) {
+        char label[4];
+        getColumnLabel(col, label);
+        size_t len = strlen(label);
+        memcpy(renderer->labels[col], label, len);
+        renderer->labelLengths[col] = (unsigned char) len;
+    }
+    return renderer;
+}
+
+/*
+ * freeRenderer releases the label table and frame buffers.
+ */
+void freeRenderer(Renderer *renderer) {
+    if (renderer) {
+        memFree(MEM_RENDER, renderer->labels, renderer->labelCount * sizeof(*renderer->labels));
+        memFree(MEM_RENDER, renderer->labelLengths, renderer->labelCount);
+        memFree(MEM_RENDER, renderer->frame, RENDER_FRAME_MAX);
+        memFree(MEM_RENDER, renderer->prevFrame, RENDER_FRAME_MAX);
+        memFree(MEM_RENDER, renderer->out, RENDER_FRAME_MAX);
+        memFree(MEM_RENDER, renderer, sizeof(Renderer));
+    }
+}
+
+/*
+ * setDeltaRendering turns delta mode on or off.  The next frame is always emitted in full.
+ */
+void setDeltaRendering(Spreadsheet *spreadsheet, int enabled) {
+    spreadsheet->renderer->deltaMode = enabled;
+    spreadsheet->renderer->prevValid = 0;
+}
+
+/*
+ * buildFrame formats the current viewport into renderer->frame and records where each line starts.
+ * The layout is identical to the original printf-based output.
+ */
+static int buildFrame(Renderer *renderer, Spreadsheet *spreadsheet) {
+    int endRow = (spreadsheet->startRow + VIEW_ROWS < spreadsheet->rows) ? spreadsheet->startRow + VIEW_ROWS : spreadsheet->rows;
+    int endCol = (spreadsheet->startCol + VIEW_COLS < spreadsheet->cols) ? spreadsheet->startCol + VIEW_COLS : spreadsheet->cols;
+    char *p = renderer->frame;
+    char digits[12];
+    int line = 0;
+
+    renderer->lineStart[line++] = 0;
+    memset(p, ' ', ROW_LABEL_WIDTH);
+    p += ROW_LABEL_WIDTH;
+    for (int col = spreadsheet->startCol; col < endCol; col++)
+        p = putPadded(p, renderer->labels[col], renderer->labelLengths[col], CELL_WIDTH);
+    *p++ = '\n';
+
+    for (int row = spreadsheet->startRow; row < endRow; row++) {
+        renderer->lineStart[line++] = (int) (p - renderer->frame);
+        p = putPadded(p, digits, formatInt(digits, row + 1), ROW_LABEL_WIDTH);
+        for (int col = spreadsheet->startCol; col < endCol; col++) {
+            const Cell *cell = sheetPeek(spreadsheet, row, col);
+            if (!cell)
+                p = putPadded(p, "0", 1, CELL_WIDTH);
+            else if (cell->error)
+                p = putPadded(p, "ERR", 3, CELL_WIDTH);
+            else
+                p = putPadded(p, digits, formatInt(digits, cell->value), CELL_WIDTH);
+        }
+        *p++ = '\n';
+    }
+    renderer->lineStart[line] = (int) (p - renderer->frame);
+    renderer->lineCount = line;
+    return (int) (p - renderer->frame);
+}
+
+/*
+ * printSpreadsheet prints a portion of the spreadsheet (up to 10 rows and 10 columns)
+ * starting from the current starting row and column.
+ * If output is disabled (or the sheet runs quietly), it simply returns without printing anything.
+ * In delta mode, only lines that differ from the previously emitted frame are written.
+ */
+void printSpreadsheet(Spreadsheet *spreadsheet) {
+    Renderer *renderer = spreadsheet->renderer;
+    commitPendingCommand(spreadsheet);
+    if (spreadsheet->display == 1 || spreadsheet->quiet) {
+        renderer->prevValid = 0;
+        return;
+    }
+    // Cells in view get their final values before they are drawn; the rest of a pending plan
+    // stays in the background.
+    int endRow = (spreadsheet->startRow + VIEW_ROWS < spreadsheet->rows) ? spreadsheet->startRow + VIEW_ROWS : spreadsheet->rows;
+    int endCol = (spreadsheet->startCol + VIEW_COLS < spreadsheet->cols) ? spreadsheet->startCol + VIEW_COLS : spreadsheet->cols;
+    backgroundSettle(homeSheet(spreadsheet)->background, spreadsheet,
+                     spreadsheet->startRow, spreadsheet->startCol, endRow - 1, endCol - 1);
+    STATS_ENTER(STATS_PHASE_RENDER);
+    TRACE_BEGIN(traceMark);
+    int frameLen = buildFrame(renderer, spreadsheet);
+
+    if (renderer->deltaMode && renderer->prevValid &&
+        renderer->prevStartRow == spreadsheet->startRow &&
+        renderer->prevStartCol == spreadsheet->startCol &&
+        renderer->prevLineCount == renderer->lineCount) {
+        char *out = renderer->out;
+        for (int i = 0; i < renderer->lineCount; i++) {
+            int start = renderer->lineStart[i];
+            int len = renderer->lineStart[i + 1] - start;
+            int prevLen = renderer->prevLineStart[i + 1] - renderer->prevLineStart[i];
+            if (len != prevLen ||
+                memcmp(renderer->frame + start, renderer->prevFrame + renderer->prevLineStart[i], len) != 0) {
+                memcpy(out, renderer->frame + start, len);
+                out += len;
+            }
+        }
+        if (out != renderer->out)
+            writeAll(renderer->out, (size_t) (out - renderer->out));
+    } else {
+        writeAll(renderer->frame, (size_t) frameLen);
+    }
+
+    /* The frame just built becomes the reference for the next delta. */
+    char *tmp = renderer->prevFrame;
+    renderer->prevFrame = renderer->frame;
+    renderer->frame = tmp;
+    memcpy(renderer->prevLineStart, renderer->lineStart, sizeof(renderer->lineStart));
+    renderer->prevLineCount = renderer->lineCount;
+    renderer->prevStartRow = spreadsheet->startRow;
+    renderer->prevStartCol = spreadsheet->startCol;
+    renderer->prevValid = 1;
+    TRACE_SPAN(traceMark, "render", -1, -1, renderer->lineCount);
+    STATS_LEAVE();
+}
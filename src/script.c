@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "script.h"
+#include "input_parser.h"
+#include "mem_track.h"
+
+/*
+   ---------------- Script (bulk) mode ----------------
+
+   runScript maps a command file into memory and feeds it to parseInput line by line.
+   The mapping is private and writable, so each newline is replaced by a terminator in place
+   and no line is ever copied.  Prompts, frames and status lines are suppressed; a single
+   throughput summary is printed to stderr when the script ends.
+*/
+
+/*
+ * runScript executes every command in the file at path and returns the process exit status.
+ */
+int runScript(const char *path, Spreadsheet *spreadsheet) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open script");
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror("Failed to stat script");
+        close(fd);
+        return 1;
+    }
+    size_t size = (size_t) st.st_size;
+    char *map = NULL;
+    if (size > 0) {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            perror("Failed to map script");
+            close(fd);
+            return 1;
+        }
+        madvise(map, size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    spreadsheet->quiet = 1;
+    long commands = 0;
+    double begin = monotonicSeconds();
+
+    char *line = map;
+    char *end = map + size;
+    int running = 1;
+    while (running && line < end) {
+        char *newline = memchr(line, '\n', end - line);
+        if (newline) {
+            *newline = '\0';
+            commands++;
+            running = parseInput(line, spreadsheet, monotonicSeconds());
+            line = newline + 1;
+        } else {
+            /* The last line has no newline and there is no room to terminate it in the mapping. */
+            size_t len = end - line;
+            char *tail = memAlloc(MEM_IO, len + 1);
+            if (!tail) {
+                perror("Failed to allocate script line");
+                exit(EXIT_FAILURE);
+            }
+            memcpy(tail, line, len);
+            tail[len] = '\0';
+            commands++;
+            parseInput(tail, spreadsheet, monotonicSeconds());
+            memFree(MEM_IO, tail, len + 1);
+            line = end;
+        }
+    }
+
+    double elapsed = monotonicSeconds() - begin;
+    if (map)
+        munmap(map, size);
+    spreadsheet->quiet = 0;
+
+    fprintf(stderr, "[script] %ld commands (%ld rejected) in %.3f s, %.1f commands/s\n",
+            commands, spreadsheet->rejectedCount, elapsed,
+            elapsed > 0 ? commands / elapsed : 0.0);
+    return 0;
+}
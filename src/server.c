@@ -0,0 +1,788 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+#include "input_parser.h"
+#include "value_plane.h"
+#include "change_feed.h"
+#include "ingest.h"
+#include "render.h"
+#include "mem_track.h"
+
+/*
+   ---------------- Server mode ----------------
+
+   The epoll loop on the main thread reads request lines and keeps every connection's requests
+   in arrival order.  Commands are handed to the writer queue as they arrive, so the writer
+   runs each connection's commands in order; a read is handed to the reader queue only once no
+   earlier command of its connection is still running.  Workers put finished requests on the
+   done queue and signal an eventfd; the loop then writes out every finished request at the
+   head of each connection.  Only the writer thread touches the engine; readers only open
+   views on the home sheet's value plane.  With --ingest, the loop also drains the ingest
+   (see ingest.h) and passes each finished tick to the writer as a request of its own, with no
+   connection; at most one is in flight.  All buffers are accounted under MEM_IO.
+*/
+
+#define SERVER_IN_BUFFER 4096
+#define SERVER_EVENTS    64
+
+typedef struct Request {
+    struct Request *next;           // link in a work queue
+    struct Request *connNext;       // link in the connection's arrival order
+    struct Connection *conn;        // NULL for an ingest tick
+    IngestBatch *ingest;
+    int isRead;
+    int submitted;
+    int done;
+    char *response;
+    size_t responseSize;
+    char line[SERVER_MAX_LINE + 1];
+} Request;
+
+typedef struct Connection {
+    int fd;
+    struct Connection *prev, *next;     // every open connection
+    char in[SERVER_IN_BUFFER];
+    size_t inUsed;
+    int discarding;                     // skipping the rest of an overlong line
+    Request *head, *tail;               // requests not answered yet, in arrival order
+    Request *nextSubmit;                // first request not yet handed to a worker
+    int pending;
+    int inFlight;                       // handed to a worker and not back yet
+    int writesInFlight;
+    char *out;
+    size_t outUsed, outSent, outCapacity;
+    int quit;                           // "q" or end of input: close once everything is answered
+    int closing;                        // socket closed; freed once nothing is in flight
+    unsigned int events;
+} Connection;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    Request *head, *tail;
+    int stop;
+} WorkQueue;
+
+typedef struct {
+    Spreadsheet *spreadsheet;
+    int listenFd, epollFd, wakeFd, signalFd;
+    WorkQueue writes, reads, done;
+    pthread_t writer;
+    pthread_t *readers;
+    int readerCount;
+    Connection *connections;
+    Connection *released;               // freed at the end of the current loop iteration
+    Ingest *ingest;                     // NULL without --ingest
+    Request ingestRequest;
+    unsigned long commands, batches, readsAnswered;
+} Server;
+
+// epoll tokens of the descriptors that are not connections.
+static char listenToken, wakeToken, signalToken, ingestToken;
+
+/*
+   ---------------- Work queues ----------------
+*/
+
+static void queueInit(WorkQueue *queue) {
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->ready, NULL);
+    queue->head = queue->tail = NULL;
+    queue->stop = 0;
+}
+
+static void queueDestroy(WorkQueue *queue) {
+    pthread_mutex_destroy(&queue->lock);
+    pthread_cond_destroy(&queue->ready);
+}
+
+/*
+ * queuePush appends a chain of requests linked through next.
+ */
+static void queuePush(WorkQueue *queue, Request *first) {
+    Request *last = first;
+    while (last->next)
+        last = last->next;
+    pthread_mutex_lock(&queue->lock);
+    if (queue->tail)
+        queue->tail->next = first;
+    else
+        queue->head = first;
+    queue->tail = last;
+    pthread_cond_signal(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+ * queueTake waits for work and detaches up to max requests from the front of the queue.
+ * Returns NULL once the queue is stopped.
+ */
+static Request *queueTake(WorkQueue *queue, int max) {
+    pthread_mutex_lock(&queue->lock);
+    while (!queue->head && !queue->stop)
+        pthread_cond_wait(&queue->ready, &queue->lock);
+    if (queue->stop) {
+        pthread_mutex_unlock(&queue->lock);
+        return NULL;
+    }
+    Request *first = queue->head, *last = first;
+    for (int taken = 1; taken < max && last->next; taken++)
+        last = last->next;
+    queue->head = last->next;
+    if (!queue->head)
+        queue->tail = NULL;
+    last->next = NULL;
+    pthread_mutex_unlock(&queue->lock);
+    return first;
+}
+
+/*
+ * queueDrain detaches everything queued without waiting.
+ */
+static Request *queueDrain(WorkQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    Request *first = queue->head;
+    queue->head = queue->tail = NULL;
+    pthread_mutex_unlock(&queue->lock);
+    return first;
+}
+
+static void queueStop(WorkQueue *queue) {
+    pthread_mutex_lock(&queue->lock);
+    queue->stop = 1;
+    pthread_cond_broadcast(&queue->ready);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+/*
+ * finish hands answered requests back to the event loop.
+ */
+static void finish(Server *server, Request *first) {
+    uint64_t one = 1;
+    queuePush(&server->done, first);
+    if (write(server->wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        perror("Failed to wake the event loop");
+}
+
+static void setResponse(Request *request, const char *text, size_t length) {
+    request->response = memAlloc(MEM_IO, length + 1);
+    if (!request->response) {
+        perror("Failed to allocate response");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(request->response, text, length);
+    request->response[length] = '\0';
+    request->responseSize = length + 1;
+}
+
+/*
+   ---------------- Workers ----------------
+*/
+
+/*
+ * writerMain runs queued commands in batches.  The batch is published, and delivered to change
+ * subscribers as one commit, before it is answered, so a read that follows a command on the
+ * same connection sees its effect.
+ */
+static void *writerMain(void *arg) {
+    Server *server = (Server *) arg;
+    Spreadsheet *spreadsheet = server->spreadsheet;
+    char status[SERVER_MAX_LINE];
+    Request *batch;
+    while ((batch = queueTake(&server->writes, SERVER_MAX_BATCH)) != NULL) {
+        spreadsheet->deferPublish = 1;
+        spreadsheet->statusOut = status;
+        spreadsheet->statusOutSize = sizeof(status);
+        for (Request *request = batch; request; request = request->next) {
+            if (request->ingest) {
+                ingestApply(server->ingest, request->ingest, spreadsheet);
+                continue;
+            }
+            status[0] = '\0';
+            parseInput(request->line, spreadsheet, monotonicSeconds());
+            if (status[0] == '\0')
+                strcpy(status, "ok");
+            setResponse(request, status, strlen(status));
+            server->commands++;
+        }
+        spreadsheet->statusOut = NULL;
+        spreadsheet->deferPublish = 0;
+        publishWorkbookValues(spreadsheet);
+        changeFeedCommit(spreadsheet);
+        packIdleTiles(spreadsheet);
+        server->batches++;
+        finish(server, batch);
+    }
+    return NULL;
+}
+
+/*
+ * answerRead answers "get <cell>" or "get <cell>:<cell>" from the latest published version.
+ */
+static void answerRead(Server *server, Request *request) {
+    char startRef[16], endRef[16], extra[2];
+    int row1, col1, row2, col2;
+    const char *refs = request->line + 4;
+    int fields = sscanf(refs, "%15[A-Za-z0-9]:%15[A-Za-z0-9]%1s", startRef, endRef, extra);
+    if (fields == 1 && sscanf(refs, "%15s%1s", startRef, extra) == 1)
+        strcpy(endRef, startRef);
+    else if (fields != 2) {
+        const char *error = "Error: Use get <cell> or get <cell>:<cell>.";
+        setResponse(request, error, strlen(error));
+        return;
+    }
+    SheetView view;
+    openView(server->spreadsheet->plane, &view);
+    const char *error = NULL;
+    if (parseCellReference(startRef, &row1, &col1) != 0 || parseCellReference(endRef, &row2, &col2) != 0 ||
+        row2 >= view.version->rows || col2 >= view.version->cols ||
+        row1 >= view.version->rows || col1 >= view.version->cols)
+        error = "Error: Cell reference out of bounds.";
+    else if (row1 > row2 || col1 > col2)
+        error = "Error: Invalid range order.";
+    else if ((long) (row2 - row1 + 1) * (col2 - col1 + 1) > SERVER_MAX_GET_CELLS)
+        error = "Error: Range too large.";
+    if (error) {
+        closeView(&view);
+        setResponse(request, error, strlen(error));
+        return;
+    }
+    // Every cell takes at most 11 characters plus a separator.
+    long cells = (long) (row2 - row1 + 1) * (col2 - col1 + 1);
+    char *text = memAlloc(MEM_IO, 3 + cells * 12);
+    if (!text) {
+        perror("Failed to allocate response");
+        exit(EXIT_FAILURE);
+    }
+    char *p = text;
+    memcpy(p, "ok ", 3);
+    p += 3;
+    for (int r = row1; r <= row2; r++) {
+        for (int c = col1; c <= col2; c++) {
+            CellValue cell = viewCell(&view, r, c);
+            if (c > col1)
+                *p++ = ',';
+            if (cell.flags & VALUE_ERROR) {
+                memcpy(p, "ERR", 3);
+                p += 3;
+            } else {
+                p += formatInt(p, cell.value);
+            }
+        }
+        if (r < row2)
+            *p++ = ';';
+    }
+    closeView(&view);
+    setResponse(request, text, p - text);
+    memFree(MEM_IO, text, 3 + cells * 12);
+}
+
+static void *readerMain(void *arg) {
+    Server *server = (Server *) arg;
+    Request *request;
+    while ((request = queueTake(&server->reads, 1)) != NULL) {
+        answerRead(server, request);
+        finish(server, request);
+    }
+    return NULL;
+}
+
+/*
+   ---------------- Connections ----------------
+*/
+
+static void updateEvents(Server *server, Connection *conn) {
+    unsigned int events = (conn->outSent < conn->outUsed) ? EPOLLOUT : 0;
+    if (!conn->quit && conn->pending < SERVER_MAX_PENDING)
+        events |= EPOLLIN | EPOLLRDHUP;
+    if (events == conn->events)
+        return;
+    struct epoll_event event = { .events = events, .data.ptr = conn };
+    epoll_ctl(server->epollFd, EPOLL_CTL_MOD, conn->fd, &event);
+    conn->events = events;
+}
+
+/*
+ * releaseConnection unlinks a connection.  It is freed by freeReleased once the events of the
+ * current epoll_wait, which may still name it, have been handled.
+ */
+static void releaseConnection(Server *server, Connection *conn) {
+    if (conn->prev)
+        conn->prev->next = conn->next;
+    else
+        server->connections = conn->next;
+    if (conn->next)
+        conn->next->prev = conn->prev;
+    conn->next = server->released;
+    server->released = conn;
+}
+
+static void freeConnection(Connection *conn) {
+    Request *request = conn->head;
+    while (request) {
+        Request *next = request->connNext;
+        if (request->response)
+            memFree(MEM_IO, request->response, request->responseSize);
+        memFree(MEM_IO, request, sizeof(Request));
+        request = next;
+    }
+    if (conn->out)
+        memFree(MEM_IO, conn->out, conn->outCapacity);
+    memFree(MEM_IO, conn, sizeof(Connection));
+}
+
+static void freeReleased(Server *server) {
+    while (server->released) {
+        Connection *conn = server->released;
+        server->released = conn->next;
+        freeConnection(conn);
+    }
+}
+
+/*
+ * closeConnection closes the socket; the connection itself goes once its workers are done.
+ */
+static void closeConnection(Server *server, Connection *conn) {
+    if (conn->fd >= 0) {
+        epoll_ctl(server->epollFd, EPOLL_CTL_DEL, conn->fd, NULL);
+        close(conn->fd);
+        conn->fd = -1;
+    }
+    conn->closing = 1;
+    if (conn->inFlight == 0)
+        releaseConnection(server, conn);
+}
+
+/*
+ * submitReady hands requests to the workers in arrival order, stopping at a read that has to
+ * wait for earlier commands of the same connection.
+ */
+static void submitReady(Server *server, Connection *conn) {
+    Request *writes = NULL, *lastWrite = NULL;
+    for (; conn->nextSubmit; conn->nextSubmit = conn->nextSubmit->connNext) {
+        Request *request = conn->nextSubmit;
+        if (request->done)
+            continue;
+        if (request->isRead) {
+            if (conn->writesInFlight > 0 || writes)
+                break;
+            request->submitted = 1;
+            conn->inFlight++;
+            queuePush(&server->reads, request);
+            continue;
+        }
+        request->submitted = 1;
+        conn->inFlight++;
+        conn->writesInFlight++;
+        if (lastWrite)
+            lastWrite->next = request;
+        else
+            writes = request;
+        lastWrite = request;
+    }
+    if (writes)
+        queuePush(&server->writes, writes);
+}
+
+static void appendOutput(Connection *conn, const char *text, size_t length) {
+    if (conn->outUsed + length > conn->outCapacity) {
+        size_t capacity = conn->outCapacity ? conn->outCapacity : SERVER_IN_BUFFER;
+        while (conn->outUsed + length > capacity)
+            capacity *= 2;
+        conn->out = memRealloc(MEM_IO, conn->out, conn->outCapacity, capacity);
+        if (!conn->out) {
+            perror("Failed to grow output buffer");
+            exit(EXIT_FAILURE);
+        }
+        conn->outCapacity = capacity;
+    }
+    memcpy(conn->out + conn->outUsed, text, length);
+    conn->outUsed += length;
+}
+
+/*
+ * flushResponses moves the answered requests at the head of the connection to its output
+ * buffer and writes as much of it as the socket takes.
+ */
+static void flushResponses(Server *server, Connection *conn) {
+    while (conn->head && conn->head->done) {
+        Request *request = conn->head;
+        appendOutput(conn, request->response, request->responseSize - 1);
+        appendOutput(conn, "\n", 1);
+        conn->head = request->connNext;
+        if (!conn->head)
+            conn->tail = NULL;
+        conn->pending--;
+        memFree(MEM_IO, request->response, request->responseSize);
+        memFree(MEM_IO, request, sizeof(Request));
+    }
+    while (conn->outSent < conn->outUsed) {
+        ssize_t n = send(conn->fd, conn->out + conn->outSent, conn->outUsed - conn->outSent, MSG_NOSIGNAL);
+        if (n > 0) {
+            conn->outSent += (size_t) n;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else {
+            closeConnection(server, conn);
+            return;
+        }
+    }
+    if (conn->outSent == conn->outUsed)
+        conn->outSent = conn->outUsed = 0;
+    if (conn->quit && !conn->head && conn->outUsed == 0) {
+        closeConnection(server, conn);
+        return;
+    }
+    updateEvents(server, conn);
+}
+
+/*
+ * addRequest queues one request line, or, when answer is not NULL, a request answered on the
+ * spot with it.
+ */
+static void addRequest(Connection *conn, const char *line, size_t length, const char *answer) {
+    if (length > 0 && line[length - 1] == '\r')
+        length--;
+    if (!answer && length == 1 && line[0] == 'q') {
+        conn->quit = 1;
+        return;
+    }
+    Request *request = memCalloc(MEM_IO, 1, sizeof(Request));
+    if (!request) {
+        perror("Failed to allocate request");
+        exit(EXIT_FAILURE);
+    }
+    request->conn = conn;
+    if (answer) {
+        setResponse(request, answer, strlen(answer));
+        request->done = 1;
+    } else {
+        memcpy(request->line, line, length);
+        request->line[length] = '\0';
+        request->isRead = strncmp(request->line, "get ", 4) == 0;
+    }
+    if (conn->tail)
+        conn->tail->connNext = request;
+    else
+        conn->head = request;
+    conn->tail = request;
+    if (!conn->nextSubmit)
+        conn->nextSubmit = request;
+    conn->pending++;
+}
+
+/*
+ * addLine queues one request line.  "ingest_stats" is answered by the loop, which owns the
+ * ingest counters.
+ */
+static void addLine(Server *server, Connection *conn, const char *line, size_t length) {
+    static const char stats[] = "ingest_stats";
+    size_t trimmed = (length > 0 && line[length - 1] == '\r') ? length - 1 : length;
+    if (trimmed != sizeof(stats) - 1 || memcmp(line, stats, trimmed) != 0) {
+        addRequest(conn, line, length, NULL);
+        return;
+    }
+    char text[2 * SERVER_MAX_LINE];
+    if (server->ingest)
+        formatIngestStats(server->ingest, text, sizeof(text));
+    else
+        strcpy(text, "Error: No ingest is running.");
+    addRequest(conn, NULL, 0, text);
+}
+
+/*
+ * readConnection reads what the socket has and splits it into request lines.
+ */
+static void readConnection(Server *server, Connection *conn) {
+    while (!conn->quit && conn->pending < SERVER_MAX_PENDING) {
+        ssize_t n = read(conn->fd, conn->in + conn->inUsed, sizeof(conn->in) - conn->inUsed);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0) {
+            // End of input: everything already sent still gets its answer.
+            conn->quit = 1;
+            break;
+        }
+        conn->inUsed += (size_t) n;
+        char *line = conn->in, *end = conn->in + conn->inUsed, *newline;
+        while (!conn->quit && (newline = memchr(line, '\n', end - line)) != NULL) {
+            size_t length = newline - line;
+            if (conn->discarding)
+                conn->discarding = 0;
+            else if (length > SERVER_MAX_LINE)
+                addRequest(conn, NULL, 0, "Error: Line too long.");
+            else
+                addLine(server, conn, line, length);
+            line = newline + 1;
+        }
+        size_t rest = end - line;
+        if (rest > SERVER_MAX_LINE && !conn->discarding) {
+            addRequest(conn, NULL, 0, "Error: Line too long.");
+            conn->discarding = 1;
+        }
+        if (conn->discarding)
+            rest = 0;
+        memmove(conn->in, line, rest);
+        conn->inUsed = rest;
+    }
+    submitReady(server, conn);
+    flushResponses(server, conn);
+}
+
+static void acceptConnections(Server *server) {
+    for (;;) {
+        int fd = accept(server->listenFd, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+                perror("accept");
+            return;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        Connection *conn = memCalloc(MEM_IO, 1, sizeof(Connection));
+        if (!conn) {
+            perror("Failed to allocate connection");
+            exit(EXIT_FAILURE);
+        }
+        conn->fd = fd;
+        conn->events = EPOLLIN | EPOLLRDHUP;
+        struct epoll_event event = { .events = conn->events, .data.ptr = conn };
+        if (epoll_ctl(server->epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            memFree(MEM_IO, conn, sizeof(Connection));
+            continue;
+        }
+        conn->next = server->connections;
+        if (conn->next)
+            conn->next->prev = conn;
+        server->connections = conn;
+    }
+}
+
+/*
+ * submitIngest queues an ingest tick behind the commands already waiting for the writer.
+ */
+static void submitIngest(Server *server, IngestBatch *batch) {
+    if (!batch)
+        return;
+    Request *request = &server->ingestRequest;
+    memset(request, 0, sizeof(*request));
+    request->ingest = batch;
+    queuePush(&server->writes, request);
+}
+
+/*
+ * collectFinished takes the answered requests back from the workers and moves every
+ * connection they touch forward.
+ */
+static void collectFinished(Server *server) {
+    uint64_t count;
+    if (read(server->wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        perror("Failed to read wakeup");
+    Request *request = queueDrain(&server->done);
+    while (request) {
+        Request *next = request->next;
+        Connection *conn = request->conn;
+        if (!conn) {
+            submitIngest(server, ingestApplied(server->ingest, request->ingest));
+            request = next;
+            continue;
+        }
+        request->done = 1;
+        conn->inFlight--;
+        if (!request->isRead)
+            conn->writesInFlight--;
+        else
+            server->readsAnswered++;
+        if (conn->closing) {
+            // Nothing of this connection is left in the chain once inFlight reaches 0.
+            if (conn->inFlight == 0)
+                releaseConnection(server, conn);
+        } else {
+            submitReady(server, conn);
+            flushResponses(server, conn);
+        }
+        request = next;
+    }
+}
+
+/*
+   ---------------- Setup and event loop ----------------
+*/
+
+static int openListener(const char *socketPath) {
+    struct sockaddr_un address;
+    if (strlen(socketPath) >= sizeof(address.sun_path))
+        return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socketPath);
+    // A socket file left by an earlier run would make bind fail.
+    unlink(socketPath);
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int watch(Server *server, int fd, void *token) {
+    struct epoll_event event = { .events = EPOLLIN, .data.ptr = token };
+    return epoll_ctl(server->epollFd, EPOLL_CTL_ADD, fd, &event);
+}
+
+/*
+ * runServer serves the sheet on a Unix-domain socket until SIGINT or SIGTERM.  Returns the
+ * process exit status.
+ */
+int runServer(const char *socketPath, Spreadsheet *spreadsheet, int readerThreads,
+              const char *ingestPath, int tickMillis) {
+    Server server;
+    memset(&server, 0, sizeof(server));
+    server.spreadsheet = spreadsheet;
+    server.readerCount = readerThreads > 0 ? readerThreads : SERVER_READER_THREADS;
+
+    // The signals are taken from a signalfd by the loop; worker threads inherit the mask.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    server.listenFd = openListener(socketPath);
+    server.epollFd = epoll_create1(EPOLL_CLOEXEC);
+    server.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    server.signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (ingestPath)
+        server.ingest = openIngest(ingestPath, tickMillis);
+    if (server.listenFd < 0 || server.epollFd < 0 || server.wakeFd < 0 || server.signalFd < 0 ||
+        (ingestPath && !server.ingest) ||
+        watch(&server, server.listenFd, &listenToken) != 0 || watch(&server, server.wakeFd, &wakeToken) != 0 ||
+        watch(&server, server.signalFd, &signalToken) != 0 ||
+        (server.ingest && watch(&server, server.ingest->epollFd, &ingestToken) != 0)) {
+        perror("Failed to start server");
+        closeIngest(server.ingest);
+        if (server.listenFd >= 0) {
+            close(server.listenFd);
+            unlink(socketPath);
+        }
+        if (server.epollFd >= 0)
+            close(server.epollFd);
+        if (server.wakeFd >= 0)
+            close(server.wakeFd);
+        if (server.signalFd >= 0)
+            close(server.signalFd);
+        pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+        return 1;
+    }
+
+    queueInit(&server.writes);
+    queueInit(&server.reads);
+    queueInit(&server.done);
+    spreadsheet->quiet = 1;
+    publishWorkbookValues(spreadsheet);
+    server.readers = memAlloc(MEM_IO, server.readerCount * sizeof(pthread_t));
+    if (!server.readers) {
+        perror("Failed to allocate reader threads");
+        exit(EXIT_FAILURE);
+    }
+    pthread_create(&server.writer, NULL, writerMain, &server);
+    for (int i = 0; i < server.readerCount; i++)
+        pthread_create(&server.readers[i], NULL, readerMain, &server);
+    fprintf(stderr, "[serve] listening on %s with %d reader threads\n", socketPath, server.readerCount);
+    if (server.ingest)
+        fprintf(stderr, "[serve] ingesting from %s every %d ms\n", ingestPath, server.ingest->tickMillis);
+
+    struct epoll_event events[SERVER_EVENTS];
+    int running = 1;
+    while (running) {
+        int count = epoll_wait(server.epollFd, events, SERVER_EVENTS, -1);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count < 0) {
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < count; i++) {
+            void *token = events[i].data.ptr;
+            if (token == &listenToken) {
+                acceptConnections(&server);
+            } else if (token == &wakeToken) {
+                collectFinished(&server);
+            } else if (token == &signalToken) {
+                // Taken off the queue, or it would be delivered when the mask is lifted on exit.
+                struct signalfd_siginfo info;
+                if (read(server.signalFd, &info, sizeof(info)) < 0 && errno != EAGAIN)
+                    perror("Failed to read signal");
+                running = 0;
+            } else if (token == &ingestToken) {
+                submitIngest(&server, ingestPoll(server.ingest));
+            } else {
+                Connection *conn = (Connection *) token;
+                if (conn->closing)
+                    continue;
+                if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                    closeConnection(&server, conn);
+                    continue;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLRDHUP))
+                    readConnection(&server, conn);
+                else if (events[i].events & EPOLLOUT)
+                    flushResponses(&server, conn);
+            }
+        }
+        freeReleased(&server);
+    }
+
+    // Commands already taken by the writer finish; everything still queued is dropped.
+    queueStop(&server.writes);
+    queueStop(&server.reads);
+    pthread_join(server.writer, NULL);
+    for (int i = 0; i < server.readerCount; i++)
+        pthread_join(server.readers[i], NULL);
+    while (server.connections) {
+        Connection *conn = server.connections;
+        if (conn->fd >= 0)
+            close(conn->fd);
+        releaseConnection(&server, conn);
+    }
+    freeReleased(&server);
+    queueDestroy(&server.writes);
+    queueDestroy(&server.reads);
+    queueDestroy(&server.done);
+    memFree(MEM_IO, server.readers, server.readerCount * sizeof(pthread_t));
+    close(server.listenFd);
+    unlink(socketPath);
+    close(server.epollFd);
+    close(server.wakeFd);
+    close(server.signalFd);
+    spreadsheet->quiet = 0;
+    pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+    fprintf(stderr, "[serve] %lu commands in %lu batches, %lu reads\n", server.commands, server.batches, server.readsAnswered);
+    if (server.ingest) {
+        char text[2 * SERVER_MAX_LINE];
+        formatIngestStats(server.ingest, text, sizeof(text));
+        // Updates still coalescing, or queued behind the writer, are dropped.
+        fprintf(stderr, "[ingest] %s\n", text + 3);
+        closeIngest(server.ingest);
+    }
+    return 0;
+}
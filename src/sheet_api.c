@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "sheet_api.h"
+#include "workbook.h"
+#include "value_plane.h"
+#include "change_feed.h"
+#include "structure.h"
+#include "mem_track.h"
+
+/*
+   ---------------- Embedding API ----------------
+
+   Each call checks its arguments the way handleOperation checks a command and then ends in the
+   same assign functions, so a typed write and the equivalent command leave identical state.
+   A rejected call leaves every value and formula as it was.
+*/
+
+// A batch larger than 1/SHEET_BULK_FRACTION of the materialized cells is settled by one
+// recalcAll instead of a propagation per update.
+#define SHEET_BULK_FRACTION 4
+
+static int inBounds(const Spreadsheet *sheet, int row, int col) {
+    return row >= 0 && col >= 0 && row < sheet->rows && col < sheet->cols;
+}
+
+/*
+ * operandSheet returns the sheet an operand or range refers to, or NULL if it is neither
+ * sheet itself nor a sheet of its workbook.
+ */
+static Spreadsheet *operandSheet(Spreadsheet *sheet, Spreadsheet *named) {
+    if (!named || named == sheet)
+        return sheet;
+    return (sheet->workbook && named->workbook == sheet->workbook) ? named : NULL;
+}
+
+/*
+ * resolveOperand sets *cell to the operand's cell, or to NULL for a literal.
+ */
+static int resolveOperand(Spreadsheet *sheet, const SheetOperand *operand, Cell **cell) {
+    *cell = NULL;
+    if (!operand->isCell)
+        return SHEET_OK;
+    Spreadsheet *owner = operandSheet(sheet, operand->sheet);
+    if (!owner)
+        return SHEET_ERR_SHEET;
+    if (!inBounds(owner, operand->row, operand->col))
+        return SHEET_ERR_BOUNDS;
+    *cell = sheetCell(owner, operand->row, operand->col);
+    return SHEET_OK;
+}
+
+/*
+ * publish makes the writes visible to views and change subscribers, and moves the pack hand,
+ * as parseInput does after a command.
+ */
+static void publish(Spreadsheet *sheet) {
+    Spreadsheet *home = homeSheet(sheet);
+    if (!home->deferPublish) {
+        publishWorkbookValues(home);
+        changeFeedCommit(home);
+        packIdleTiles(home);
+    }
+}
+
+static int applyValue(Spreadsheet *sheet, int row, int col, int value, double start) {
+    if (!inBounds(sheet, row, col))
+        return SHEET_ERR_BOUNDS;
+    assignLiteral(sheet, sheetCell(sheet, row, col), value, start);
+    return SHEET_OK;
+}
+
+static int applyRange(Spreadsheet *sheet, int row, int col, const SheetFormula *formula, double start) {
+    Spreadsheet *rangeSheet = operandSheet(sheet, formula->rangeSheet);
+    if (!rangeSheet)
+        return SHEET_ERR_SHEET;
+    if (formula->row1 > formula->row2 || formula->col1 > formula->col2)
+        return SHEET_ERR_RANGE;
+    if (!inBounds(rangeSheet, formula->row1, formula->col1) || !inBounds(rangeSheet, formula->row2, formula->col2))
+        return SHEET_ERR_BOUNDS;
+    if (rangeSheet == sheet && row >= formula->row1 && row <= formula->row2 &&
+        col >= formula->col1 && col <= formula->col2)
+        return SHEET_ERR_CYCLE;
+    Cell *target = sheetCell(sheet, row, col);
+    if (checkAdvancedFormulaCycleNew(target, rangeSheet, formula->row1, formula->col1, formula->row2, formula->col2))
+        return SHEET_ERR_CYCLE;
+    assignRange(sheet, target, formula->op, rangeSheet, formula->row1, formula->col1,
+                formula->row2, formula->col2, start);
+    return SHEET_OK;
+}
+
+static int applyFormula(Spreadsheet *sheet, int row, int col, const SheetFormula *formula, double start) {
+    if (!formula)
+        return SHEET_ERR_ARGUMENT;
+    if (!inBounds(sheet, row, col))
+        return SHEET_ERR_BOUNDS;
+    if (formula->op >= OP_ADV_SUM && formula->op <= OP_ADV_STDEV)
+        return applyRange(sheet, row, col, formula, start);
+    // SLEEP is left to the command interface: an embedding caller has no use for a blocking cell.
+    if (formula->op < OP_NONE || formula->op > OP_DIV)
+        return SHEET_ERR_ARGUMENT;
+    if (formula->op == OP_NONE && !formula->operand1.isCell)
+        return applyValue(sheet, row, col, formula->operand1.literal, start);
+
+    Cell *operand1, *operand2 = NULL;
+    int status = resolveOperand(sheet, &formula->operand1, &operand1);
+    if (status == SHEET_OK && formula->op != OP_NONE)
+        status = resolveOperand(sheet, &formula->operand2, &operand2);
+    if (status != SHEET_OK)
+        return status;
+    Cell *target = sheetCell(sheet, row, col);
+    if ((operand1 && checkCycleNew(sheet, operand1, target)) || (operand2 && checkCycleNew(sheet, operand2, target)))
+        return SHEET_ERR_CYCLE;
+    if (formula->op == OP_NONE)
+        assignReference(sheet, target, operand1, start);
+    else
+        assignBinary(sheet, target, formula->op, operand1, formula->operand1.literal,
+                     operand2, formula->operand2.literal, start);
+    return SHEET_OK;
+}
+
+/*
+ * sheet_open creates an empty sheet, or returns NULL if the size is outside what the engine
+ * accepts.  Close it with sheet_close.
+ */
+Spreadsheet *sheet_open(int rows, int cols) {
+    if (rows < 1 || cols < 1 || rows > SHEET_MAX_ROWS || cols > SHEET_MAX_COLS)
+        return NULL;
+    Spreadsheet *sheet = initializeSpreadsheet(rows, cols);
+    sheet->quiet = 1;
+    return sheet;
+}
+
+void sheet_close(Spreadsheet *sheet) {
+    freeSpreadsheet(sheet);
+}
+
+/*
+ * sheet_set_value stores a literal, like "A1=<value>".
+ */
+int sheet_set_value(Spreadsheet *sheet, int row, int col, int value) {
+    if (!sheet)
+        return SHEET_ERR_ARGUMENT;
+    int status = applyValue(sheet, row, col, value, monotonicSeconds());
+    if (status == SHEET_OK)
+        publish(sheet);
+    return status;
+}
+
+/*
+ * sheet_set_formula installs a parsed formula, or rejects it and leaves the sheet unchanged.
+ */
+int sheet_set_formula(Spreadsheet *sheet, int row, int col, const SheetFormula *formula) {
+    if (!sheet)
+        return SHEET_ERR_ARGUMENT;
+    int status = applyFormula(sheet, row, col, formula, monotonicSeconds());
+    if (status == SHEET_OK)
+        publish(sheet);
+    return status;
+}
+
+/*
+ * sheet_apply_batch applies updates in order and publishes once at the end.  An update that is
+ * rejected is skipped and the rest still apply; results, if not NULL, receives the status of
+ * each update.  It returns the number of rejected updates, or SHEET_ERR_ARGUMENT.
+ *
+ * Recalculation is deferred to the end of the batch: one cascade from all updated cells, or one
+ * recalcAll for a batch that touches a good part of the sheet.
+ */
+long sheet_apply_batch(Spreadsheet *sheet, const SheetUpdate *updates, long count, int *results) {
+    if (!sheet || count < 0 || (count > 0 && !updates))
+        return SHEET_ERR_ARGUMENT;
+    double start = monotonicSeconds();
+    int deferred = !sheet->deferRecalc;
+    int bulk = deferred && count > sheet->store.cellCount / SHEET_BULK_FRACTION;
+    Cell **changed = NULL;
+    long changedCount = 0;
+    if (deferred && !bulk && count > 0) {
+        changed = memAlloc(MEM_RECALC, count * sizeof(Cell *));
+        if (!changed) {
+            perror("Failed to allocate batch buffer");
+            exit(EXIT_FAILURE);
+        }
+    }
+    sheet->deferRecalc = 1;
+    long rejected = 0;
+    for (long i = 0; i < count; i++) {
+        const SheetUpdate *update = &updates[i];
+        int status = update->formula ? applyFormula(sheet, update->row, update->col, update->formula, start)
+                                     : applyValue(sheet, update->row, update->col, update->value, start);
+        if (status != SHEET_OK)
+            rejected++;
+        else if (changed)
+            changed[changedCount++] = sheetCell(sheet, update->row, update->col);
+        if (results)
+            results[i] = status;
+    }
+    if (deferred) {
+        sheet->deferRecalc = 0;
+        if (bulk)
+            recalcAll(sheet);
+        else
+            propagateChanges(sheet, changed, changedCount, start);
+    }
+    memFree(MEM_RECALC, changed, count * sizeof(Cell *));
+    publish(sheet);
+    return rejected;
+}
+
+/*
+ * structureStatus maps a STRUCTURE_* code of structure.h to its SHEET_* code, publishing the
+ * edit if it was made.
+ */
+static int structureStatus(Spreadsheet *sheet, int status) {
+    switch (status) {
+        case STRUCTURE_OK:
+            publish(sheet);
+            return SHEET_OK;
+        case STRUCTURE_ERR_REFERENCED: return SHEET_ERR_REFERENCED;
+        case STRUCTURE_ERR_OCCUPIED:   return SHEET_ERR_OCCUPIED;
+        default:                       return SHEET_ERR_BOUNDS;
+    }
+}
+
+/*
+ * sheet_insert_rows inserts count empty rows above row, like "insert_row".  The sheet keeps
+ * its size: the last count rows, which must be empty, drop off (SHEET_ERR_OCCUPIED otherwise).
+ * References follow the cells they name; ranges across row grow.
+ */
+int sheet_insert_rows(Spreadsheet *sheet, int row, int count) {
+    if (!sheet)
+        return SHEET_ERR_ARGUMENT;
+    return structureStatus(sheet, insertRows(sheet, row, count, monotonicSeconds()));
+}
+
+/*
+ * sheet_delete_rows deletes count rows from row on, like "delete_row", and brings empty rows
+ * in at the bottom.  It returns SHEET_ERR_REFERENCED, changing nothing, if a cell outside the
+ * rows refers to one inside them or a range lies wholly inside them.
+ */
+int sheet_delete_rows(Spreadsheet *sheet, int row, int count) {
+    if (!sheet)
+        return SHEET_ERR_ARGUMENT;
+    return structureStatus(sheet, deleteRows(sheet, row, count, monotonicSeconds()));
+}
+
+/*
+ * sheet_insert_cols and sheet_delete_cols are the same for columns.
+ */
+int sheet_insert_cols(Spreadsheet *sheet, int col, int count) {
+    if (!sheet)
+        return SHEET_ERR_ARGUMENT;
+    return structureStatus(sheet, insertColumns(sheet, col, count, monotonicSeconds()));
+}
+
+int sheet_delete_cols(Spreadsheet *sheet, int col, int count) {
+    if (!sheet)
+        return SHEET_ERR_ARGUMENT;
+    return structureStatus(sheet, deleteColumns(sheet, col, count, monotonicSeconds()));
+}
+
+/*
+ * sheet_get_value reads one cell.  It returns SHEET_ERR_CELL, with *value 0, for an error cell.
+ */
+int sheet_get_value(const Spreadsheet *sheet, int row, int col, int *value) {
+    if (!sheet || !value)
+        return SHEET_ERR_ARGUMENT;
+    if (!inBounds(sheet, row, col))
+        return SHEET_ERR_BOUNDS;
+    const Cell *cell = sheetPeek(sheet, row, col);
+    if (cell && cell->error) {
+        *value = 0;
+        return SHEET_ERR_CELL;
+    }
+    *value = cell ? cell->value : 0;
+    return SHEET_OK;
+}
+
+/*
+ * sheet_get_range copies the inclusive range (row1, col1)..(row2, col2) into values row by row;
+ * errors, if not NULL, receives 1 for each error cell and 0 otherwise.  Both buffers hold
+ * (row2 - row1 + 1) * (col2 - col1 + 1) entries.  Cells are read a tile row at a time.
+ */
+int sheet_get_range(const Spreadsheet *sheet, int row1, int col1, int row2, int col2,
+                    int *values, unsigned char *errors) {
+    if (!sheet || !values)
+        return SHEET_ERR_ARGUMENT;
+    if (row1 > row2 || col1 > col2)
+        return SHEET_ERR_RANGE;
+    if (!inBounds(sheet, row1, col1) || !inBounds(sheet, row2, col2))
+        return SHEET_ERR_BOUNDS;
+    long out = 0;
+    for (int r = row1; r <= row2; r++) {
+        int row = sheetPhysicalRow(sheet, r);
+        for (int c = col1; c <= col2; ) {
+            // A run of columns lying side by side in the store, cut at the tile edge.
+            int col, span = indexMapSpan(sheet->colMap, c, col2, &col);
+            int tileEnd = ((col >> TILE_COL_BITS) + 1) << TILE_COL_BITS;
+            if (span > tileEnd - col)
+                span = tileEnd - col;
+            c += span;
+            Tile *tile = tileStoreTile(&sheet->store, row >> TILE_ROW_BITS, col >> TILE_COL_BITS);
+            // A packed tile holds no error cells and is read in place.
+            if (tile && tile->packed) {
+                for (long index = tileCellIndex(tile, row, col); span > 0; span--, out++, index++) {
+                    values[out] = tilePackedValue(tile, index);
+                    if (errors)
+                        errors[out] = 0;
+                }
+                continue;
+            }
+            if (tile)
+                tileStoreUse(&sheet->store, tile);
+            const Cell *run = tile ? &tile->cells[tileCellIndex(tile, row, col)] : NULL;
+            for (; span > 0; span--, out++) {
+                int error = run && run->error;
+                values[out] = (run && !error) ? run->value : 0;
+                if (errors)
+                    errors[out] = (unsigned char) error;
+                if (run)
+                    run++;
+            }
+        }
+    }
+    return SHEET_OK;
+}
+
+/*
+ * sheet_subscribe calls callback on the sheet's thread after every commit that changes cells
+ * of its workbook (see change_feed.h).  The callback must not write to the workbook.  Returns
+ * an id for sheet_unsubscribe, or SHEET_ERR_ARGUMENT when callback is NULL or all
+ * FEED_MAX_SUBSCRIBERS slots are taken.
+ */
+int sheet_subscribe(Spreadsheet *sheet, ChangeCallback callback, void *data) {
+    if (!sheet || !callback)
+        return SHEET_ERR_ARGUMENT;
+    int id = changeFeedSubscribe(sheet, callback, data);
+    return id < 0 ? SHEET_ERR_ARGUMENT : id;
+}
+
+void sheet_unsubscribe(Spreadsheet *sheet, int id) {
+    if (sheet)
+        changeFeedUnsubscribe(sheet, id);
+}
+
+const char *sheet_strerror(int code) {
+    switch (code) {
+        case SHEET_OK:           return "ok";
+        case SHEET_ERR_ARGUMENT: return "invalid argument";
+        case SHEET_ERR_BOUNDS:   return "cell out of bounds";
+        case SHEET_ERR_RANGE:    return "invalid range order";
+        case SHEET_ERR_SHEET:    return "sheet not in workbook";
+        case SHEET_ERR_CYCLE:    return "cyclic dependency";
+        case SHEET_ERR_CELL:     return "cell holds an error";
+        case SHEET_ERR_REFERENCED: return "deleted cells are referenced";
+        case SHEET_ERR_OCCUPIED: return "cells would be pushed off the sheet";
+        default:                 return "unknown error";
+    }
+}
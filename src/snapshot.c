@@ -0,0 +1,565 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+#include "avl_tree.h"
+#include "mem_track.h"
+
+/*
+   ---------------- Binary snapshots ----------------
+
+   A snapshot stores the materialized tiles with their values, the error bitmap, every formula
+   in compiled form and the dependency adjacency in a versioned, page-aligned file.  Loading maps
+   the file and restores the sheet without parsing a single command, cycle check or
+   recalculation: values are copied straight out of the mapping and each dependency tree is
+   rebuilt balanced from its run of edges.
+*/
+
+/*
+ * SnapshotWriter wraps the output stream together with the sheet being written.
+ */
+typedef struct {
+    FILE *file;
+    Spreadsheet *spreadsheet;
+    uint64_t current;
+    uint64_t count;
+    int failed;
+} SnapshotWriter;
+
+static uint64_t cellIndex(Spreadsheet *spreadsheet, Cell *cell) {
+    return (uint64_t) cell->selfRow * spreadsheet->cols + cell->selfCol;
+}
+
+/*
+ * isFormulaCell reports whether a cell carries anything beyond a plain literal value.
+ */
+static int isFormulaCell(Cell *cell) {
+    return cell->op != OP_NONE || cell->operand1 != NULL || cell->operand2 != NULL;
+}
+
+/*
+ * writeBytes writes a block and remembers any failure so callers can check once at the end.
+ */
+static void writeBytes(SnapshotWriter *writer, const void *data, size_t len) {
+    if (len > 0 && fwrite(data, 1, len, writer->file) != len)
+        writer->failed = 1;
+}
+
+/*
+ * beginSection pads the file to the next page boundary and records where the section starts.
+ */
+static void beginSection(SnapshotWriter *writer, SnapshotSection *section) {
+    static const char zeros[SNAPSHOT_PAGE_SIZE];
+    long pos = ftell(writer->file);
+    if (pos < 0) {
+        writer->failed = 1;
+        return;
+    }
+    long pad = (SNAPSHOT_PAGE_SIZE - pos % SNAPSHOT_PAGE_SIZE) % SNAPSHOT_PAGE_SIZE;
+    writeBytes(writer, zeros, (size_t) pad);
+    section->offset = (uint64_t) (pos + pad);
+}
+
+static void endSection(SnapshotWriter *writer, SnapshotSection *section) {
+    long pos = ftell(writer->file);
+    if (pos < 0) {
+        writer->failed = 1;
+        return;
+    }
+    section->length = (uint64_t) pos - section->offset;
+}
+
+static void count_callback(Cell *cell, void *data) {
+    (void) cell;
+    ((SnapshotWriter *) data)->count++;
+}
+
+/* Emits "cell depends on writer->current" while walking a dependents tree. */
+static void dependent_edge_callback(Cell *cell, void *data) {
+    SnapshotWriter *writer = (SnapshotWriter *) data;
+    SnapshotEdge edge = { writer->current, cellIndex(writer->spreadsheet, cell) };
+    writeBytes(writer, &edge, sizeof(edge));
+}
+
+/* Emits "writer->current depends on cell" while walking a dependencies tree. */
+static void dependency_edge_callback(Cell *cell, void *data) {
+    SnapshotWriter *writer = (SnapshotWriter *) data;
+    SnapshotEdge edge = { cellIndex(writer->spreadsheet, cell), writer->current };
+    writeBytes(writer, &edge, sizeof(edge));
+}
+
+/*
+ * writeRuns writes the runs of map, none for the identity.
+ */
+static void writeRuns(SnapshotWriter *writer, const IndexMap *map) {
+    for (int i = 0; map && i < map->count; i++) {
+        SnapshotRun run = { map->runs[i].logical, map->runs[i].physical, map->runs[i].length };
+        writeBytes(writer, &run, sizeof(run));
+    }
+}
+
+/*
+ * orderedTiles returns the materialized tiles sorted by (row0, col0), found by walking the
+ * band directory.  The caller frees the array with memFree(MEM_IO, ..., count * sizeof(Tile *)).
+ */
+static Tile **orderedTiles(const TileStore *store) {
+    Tile **ordered = memAlloc(MEM_IO, (store->tileCount ? store->tileCount : 1) * sizeof(Tile *));
+    if (!ordered) {
+        perror("Failed to allocate snapshot tile list");
+        exit(EXIT_FAILURE);
+    }
+    long n = 0;
+    for (int b = 0; b < store->bandCount; b++) {
+        if (!store->bands[b])
+            continue;
+        for (int t = 0; t < store->tilesPerBand; t++) {
+            if (store->bands[b][t])
+                ordered[n++] = store->bands[b][t];
+        }
+    }
+    return ordered;
+}
+
+/*
+ * saveSnapshot writes the whole sheet to path.  The file is written under a temporary name,
+ * synced and then renamed, so an existing snapshot is never left half-written.
+ * It returns 0 on success and -1 on failure.
+ */
+int saveSnapshot(Spreadsheet *spreadsheet, const char *path) {
+    size_t pathLen = strlen(path);
+    char *tmpPath = malloc(pathLen + 5);
+    if (!tmpPath)
+        return -1;
+    memcpy(tmpPath, path, pathLen);
+    memcpy(tmpPath + pathLen, ".tmp", 5);
+
+    FILE *file = fopen(tmpPath, "wb");
+    if (!file) {
+        free(tmpPath);
+        return -1;
+    }
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+
+    const TileStore *store = &spreadsheet->store;
+    long tileCount = store->tileCount;
+    Tile **tiles = orderedTiles(store);
+    SnapshotWriter writer = { file, spreadsheet, 0, 0, 0 };
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.pageSize = SNAPSHOT_PAGE_SIZE;
+    header.rows = spreadsheet->rows;
+    header.cols = spreadsheet->cols;
+    header.startRow = spreadsheet->startRow;
+    header.startCol = spreadsheet->startCol;
+    header.tileRows = TILE_ROWS;
+    header.tileCols = TILE_COLS;
+    header.tileCount = (uint64_t) tileCount;
+    header.cellCount = (uint64_t) store->cellCount;
+    header.advancedCount = (uint64_t) spreadsheet->advancedFormulasCount;
+    header.rowRunCount = spreadsheet->rowMap ? (uint64_t) spreadsheet->rowMap->count : 0;
+    header.colRunCount = spreadsheet->colMap ? (uint64_t) spreadsheet->colMap->count : 0;
+
+    /* Reserve the header page; the real header is written last. */
+    char page[SNAPSHOT_PAGE_SIZE];
+    memset(page, 0, sizeof(page));
+    writeBytes(&writer, page, sizeof(page));
+
+    beginSection(&writer, &header.tiles);
+    for (long t = 0; t < tileCount; t++) {
+        SnapshotTile record = { tiles[t]->row0, tiles[t]->col0 };
+        writeBytes(&writer, &record, sizeof(record));
+    }
+    endSection(&writer, &header.tiles);
+
+    beginSection(&writer, &header.values);
+    for (long t = 0; t < tileCount; t++) {
+        int32_t values[TILE_ROWS * TILE_COLS];
+        long n = (long) tiles[t]->rows * tiles[t]->cols;
+        if (tiles[t]->packed) {
+            for (long k = 0; k < n; k++)
+                values[k] = tilePackedValue(tiles[t], k);
+        } else {
+            tileStoreUse(store, tiles[t]);
+            for (long k = 0; k < n; k++)
+                values[k] = tiles[t]->cells[k].value;
+        }
+        writeBytes(&writer, values, n * sizeof(int32_t));
+    }
+    endSection(&writer, &header.values);
+
+    beginSection(&writer, &header.errors);
+    uint64_t word = 0, bit = 0;
+    for (long t = 0; t < tileCount; t++) {
+        long n = (long) tiles[t]->rows * tiles[t]->cols;
+        // Packed tiles hold no error cells.
+        if (!tiles[t]->packed)
+            tileStoreUse(store, tiles[t]);
+        for (long k = 0; k < n; k++) {
+            if (!tiles[t]->packed && tiles[t]->cells[k].error)
+                word |= (uint64_t) 1 << bit;
+            if (++bit == 64) {
+                writeBytes(&writer, &word, sizeof(word));
+                word = bit = 0;
+            }
+        }
+    }
+    if (bit > 0)
+        writeBytes(&writer, &word, sizeof(word));
+    endSection(&writer, &header.errors);
+
+    beginSection(&writer, &header.formulas);
+    for (long t = 0; t < tileCount; t++) {
+        if (tiles[t]->packed)
+            continue;
+        tileStoreUse(store, tiles[t]);
+        long n = (long) tiles[t]->rows * tiles[t]->cols;
+        for (long k = 0; k < n; k++) {
+            Cell *cell = &tiles[t]->cells[k];
+            if (!isFormulaCell(cell))
+                continue;
+            SnapshotFormula formula;
+            memset(&formula, 0, sizeof(formula));
+            formula.cell = cellIndex(spreadsheet, cell);
+            formula.op = cell->op;
+            if (cell->operand1IsLiteral)
+                formula.flags |= SNAP_OP1_LITERAL;
+            if (cell->operand2IsLiteral)
+                formula.flags |= SNAP_OP2_LITERAL;
+            formula.literal1 = cell->operand1Literal;
+            formula.literal2 = cell->operand2Literal;
+            if (cell->operand1) {
+                formula.flags |= SNAP_OP1_REF;
+                formula.ref1 = cellIndex(spreadsheet, cell->operand1);
+            }
+            if (cell->operand2) {
+                formula.flags |= SNAP_OP2_REF;
+                formula.ref2 = cellIndex(spreadsheet, cell->operand2);
+            }
+            formula.row1 = cell->row1;
+            formula.col1 = cell->col1;
+            formula.row2 = cell->row2;
+            formula.col2 = cell->col2;
+            writeBytes(&writer, &formula, sizeof(formula));
+            header.formulaCount++;
+        }
+    }
+    endSection(&writer, &header.formulas);
+
+    /* One run of edges per cell; the loader sorts each run itself. */
+    beginSection(&writer, &header.dependents);
+    for (long t = 0; t < tileCount; t++) {
+        if (tiles[t]->packed)
+            continue;
+        tileStoreUse(store, tiles[t]);
+        long n = (long) tiles[t]->rows * tiles[t]->cols;
+        for (long k = 0; k < n; k++) {
+            Cell *cell = &tiles[t]->cells[k];
+            if (!cell->dependents)
+                continue;
+            writer.current = cellIndex(spreadsheet, cell);
+            writer.count = 0;
+            avl_traverse(cell->dependents, count_callback, &writer);
+            header.edgeCount += writer.count;
+            avl_traverse(cell->dependents, dependent_edge_callback, &writer);
+        }
+    }
+    endSection(&writer, &header.dependents);
+
+    beginSection(&writer, &header.dependencies);
+    for (long t = 0; t < tileCount; t++) {
+        if (tiles[t]->packed)
+            continue;
+        tileStoreUse(store, tiles[t]);
+        long n = (long) tiles[t]->rows * tiles[t]->cols;
+        for (long k = 0; k < n; k++) {
+            Cell *cell = &tiles[t]->cells[k];
+            if (!cell->dependencies)
+                continue;
+            writer.current = cellIndex(spreadsheet, cell);
+            avl_traverse(cell->dependencies, dependency_edge_callback, &writer);
+        }
+    }
+    endSection(&writer, &header.dependencies);
+    memFree(MEM_IO, tiles, (tileCount ? tileCount : 1) * sizeof(Tile *));
+
+    beginSection(&writer, &header.advanced);
+    for (int i = 0; i < spreadsheet->advancedFormulasCount; i++) {
+        uint64_t index = cellIndex(spreadsheet, spreadsheet->advancedFormulas[i]);
+        writeBytes(&writer, &index, sizeof(index));
+    }
+    endSection(&writer, &header.advanced);
+
+    beginSection(&writer, &header.layout);
+    writeRuns(&writer, spreadsheet->rowMap);
+    writeRuns(&writer, spreadsheet->colMap);
+    endSection(&writer, &header.layout);
+
+    if (fseek(file, 0, SEEK_SET) != 0)
+        writer.failed = 1;
+    writeBytes(&writer, &header, sizeof(header));
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0)
+        writer.failed = 1;
+    if (fclose(file) != 0)
+        writer.failed = 1;
+    if (writer.failed || rename(tmpPath, path) != 0) {
+        unlink(tmpPath);
+        free(tmpPath);
+        return -1;
+    }
+    free(tmpPath);
+    return 0;
+}
+
+/*
+ * sectionValid checks that a section lies inside the file and holds exactly count records.
+ */
+static int sectionValid(const SnapshotSection *section, size_t fileSize, uint64_t count, size_t recordSize) {
+    if (section->offset % SNAPSHOT_PAGE_SIZE != 0)
+        return 0;
+    if (section->length != count * recordSize)
+        return 0;
+    return section->offset <= fileSize && section->length <= fileSize - section->offset;
+}
+
+/*
+ * cellAt maps a sheet index from the file to its cell, or NULL if the index is outside the
+ * sheet or its tile was not stored.
+ */
+static Cell *cellAt(Spreadsheet *spreadsheet, uint64_t index) {
+    if (index >= (uint64_t) spreadsheet->rows * spreadsheet->cols)
+        return NULL;
+    return tileStorePeek(&spreadsheet->store, (int) (index / spreadsheet->cols),
+                         (int) (index % spreadsheet->cols));
+}
+
+/*
+ * restoreRuns sets *out to the index map of size indices stored as count runs, the identity
+ * if there are none.  It returns -1 if the runs are not a permutation of 0..size-1.
+ */
+static int restoreRuns(IndexMap **out, const SnapshotRun *stored, uint64_t count, int size) {
+    if (count == 0)
+        return 0;
+    IndexRun *runs = memAlloc(MEM_IO, count * sizeof(IndexRun));
+    if (!runs) {
+        perror("Failed to allocate snapshot index runs");
+        exit(EXIT_FAILURE);
+    }
+    for (uint64_t i = 0; i < count; i++) {
+        runs[i].logical = stored[i].logical;
+        runs[i].physical = stored[i].physical;
+        runs[i].length = stored[i].length;
+    }
+    int result = indexMapRestore(out, runs, (int) count, size, MEM_CELLS);
+    memFree(MEM_IO, runs, count * sizeof(IndexRun));
+    return result;
+}
+
+static int compareCellPointers(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t) *(Cell *const *) a, y = (uintptr_t) *(Cell *const *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * buildTrees rebuilds one side of the dependency graph from an edge list grouped by key.
+ * For each run of edges sharing the same key it sorts the other endpoints by address and
+ * builds a balanced tree of them.  byFrom selects whether the key is edge.from (dependents)
+ * or edge.to (dependencies).  It returns 0 on success or -1 if a cell appears in two runs,
+ * twice in one run, or outside the stored tiles.
+ */
+static int buildTrees(Spreadsheet *spreadsheet, const SnapshotEdge *edges, uint64_t edgeCount,
+                      int byFrom, Cell **scratch) {
+    uint64_t i = 0;
+    while (i < edgeCount) {
+        uint64_t key = byFrom ? edges[i].from : edges[i].to;
+        Cell *cell = cellAt(spreadsheet, key);
+        if (!cell || (byFrom ? cell->dependents : cell->dependencies))
+            return -1;
+        uint64_t j = i;
+        while (j < edgeCount && (byFrom ? edges[j].from : edges[j].to) == key) {
+            Cell *other = cellAt(spreadsheet, byFrom ? edges[j].to : edges[j].from);
+            if (!other)
+                return -1;
+            scratch[j - i] = other;
+            j++;
+        }
+        qsort(scratch, j - i, sizeof(Cell *), compareCellPointers);
+        for (uint64_t k = 1; k < j - i; k++) {
+            if (scratch[k] == scratch[k - 1])
+                return -1;
+        }
+        AVLNode *tree = avl_build_sorted(scratch, (long) (j - i));
+        if (byFrom)
+            cell->dependents = tree;
+        else
+            cell->dependencies = tree;
+        i = j;
+    }
+    return 0;
+}
+
+/*
+ * loadSnapshot replaces the sheet's contents with the snapshot stored at path.
+ * Display settings of the running session are kept.  On any validation failure the
+ * current sheet is left untouched and -1 is returned.
+ */
+int loadSnapshot(Spreadsheet *spreadsheet, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < SNAPSHOT_PAGE_SIZE) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t) st.st_size;
+    const char *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    madvise((void *) map, size, MADV_SEQUENTIAL | MADV_WILLNEED);
+
+    SnapshotHeader header;
+    memcpy(&header, map, sizeof(header));
+    int ok = memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) == 0 &&
+             header.version == SNAPSHOT_VERSION &&
+             header.pageSize == SNAPSHOT_PAGE_SIZE &&
+             header.rows > 0 && header.rows <= SHEET_MAX_ROWS &&
+             header.cols > 0 && header.cols <= SHEET_MAX_COLS &&
+             header.tileRows == TILE_ROWS && header.tileCols == TILE_COLS &&
+             header.cellCount <= (uint64_t) header.rows * (uint64_t) header.cols &&
+             header.tileCount <= header.cellCount &&
+             header.startRow >= 0 && header.startRow < header.rows &&
+             header.startCol >= 0 && header.startCol < header.cols &&
+             sectionValid(&header.tiles, size, header.tileCount, sizeof(SnapshotTile)) &&
+             sectionValid(&header.values, size, header.cellCount, sizeof(int32_t)) &&
+             sectionValid(&header.errors, size, (header.cellCount + 63) / 64, sizeof(uint64_t)) &&
+             sectionValid(&header.formulas, size, header.formulaCount, sizeof(SnapshotFormula)) &&
+             sectionValid(&header.dependents, size, header.edgeCount, sizeof(SnapshotEdge)) &&
+             sectionValid(&header.dependencies, size, header.edgeCount, sizeof(SnapshotEdge)) &&
+             sectionValid(&header.advanced, size, header.advancedCount, sizeof(uint64_t)) &&
+             header.rowRunCount <= (uint64_t) header.rows && header.colRunCount <= (uint64_t) header.cols &&
+             sectionValid(&header.layout, size, header.rowRunCount + header.colRunCount, sizeof(SnapshotRun)) &&
+             header.formulaCount <= header.cellCount &&
+             header.advancedCount <= header.formulaCount;
+    if (!ok) {
+        munmap((void *) map, size);
+        return -1;
+    }
+
+    Spreadsheet *loaded = initializeSpreadsheet(header.rows, header.cols);
+    TileStore *store = &loaded->store;
+    const SnapshotTile *tiles = (const SnapshotTile *) (map + header.tiles.offset);
+    const int32_t *values = (const int32_t *) (map + header.values.offset);
+    const uint64_t *errors = (const uint64_t *) (map + header.errors.offset);
+    uint64_t stored = 0;
+    for (uint64_t t = 0; t < header.tileCount && ok; t++) {
+        int row0 = tiles[t].row0, col0 = tiles[t].col0;
+        if (row0 < 0 || row0 >= header.rows || row0 % TILE_ROWS != 0 ||
+            col0 < 0 || col0 >= header.cols || col0 % TILE_COLS != 0 ||
+            tileStoreTile(store, row0 >> TILE_ROW_BITS, col0 >> TILE_COL_BITS)) {
+            ok = 0;
+            break;
+        }
+        Tile *tile = tileStoreMaterialize(store, row0 >> TILE_ROW_BITS, col0 >> TILE_COL_BITS);
+        long n = (long) tile->rows * tile->cols;
+        if ((uint64_t) n > header.cellCount - stored) {
+            ok = 0;
+            break;
+        }
+        for (long k = 0; k < n; k++, stored++) {
+            tile->cells[k].value = values[stored];
+            tile->cells[k].error = (int) ((errors[stored / 64] >> (stored % 64)) & 1);
+        }
+    }
+    if (stored != header.cellCount)
+        ok = 0;
+
+    const SnapshotFormula *formulas = (const SnapshotFormula *) (map + header.formulas.offset);
+    for (uint64_t i = 0; i < header.formulaCount && ok; i++) {
+        const SnapshotFormula *f = &formulas[i];
+        Cell *cell = cellAt(loaded, f->cell);
+        Cell *ref1 = (f->flags & SNAP_OP1_REF) ? cellAt(loaded, f->ref1) : NULL;
+        Cell *ref2 = (f->flags & SNAP_OP2_REF) ? cellAt(loaded, f->ref2) : NULL;
+        if (!cell || ((f->flags & SNAP_OP1_REF) && !ref1) || ((f->flags & SNAP_OP2_REF) && !ref2)) {
+            ok = 0;
+            break;
+        }
+        cell->op = f->op;
+        cell->operand1IsLiteral = (f->flags & SNAP_OP1_LITERAL) != 0;
+        cell->operand2IsLiteral = (f->flags & SNAP_OP2_LITERAL) != 0;
+        cell->operand1Literal = f->literal1;
+        cell->operand2Literal = f->literal2;
+        cell->operand1 = ref1;
+        cell->operand2 = ref2;
+        cell->row1 = f->row1;
+        cell->col1 = f->col1;
+        cell->row2 = f->row2;
+        cell->col2 = f->col2;
+        if (cell->op >= OP_ADV_SUM && cell->op <= OP_ADV_STDEV &&
+            (cell->row1 < 0 || cell->col1 < 0 || cell->row2 >= header.rows ||
+             cell->col2 >= header.cols || cell->row1 > cell->row2 || cell->col1 > cell->col2))
+            ok = 0;
+    }
+
+    if (ok && header.edgeCount > 0) {
+        Cell **scratch = memAlloc(MEM_IO, header.edgeCount * sizeof(Cell *));
+        if (!scratch) {
+            perror("Failed to allocate snapshot scratch space");
+            exit(EXIT_FAILURE);
+        }
+        const SnapshotEdge *dependents = (const SnapshotEdge *) (map + header.dependents.offset);
+        const SnapshotEdge *dependencies = (const SnapshotEdge *) (map + header.dependencies.offset);
+        if (buildTrees(loaded, dependents, header.edgeCount, 1, scratch) != 0 ||
+            buildTrees(loaded, dependencies, header.edgeCount, 0, scratch) != 0)
+            ok = 0;
+        memFree(MEM_IO, scratch, header.edgeCount * sizeof(Cell *));
+    }
+
+    // Ranges are covered through the maps, so they are restored first.
+    const SnapshotRun *runs = (const SnapshotRun *) (map + header.layout.offset);
+    if (ok && (restoreRuns(&loaded->rowMap, runs, header.rowRunCount, header.rows) != 0 ||
+               restoreRuns(&loaded->colMap, runs + header.rowRunCount, header.colRunCount, header.cols) != 0))
+        ok = 0;
+
+    if (ok) {
+        const uint64_t *advanced = (const uint64_t *) (map + header.advanced.offset);
+        if (header.advancedCount > (uint64_t) loaded->advancedFormulasCapacity) {
+            loaded->advancedFormulas = memRealloc(MEM_ADVANCED, loaded->advancedFormulas,
+                loaded->advancedFormulasCapacity * sizeof(Cell *), header.advancedCount * sizeof(Cell *));
+            loaded->advancedFormulasCapacity = (int) header.advancedCount;
+            if (!loaded->advancedFormulas) {
+                perror("Failed to reallocate advanced formulas array");
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (uint64_t i = 0; i < header.advancedCount; i++) {
+            Cell *formula = cellAt(loaded, advanced[i]);
+            // Ranges were checked with the formulas above; coverage needs one.
+            if (!formula || formula->op < OP_ADV_SUM || formula->op > OP_ADV_STDEV) {
+                ok = 0;
+                break;
+            }
+            loaded->advancedFormulas[i] = formula;
+            coverRange(loaded, formula, 1);
+        }
+        loaded->advancedFormulasCount = (int) header.advancedCount;
+    }
+    munmap((void *) map, size);
+
+    if (!ok) {
+        freeSpreadsheet(loaded);
+        return -1;
+    }
+    loaded->startRow = header.startRow;
+    loaded->startCol = header.startCol;
+    // Most of a loaded sheet is not looked at again soon; what is gets unpacked on the way.
+    tileStoreMarkCold(&loaded->store);
+    adoptSpreadsheet(spreadsheet, loaded);
+    return 0;
+}
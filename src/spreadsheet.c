@@ -6,9 +6,23 @@
 #include <limits.h>
 #include <unistd.h>
 #include <time.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include "cell.h"
 #include "spreadsheet.h"
 #include "avl_tree.h"
+#include "render.h"
+#include "journal.h"
+#include "stats.h"
+#include "mem_track.h"
+#include "trace.h"
+#include "tile_store.h"
+#include "workbook.h"
+#include "value_plane.h"
+#include "change_feed.h"
+#include "components.h"
+#include "thread_pool.h"
+#include "background.h"
 
 /* Operation codes for advanced formulas */
 #define OP_ADV_SUM    5
@@ -25,85 +39,181 @@
 #define OP_DIV        4
 #define OP_NONE       0
 
-clock_t global_end;
-double global_cpu_time_used;
-
 /*
-   ---------------- Queue & BFS-based cycle detection ----------------
+   ---------------- Status reporting ----------------
 
-   The code below implements a simple queue using a linked list.
-   This queue is used for breadth-first search (BFS) to detect cycles in cell dependencies.
+   Every command ends with a "[time] (message) " status line.  These helpers keep the
+   elapsed-time bookkeeping in one place and let script mode run quietly.
 */
 
 /*
- * The Node structure represents an element in our queue.
- * It holds a pointer to a Cell and a pointer to the next Node.
+ * commitPendingCommand appends the command being executed to the journal.  It runs the first time
+ * a result of an accepted command is emitted (its frame or its "ok"), so the journal always
+ * holds a command before the user can see its effect.
  */
-typedef struct Node {
-    Cell *cell;
-    struct Node *next;
-} Node;
+void commitPendingCommand(Spreadsheet *spreadsheet) {
+    if (spreadsheet->journal && spreadsheet->pendingCommand) {
+        journalAppend(spreadsheet->journal, spreadsheet->pendingCommand);
+        spreadsheet->pendingCommand = NULL;
+    }
+}
 
 /*
- * The enqueue function adds a new cell to the end of the BFS queue.
- * It dynamically allocates a new node and updates the head and tail pointers accordingly.
+ * emitStatus counts rejected commands (any message other than "ok") and prints the status line
+ * using the time already stored in the spreadsheet.
  */
-void enqueue(Node **head, Node **tail, Cell *cell) {
-    Node *newNode = malloc(sizeof(Node));
-    if (!newNode) {
-        perror("Failed to allocate Node");
-        exit(EXIT_FAILURE);
-    }
-    newNode->cell = cell;
-    newNode->next = NULL;
-    if (*tail == NULL) {
-        *head = *tail = newNode;
-    } else {
-        (*tail)->next = newNode;
-        *tail = newNode;
+static void emitStatus(Spreadsheet *spreadsheet, const char *fmt, va_list args) {
+    if (strcmp(fmt, "ok") != 0)
+        spreadsheet->rejectedCount++;
+    else
+        commitPendingCommand(spreadsheet);
+    if (spreadsheet->statusOut) {
+        va_list copy;
+        va_copy(copy, args);
+        vsnprintf(spreadsheet->statusOut, spreadsheet->statusOutSize, fmt, copy);
+        va_end(copy);
     }
+    if (spreadsheet->quiet)
+        return;
+    printf("[%.1f] (", spreadsheet->time);
+    vprintf(fmt, args);
+    printf(") ");
 }
 
 /*
- * The dequeue function removes and returns the cell at the front of the queue.
- * It handles updating the head and tail pointers and frees the removed node.
+ * printStatus prints the status line without touching the recorded time.
  */
-Cell *dequeue(Node **head, Node **tail) {
-    if (*head == NULL)
-        return NULL;
-    Node *temp = *head;
-    Cell *cell = temp->cell;
-    *head = temp->next;
-    if (*head == NULL)
-        *tail = NULL;
-    free(temp);
-    return cell;
+void printStatus(Spreadsheet *spreadsheet, const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    emitStatus(spreadsheet, fmt, args);
+    va_end(args);
 }
 
 /*
-   The BFSData structure holds information needed for a BFS traversal.
-   It includes pointers to the queue's head and tail, an array to track visited cells,
-   the total number of cells in the spreadsheet, and a pointer to the spreadsheet.
+ * monotonicSeconds returns a wall-clock timestamp that is unaffected by clock adjustments.
+ * Command start times are taken from it so the status line shows elapsed wall time.
+ */
+double monotonicSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * reportStatus records the wall time spent since start and prints the status line.
+ */
+void reportStatus(Spreadsheet *spreadsheet, double start, const char *fmt, ...) {
+    spreadsheet->time = monotonicSeconds() - start;
+    va_list args;
+    va_start(args, fmt);
+    emitStatus(spreadsheet, fmt, args);
+    va_end(args);
+}
+
+/*
+   ---------------- Visited sets & BFS-based cycle detection ----------------
+
+   Cycle checks and recalculation walk the dependents graph breadth-first.  The walk keeps its
+   frontier in an AffectedSet, which is the queue and the visited set at once, so a walk costs
+   time proportional to the cells it reaches rather than to the size of the sheet.
 */
+
+/*
+ * AffectedSet is the list of cells reached by a walk, together with an open-addressing
+ * hash index from cell pointer to list position.  Every cell enters the list once, no matter how
+ * many paths lead to it, and lookups during the in-degree passes are constant time.
+ */
 typedef struct {
-    Node **head;
-    Node **tail;
-    int *visited;
-    int totalCells;
-    Spreadsheet *spreadsheet;
-} BFSData;
+    Cell **cells;
+    int count;
+    int capacity;
+    Cell **slots;
+    int *slotIndex;
+    unsigned long mask;
+    int tag;                // mem_track tag the buffers are charged to
+} AffectedSet;
+
+static unsigned long hashCell(Cell *cell) {
+    unsigned long long x = (unsigned long long) (uintptr_t) cell;
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return (unsigned long) x;
+}
+
+static void affectedInit(AffectedSet *set, int tag) {
+    set->tag = tag;
+    set->count = 0;
+    set->capacity = 64;
+    set->cells = memAlloc(set->tag, set->capacity * sizeof(Cell *));
+    set->slots = memCalloc(set->tag, 2 * set->capacity, sizeof(Cell *));
+    set->slotIndex = memAlloc(set->tag, 2 * set->capacity * sizeof(int));
+    if (!set->cells || !set->slots || !set->slotIndex) {
+        perror("Failed to allocate affected cells set");
+        exit(EXIT_FAILURE);
+    }
+    set->mask = 2 * set->capacity - 1;
+}
+
+static void affectedFree(AffectedSet *set) {
+    memFree(set->tag, set->cells, set->capacity * sizeof(Cell *));
+    memFree(set->tag, set->slots, 2 * set->capacity * sizeof(Cell *));
+    memFree(set->tag, set->slotIndex, 2 * set->capacity * sizeof(int));
+}
 
 /*
- * This callback function is called during the BFS traversal.
- * It checks if the cell has been visited; if not, it marks the cell as visited and enqueues it.
+ * findAffectedIndex returns the position of a cell in the affected list, or -1 if it is not there.
  */
-void bfs_enqueue_if_not_visited(Cell *cell, void *data) {
-    BFSData *bfsData = (BFSData *) data;
-    int idx = cell->selfRow * bfsData->spreadsheet->cols + cell->selfCol;
-    if (!bfsData->visited[idx]) {
-        bfsData->visited[idx] = 1;
-        enqueue(bfsData->head, bfsData->tail, cell);
+static int findAffectedIndex(AffectedSet *set, Cell *cell) {
+    for (unsigned long i = hashCell(cell) & set->mask; set->slots[i]; i = (i + 1) & set->mask) {
+        if (set->slots[i] == cell)
+            return set->slotIndex[i];
     }
+    return -1;
+}
+
+static void affectedIndexSlot(AffectedSet *set, Cell *cell, int index) {
+    unsigned long i = hashCell(cell) & set->mask;
+    while (set->slots[i])
+        i = (i + 1) & set->mask;
+    set->slots[i] = cell;
+    set->slotIndex[i] = index;
+}
+
+/*
+ * affectedAdd appends a cell unless it is already in the set.  The hash index is kept at most
+ * half full and rebuilt when the list doubles.
+ */
+static void affectedAdd(AffectedSet *set, Cell *cell) {
+    if (findAffectedIndex(set, cell) != -1)
+        return;
+    if (set->count == set->capacity) {
+        memFree(set->tag, set->slots, 2 * set->capacity * sizeof(Cell *));
+        memFree(set->tag, set->slotIndex, 2 * set->capacity * sizeof(int));
+        set->cells = memRealloc(set->tag, set->cells, set->capacity * sizeof(Cell *),
+                                2 * set->capacity * sizeof(Cell *));
+        set->capacity *= 2;
+        set->slots = memCalloc(set->tag, 2 * set->capacity, sizeof(Cell *));
+        set->slotIndex = memAlloc(set->tag, 2 * set->capacity * sizeof(int));
+        if (!set->cells || !set->slots || !set->slotIndex) {
+            perror("Failed to reallocate affected cells set");
+            exit(EXIT_FAILURE);
+        }
+        set->mask = 2 * set->capacity - 1;
+        for (int i = 0; i < set->count; i++)
+            affectedIndexSlot(set, set->cells[i], i);
+    }
+    affectedIndexSlot(set, cell, set->count);
+    set->cells[set->count++] = cell;
+}
+
+/*
+ * collect_affected_callback adds a dependent to the affected set; the set doubles as the BFS queue.
+ */
+static void collect_affected_callback(Cell *cell, void *data) {
+    STATS_COUNT(STATS_EDGES_TRAVERSED, 1);
+    affectedAdd((AffectedSet *) data, cell);
 }
 
 /*
@@ -111,119 +221,73 @@ void bfs_enqueue_if_not_visited(Cell *cell, void *data) {
  * It starts from the source cell and performs a BFS looking for the target cell.
  * This function is essential for detecting cycles in cell dependencies.
  */
-int existsPath(Cell *source, Cell *target, Spreadsheet *spreadsheet) {
-    int totalCells = spreadsheet->rows * spreadsheet->cols;
-    int *visited = calloc(totalCells, sizeof(int));
-    if (!visited) {
-        perror("calloc failed in existsPath");
-        exit(EXIT_FAILURE);
-    }
-    Node *queueHead = NULL, *queueTail = NULL;
-    BFSData bfsData;
-    bfsData.head = &queueHead;
-    bfsData.tail = &queueTail;
-    bfsData.visited = visited;
-    bfsData.totalCells = totalCells;
-    bfsData.spreadsheet = spreadsheet;
-    int startIndex = source->selfRow * spreadsheet->cols + source->selfCol;
-    visited[startIndex] = 1;
-    enqueue(&queueHead, &queueTail, source);
+static int existsPath(Cell *source, Cell *target) {
+    // A cell nothing depends on reaches only itself (bulk loads hit this).
+    if (!source->dependents)
+        return source == target;
+    AffectedSet reached;
+    affectedInit(&reached, MEM_VISITED);
+    affectedAdd(&reached, source);
     int found = 0;
-    while (queueHead != NULL) {
-        Cell *curr = dequeue(&queueHead, &queueTail);
+    for (int front = 0; front < reached.count; front++) {
+        Cell *curr = reached.cells[front];
+        STATS_COUNT(STATS_BFS_VISITED, 1);
         if (curr == target) {
             found = 1;
             break;
         }
         if (curr->dependents)
-            avl_traverse(curr->dependents, bfs_enqueue_if_not_visited, &bfsData);
+            avl_traverse(curr->dependents, collect_affected_callback, &reached);
     }
-    free(visited);
+    affectedFree(&reached);
     return found;
 }
 
 /*
  * The checkCycleNew function is simply a wrapper around existsPath.
  * It inverts the order of parameters to check for cycles when adding dependencies.
+ * No path can join cells of different components, so that case needs no search.
  */
-int checkCycleNew(Cell *operand, Cell *target, Spreadsheet *spreadsheet) {
-    return existsPath(target, operand, spreadsheet);
+int checkCycleNew(Spreadsheet *spreadsheet, Cell *operand, Cell *target) {
+    if (componentsSeparate(spreadsheet, operand, target))
+        return 0;
+    STATS_ENTER(STATS_PHASE_CYCLE_CHECK);
+    TRACE_BEGIN(traceMark);
+    int found = existsPath(target, operand);
+    TRACE_SPAN(traceMark, "cycle_check", target->selfRow, target->selfCol, -1);
+    STATS_LEAVE();
+    return found;
 }
 
 /*
-   ---------------- Optimized Advanced Formula Cycle Detection ----------------
-
-   The following code is used to detect cycles in advanced formulas more efficiently.
-   Instead of checking every cell individually, it performs one BFS from the target cell over a range.
-*/
-
-/*
- * CycleBFSData stores extra information needed during BFS for advanced formulas.
- * In addition to the queue and visited array, it keeps the boundaries of the cell range and a flag if a cycle is found.
+ * The checkAdvancedFormulaCycleNew function performs a BFS from the target cell over its
+ * dependents and returns 1 if any cell it reaches lies in the given advanced formula range
+ * on rangeSheet.
  */
-typedef struct {
-    Node **head;
-    Node **tail;
-    int *visited;
-    Spreadsheet *spreadsheet;
-    int rStart, cStart, rEnd, cEnd;
-    int foundCycle;
-} CycleBFSData;
-
-/*
- * The bfs_enqueue_if_in_range callback is similar to the previous BFS callback but checks whether the enqueued cell falls within a specified range.
- * If it does, it sets the cycle flag.
- */
-void bfs_enqueue_if_in_range(Cell *cell, void *data) {
-    CycleBFSData *cbData = (CycleBFSData *) data;
-    int idx = cell->selfRow * cbData->spreadsheet->cols + cell->selfCol;
-    if (!cbData->visited[idx]) {
-        cbData->visited[idx] = 1;
-        /* If the cell lies within the target range, a cycle is detected */
-        if (cell->selfRow >= cbData->rStart && cell->selfRow <= cbData->rEnd &&
-            cell->selfCol >= cbData->cStart && cell->selfCol <= cbData->cEnd) {
-            cbData->foundCycle = 1;
+int checkAdvancedFormulaCycleNew(Cell *target, const Spreadsheet *rangeSheet,
+                                 int rStart, int cStart, int rEnd, int cEnd) {
+    if (!target->dependents)
+        return 0;
+    STATS_ENTER(STATS_PHASE_CYCLE_CHECK);
+    TRACE_BEGIN(traceMark);
+    AffectedSet reached;
+    affectedInit(&reached, MEM_VISITED);
+    affectedAdd(&reached, target);
+    int foundCycle = 0;
+    for (int front = 0; front < reached.count; front++) {
+        Cell *curr = reached.cells[front];
+        STATS_COUNT(STATS_BFS_VISITED, 1);
+        if (front > 0 && sheetRangeHolds(rangeSheet, curr, rStart, cStart, rEnd, cEnd)) {
+            foundCycle = 1;
+            break;
         }
-        enqueue(cbData->head, cbData->tail, cell);
-    }
-}
-
-/*
- * The checkAdvancedFormulaCycleNew function performs a BFS from the target cell,
- * but only enqueues cells that are in the given advanced formula range.
- * It returns 1 if a cycle is found in that range.
- */
-int checkAdvancedFormulaCycleNew(Cell *target, int rStart, int cStart, int rEnd, int cEnd, Spreadsheet *spreadsheet) {
-    int totalCells = spreadsheet->rows * spreadsheet->cols;
-    int *visited = calloc(totalCells, sizeof(int));
-    if (!visited) {
-        perror("calloc failed in checkAdvancedFormulaCycleNew");
-        exit(EXIT_FAILURE);
-    }
-    Node *queueHead = NULL, *queueTail = NULL;
-    CycleBFSData cbData;
-    cbData.head = &queueHead;
-    cbData.tail = &queueTail;
-    cbData.visited = visited;
-    cbData.spreadsheet = spreadsheet;
-    cbData.rStart = rStart;
-    cbData.cStart = cStart;
-    cbData.rEnd = rEnd;
-    cbData.cEnd = cEnd;
-    cbData.foundCycle = 0;
-
-    int index = target->selfRow * spreadsheet->cols + target->selfCol;
-    visited[index] = 1;
-    enqueue(&queueHead, &queueTail, target);
-
-    while (queueHead != NULL && !cbData.foundCycle) {
-        Cell *curr = dequeue(&queueHead, &queueTail);
         if (curr->dependents)
-            avl_traverse(curr->dependents, bfs_enqueue_if_in_range, &cbData);
+            avl_traverse(curr->dependents, collect_affected_callback, &reached);
     }
-
-    free(visited);
-    return cbData.foundCycle;
+    affectedFree(&reached);
+    TRACE_SPAN(traceMark, "cycle_check", target->selfRow, target->selfCol, -1);
+    STATS_LEAVE();
+    return foundCycle;
 }
 
 /*
@@ -246,8 +310,9 @@ static void remove_dependent_callback(Cell *source, void *target_ptr) {
  * It traverses the cell's dependency tree, removes the cell from the dependents' lists,
  * frees the dependency tree, and resets the pointer.
  */
-void clearDependencies(Cell *cell) {
+void clearDependencies(Spreadsheet *spreadsheet, Cell *cell) {
     if (cell->dependencies) {
+        componentsNoteRemoval(spreadsheet);
         avl_traverse(cell->dependencies, remove_dependent_callback, cell);
         avl_free(cell->dependencies);
         cell->dependencies = NULL;
@@ -270,6 +335,16 @@ void addDependent(Cell *sourceCell, Cell *target) {
     sourceCell->dependents = avl_insert(sourceCell->dependents, target, avl_cell_compare);
 }
 
+/*
+ * linkDependency records that target, a cell of spreadsheet, depends on source, in both
+ * directions, and joins their components.
+ */
+static void linkDependency(Spreadsheet *spreadsheet, Cell *target, Cell *source) {
+    addDependency(target, source);
+    addDependent(source, target);
+    componentsLink(spreadsheet, target, source);
+}
+
 /*
    ---------------- Recalculation functions ----------------
 
@@ -278,70 +353,264 @@ void addDependent(Cell *sourceCell, Cell *target) {
 */
 
 /*
- * recalc_cell recalculates a cell's value based on its type of operation.
+ * prefetchRange asks for the spilled tiles a scan of the range is going to read to be paged in
+ * ahead of it: those it cuts and, unless their summaries will do (summaries set and fresh),
+ * those it covers whole.
+ */
+static void prefetchRange(const TileStore *store, int rStart, int cStart, int rEnd, int cEnd, int summaries) {
+    for (int tileRow = rStart >> TILE_ROW_BITS; tileRow <= rEnd >> TILE_ROW_BITS; tileRow++) {
+        if (!store->bands[tileRow])
+            continue;
+        for (int tileCol = cStart >> TILE_COL_BITS; tileCol <= cEnd >> TILE_COL_BITS; tileCol++) {
+            const Tile *tile = store->bands[tileRow][tileCol];
+            if (!tile || tile->packed || tile->resident)
+                continue;
+            int covered = rStart <= tile->row0 && rEnd >= tile->row0 + tile->rows - 1 &&
+                          cStart <= tile->col0 && cEnd >= tile->col0 + tile->cols - 1;
+            if (!(summaries && covered && !tile->summary.stale))
+                tileBackingPrefetch(store->backing, tile);
+        }
+    }
+}
+
+/*
+ * visitPacked hands rows r0..r1, columns c0..c1 of a packed tile to visit, one row at a time.
+ */
+static void visitPacked(const Tile *tile, int r0, int c0, int r1, int c1,
+                        void (*visit)(const Cell *block, int rows, long width, int pitch, void *data),
+                        void *data) {
+    Cell row[TILE_COLS];
+    for (int r = r0; r <= r1; r++) {
+        long index = tileCellIndex(tile, r, c0);
+        for (int c = 0; c <= c1 - c0; c++) {
+            row[c].value = tilePackedValue(tile, index + c);
+            row[c].error = 0;
+        }
+        visit(row, 1, c1 - c0 + 1, 0, data);
+    }
+}
+
+/*
+ * scanRect hands the cells of a rectangle of the store to visit one block at a time: the part
+ * of the rectangle in one tile, rows cells high and width wide, with pitch cells from the start
+ * of one row to the next.  Column ranges then cost one call per tile, as row ranges do.  A tile
+ * that was never materialized holds only empty cells, so such tiles are passed as single rows
+ * of NULL cells.  A tile the rectangle covers whole is first offered to whole, if given, which
+ * returns 1 if it took the tile in from its summary.  Spilled tiles the scan will read are
+ * prefetched first.  Packed tiles are read in place, a row at a time.  Only with whole given
+ * (on the calling thread) are the tiles read passed to tileStoreUse.
+ */
+static void scanRect(const TileStore *store, int rStart, int cStart, int rEnd, int cEnd,
+                     void (*visit)(const Cell *block, int rows, long width, int pitch, void *data),
+                     int (*whole)(const TileStore *store, Tile *tile, void *data), void *data) {
+    if (store->backing)
+        prefetchRange(store, rStart, cStart, rEnd, cEnd, whole != NULL);
+    for (int tileRow = rStart >> TILE_ROW_BITS; tileRow <= rEnd >> TILE_ROW_BITS; tileRow++) {
+        int r0 = tileRow << TILE_ROW_BITS, r1 = r0 + TILE_ROWS - 1;
+        if (r0 < rStart) r0 = rStart;
+        if (r1 > rEnd) r1 = rEnd;
+        // Neighbouring missing tiles, and whole missing bands, are reported as one empty run.
+        long missing = 0;
+        if (!store->bands[tileRow]) {
+            visit(NULL, 1, (long) (r1 - r0 + 1) * (cEnd - cStart + 1), 0, data);
+            continue;
+        }
+        for (int tileCol = cStart >> TILE_COL_BITS; tileCol <= cEnd >> TILE_COL_BITS; tileCol++) {
+            int c0 = tileCol << TILE_COL_BITS, c1 = c0 + TILE_COLS - 1;
+            if (c0 < cStart) c0 = cStart;
+            if (c1 > cEnd) c1 = cEnd;
+            Tile *tile = store->bands[tileRow][tileCol];
+            if (!tile) {
+                missing += (long) (r1 - r0 + 1) * (c1 - c0 + 1);
+                continue;
+            }
+            if (missing > 0) {
+                visit(NULL, 1, missing, 0, data);
+                missing = 0;
+            }
+            if (whole && r0 == tile->row0 && r1 - r0 + 1 == tile->rows &&
+                c0 == tile->col0 && c1 - c0 + 1 == tile->cols && whole(store, tile, data))
+                continue;
+            if (tile->packed) {
+                visitPacked(tile, r0, c0, r1, c1, visit, data);
+                continue;
+            }
+            if (whole)
+                tileStoreUse(store, tile);
+            visit(&tile->cells[tileCellIndex(tile, r0, c0)], r1 - r0 + 1, c1 - c0 + 1, tile->cols, data);
+        }
+        if (missing > 0)
+            visit(NULL, 1, missing, 0, data);
+    }
+}
+
+/*
+ * scanRange is scanRect for a range of the sheet: one rectangle per run of rows and run of
+ * columns the range lies on in the store, which is the range itself until rows or columns are
+ * inserted or deleted.
+ */
+static void scanRange(const Spreadsheet *spreadsheet, int rStart, int cStart, int rEnd, int cEnd,
+                      void (*visit)(const Cell *block, int rows, long width, int pitch, void *data),
+                      int (*whole)(const TileStore *store, Tile *tile, void *data), void *data) {
+    for (int r = rStart; r <= rEnd; ) {
+        int row, rows = indexMapSpan(spreadsheet->rowMap, r, rEnd, &row);
+        for (int c = cStart; c <= cEnd; ) {
+            int col, cols = indexMapSpan(spreadsheet->colMap, c, cEnd, &col);
+            scanRect(&spreadsheet->store, row, col, row + rows - 1, col + cols - 1, visit, whole, data);
+            c += cols;
+        }
+        r += rows;
+    }
+}
+
+/*
+ * RangeAggregate accumulates what the advanced formulas need from one pass over a range.
+ */
+typedef struct {
+    long sum;
+    long count;
+    int minVal;
+    int maxVal;
+    int error;
+    long summarized;        // cells taken in from tile summaries
+} RangeAggregate;
+
+static void aggregate_visit(const Cell *block, int rows, long width, int pitch, void *data) {
+    RangeAggregate *agg = (RangeAggregate *) data;
+    agg->count += rows * width;
+    if (!block) {
+        if (agg->minVal > 0) agg->minVal = 0;
+        if (agg->maxVal < 0) agg->maxVal = 0;
+        return;
+    }
+    long sum = 0;
+    int minVal = agg->minVal, maxVal = agg->maxVal, error = 0;
+    for (int r = 0; r < rows; r++, block += pitch) {
+        for (long i = 0; i < width; i++) {
+            int val = block[i].value;
+            error |= block[i].error;
+            sum += val;
+            if (val < minVal)
+                minVal = val;
+            if (val > maxVal)
+                maxVal = val;
+        }
+    }
+    agg->sum += sum;
+    agg->minVal = minVal;
+    agg->maxVal = maxVal;
+    agg->error |= error;
+}
+
+static int aggregate_tile(const TileStore *store, Tile *tile, void *data) {
+    RangeAggregate *agg = (RangeAggregate *) data;
+    const TileSummary *summary = tileStoreSummary(store, tile);
+    agg->count += (long) tile->rows * tile->cols;
+    agg->summarized += (long) tile->rows * tile->cols;
+    agg->sum += summary->sum;
+    agg->error |= summary->errors > 0;
+    if (summary->min < agg->minVal)
+        agg->minVal = summary->min;
+    if (summary->max > agg->maxVal)
+        agg->maxVal = summary->max;
+    return 1;
+}
+
+/*
+ * DeviationData accumulates squared deviations from an integer mean (the STDEV second pass).
+ */
+typedef struct {
+    int mean;
+    double sqDiffSum;
+    long summarized;
+} DeviationData;
+
+static void deviation_visit(const Cell *block, int rows, long width, int pitch, void *data) {
+    DeviationData *dev = (DeviationData *) data;
+    if (!block) {
+        dev->sqDiffSum += (double) width * dev->mean * dev->mean;
+        return;
+    }
+    for (int r = 0; r < rows; r++, block += pitch) {
+        for (long i = 0; i < width; i++) {
+            double diff = block[i].value - dev->mean;
+            dev->sqDiffSum += diff * diff;
+        }
+    }
+}
+
+// 2^53: integers up to here are exact in a double.
+#define DEVIATION_EXACT_MAX 9007199254740992.0
+
+/*
+ * deviation_tile adds the squared deviations of a tile as sumSquares - 2 * mean * sum + n * mean^2.
+ * While values, mean and the running total are small every term is an exact integer, so this is
+ * what a scan of the tile would add; otherwise the tile is scanned.
+ */
+static int deviation_tile(const TileStore *store, Tile *tile, void *data) {
+    DeviationData *dev = (DeviationData *) data;
+    const TileSummary *summary = tileStoreSummary(store, tile);
+    if (!summary->exact || dev->mean < -TILE_SUMMARY_EXACT_MAX || dev->mean > TILE_SUMMARY_EXACT_MAX)
+        return 0;
+    double mean = dev->mean;
+    double squares = summary->sumSquares - 2.0 * mean * (double) summary->sum +
+                     (double) tile->rows * tile->cols * mean * mean;
+    if (dev->sqDiffSum + squares > DEVIATION_EXACT_MAX)
+        return 0;
+    dev->sqDiffSum += squares;
+    dev->summarized += (long) tile->rows * tile->cols;
+    return 1;
+}
+
+/*
+ * evaluateCell recalculates a cell's value based on its type of operation.
  * It handles advanced formulas by iterating over a range of cells,
  * and simple operations by applying arithmetic to one or two operands.
+ * It returns the number of range cells it scanned.  With summaries set, tiles a range covers
+ * whole are taken in from their summaries, which are refreshed on the way; without, it touches
+ * no shared state besides the trace, so recalcAll can run it on the thread pool (with tracing
+ * off).
  */
-void recalc_cell(Cell *cell, Spreadsheet *spreadsheet) {
+static long evaluateCell(Cell *cell, Spreadsheet *spreadsheet, int summaries) {
+    long scanned = 0;
     if (cell->op != OP_NONE) {
         if (cell->op >= OP_ADV_SUM && cell->op <= OP_ADV_STDEV) {
-            int rStart = cell->row1, cStart = cell->col1;
-            int rEnd = cell->row2, cEnd = cell->col2;
-            long sum = 0;
-            int count = 0, minVal = INT_MAX, maxVal = INT_MIN;
-            int foundError = 0;
-            for (int r = rStart; r <= rEnd; r++) {
-                for (int c = cStart; c <= cEnd; c++) {
-                    Cell *curr = &spreadsheet->table[r][c];
-                    if (curr->error)
-                        foundError = 1;
-                    int val = curr->value;
-                    sum += val;
-                    if (val < minVal)
-                        minVal = val;
-                    if (val > maxVal)
-                        maxVal = val;
-                    count++;
-                }
-            }
-            if (foundError) {
+            TRACE_BEGIN(traceMark);
+            const Spreadsheet *rangeSheet = cell->rangeSheet ? cell->rangeSheet : spreadsheet;
+            RangeAggregate agg = { 0, 0, INT_MAX, INT_MIN, 0, 0 };
+            scanRange(rangeSheet, cell->row1, cell->col1, cell->row2, cell->col2, aggregate_visit,
+                      summaries ? aggregate_tile : NULL, &agg);
+            scanned = agg.count - agg.summarized;
+            if (agg.error) {
                 cell->error = 1;
-                return;
+                TRACE_SPAN(traceMark, "range_scan", cell->selfRow, cell->selfCol, agg.count);
+                return scanned;
             }
             int result = 0;
             switch (cell->op) {
                 case OP_ADV_SUM:
-                    result = (int) sum;
+                    result = (int) agg.sum;
                     break;
                 case OP_ADV_MIN:
-                    result = minVal;
+                    result = agg.minVal;
                     break;
                 case OP_ADV_MAX:
-                    result = maxVal;
+                    result = agg.maxVal;
                     break;
                 case OP_ADV_AVG:
-                    result = (count > 0) ? (int)(sum / count) : 0;
+                    result = (agg.count > 0) ? (int)(agg.sum / agg.count) : 0;
                     break;
                 case OP_ADV_STDEV: {
-                    if (count <= 1) {
+                    if (agg.count <= 1) {
                         result = 0;
                         break;
                     }
-                    int total = 0, mean;
-                    double sqDiffSum = 0.0;
-                    for (int r = rStart; r <= rEnd; r++) {
-                        for (int c = cStart; c <= cEnd; c++) {
-                            total += spreadsheet->table[r][c].value;
-                        }
-                    }
-                    mean = total / count;
-                    for (int r = rStart; r <= rEnd; r++) {
-                        for (int c = cStart; c <= cEnd; c++) {
-                            double diff = spreadsheet->table[r][c].value - mean;
-                            sqDiffSum += diff * diff;
-                        }
-                    }
-                    double stdev = sqrt(sqDiffSum / count);
+                    // The mean is taken over the int-wrapped total, as it always has been.
+                    DeviationData dev = { (int) ((int) agg.sum / agg.count), 0.0, 0 };
+                    scanRange(rangeSheet, cell->row1, cell->col1, cell->row2, cell->col2, deviation_visit,
+                              summaries ? deviation_tile : NULL, &dev);
+                    scanned += agg.count - dev.summarized;
+                    double stdev = sqrt(dev.sqDiffSum / agg.count);
                     result = (int) round(stdev);
                     break;
                 }
@@ -350,6 +619,7 @@ void recalc_cell(Cell *cell, Spreadsheet *spreadsheet) {
             }
             cell->value = result;
             cell->error = 0;
+            TRACE_SPAN(traceMark, "range_scan", cell->selfRow, cell->selfCol, agg.count);
         }
         else if (cell->op == OP_SLEEP) {
             cell->error = 0;
@@ -359,8 +629,7 @@ void recalc_cell(Cell *cell, Spreadsheet *spreadsheet) {
                 (!cell->operand2IsLiteral && cell->operand2 && cell->operand2->error)) {
                 cell->error = 1;
                 cell->value = 0;
-                cell->op = OP_ADD;
-                return;
+                return scanned;
             }
             int op1 = cell->operand1IsLiteral ? cell->operand1Literal : (cell->operand1 ? cell->operand1->value : 0);
             int op2 = cell->operand2IsLiteral ? cell->operand2Literal : (cell->operand2 ? cell->operand2->value : 0);
@@ -379,7 +648,7 @@ void recalc_cell(Cell *cell, Spreadsheet *spreadsheet) {
                     if (op2 == 0) {
                         cell->error = 1;
                         cell->value = 0;
-                        return;
+                        return scanned;
                     }
                     result = op1 / op2;
                     break;
@@ -395,8 +664,36 @@ void recalc_cell(Cell *cell, Spreadsheet *spreadsheet) {
             cell->value = cell->operand1->value;
             cell->error = cell->operand1->error;
         }
-        return;
     }
+    return scanned;
+}
+
+/*
+ * noteChange records for the change feed that cell of sheet, which showed oldValue/oldError,
+ * is changing.  It costs a pointer test while nobody subscribes.
+ */
+static void noteChange(Spreadsheet *sheet, Cell *cell, int oldValue, int oldError) {
+    ChangeFeed *feed = homeSheet(sheet)->feed;
+    if (changeFeedActive(feed))
+        changeFeedRecord(feed, sheet, cell, oldValue, oldError);
+}
+
+/*
+ * recalc_cell recomputes one cell; it is the unit the statistics and the trace count.
+ */
+void recalc_cell(Cell *cell, Spreadsheet *spreadsheet) {
+    STATS_COUNT(STATS_CELLS_RECOMPUTED, 1);
+    TRACE_BEGIN(traceMark);
+    int oldValue = cell->value, oldError = cell->error;
+    long scanned = evaluateCell(cell, spreadsheet, 1);
+    STATS_COUNT(STATS_RANGE_CELLS_SCANNED, scanned);
+    (void) scanned;
+    // A cascade can reach cells of other sheets, so the tile is looked up on the owner.
+    Spreadsheet *owner = spreadsheet->workbook ? workbookOwner(spreadsheet, cell) : spreadsheet;
+    tileStoreTouch(&owner->store, cell);
+    if (cellShowsChange(cell->value, cell->error, oldValue, oldError))
+        noteChange(owner, cell, oldValue, oldError);
+    TRACE_SPAN(traceMark, "recalc_cell", cell->selfRow, cell->selfCol, -1);
 }
 
 /*
@@ -417,26 +714,12 @@ void recalc_basic_recursive(Cell *cell, Spreadsheet *spreadsheet) {
    using a topological sort based on dependency in-degrees.
 */
 
-/*
- * findAffectedIndex searches for a given cell in the list of affected cells.
- * It returns the index of the cell or -1 if the cell is not found.
- */
-int findAffectedIndex(Cell **arr, int count, Cell *cell) {
-    for (int i = 0; i < count; i++) {
-        if (arr[i] == cell)
-            return i;
-    }
-    return -1;
-}
-
 /*
  * DepCallbackData is used when updating the in-degree of cells.
- * It contains the array of affected cells, the number of them,
- * the target index currently being processed, and the in-degree array.
+ * It contains the set of affected cells, the target index currently being processed, and the in-degree array.
  */
 typedef struct {
-    Cell **affected;
-    int affectedCount;
+    AffectedSet *affected;
     int targetIndex;
     int *inDegree;
 } DepCallbackData;
@@ -446,19 +729,17 @@ typedef struct {
  */
 void dep_check_callback(Cell *dep, void *data) {
     DepCallbackData *dData = (DepCallbackData *) data;
-    int idx = findAffectedIndex(dData->affected, dData->affectedCount, dep);
-    if (idx != -1) {
+    STATS_COUNT(STATS_EDGES_TRAVERSED, 1);
+    if (findAffectedIndex(dData->affected, dep) != -1)
         dData->inDegree[dData->targetIndex]++;
-    }
 }
 
 /*
  * ProcessDepData is a helper structure used during the topological sorting process.
- * It holds the affected cells array, in-degrees, and a queue of cells with zero in-degree.
+ * It holds the affected cells set, in-degrees, and a queue of cells with zero in-degree.
  */
 typedef struct {
-    Cell **affected;
-    int affectedCount;
+    AffectedSet *affected;
     int *inDegree;
     int *zeroQueue;
     int *zeroQueueSize;
@@ -470,7 +751,8 @@ typedef struct {
  */
 void process_dependent_callback(Cell *dep, void *data) {
     ProcessDepData *pData = (ProcessDepData *) data;
-    int idx = findAffectedIndex(pData->affected, pData->affectedCount, dep);
+    STATS_COUNT(STATS_EDGES_TRAVERSED, 1);
+    int idx = findAffectedIndex(pData->affected, dep);
     if (idx != -1) {
         pData->inDegree[idx]--;
         if (pData->inDegree[idx] == 0) {
@@ -481,70 +763,52 @@ void process_dependent_callback(Cell *dep, void *data) {
 }
 
 /*
- * LLQueueData is a small structure for holding the head and tail pointers of a linked-list queue.
- * This queue is used in the topological sorting process.
- */
-typedef struct {
-    Node **head;
-    Node **tail;
-} LLQueueData;
-
-/*
- * bfs_enqueue_callback_ll is used to enqueue cells into the linked-list queue for the topological sort.
+ * collectDownstream adds every cell reachable from start through dependents to set.
  */
-void bfs_enqueue_callback_ll(Cell *cell, void *data) {
-    LLQueueData *qdata = (LLQueueData *) data;
-    enqueue(qdata->head, qdata->tail, cell);
+static void collectDownstream(Cell *start, AffectedSet *set) {
+    if (start->dependents)
+        avl_traverse(start->dependents, collect_affected_callback, set);
+    for (int front = 0; front < set->count; front++) {
+        Cell *curr = set->cells[front];
+        if (curr->dependents)
+            avl_traverse(curr->dependents, collect_affected_callback, set);
+    }
 }
 
 /*
- * recalcUsingTopoOrder recalculates all cells affected by a change in a topologically sorted order.
- * This ensures that no cell is calculated before all of its dependencies have been updated.
+ * recalcDownstream recalculates, in one topologically sorted pass, every cell affected by a
+ * change of any of the count cells in starts.  The affected cells are collected with a visited
+ * set, so shared sub-graphs (e.g. a Fibonacci chain, where every cell is reachable along
+ * exponentially many paths) are walked once, and a cell downstream of several starts is
+ * recomputed once.  A start that is itself downstream of another is recomputed in order too.
  */
-void recalcUsingTopoOrder(Cell *start, Spreadsheet *spreadsheet) {
-    Node *queueHead = NULL, *queueTail = NULL;
-    LLQueueData llData;
-    llData.head = &queueHead;
-    llData.tail = &queueTail;
-
-    int affectedCapacity = 100, affectedCount = 0;
-    Cell **affected = malloc(affectedCapacity * sizeof(Cell *));
-    if (!affected) {
-        perror("Failed to allocate affected cells array");
+static void recalcDownstream(Cell *const *starts, long count, Spreadsheet *spreadsheet) {
+    STATS_ENTER(STATS_PHASE_TOPO_RECALC);
+    TRACE_BEGIN(traceMark);
+    AffectedSet affected;
+    affectedInit(&affected, MEM_RECALC);
+    for (long s = 0; s < count; s++)
+        collectDownstream(starts[s], &affected);
+    int affectedCount = affected.count;
+    STATS_COUNT(STATS_BFS_VISITED, affectedCount);
+
+    int *inDegree = memAlloc(MEM_RECALC, affectedCount * sizeof(int));
+    int *zeroQueue = memAlloc(MEM_RECALC, affectedCount * sizeof(int));
+    if (affectedCount > 0 && (!inDegree || !zeroQueue)) {
+        perror("Failed to allocate topological order buffers");
         exit(EXIT_FAILURE);
     }
-
-    if (start->dependents)
-        avl_traverse(start->dependents, bfs_enqueue_callback_ll, &llData);
-    while (queueHead != NULL) {
-        Cell *curr = dequeue(&queueHead, &queueTail);
-        if (affectedCount >= affectedCapacity) {
-            affectedCapacity *= 2;
-            affected = realloc(affected, affectedCapacity * sizeof(Cell *));
-            if (!affected) {
-                perror("Failed to reallocate affected cells array");
-                exit(EXIT_FAILURE);
-            }
-        }
-        affected[affectedCount++] = curr;
-        if (curr->dependents)
-            avl_traverse(curr->dependents, bfs_enqueue_callback_ll, &llData);
-    }
-
-    int *inDegree = malloc(affectedCount * sizeof(int));
     for (int i = 0; i < affectedCount; i++) {
         inDegree[i] = 0;
-        if (affected[i]->dependencies) {
+        if (affected.cells[i]->dependencies) {
             DepCallbackData depData;
-            depData.affected = affected;
-            depData.affectedCount = affectedCount;
+            depData.affected = &affected;
             depData.targetIndex = i;
             depData.inDegree = inDegree;
-            avl_traverse(affected[i]->dependencies, dep_check_callback, &depData);
+            avl_traverse(affected.cells[i]->dependencies, dep_check_callback, &depData);
         }
     }
 
-    int *zeroQueue = malloc(affectedCount * sizeof(int));
     int zeroQueueSize = 0;
     for (int i = 0; i < affectedCount; i++) {
         if (inDegree[i] == 0)
@@ -552,23 +816,40 @@ void recalcUsingTopoOrder(Cell *start, Spreadsheet *spreadsheet) {
     }
 
     ProcessDepData pData;
-    pData.affected = affected;
-    pData.affectedCount = affectedCount;
+    pData.affected = &affected;
     pData.inDegree = inDegree;
     pData.zeroQueue = zeroQueue;
     pData.zeroQueueSize = &zeroQueueSize;
 
-    int zeroQueueFront = 0;
-    while (zeroQueueFront < zeroQueueSize) {
-        int idx = zeroQueue[zeroQueueFront++];
-        Cell *cell = affected[idx];
-        recalc_cell(cell, spreadsheet);
-        if (cell->dependents)
-            avl_traverse(cell->dependents, process_dependent_callback, &pData);
+    // Cells queued before a wave starts are exactly one level of the cascade.
+    for (int waveStart = 0; waveStart < zeroQueueSize; ) {
+        int waveEnd = zeroQueueSize;
+        TRACE_BEGIN(waveMark);
+        for (int i = waveStart; i < waveEnd; i++) {
+            Cell *cell = affected.cells[zeroQueue[i]];
+            recalc_cell(cell, spreadsheet);
+            if (cell->dependents)
+                avl_traverse(cell->dependents, process_dependent_callback, &pData);
+        }
+        TRACE_SPAN(waveMark, "recalc_wave", -1, -1, waveEnd - waveStart);
+        waveStart = waveEnd;
     }
-    free(affected);
-    free(inDegree);
-    free(zeroQueue);
+    affectedFree(&affected);
+    memFree(MEM_RECALC, inDegree, affectedCount * sizeof(int));
+    memFree(MEM_RECALC, zeroQueue, affectedCount * sizeof(int));
+    TRACE_SPAN(traceMark, "recalc_cascade", count == 1 ? starts[0]->selfRow : -1,
+               count == 1 ? starts[0]->selfCol : -1, affectedCount);
+    STATS_LEAVE();
+}
+
+/*
+ * recalcUsingTopoOrder recalculates all cells affected by a change of start, in topologically
+ * sorted order, so that no cell is calculated before all of its dependencies have been updated.
+ */
+void recalcUsingTopoOrder(Cell *start, Spreadsheet *spreadsheet) {
+    if (!start->dependents)
+        return;
+    recalcDownstream(&start, 1, spreadsheet);
 }
 
 /*
@@ -576,8 +857,27 @@ void recalcUsingTopoOrder(Cell *start, Spreadsheet *spreadsheet) {
 
    This section manages a list of cells that use advanced formulas.
    It provides functions to add and remove cells from the list, and to recalculate all advanced formulas.
+   Every formula on the list counts towards the coverage of the tiles under its range.
 */
 
+/*
+ * coverRange adds delta to the coverage of the tiles under the range of the advanced formula
+ * cell, a cell of spreadsheet.  A tile under several rectangles of the range is counted once
+ * for each, so a range is uncovered with the index maps it was covered with.
+ */
+void coverRange(Spreadsheet *spreadsheet, const Cell *cell, int delta) {
+    Spreadsheet *rangeSheet = cell->rangeSheet ? cell->rangeSheet : spreadsheet;
+    for (int r = cell->row1; r <= cell->row2; ) {
+        int row, rows = indexMapSpan(rangeSheet->rowMap, r, cell->row2, &row);
+        for (int c = cell->col1; c <= cell->col2; ) {
+            int col, cols = indexMapSpan(rangeSheet->colMap, c, cell->col2, &col);
+            tileStoreCover(&rangeSheet->store, row, col, row + rows - 1, col + cols - 1, delta);
+            c += cols;
+        }
+        r += rows;
+    }
+}
+
 /*
  * addAdvancedFormula adds a cell to the spreadsheet's advanced formulas list if it's not already present.
  * It also resizes the list if necessary.
@@ -588,15 +888,17 @@ static void addAdvancedFormula(Spreadsheet *spreadsheet, Cell *cell) {
             return;
     }
     if (spreadsheet->advancedFormulasCount >= spreadsheet->advancedFormulasCapacity) {
+        spreadsheet->advancedFormulas = memRealloc(MEM_ADVANCED, spreadsheet->advancedFormulas,
+            spreadsheet->advancedFormulasCapacity * sizeof(Cell *),
+            2 * spreadsheet->advancedFormulasCapacity * sizeof(Cell *));
         spreadsheet->advancedFormulasCapacity *= 2;
-        spreadsheet->advancedFormulas = realloc(spreadsheet->advancedFormulas,
-            spreadsheet->advancedFormulasCapacity * sizeof(Cell *));
         if (!spreadsheet->advancedFormulas) {
             perror("Failed to reallocate advanced formulas array");
             exit(EXIT_FAILURE);
         }
     }
     spreadsheet->advancedFormulas[spreadsheet->advancedFormulasCount++] = cell;
+    coverRange(spreadsheet, cell, 1);
 }
 
 /*
@@ -608,79 +910,892 @@ static void removeAdvancedFormula(Spreadsheet *spreadsheet, Cell *cell) {
         if (spreadsheet->advancedFormulas[i] == cell) {
             spreadsheet->advancedFormulas[i] = spreadsheet->advancedFormulas[spreadsheet->advancedFormulasCount - 1];
             spreadsheet->advancedFormulasCount--;
+            coverRange(spreadsheet, cell, -1);
+            componentsNoteRemoval(spreadsheet);
             break;
         }
     }
+    cell->rangeSheet = NULL;
+}
+
+/*
+ * AdvancedReach is an advanced formula together with every cell it feeds through ordinary
+ * dependents, and the bounding box of those cells.
+ */
+typedef struct {
+    AffectedSet downstream;
+    int row1, col1, row2, col2;
+} AdvancedReach;
+
+/*
+ * computeAdvancedReach fills reach for the advanced formula Y.
+ */
+static void computeAdvancedReach(Cell *Y, AdvancedReach *reach) {
+    affectedInit(&reach->downstream, MEM_RECALC);
+    affectedAdd(&reach->downstream, Y);
+    collectDownstream(Y, &reach->downstream);
+    reach->row1 = reach->row2 = Y->selfRow;
+    reach->col1 = reach->col2 = Y->selfCol;
+    for (int i = 1; i < reach->downstream.count; i++) {
+        Cell *cell = reach->downstream.cells[i];
+        if (cell->selfRow < reach->row1) reach->row1 = cell->selfRow;
+        if (cell->selfRow > reach->row2) reach->row2 = cell->selfRow;
+        if (cell->selfCol < reach->col1) reach->col1 = cell->selfCol;
+        if (cell->selfCol > reach->col2) reach->col2 = cell->selfCol;
+    }
+}
+
+/*
+ * advancedFeeds reports whether the range of X, which lies on rangeSheet, contains the advanced
+ * formula behind reach or any cell that depends on it, i.e. whether X must be recalculated after it.
+ * The bounding box is in store coordinates, so it only rules X out while rangeSheet has no
+ * index maps.
+ */
+static int advancedFeeds(const AdvancedReach *reach, const Cell *X, const Spreadsheet *rangeSheet) {
+    if (!rangeSheet->rowMap && !rangeSheet->colMap &&
+        (reach->row2 < X->row1 || reach->row1 > X->row2 ||
+         reach->col2 < X->col1 || reach->col1 > X->col2))
+         return 0;
+    for (int i = 0; i < reach->downstream.count; i++) {
+         if (sheetRangeHolds(rangeSheet, reach->downstream.cells[i], X->row1, X->col1, X->row2, X->col2))
+              return 1;
+    }
+    return 0;
+}
+
+static int compare_roots(const void *a, const void *b) {
+    int x = *(const int *) a, y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * gatherAdvancedFormulas lists the advanced formulas of spreadsheet, or with roots only those
+ * of the rootCount components listed there (sorted), and returns how many there are.
+ * In a workbook the formulas of every sheet are listed together, since a range may read
+ * another sheet.  Unless the sheet's own list can be used as it is (*owners is then NULL),
+ * *formulas and *owners are MEM_RECALC arrays of *listed entries, for releaseAdvancedFormulas;
+ * (*owners)[i] is the sheet of (*formulas)[i].
+ */
+static int gatherAdvancedFormulas(Spreadsheet *spreadsheet, const int *roots, int rootCount,
+                                  Cell ***formulasOut, Spreadsheet ***ownersOut, int *listedOut) {
+    Workbook *workbook = spreadsheet->workbook;
+    Components *components = roots ? componentsUsable(spreadsheet) : NULL;
+    *formulasOut = spreadsheet->advancedFormulas;
+    *ownersOut = NULL;
+    *listedOut = 0;
+    if (!(workbook && workbook->count > 1) && !components)
+        return spreadsheet->advancedFormulasCount;
+    int sheetCount = (workbook && workbook->count > 1) ? workbook->count : 1;
+    int listed = 0;
+    for (int s = 0; s < sheetCount; s++)
+        listed += (sheetCount > 1 ? workbook->sheets[s] : spreadsheet)->advancedFormulasCount;
+    if (listed == 0)
+        return 0;
+    Cell **formulas = memAlloc(MEM_RECALC, listed * sizeof(Cell *));
+    Spreadsheet **owners = memAlloc(MEM_RECALC, listed * sizeof(Spreadsheet *));
+    if (!formulas || !owners) {
+        perror("Failed to allocate workbook formula list");
+        exit(EXIT_FAILURE);
+    }
+    int count = 0;
+    for (int s = 0; s < sheetCount; s++) {
+        Spreadsheet *sheet = sheetCount > 1 ? workbook->sheets[s] : spreadsheet;
+        for (int i = 0; i < sheet->advancedFormulasCount; i++) {
+            Cell *formula = sheet->advancedFormulas[i];
+            if (components && formula->component) {
+                int root = componentFind(components, formula->component);
+                if (!bsearch(&root, roots, rootCount, sizeof(int), compare_roots))
+                    continue;
+            }
+            formulas[count] = formula;
+            owners[count++] = sheet;
+        }
+    }
+    *formulasOut = formulas;
+    *ownersOut = owners;
+    *listedOut = listed;
+    return count;
+}
+
+static void releaseAdvancedFormulas(Cell **formulas, Spreadsheet **owners, int listed) {
+    if (!owners)
+        return;
+    memFree(MEM_RECALC, formulas, listed * sizeof(Cell *));
+    memFree(MEM_RECALC, owners, listed * sizeof(Spreadsheet *));
 }
 
 /*
- * recalcAllAdvancedFormulas recalculates every advanced formula in the spreadsheet.
- * It first computes a topological order to ensure proper dependency order.
+ * recalcAllAdvancedFormulas recalculates every advanced formula in the spreadsheet, or with
+ * roots only those of the rootCount components listed there (sorted): a change cannot reach
+ * the range of a formula in another component.
+ * It first computes a topological order to ensure proper dependency order: X comes after Y when
+ * X's range holds Y itself or any ordinary formula that (transitively) reads Y.
  * If a cycle is detected among advanced formulas, an error message is printed.
  */
-static void recalcAllAdvancedFormulas(Spreadsheet *spreadsheet, clock_t start) {
-    int count = spreadsheet->advancedFormulasCount;
-    if (count == 0)
+static void recalcAllAdvancedFormulas(Spreadsheet *spreadsheet, double start, const int *roots, int rootCount) {
+    Cell **formulas;
+    Spreadsheet **owners;
+    int listed;
+    int count = gatherAdvancedFormulas(spreadsheet, roots, rootCount, &formulas, &owners, &listed);
+    if (count == 0) {
+         releaseAdvancedFormulas(formulas, owners, listed);
          return;
-    int *inDegree = malloc(count * sizeof(int));
+    }
+    STATS_ENTER(STATS_PHASE_ADVANCED_RECALC);
+    TRACE_BEGIN(traceMark);
+    AdvancedReach *reach = memAlloc(MEM_RECALC, count * sizeof(AdvancedReach));
+    const Spreadsheet **rangeSheets = memAlloc(MEM_RECALC, count * sizeof(Spreadsheet *));
+    if (!reach || !rangeSheets) {
+         perror("Failed to allocate advanced formula reach");
+         exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++) {
+         computeAdvancedReach(formulas[i], &reach[i]);
+         Spreadsheet *owner = owners ? owners[i] : spreadsheet;
+         rangeSheets[i] = formulas[i]->rangeSheet ? formulas[i]->rangeSheet : owner;
+    }
+    int *inDegree = memAlloc(MEM_RECALC, count * sizeof(int));
     for (int i = 0; i < count; i++) {
          inDegree[i] = 0;
     }
     for (int i = 0; i < count; i++) {
-         Cell *X = spreadsheet->advancedFormulas[i];
+         Cell *X = formulas[i];
          for (int j = 0; j < count; j++) {
              if (i == j) continue;
-             Cell *Y = spreadsheet->advancedFormulas[j];
-             if (Y->selfRow >= X->row1 && Y->selfRow <= X->row2 &&
-                 Y->selfCol >= X->col1 && Y->selfCol <= X->col2) {
+             if (advancedFeeds(&reach[j], X, rangeSheets[i])) {
                  inDegree[i]++;
              }
          }
     }
-    int *zeroQueue = malloc(count * sizeof(int));
+    int *zeroQueue = memAlloc(MEM_RECALC, count * sizeof(int));
     int zeroQueueSize = 0;
     for (int i = 0; i < count; i++) {
          if (inDegree[i] == 0)
              zeroQueue[zeroQueueSize++] = i;
     }
     int processedCount = 0;
-    int *topoOrder = malloc(count * sizeof(int));
+    int *topoOrder = memAlloc(MEM_RECALC, count * sizeof(int));
     int topoIndex = 0;
     while (zeroQueueSize > 0) {
          int idx = zeroQueue[--zeroQueueSize];
          topoOrder[topoIndex++] = idx;
          processedCount++;
-         Cell *Y = spreadsheet->advancedFormulas[idx];
          for (int j = 0; j < count; j++) {
               if (j == idx) continue;
-              Cell *X = spreadsheet->advancedFormulas[j];
-              if (Y->selfRow >= X->row1 && Y->selfRow <= X->row2 &&
-                  Y->selfCol >= X->col1 && Y->selfCol <= X->col2) {
+              Cell *X = formulas[j];
+              if (advancedFeeds(&reach[idx], X, rangeSheets[j])) {
                    inDegree[j]--;
                    if (inDegree[j] == 0)
                         zeroQueue[zeroQueueSize++] = j;
               }
          }
     }
+    for (int i = 0; i < count; i++)
+         affectedFree(&reach[i].downstream);
+    memFree(MEM_RECALC, reach, count * sizeof(AdvancedReach));
+    memFree(MEM_RECALC, rangeSheets, count * sizeof(Spreadsheet *));
     if (processedCount != count) {
-         global_end = clock();
-         global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-         spreadsheet->time = global_cpu_time_used;
-         printf("[%.1f] (Error: Cycle detected in advanced formulas.) ", spreadsheet->time);
-         free(inDegree);
-         free(zeroQueue);
-         free(topoOrder);
-         return;
+         reportStatus(spreadsheet, start, "Error: Cycle detected in advanced formulas.");
+    } else {
+         for (int i = 0; i < count; i++) {
+              int idx = topoOrder[i];
+              Spreadsheet *owner = owners ? owners[idx] : spreadsheet;
+              recalc_cell(formulas[idx], owner);
+              recalcUsingTopoOrder(formulas[idx], owner);
+         }
+    }
+    memFree(MEM_RECALC, inDegree, count * sizeof(int));
+    memFree(MEM_RECALC, zeroQueue, count * sizeof(int));
+    memFree(MEM_RECALC, topoOrder, count * sizeof(int));
+    releaseAdvancedFormulas(formulas, owners, listed);
+    TRACE_SPAN(traceMark, "advanced_recalc", -1, -1, count);
+    STATS_LEAVE();
+}
+
+/*
+   ---------------- Progressive recalculation ----------------
+
+   At the interactive prompt propagateChange only plans the cascade (see background.h).  The
+   plan holds every cell the synchronous path would recompute: the changed cell's downstream
+   and the advanced formulas of its component with theirs.  The steps still pending from the
+   plan before are merged in, with their downstream and component formulas, so one plan always
+   covers every cell that is out of date.  It is ordered topologically under the ordinary edges
+   plus an edge from every cell to each range formula whose range holds it, and recomputing in
+   any such order gives the values the synchronous path gives.  If those edges close a cycle,
+   the synchronous path runs instead and reports it.
+*/
+
+/*
+ * RangeEdges collects the edges from cells of the plan to the range formulas that read them.
+ */
+typedef struct {
+    int *from;
+    int *to;
+    long count;
+    long capacity;
+} RangeEdges;
+
+static void rangeEdgeAdd(RangeEdges *edges, int from, int to) {
+    if (edges->count == edges->capacity) {
+        long capacity = edges->capacity ? 2 * edges->capacity : 64;
+        edges->from = memRealloc(MEM_RECALC, edges->from, edges->capacity * sizeof(int), capacity * sizeof(int));
+        edges->to = memRealloc(MEM_RECALC, edges->to, edges->capacity * sizeof(int), capacity * sizeof(int));
+        if (!edges->from || !edges->to) {
+            perror("Failed to grow range edges");
+            exit(EXIT_FAILURE);
+        }
+        edges->capacity = capacity;
+    }
+    edges->from[edges->count] = from;
+    edges->to[edges->count++] = to;
+}
+
+/*
+ * NodePlace is where a cell of the plan lies, in the logical coordinates ranges are given in.
+ * Sorted by sheet, column and row, the places let linkRangeInputs find the cells of a range
+ * one column at a time.
+ */
+typedef struct {
+    const Spreadsheet *sheet;
+    int col;
+    int row;
+    int index;
+} NodePlace;
+
+static int compare_places(const void *a, const void *b) {
+    const NodePlace *x = (const NodePlace *) a, *y = (const NodePlace *) b;
+    if (x->sheet != y->sheet)
+        return ((uintptr_t) x->sheet > (uintptr_t) y->sheet) - ((uintptr_t) x->sheet < (uintptr_t) y->sheet);
+    if (x->col != y->col)
+        return (x->col > y->col) - (x->col < y->col);
+    return (x->row > y->row) - (x->row < y->row);
+}
+
+/*
+ * linkRangeInputs adds an edge to the range formula of plan node f from every other node in its
+ * range, which lies on rangeSheet.
+ */
+static void linkRangeInputs(const NodePlace *places, int count, int f, const Cell *formula,
+                            const Spreadsheet *rangeSheet, RangeEdges *edges) {
+    for (int col = formula->col1; col <= formula->col2; col++) {
+        NodePlace first = { rangeSheet, col, formula->row1, 0 };
+        int lo = 0, hi = count;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (compare_places(&places[mid], &first) < 0)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        for (int p = lo; p < count && places[p].sheet == rangeSheet && places[p].col == col &&
+                         places[p].row <= formula->row2; p++) {
+            if (places[p].index != f)
+                rangeEdgeAdd(edges, places[p].index, f);
+        }
+    }
+}
+
+/*
+ * planRecalc hands background a plan for the change of cell, a cell of spreadsheet, merged
+ * with the steps it still has pending.  Returns 0, leaving the pending steps alone, if the
+ * plan would hold a cycle.
+ */
+static int planRecalc(Spreadsheet *spreadsheet, BackgroundRecalc *background, Cell *cell) {
+    STATS_ENTER(STATS_PHASE_TOPO_RECALC);
+    AffectedSet nodes;
+    affectedInit(&nodes, MEM_RECALC);
+    affectedAdd(&nodes, cell);
+    long pending = background->pending;
+    int *roots = memAlloc(MEM_RECALC, (pending + 1) * sizeof(int));
+    if (!roots) {
+        perror("Failed to allocate component roots");
+        exit(EXIT_FAILURE);
     }
+    int rootCount = 0, unconfined = 0;
+    roots[rootCount++] = componentOf(spreadsheet, cell);
+    for (long i = background->next; i < background->count; i++) {
+        if (backgroundStep(background, background->cells[i]) != i)
+            continue;
+        affectedAdd(&nodes, background->cells[i]);
+        roots[rootCount++] = componentOf(background->owners[i], background->cells[i]);
+    }
+    qsort(roots, rootCount, sizeof(int), compare_roots);
+    int unique = 0;
+    for (int i = 0; i < rootCount; i++) {
+        unconfined |= roots[i] == 0;
+        if (unique == 0 || roots[unique - 1] != roots[i])
+            roots[unique++] = roots[i];
+    }
+    Cell **formulas;
+    Spreadsheet **formulaOwners;
+    int listed;
+    int formulaCount = gatherAdvancedFormulas(spreadsheet, unconfined ? NULL : roots, unique,
+                                              &formulas, &formulaOwners, &listed);
+    for (int i = 0; i < formulaCount; i++)
+        affectedAdd(&nodes, formulas[i]);
+    releaseAdvancedFormulas(formulas, formulaOwners, listed);
+    memFree(MEM_RECALC, roots, (pending + 1) * sizeof(int));
+    collectDownstream(cell, &nodes);
+    int count = nodes.count;
+    STATS_COUNT(STATS_BFS_VISITED, count);
+
+    Spreadsheet **owners = memAlloc(MEM_RECALC, count * sizeof(Spreadsheet *));
+    int *inDegree = memCalloc(MEM_RECALC, count, sizeof(int));
+    int *zeroQueue = memAlloc(MEM_RECALC, count * sizeof(int));
+    int *rangeStart = memCalloc(MEM_RECALC, count + 1, sizeof(int));
+    if (!owners || !inDegree || !zeroQueue || !rangeStart) {
+        perror("Failed to allocate recalculation plan");
+        exit(EXIT_FAILURE);
+    }
+    NodePlace *places = memAlloc(MEM_RECALC, count * sizeof(NodePlace));
+    if (!places) {
+        perror("Failed to allocate recalculation plan");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++) {
+        Cell *node = nodes.cells[i];
+        owners[i] = spreadsheet->workbook ? workbookOwner(spreadsheet, node) : spreadsheet;
+        NodePlace place = { owners[i], sheetLogicalCol(owners[i], node->selfCol),
+                            sheetLogicalRow(owners[i], node->selfRow), i };
+        places[i] = place;
+        if (node->dependencies) {
+            DepCallbackData depData = { &nodes, i, inDegree };
+            avl_traverse(node->dependencies, dep_check_callback, &depData);
+        }
+    }
+    qsort(places, count, sizeof(NodePlace), compare_places);
+    RangeEdges edges = { NULL, NULL, 0, 0 };
     for (int i = 0; i < count; i++) {
-         int idx = topoOrder[i];
-         Cell *cell = spreadsheet->advancedFormulas[idx];
-         recalc_cell(cell, spreadsheet);
-         recalcUsingTopoOrder(cell, spreadsheet);
+        Cell *node = nodes.cells[i];
+        if (node->op >= OP_ADV_SUM && node->op <= OP_ADV_STDEV)
+            linkRangeInputs(places, count, i, node, node->rangeSheet ? node->rangeSheet : owners[i], &edges);
+    }
+    memFree(MEM_RECALC, places, count * sizeof(NodePlace));
+    // The range edges, grouped by the cell they leave (counting sort).
+    int *rangeTargets = memAlloc(MEM_RECALC, (edges.count + 1) * sizeof(int));
+    if (!rangeTargets) {
+        perror("Failed to allocate range edges");
+        exit(EXIT_FAILURE);
+    }
+    for (long e = 0; e < edges.count; e++) {
+        rangeStart[edges.from[e] + 1]++;
+        inDegree[edges.to[e]]++;
+    }
+    for (int i = 0; i < count; i++)
+        rangeStart[i + 1] += rangeStart[i];
+    for (long e = 0; e < edges.count; e++)
+        rangeTargets[rangeStart[edges.from[e]]++] = edges.to[e];
+    for (int i = count; i > 0; i--)
+        rangeStart[i] = rangeStart[i - 1];
+    rangeStart[0] = 0;
+
+    int zeroQueueSize = 0;
+    for (int i = 0; i < count; i++) {
+        if (inDegree[i] == 0)
+            zeroQueue[zeroQueueSize++] = i;
+    }
+    ProcessDepData pData = { &nodes, inDegree, zeroQueue, &zeroQueueSize };
+    for (int front = 0; front < zeroQueueSize; front++) {
+        int idx = zeroQueue[front];
+        Cell *node = nodes.cells[idx];
+        if (node->dependents)
+            avl_traverse(node->dependents, process_dependent_callback, &pData);
+        for (int e = rangeStart[idx]; e < rangeStart[idx + 1]; e++) {
+            if (--inDegree[rangeTargets[e]] == 0)
+                zeroQueue[zeroQueueSize++] = rangeTargets[e];
+        }
+    }
+    int planned = zeroQueueSize == count;
+    if (planned) {
+        Cell **stepCells = memAlloc(MEM_RECALC, count * sizeof(Cell *));
+        Spreadsheet **stepOwners = memAlloc(MEM_RECALC, count * sizeof(Spreadsheet *));
+        if (!stepCells || !stepOwners) {
+            perror("Failed to allocate recalculation plan");
+            exit(EXIT_FAILURE);
+        }
+        for (int i = 0; i < count; i++) {
+            stepCells[i] = nodes.cells[zeroQueue[i]];
+            stepOwners[i] = owners[zeroQueue[i]];
+        }
+        backgroundSetPlan(background, stepCells, stepOwners, count);
+    }
+    affectedFree(&nodes);
+    memFree(MEM_RECALC, owners, count * sizeof(Spreadsheet *));
+    memFree(MEM_RECALC, inDegree, count * sizeof(int));
+    memFree(MEM_RECALC, zeroQueue, count * sizeof(int));
+    memFree(MEM_RECALC, rangeStart, (count + 1) * sizeof(int));
+    memFree(MEM_RECALC, rangeTargets, (edges.count + 1) * sizeof(int));
+    memFree(MEM_RECALC, edges.from, edges.capacity * sizeof(int));
+    memFree(MEM_RECALC, edges.to, edges.capacity * sizeof(int));
+    STATS_LEAVE();
+    return planned;
+}
+
+/*
+ * changeStaysLocal reports whether a change of cell can be seen nowhere but in cell itself: no
+ * formula reads it and no range overlaps its tile.  While a plan is pending, only a literal
+ * qualifies, since a formula may have read inputs the plan has not reached yet.
+ */
+static int changeStaysLocal(Spreadsheet *spreadsheet, const Cell *cell) {
+    if (cell->dependents || !sheetOwns(spreadsheet, cell) ||
+        tileStoreCovered(&spreadsheet->store, cell->selfRow, cell->selfCol))
+        return 0;
+    return !backgroundPending(homeSheet(spreadsheet)->background) ||
+           (cell->op == OP_NONE && !cell->operand1);
+}
+
+/*
+ * propagateChange pushes a change of the given cell through its dependents and the advanced
+ * formulas of its component.
+ * While recalculation is deferred (bulk replay), nothing is done here; recalcAll runs once at the end.
+ * A change that stays local needs nothing more either.
+ * At the interactive prompt the cascade is only planned, for the background worker.
+ */
+static void propagateChange(Cell *cell, Spreadsheet *spreadsheet, double start) {
+    if (spreadsheet->deferRecalc || changeStaysLocal(spreadsheet, cell))
+        return;
+    componentsRefresh(spreadsheet);
+    BackgroundRecalc *background = homeSheet(spreadsheet)->background;
+    if (background) {
+        if (!TRACE_ACTIVE() && !changeFeedActive(homeSheet(spreadsheet)->feed) &&
+            planRecalc(spreadsheet, background, cell))
+            return;
+        // The cell was computed from inputs the pending steps had not reached yet.
+        if (backgroundPending(background)) {
+            backgroundFinish(background);
+            recalc_cell(cell, spreadsheet);
+        }
+    }
+    int root = componentOf(spreadsheet, cell);
+    recalcUsingTopoOrder(cell, spreadsheet);
+    recalcAllAdvancedFormulas(spreadsheet, start, root ? &root : NULL, 1);
+}
+
+/*
+ * propagateChanges is propagateChange for count cells changed together, e.g. by a batch applied
+ * with deferRecalc set: one cascade over everything they affect and one pass over the advanced
+ * formulas, instead of one of each per cell.
+ */
+void propagateChanges(Spreadsheet *spreadsheet, Cell *const *cells, long count, double start) {
+    if (spreadsheet->deferRecalc || count == 0)
+        return;
+    componentsRefresh(spreadsheet);
+    int *roots = memAlloc(MEM_RECALC, count * sizeof(int));
+    if (!roots) {
+        perror("Failed to allocate component roots");
+        exit(EXIT_FAILURE);
+    }
+    int rootCount = 0;
+    for (long i = 0; i < count; i++) {
+        int root = componentOf(spreadsheet, cells[i]);
+        if (root)
+            roots[rootCount++] = root;
     }
-    free(inDegree);
-    free(zeroQueue);
-    free(topoOrder);
+    qsort(roots, rootCount, sizeof(int), compare_roots);
+    int unique = 0;
+    for (int i = 0; i < rootCount; i++) {
+        if (unique == 0 || roots[unique - 1] != roots[i])
+            roots[unique++] = roots[i];
+    }
+    recalcDownstream(cells, count, spreadsheet);
+    recalcAllAdvancedFormulas(spreadsheet, start, rootCount == count ? roots : NULL, unique);
+    memFree(MEM_RECALC, roots, count * sizeof(int));
+}
+
+/*
+ * setCellLiteral turns a cell into a plain literal without recalculating anything.
+ * It is the bulk-load counterpart of "A1=<number>"; callers follow it with recalcAll.
+ */
+void setCellLiteral(Spreadsheet *spreadsheet, Cell *cell, int value) {
+    clearDependencies(spreadsheet, cell);
+    if (cell->op >= OP_ADV_SUM && cell->op <= OP_ADV_STDEV)
+        removeAdvancedFormula(spreadsheet, cell);
+    if (cellShowsChange(value, 0, cell->value, cell->error))
+        noteChange(spreadsheet, cell, cell->value, cell->error);
+    cell->value = value;
+    cell->error = 0;
+    cell->op = OP_NONE;
+    cell->operand1 = NULL;
+    cell->operand2 = NULL;
+}
+
+/*
+ * indegree_callback counts one incoming edge for the cell being visited.
+ */
+static void indegree_callback(Cell *dep, void *data) {
+    (void) dep;
+    STATS_COUNT(STATS_EDGES_TRAVERSED, 1);
+    (*(int *) data)++;
+}
+
+/*
+ * LocalDegree counts only the incoming edges from cells of one sheet of a workbook; edges from
+ * other sheets are inputs that recalcAll treats as final.
+ */
+typedef struct {
+    const Spreadsheet *spreadsheet;
+    int degree;
+    int foreign;
+} LocalDegree;
+
+static void local_indegree_callback(Cell *dep, void *data) {
+    LocalDegree *local = (LocalDegree *) data;
+    STATS_COUNT(STATS_EDGES_TRAVERSED, 1);
+    if (sheetOwns(local->spreadsheet, dep))
+        local->degree++;
+    else
+        local->foreign = 1;
+}
+
+/*
+ * RecalcAllData carries the in-degree table and the ready queue through the dependents walk.
+ */
+typedef struct {
+    Spreadsheet *spreadsheet;
+    int *inDegree;
+    Cell **ready;
+    long *readyCount;
+} RecalcAllData;
+
+static void release_dependent_callback(Cell *dep, void *data) {
+    RecalcAllData *rData = (RecalcAllData *) data;
+    STATS_COUNT(STATS_EDGES_TRAVERSED, 1);
+    if (rData->spreadsheet->workbook && !sheetOwns(rData->spreadsheet, dep))
+        return;
+    long idx = tileStoreOrdinal(&rData->spreadsheet->store, dep);
+    if (--rData->inDegree[idx] == 0)
+        rData->ready[(*rData->readyCount)++] = dep;
+}
+
+/*
+ * recalcInOrder is the whole-sheet pass of recalcAll on the calling thread.  It returns the
+ * number of cells recomputed.
+ */
+static long recalcInOrder(Spreadsheet *spreadsheet) {
+    TileStore *store = &spreadsheet->store;
+    long totalCells = store->cellCount;
+    int *inDegree = memCalloc(MEM_RECALC, totalCells, sizeof(int));
+    Cell **ready = memAlloc(MEM_RECALC, totalCells * sizeof(Cell *));
+    if (!inDegree || !ready) {
+        perror("Failed to allocate recalculation buffers");
+        exit(EXIT_FAILURE);
+    }
+    long readyCount = 0;
+    for (long t = 0; t < store->tileCount; t++) {
+        Tile *tile = store->tiles[t];
+        if (tile->packed)
+            continue;
+        tileStoreUse(store, tile);
+        long count = (long) tile->rows * tile->cols;
+        for (long i = 0; i < count; i++) {
+            Cell *cell = &tile->cells[i];
+            if (cell->dependencies && spreadsheet->workbook) {
+                LocalDegree local = { spreadsheet, 0, 0 };
+                avl_traverse(cell->dependencies, local_indegree_callback, &local);
+                inDegree[tile->ordinal + i] = local.degree;
+                if (local.degree == 0)
+                    ready[readyCount++] = cell;
+            } else if (cell->dependencies) {
+                avl_traverse(cell->dependencies, indegree_callback, &inDegree[tile->ordinal + i]);
+            } else if (cell->dependents) {
+                ready[readyCount++] = cell;
+            }
+        }
+    }
+    RecalcAllData rData = { spreadsheet, inDegree, ready, &readyCount };
+    for (long front = 0; front < readyCount; front++) {
+        Cell *cell = ready[front];
+        recalc_cell(cell, spreadsheet);
+        if (cell->dependents)
+            avl_traverse(cell->dependents, release_dependent_callback, &rData);
+    }
+    STATS_COUNT(STATS_BFS_VISITED, readyCount);
+    if (spreadsheet->workbook) {
+        for (long i = 0; i < readyCount; i++) {
+            LocalDegree local = { spreadsheet, 0, 0 };
+            if (ready[i]->dependents)
+                avl_traverse(ready[i]->dependents, local_indegree_callback, &local);
+            if (local.foreign)
+                recalcUsingTopoOrder(ready[i], spreadsheet);
+        }
+    }
+    memFree(MEM_RECALC, inDegree, totalCells * sizeof(int));
+    memFree(MEM_RECALC, ready, totalCells * sizeof(Cell *));
+    return readyCount;
+}
+
+/*
+ * ComponentRecalc is the share of one component in recalcByComponent: its cells with edges are
+ * cells[first .. first + count), and the same slots of ready are its queue.
+ */
+typedef struct {
+    int root;
+    long first;
+    long count;
+    long done;
+    long scanned;
+    long edges;
+} ComponentRecalc;
+
+typedef struct {
+    Spreadsheet *spreadsheet;
+    int *inDegree;
+    Cell **cells;
+    Cell **ready;
+    ComponentRecalc *groups;
+} ComponentJob;
+
+/*
+ * ComponentQueue is the ready queue of one component while its task runs.
+ */
+typedef struct {
+    const TileStore *store;
+    int *inDegree;
+    Cell **ready;
+    long readyCount;
+    long edges;
+} ComponentQueue;
+
+static void release_in_component_callback(Cell *dep, void *data) {
+    ComponentQueue *queue = (ComponentQueue *) data;
+    queue->edges++;
+    if (--queue->inDegree[tileStoreOrdinal(queue->store, dep)] == 0)
+        queue->ready[queue->readyCount++] = dep;
+}
+
+/*
+ * recalcComponentTask is recalcInOrder confined to one component.  Dependents never leave a
+ * component and range formulas only read cells of their own, so components run side by side;
+ * inDegree slots are disjoint between them.  Statistics, tiles and the change feed are left to
+ * the calling thread.
+ */
+static void recalcComponentTask(void *arg, long index) {
+    ComponentJob *job = (ComponentJob *) arg;
+    ComponentRecalc *group = &job->groups[index];
+    ComponentQueue queue = { &job->spreadsheet->store, job->inDegree, job->ready + group->first, 0, 0 };
+    for (long i = 0; i < group->count; i++) {
+        Cell *cell = job->cells[group->first + i];
+        if (job->inDegree[tileStoreOrdinal(queue.store, cell)] == 0)
+            queue.ready[queue.readyCount++] = cell;
+    }
+    for (long front = 0; front < queue.readyCount; front++) {
+        Cell *cell = queue.ready[front];
+        // Tile summaries are shared between components, and tiles are only touched once the
+        // pass is over, so ranges are scanned.
+        group->scanned += evaluateCell(cell, job->spreadsheet, 0);
+        if (cell->dependents)
+            avl_traverse(cell->dependents, release_in_component_callback, &queue);
+    }
+    group->done = queue.readyCount;
+    group->edges = queue.edges;
+}
+
+static int compare_groups_by_size(const void *a, const void *b) {
+    const ComponentRecalc *x = (const ComponentRecalc *) a, *y = (const ComponentRecalc *) b;
+    return (y->count > x->count) - (y->count < x->count);
+}
+
+/*
+ * recalcByComponent is the whole-sheet pass of recalcAll with one task per component on the
+ * shared thread pool, largest components first.  It returns the number of cells recomputed,
+ * or -1 if the sheet does not qualify: it must be a lone sheet that is large enough, with an
+ * up-to-date component table and its tiles on the heap (the resident set of a spilled store
+ * is not shared between threads), and neither the change feed nor the trace may be recording.
+ */
+static long recalcByComponent(Spreadsheet *spreadsheet) {
+    Components *components = componentsUsable(spreadsheet);
+    TileStore *store = &spreadsheet->store;
+    if (!components || spreadsheet->workbook || store->cellCount < COMPONENTS_PARALLEL_MIN || store->backing ||
+        changeFeedActive(spreadsheet->feed) || TRACE_ACTIVE())
+        return -1;
+    long totalCells = store->cellCount;
+    int *inDegree = memCalloc(MEM_RECALC, totalCells, sizeof(int));
+    long *members = memCalloc(MEM_RECALC, components->count, sizeof(long));
+    if (!inDegree || !members) {
+        perror("Failed to allocate recalculation buffers");
+        exit(EXIT_FAILURE);
+    }
+    long linked = 0;
+    int groupCount = 0;
+    for (long t = 0; t < store->tileCount; t++) {
+        Tile *tile = store->tiles[t];
+        if (tile->packed)
+            continue;
+        tileStoreUse(store, tile);
+        long count = (long) tile->rows * tile->cols;
+        for (long i = 0; i < count; i++) {
+            Cell *cell = &tile->cells[i];
+            if (!cell->dependencies && !cell->dependents)
+                continue;
+            if (cell->dependencies)
+                avl_traverse(cell->dependencies, indegree_callback, &inDegree[tile->ordinal + i]);
+            if (members[componentFind(components, cell->component)]++ == 0)
+                groupCount++;
+            linked++;
+        }
+    }
+    ComponentRecalc *groups = memCalloc(MEM_RECALC, groupCount > 0 ? groupCount : 1, sizeof(ComponentRecalc));
+    Cell **cells = memAlloc(MEM_RECALC, (linked > 0 ? linked : 1) * sizeof(Cell *));
+    Cell **ready = memAlloc(MEM_RECALC, (linked > 0 ? linked : 1) * sizeof(Cell *));
+    if (!groups || !cells || !ready) {
+        perror("Failed to allocate component groups");
+        exit(EXIT_FAILURE);
+    }
+    int g = 0;
+    for (int root = 1; root < components->count; root++) {
+        if (members[root] > 0) {
+            groups[g].root = root;
+            groups[g++].count = members[root];
+        }
+    }
+    qsort(groups, groupCount, sizeof(ComponentRecalc), compare_groups_by_size);
+    long first = 0;
+    for (g = 0; g < groupCount; g++) {
+        groups[g].first = first;
+        first += groups[g].count;
+        members[groups[g].root] = g;
+    }
+    for (long t = 0; t < store->tileCount; t++) {
+        Tile *tile = store->tiles[t];
+        if (tile->packed)
+            continue;
+        tileStoreUse(store, tile);
+        long count = (long) tile->rows * tile->cols;
+        for (long i = 0; i < count; i++) {
+            Cell *cell = &tile->cells[i];
+            if (!cell->dependencies && !cell->dependents)
+                continue;
+            ComponentRecalc *group = &groups[members[componentFind(components, cell->component)]];
+            cells[group->first + group->done++] = cell;
+        }
+    }
+    for (g = 0; g < groupCount; g++)
+        groups[g].done = 0;
+
+    ComponentJob job = { spreadsheet, inDegree, cells, ready, groups };
+    if (groupCount > 1)
+        threadPoolRun(sharedThreadPool(), groupCount, recalcComponentTask, &job);
+    else if (groupCount == 1)
+        recalcComponentTask(&job, 0);
+    long recomputed = 0;
+    for (g = 0; g < groupCount; g++) {
+        for (long i = 0; i < groups[g].done; i++)
+            tileStoreTouch(store, ready[groups[g].first + i]);
+        recomputed += groups[g].done;
+        STATS_COUNT(STATS_RANGE_CELLS_SCANNED, groups[g].scanned);
+        STATS_COUNT(STATS_EDGES_TRAVERSED, groups[g].edges);
+    }
+    STATS_COUNT(STATS_CELLS_RECOMPUTED, recomputed);
+    STATS_COUNT(STATS_BFS_VISITED, recomputed);
+    memFree(MEM_RECALC, inDegree, totalCells * sizeof(int));
+    memFree(MEM_RECALC, members, components->count * sizeof(long));
+    memFree(MEM_RECALC, groups, (groupCount > 0 ? groupCount : 1) * sizeof(ComponentRecalc));
+    memFree(MEM_RECALC, cells, (linked > 0 ? linked : 1) * sizeof(Cell *));
+    memFree(MEM_RECALC, ready, (linked > 0 ? linked : 1) * sizeof(Cell *));
+    return recomputed;
+}
+
+/*
+ * recalcAll recomputes every formula in the sheet once, in topological order of the dependency graph,
+ * and then re-evaluates the advanced formulas.  It is the single recalculation that follows a
+ * batch of commands applied with deferRecalc set.  In a workbook, cells of other sheets that
+ * read this one are brought up to date afterwards by ordinary propagation.
+ */
+void recalcAll(Spreadsheet *spreadsheet) {
+    componentsRefresh(spreadsheet);
+    STATS_ENTER(STATS_PHASE_TOPO_RECALC);
+    TRACE_BEGIN(traceMark);
+    long recomputed = recalcByComponent(spreadsheet);
+    if (recomputed < 0)
+        recomputed = recalcInOrder(spreadsheet);
+    TRACE_SPAN(traceMark, "recalc_all", -1, -1, recomputed);
+    (void) recomputed;
+    STATS_LEAVE();
+    recalcAllAdvancedFormulas(spreadsheet, monotonicSeconds(), NULL, 0);
+}
+
+/*
+   ---------------- Typed assignment ----------------
+
+   The assign functions install one already parsed right-hand side into a cell and propagate
+   the change.  handleOperation and the library API (sheet_api.h) both end in them; callers
+   have checked bounds and, with checkCycleNew or checkAdvancedFormulaCycleNew, that the new
+   edges close no cycle.
+*/
+
+/*
+ * assignLiteral is "A1=<number>".
+ */
+void assignLiteral(Spreadsheet *spreadsheet, Cell *target, int value, double start) {
+    setCellLiteral(spreadsheet, target, value);
+    propagateChange(target, spreadsheet, start);
+}
+
+/*
+ * assignReference is "A1=B1": the target copies the value and error of source.
+ */
+void assignReference(Spreadsheet *spreadsheet, Cell *target, Cell *source, double start) {
+    clearDependencies(spreadsheet, target);
+    removeAdvancedFormula(spreadsheet, target);
+    target->op = OP_NONE;
+    target->operand1 = source;
+    target->operand1IsLiteral = 0;
+    linkDependency(spreadsheet, target, source);
+    recalc_cell(target, spreadsheet);
+    propagateChange(target, spreadsheet, start);
+}
+
+/*
+ * linkOperand stores one operand of a binary formula; a NULL cell means the literal is used.
+ */
+static void linkOperand(Spreadsheet *spreadsheet, Cell *target, Cell *operand, int literal,
+                        Cell **slot, int *isLiteral, int *literalSlot) {
+    *isLiteral = (operand == NULL);
+    if (operand) {
+        *slot = operand;
+        linkDependency(spreadsheet, target, operand);
+    } else {
+        *literalSlot = literal;
+    }
+}
+
+/*
+ * assignBinary is "A1=<x><op><y>" for op in OP_ADD..OP_DIV; each operand is a cell or, when
+ * its cell is NULL, the matching literal.
+ */
+void assignBinary(Spreadsheet *spreadsheet, Cell *target, int op,
+                  Cell *operand1, int literal1, Cell *operand2, int literal2, double start) {
+    clearDependencies(spreadsheet, target);
+    target->op = op;
+    linkOperand(spreadsheet, target, operand1, literal1,
+                &target->operand1, &target->operand1IsLiteral, &target->operand1Literal);
+    linkOperand(spreadsheet, target, operand2, literal2,
+                &target->operand2, &target->operand2IsLiteral, &target->operand2Literal);
+    removeAdvancedFormula(spreadsheet, target);
+    recalc_cell(target, spreadsheet);
+    propagateChange(target, spreadsheet, start);
+}
+
+/*
+ * assignRange is "A1=<OP>(B1:C9)" for op in OP_ADV_SUM..OP_ADV_STDEV over a range of rangeSheet.
+ */
+void assignRange(Spreadsheet *spreadsheet, Cell *target, int op, Spreadsheet *rangeSheet,
+                 int rStart, int cStart, int rEnd, int cEnd, double start) {
+    clearDependencies(spreadsheet, target);
+    removeAdvancedFormula(spreadsheet, target);
+    // The value is cleared before recalc_cell sees it, so the feed is told about it here.
+    noteChange(spreadsheet, target, target->value, target->error);
+    target->op = op;
+    target->value = 0;
+    target->row1 = rStart;
+    target->col1 = cStart;
+    target->row2 = rEnd;
+    target->col2 = cEnd;
+    target->rangeSheet = (rangeSheet != spreadsheet) ? rangeSheet : NULL;
+    addAdvancedFormula(spreadsheet, target);
+    componentsLinkRange(spreadsheet, target, rangeSheet);
+    recalc_cell(target, spreadsheet);
+    propagateChange(target, spreadsheet, start);
 }
 
 /*
@@ -690,73 +1805,93 @@ static void recalcAllAdvancedFormulas(Spreadsheet *spreadsheet, clock_t start) {
    It determines whether the input is for an advanced formula, a simple arithmetic operation, or a direct cell assignment.
    It also handles output control commands and error checking.
 */
-void handleOperation(const char *input, Spreadsheet *spreadsheet, clock_t start) {
+
+/*
+ * resolveSheet splits an optional "Name!" prefix off a reference.  It returns the sheet the
+ * reference names (spreadsheet itself when there is no prefix) and points *ref past the prefix,
+ * or returns NULL if no sheet has that name.
+ */
+static Spreadsheet *resolveSheet(Spreadsheet *spreadsheet, const char **ref) {
+    const char *bang = strchr(*ref, '!');
+    if (!bang)
+        return spreadsheet;
+    Spreadsheet *sheet = workbookFindSheet(spreadsheet, *ref, (size_t) (bang - *ref));
+    *ref = bang + 1;
+    return sheet;
+}
+
+/*
+ * resolveCell parses a cell reference such as "B2" or "Name!B2" and checks it against the
+ * bounds of its sheet.  It returns that sheet and fills row and col, or returns NULL for an
+ * unknown sheet or an invalid or out-of-bounds reference.
+ */
+static Spreadsheet *resolveCell(Spreadsheet *spreadsheet, const char *ref, int *row, int *col) {
+    Spreadsheet *sheet = resolveSheet(spreadsheet, &ref);
+    if (!sheet || parseCellReference(ref, row, col) != 0 || *row >= sheet->rows || *col >= sheet->cols)
+        return NULL;
+    return sheet;
+}
+
+/*
+ * detachTarget clears the inputs of the cell at (row, col) before it is given a new formula.
+ * The formula may still be rejected, which leaves the cell detached with the value it had, so
+ * a pending background step for it is run first: run later, it would recompute the cell from
+ * inputs it no longer reads.
+ */
+static Cell *detachTarget(Spreadsheet *spreadsheet, int row, int col) {
+    backgroundSettle(homeSheet(spreadsheet)->background, spreadsheet, row, col, row, col);
+    Cell *target = sheetCell(spreadsheet, row, col);
+    clearDependencies(spreadsheet, target);
+    return target;
+}
+
+void handleOperation(const char *input, Spreadsheet *spreadsheet, double start) {
     if (strcmp(input, "disable_output") == 0) {
         spreadsheet->display = 1;
-        global_end = clock();
-        global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-        spreadsheet->time = global_cpu_time_used;
-        printf("[%.1f] (ok) ", spreadsheet->time);
+        reportStatus(spreadsheet, start, "ok");
         return;
     }
     if (strcmp(input, "enable_output") == 0) {
         spreadsheet->display = 0;
-        global_end = clock();
-        global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-        spreadsheet->time = global_cpu_time_used;
-        printf("[%.1f] (ok) ", spreadsheet->time);
+        reportStatus(spreadsheet, start, "ok");
         return;
     }
 
     /* Advanced formulas (input contains '(') */
     if (strchr(input, '(') != NULL) {
-        char targetRef[10], opStr[10], paramStr[30];
+        char targetRef[16], opStr[10], paramStr[64];
         char extra[100];
-        if (sscanf(input, "%9[^=]=%9[A-Z](%29[^)])%9s", targetRef, opStr, paramStr, extra) == 4) {
-            global_end = clock();
-            global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-            spreadsheet->time = global_cpu_time_used;
-            printf("[%.1f] (Error: Invalid input format, unexpected characters found after function.) ", spreadsheet->time);
+        if (sscanf(input, "%15[^=]=%9[A-Z](%63[^)])%9s", targetRef, opStr, paramStr, extra) == 4) {
+            reportStatus(spreadsheet, start, "Error: Invalid input format, unexpected characters found after function.");
             return;
-        } else if (sscanf(input, "%9[^=]=%9[A-Z](%29[^)])", targetRef, opStr, paramStr) != 3) {
-            global_end = clock();
-            global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-            spreadsheet->time = global_cpu_time_used;
-            printf("[%.1f] (Error: Invalid advanced formula format.) ", spreadsheet->time);
+        } else if (sscanf(input, "%15[^=]=%9[A-Z](%63[^)])", targetRef, opStr, paramStr) != 3) {
+            reportStatus(spreadsheet, start, "Error: Invalid advanced formula format.");
             return;
         }
         int targetRow, targetCol;
-        parseCellReference(targetRef, &targetRow, &targetCol);
-        if (targetRow < 0 || targetRow >= spreadsheet->rows ||
-            targetCol < 0 || targetCol >= spreadsheet->cols) {
-            global_end = clock();
-            global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-            spreadsheet->time = global_cpu_time_used;
-            printf("[%.1f] (Error: Target cell %s is out of bounds.) ", spreadsheet->time, targetRef);
+        if (resolveCell(spreadsheet, targetRef, &targetRow, &targetCol) != spreadsheet) {
+            reportStatus(spreadsheet, start, "Error: Target cell %s is out of bounds.", targetRef);
             return;
         }
-        Cell *targetCell = &spreadsheet->table[targetRow][targetCol];
-        clearDependencies(targetCell);
+        Cell *targetCell = detachTarget(spreadsheet, targetRow, targetCol);
         removeAdvancedFormula(spreadsheet, targetCell);
 
         int result = 0, opCode = 0;
         int rStart = -1, cStart = -1, rEnd = -1, cEnd = -1;
+        Spreadsheet *rangeSheet = spreadsheet;
 
         if (strcmp(opStr, "SLEEP") == 0) {
             int seconds = 0;
+            noteChange(spreadsheet, targetCell, targetCell->value, targetCell->error);
             if (isalpha(paramStr[0])) {
                 int row, col;
-                parseCellReference(paramStr, &row, &col);
-                if (row < 0 || row >= spreadsheet->rows || col < 0 || col >= spreadsheet->cols) {
-                    global_end = clock();
-                    global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                    spreadsheet->time = global_cpu_time_used;
-                    printf("[%.1f] (Error: Cell reference %s is out of bounds.) ", spreadsheet->time, paramStr);
+                Spreadsheet *sourceSheet = resolveCell(spreadsheet, paramStr, &row, &col);
+                if (!sourceSheet) {
+                    reportStatus(spreadsheet, start, "Error: Cell reference %s is out of bounds.", paramStr);
                     return;
                 }
-                Cell *source = &spreadsheet->table[row][col];
-                addDependency(targetCell, source);
-                addDependent(source, targetCell);
+                Cell *source = sheetCell(sourceSheet, row, col);
+                linkDependency(spreadsheet, targetCell, source);
                 if (source->error) {
                     targetCell->error = 1;
                     printSpreadsheet(spreadsheet);
@@ -765,10 +1900,7 @@ void handleOperation(const char *input, Spreadsheet *spreadsheet, clock_t start)
                 seconds = source->value;
             } else {
                 if (sscanf(paramStr, "%d", &seconds) != 1) {
-                    global_end = clock();
-                    global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                    spreadsheet->time = global_cpu_time_used;
-                    printf("[%.1f] (Error: Invalid literal operand '%s' for SLEEP.) ", spreadsheet->time, paramStr);
+                    reportStatus(spreadsheet, start, "Error: Invalid literal operand '%s' for SLEEP.", paramStr);
                     return;
                 }
             }
@@ -778,7 +1910,8 @@ void handleOperation(const char *input, Spreadsheet *spreadsheet, clock_t start)
             } else {
                 result = seconds;
             }
-            sleep(seconds);
+            if (!spreadsheet->deferRecalc)
+                sleep(seconds);
             opCode = OP_SLEEP;
             targetCell->op = opCode;
             targetCell->value = result;
@@ -788,388 +1921,200 @@ void handleOperation(const char *input, Spreadsheet *spreadsheet, clock_t start)
             targetCell->col2 = cEnd;
 
             recalc_cell(targetCell, spreadsheet);
-            recalcUsingTopoOrder(targetCell, spreadsheet);
-            recalcAllAdvancedFormulas(spreadsheet, start);
+            propagateChange(targetCell, spreadsheet, start);
 
             spreadsheet->time = (result < 0 ? 0.0 : result);
             printSpreadsheet(spreadsheet);
-            printf("[%.1f] (ok) ", spreadsheet->time);
+            printStatus(spreadsheet, "ok");
             return;
         } else {
-            char startRef[10], endRef[10];
+            char startRef[48], endRef[48];
             const char *colon = strchr(paramStr, ':');
             if (!colon) {
-                global_end = clock();
-                global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                spreadsheet->time = global_cpu_time_used;
-                printf("[%.1f] (Error: Invalid range format: %s) ", spreadsheet->time, paramStr);
+                reportStatus(spreadsheet, start, "Error: Invalid range format: %s", paramStr);
                 return;
             }
             size_t len1 = colon - paramStr;
-            strncpy(startRef, paramStr, len1);
+            if (len1 >= sizeof(startRef) || strlen(colon + 1) >= sizeof(endRef)) {
+                reportStatus(spreadsheet, start, "Error: Range %s is out of bounds.", paramStr);
+                return;
+            }
+            memcpy(startRef, paramStr, len1);
             startRef[len1] = '\0';
             strcpy(endRef, colon + 1);
-            parseCellReference(startRef, &rStart, &cStart);
-            parseCellReference(endRef, &rEnd, &cEnd);
+            // "Name!A1:B9" reads another sheet; the end may repeat the same prefix.
+            const char *startPart = startRef, *endPart = endRef;
+            rangeSheet = resolveSheet(spreadsheet, &startPart);
+            if (rangeSheet && strchr(endPart, '!') && resolveSheet(spreadsheet, &endPart) != rangeSheet)
+                rangeSheet = NULL;
+            if (!rangeSheet ||
+                parseCellReference(startPart, &rStart, &cStart) != 0 ||
+                parseCellReference(endPart, &rEnd, &cEnd) != 0) {
+                reportStatus(spreadsheet, start, "Error: Range %s is out of bounds.", paramStr);
+                return;
+            }
             if (rStart > rEnd || cStart > cEnd) {
-                global_end = clock();
-                global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                spreadsheet->time = global_cpu_time_used;
-                printf("[%.1f] (Error: Invalid range order: %s (should be top-left:bottom-right).) ", spreadsheet->time, paramStr);
+                reportStatus(spreadsheet, start, "Error: Invalid range order: %s (should be top-left:bottom-right).", paramStr);
                 return;
             }
-            if (targetRow >= rStart && targetRow <= rEnd &&
-                targetCol >= cStart && targetCol <= cEnd) {
-                global_end = clock();
-                global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                spreadsheet->time = global_cpu_time_used;
-                printf("[%.1f] (Error: Advanced formula creates a direct self-reference. Formula rejected.) ", spreadsheet->time);
+            if (rEnd >= rangeSheet->rows || cEnd >= rangeSheet->cols) {
+                reportStatus(spreadsheet, start, "Error: Range %s is out of bounds.", paramStr);
                 return;
             }
-            if (checkAdvancedFormulaCycleNew(targetCell, rStart, cStart, rEnd, cEnd, spreadsheet)) {
-                global_end = clock();
-                global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                spreadsheet->time = global_cpu_time_used;
-                printf("[%.1f] (Error: Advanced formula would create a cyclic dependency. Formula rejected.) ", spreadsheet->time);
+            if (rangeSheet == spreadsheet && targetRow >= rStart && targetRow <= rEnd &&
+                targetCol >= cStart && targetCol <= cEnd) {
+                reportStatus(spreadsheet, start, "Error: Advanced formula creates a direct self-reference. Formula rejected.");
                 return;
             }
-            long sum = 0;
-            int count = 0, minVal = INT_MAX, maxVal = INT_MIN;
-            for (int r = rStart; r <= rEnd; r++) {
-                for (int c = cStart; c <= cEnd; c++) {
-                    int val = spreadsheet->table[r][c].value;
-                    sum += val;
-                    if (val < minVal)
-                        minVal = val;
-                    if (val > maxVal)
-                        maxVal = val;
-                    count++;
-                }
+            if (checkAdvancedFormulaCycleNew(targetCell, rangeSheet, rStart, cStart, rEnd, cEnd)) {
+                reportStatus(spreadsheet, start, "Error: Advanced formula would create a cyclic dependency. Formula rejected.");
+                return;
             }
+            // The value itself comes from recalc_cell below.
             if (strcmp(opStr, "SUM") == 0) {
-                result = (int) sum;
                 opCode = OP_ADV_SUM;
             } else if (strcmp(opStr, "MIN") == 0) {
-                result = minVal;
                 opCode = OP_ADV_MIN;
             } else if (strcmp(opStr, "MAX") == 0) {
-                result = maxVal;
                 opCode = OP_ADV_MAX;
             } else if (strcmp(opStr, "AVG") == 0) {
-                result = (count > 0) ? (int)(sum / count) : 0;
                 opCode = OP_ADV_AVG;
             } else if (strcmp(opStr, "STDEV") == 0) {
-                double mean = (count > 0) ? (double) sum / count : 0.0;
-                double sqDiffSum = 0.0;
-                for (int r = rStart; r <= rEnd; r++) {
-                    for (int c = cStart; c <= cEnd; c++) {
-                        double diff = spreadsheet->table[r][c].value - mean;
-                        sqDiffSum += diff * diff;
-                    }
-                }
-                double stdev = (count > 0) ? sqrt(sqDiffSum / count) : 0.0;
-                result = (int) stdev;
                 opCode = OP_ADV_STDEV;
             } else {
-                global_end = clock();
-                global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                spreadsheet->time = global_cpu_time_used;
-                printf("[%.1f] (Error: Unsupported advanced operation '%s'.) ", spreadsheet->time, opStr);
+                reportStatus(spreadsheet, start, "Error: Unsupported advanced operation '%s'.", opStr);
                 return;
             }
         }
 
-        targetCell->op = opCode;
-        targetCell->value = result;
-        targetCell->row1 = rStart;
-        targetCell->col1 = cStart;
-        targetCell->row2 = rEnd;
-        targetCell->col2 = cEnd;
-        if (opCode != OP_SLEEP)
-            addAdvancedFormula(spreadsheet, targetCell);
-
-        recalc_cell(targetCell, spreadsheet);
-        recalcUsingTopoOrder(targetCell, spreadsheet);
-        recalcAllAdvancedFormulas(spreadsheet, start);
+        assignRange(spreadsheet, targetCell, opCode, rangeSheet, rStart, cStart, rEnd, cEnd, start);
         printSpreadsheet(spreadsheet);
-        global_end = clock();
-        global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-        spreadsheet->time = global_cpu_time_used;
-        printf("[%.1f] (ok) ", spreadsheet->time);
+        reportStatus(spreadsheet, start, "ok");
         return;
     } else {
         /* Simple assignment or reference branch */
-        char targetRef[10], rhs[100];
+        char targetRef[16], rhs[100];
         char extra[10];
-        if (sscanf(input, "%9[^=]=%99s%9s", targetRef, rhs, extra) == 3) {
-            global_end = clock();
-            global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-            spreadsheet->time = global_cpu_time_used;
-            printf("[%.1f] (Error: Invalid input format.) ", spreadsheet->time);
+        if (sscanf(input, "%15[^=]=%99s%9s", targetRef, rhs, extra) == 3) {
+            reportStatus(spreadsheet, start, "Error: Invalid input format.");
             return;
         }
         int targetRow, targetCol;
-        parseCellReference(targetRef, &targetRow, &targetCol);
-        if (targetRow < 0 || targetRow >= spreadsheet->rows || targetCol < 0 || targetCol >= spreadsheet->cols) {
-            global_end = clock();
-            global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-            spreadsheet->time = global_cpu_time_used;
-            printf("[%.1f] (Error: Target cell out of bounds.) ", spreadsheet->time);
+        if (resolveCell(spreadsheet, targetRef, &targetRow, &targetCol) != spreadsheet) {
+            reportStatus(spreadsheet, start, "Error: Target cell out of bounds.");
             return;
         }
-        Cell *targetCell = &spreadsheet->table[targetRow][targetCol];
-        clearDependencies(targetCell);
+        Cell *targetCell = detachTarget(spreadsheet, targetRow, targetCol);
 
         int val;
         if (rhs[0] == '-') {
             if (sscanf(rhs + 1, "%d%9s", &val, extra) != 1) {
-                global_end = clock();
-                global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                spreadsheet->time = global_cpu_time_used;
-                printf("[%.1f] (Error) ", spreadsheet->time);
+                reportStatus(spreadsheet, start, "Error");
                 return;
             }
-            targetCell->value = -val;
-            targetCell->op = OP_NONE;
-            recalcUsingTopoOrder(targetCell, spreadsheet);
-            recalcAllAdvancedFormulas(spreadsheet, start);
-            global_end = clock();
-            global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-            spreadsheet->time = global_cpu_time_used;
+            assignLiteral(spreadsheet, targetCell, -val, start);
             printSpreadsheet(spreadsheet);
-            printf("[%.1f] (ok) ", spreadsheet->time);
+            reportStatus(spreadsheet, start, "ok");
         }
         else if (strchr(rhs, '+') || strchr(rhs, '-') || strchr(rhs, '*') || strchr(rhs, '/')) {
-            char operand1Str[20], operand2Str[20];
+            char operand1Str[48], operand2Str[48];
             char opChar;
-            if (sscanf(rhs, "%19[^+*/-]%c%19s", operand1Str, &opChar, operand2Str) != 3) {
-                global_end = clock();
-                global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                spreadsheet->time = global_cpu_time_used;
-                printf("[%.1f] (Error: Invalid binary operation format.) ", spreadsheet->time);
+            if (sscanf(rhs, "%47[^+*/-]%c%47s", operand1Str, &opChar, operand2Str) != 3) {
+                reportStatus(spreadsheet, start, "Error: Invalid binary operation format.");
                 return;
             }
-            int operand1IsLiteral = 0, operand2IsLiteral = 0;
+            // A NULL operand cell means the literal is used.
             int literal1 = 0, literal2 = 0;
             Cell *operand1 = NULL, *operand2 = NULL;
             if (isalpha(operand1Str[0])) {
                 int row1, col1;
-                parseCellReference(operand1Str, &row1, &col1);
-                if (row1 < 0 || row1 >= spreadsheet->rows || col1 < 0 || col1 >= spreadsheet->cols) {
-                    global_end = clock();
-                    global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                    spreadsheet->time = global_cpu_time_used;
-                    printf("[%.1f] (Error: Operand cell %s is out of bounds.) ", spreadsheet->time, operand1Str);
+                Spreadsheet *operandSheet = resolveCell(spreadsheet, operand1Str, &row1, &col1);
+                if (!operandSheet) {
+                    reportStatus(spreadsheet, start, "Error: Operand cell %s is out of bounds.", operand1Str);
                     return;
                 }
-                operand1 = &spreadsheet->table[row1][col1];
-                if (checkCycleNew(operand1, targetCell, spreadsheet)) {
-                    global_end = clock();
-                    global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                    spreadsheet->time = global_cpu_time_used;
-                    printf("[%.1f] (Error: Cyclic dependency detected via operand %s. Formula rejected.) ", spreadsheet->time, operand1Str);
+                operand1 = sheetCell(operandSheet, row1, col1);
+                if (checkCycleNew(spreadsheet, operand1, targetCell)) {
+                    reportStatus(spreadsheet, start, "Error: Cyclic dependency detected via operand %s. Formula rejected.", operand1Str);
                     return;
                 }
             } else {
                 char extra1[10];
                 if (sscanf(operand1Str, "%d%9s", &literal1, extra1) != 1) {
-                    global_end = clock();
-                    global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                    spreadsheet->time = global_cpu_time_used;
-                    printf("[%.1f] (Error: Invalid literal operand '%s'.) ", spreadsheet->time, operand1Str);
+                    reportStatus(spreadsheet, start, "Error: Invalid literal operand '%s'.", operand1Str);
                     return;
                 }
-                operand1IsLiteral = 1;
             }
             if (isalpha(operand2Str[0])) {
                 int row2, col2;
-                parseCellReference(operand2Str, &row2, &col2);
-                if (row2 < 0 || row2 >= spreadsheet->rows || col2 < 0 || col2 >= spreadsheet->cols) {
-                    global_end = clock();
-                    global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                    spreadsheet->time = global_cpu_time_used;
-                    printf("[%.1f] (Error: Operand cell %s is out of bounds.) ", spreadsheet->time, operand2Str);
+                Spreadsheet *operandSheet = resolveCell(spreadsheet, operand2Str, &row2, &col2);
+                if (!operandSheet) {
+                    reportStatus(spreadsheet, start, "Error: Operand cell %s is out of bounds.", operand2Str);
                     return;
                 }
-                operand2 = &spreadsheet->table[row2][col2];
-                if (checkCycleNew(operand2, targetCell, spreadsheet)) {
-                    global_end = clock();
-                    global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                    spreadsheet->time = global_cpu_time_used;
-                    printf("[%.1f] (Error: Cyclic dependency detected via operand %s. Formula rejected.) ", spreadsheet->time, operand2Str);
+                operand2 = sheetCell(operandSheet, row2, col2);
+                if (checkCycleNew(spreadsheet, operand2, targetCell)) {
+                    reportStatus(spreadsheet, start, "Error: Cyclic dependency detected via operand %s. Formula rejected.", operand2Str);
                     return;
                 }
             } else {
                 char extra2[10];
                 if (sscanf(operand2Str, "%d%9s", &literal2, extra2) != 1) {
-                    global_end = clock();
-                    global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                    spreadsheet->time = global_cpu_time_used;
-                    printf("[%.1f] (Error: Invalid literal operand '%s'.) ", spreadsheet->time, operand2Str);
+                    reportStatus(spreadsheet, start, "Error: Invalid literal operand '%s'.", operand2Str);
                     return;
                 }
-                operand2IsLiteral = 1;
-            }
-
-            if ((!operand1IsLiteral && operand1->error) ||
-                (!operand2IsLiteral && operand2->error)) {
-                targetCell->error = 1;
-                targetCell->value = 0;
-                targetCell->op = OP_ADD;
-                targetCell->operand1IsLiteral = operand1IsLiteral;
-                targetCell->operand2IsLiteral = operand2IsLiteral;
-                if (!operand1IsLiteral) {
-                    targetCell->operand1 = operand1;
-                    addDependency(targetCell, operand1);
-                    addDependent(operand1, targetCell);
-                } else {
-                    targetCell->operand1Literal = literal1;
-                }
-                if (!operand2IsLiteral) {
-                    targetCell->operand2 = operand2;
-                    addDependency(targetCell, operand2);
-                    addDependent(operand2, targetCell);
-                } else {
-                    targetCell->operand2Literal = literal2;
-                }
-                removeAdvancedFormula(spreadsheet, targetCell);
-                recalcUsingTopoOrder(targetCell, spreadsheet);
-                recalcAllAdvancedFormulas(spreadsheet, start);
-                printSpreadsheet(spreadsheet);
-                global_end = clock();
-                global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                spreadsheet->time = global_cpu_time_used;
-                printf("[%.1f] (ok) ", spreadsheet->time);
-                return;
             }
 
-            int result = 0;
-            switch (opChar) {
-                case '+': result = (operand1IsLiteral ? literal1 : operand1->value) +
-                                 (operand2IsLiteral ? literal2 : operand2->value);
-                          targetCell->op = OP_ADD;
-                          break;
-                case '-': result = (operand1IsLiteral ? literal1 : operand1->value) -
-                                 (operand2IsLiteral ? literal2 : operand2->value);
-                          targetCell->op = OP_SUB;
-                          break;
-                case '*': result = (operand1IsLiteral ? literal1 : operand1->value) *
-                                 (operand2IsLiteral ? literal2 : operand2->value);
-                          targetCell->op = OP_MUL;
-                          break;
-                case '/':
-                          if ((operand2IsLiteral ? literal2 : operand2->value) == 0) {
-                              targetCell->error = 1;
-                              result = 0;
-                          } else {
-                              result = (operand1IsLiteral ? literal1 : operand1->value) /
-                                       (operand2IsLiteral ? literal2 : operand2->value);
-                              targetCell->error = 0;
-                          }
-                          targetCell->op = OP_DIV;
-                          break;
-                default:
-                          global_end = clock();
-                          global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                          spreadsheet->time = global_cpu_time_used;
-                          printf("[%.1f] (Error: Unsupported operation '%c'.) ", spreadsheet->time, opChar);
-                          return;
-            }
-            targetCell->value = result;
-            targetCell->operand1IsLiteral = operand1IsLiteral;
-            targetCell->operand2IsLiteral = operand2IsLiteral;
-            if (!operand1IsLiteral) {
-                targetCell->operand1 = operand1;
-                addDependency(targetCell, operand1);
-                addDependent(operand1, targetCell);
-            } else {
-                targetCell->operand1Literal = literal1;
-            }
-            if (!operand2IsLiteral) {
-                targetCell->operand2 = operand2;
-                addDependency(targetCell, operand2);
-                addDependent(operand2, targetCell);
-            } else {
-                targetCell->operand2Literal = literal2;
-            }
-            removeAdvancedFormula(spreadsheet, targetCell);
-            recalc_cell(targetCell, spreadsheet);
-            recalcUsingTopoOrder(targetCell, spreadsheet);
-            recalcAllAdvancedFormulas(spreadsheet, start);
+            int op = (opChar == '-') ? OP_SUB : (opChar == '*') ? OP_MUL : (opChar == '/') ? OP_DIV : OP_ADD;
+            assignBinary(spreadsheet, targetCell, op, operand1, literal1, operand2, literal2, start);
             printSpreadsheet(spreadsheet);
-            global_end = clock();
-            global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-            spreadsheet->time = global_cpu_time_used;
-            printf("[%.1f] (ok) ", spreadsheet->time);
+            reportStatus(spreadsheet, start, "ok");
             return;
         } else {
             /* Direct assignment branch */
             if (isalpha(rhs[0])) {
                 int row, col;
-                parseCellReference(rhs, &row, &col);
-                if (row < 0 || row >= spreadsheet->rows || col < 0 || col >= spreadsheet->cols) {
-                    global_end = clock();
-                    global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                    spreadsheet->time = global_cpu_time_used;
-                    printf("[%.1f] (Error: Cell reference out of bounds (%s).) ", spreadsheet->time, rhs);
+                Spreadsheet *sourceSheet = resolveCell(spreadsheet, rhs, &row, &col);
+                if (!sourceSheet) {
+                    reportStatus(spreadsheet, start, "Error: Cell reference out of bounds (%s).", rhs);
                     return;
                 }
-                Cell *source = &spreadsheet->table[row][col];
-                if (checkCycleNew(source, targetCell, spreadsheet)) {
-                    global_end = clock();
-                    global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                    spreadsheet->time = global_cpu_time_used;
-                    printf("[%.1f] (Error: Cyclic dependency detected via direct assignment (%s).) ", spreadsheet->time, rhs);
+                Cell *source = sheetCell(sourceSheet, row, col);
+                if (checkCycleNew(spreadsheet, source, targetCell)) {
+                    reportStatus(spreadsheet, start, "Error: Cyclic dependency detected via direct assignment (%s).", rhs);
                     return;
                 }
-                targetCell->value = source->value;
-                targetCell->operand1 = source;
-                targetCell->operand1IsLiteral = 0;
-                addDependency(targetCell, source);
-                addDependent(source, targetCell);
+                assignReference(spreadsheet, targetCell, source, start);
             } else {
                 int val;
                 char extra[10];
                 if (sscanf(rhs, "%d%9s", &val, extra) != 1) {
-                    global_end = clock();
-                    global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-                    spreadsheet->time = global_cpu_time_used;
-                    printf("[%.1f] (Error: Invalid literal in assignment.) ", spreadsheet->time);
+                    reportStatus(spreadsheet, start, "Error: Invalid literal in assignment.");
                     return;
                 }
-                targetCell->value = val;
-                targetCell->error = 0;
-                targetCell->operand1 = NULL;
-                targetCell->operand2 = NULL;
+                assignLiteral(spreadsheet, targetCell, val, start);
             }
-            targetCell->op = OP_NONE;
-            removeAdvancedFormula(spreadsheet, targetCell);
-            recalc_cell(targetCell, spreadsheet);
-            recalcUsingTopoOrder(targetCell, spreadsheet);
-            recalcAllAdvancedFormulas(spreadsheet, start);
             printSpreadsheet(spreadsheet);
-            global_end = clock();
-            global_cpu_time_used = ((double)(global_end - start)) / CLOCKS_PER_SEC;
-            spreadsheet->time = global_cpu_time_used;
-            printf("[%.1f] (ok) ", spreadsheet->time);
+            reportStatus(spreadsheet, start, "ok");
         }
     }
 }
 
 /*
-   ---------------- Spreadsheet Initialization & Display ----------------
+   ---------------- Spreadsheet Initialization ----------------
 
-   The code below is responsible for initializing the spreadsheet data structure,
-   setting up the cells, and printing the spreadsheet to the screen.
+   The code below is responsible for initializing the spreadsheet data structure
+   and setting up the cells.  Printing the viewport lives in render.c.
 */
 
 /*
  * initializeSpreadsheet allocates a new Spreadsheet with the specified number of rows and columns.
- * It allocates a contiguous block of memory for all cells and initializes each cell.
- * It also sets up the initial capacity for the advanced formulas list.
+ * Cells are not allocated here: the tile store creates them on first use, so the cost of an
+ * empty sheet does not grow with its size.
+ * It also sets up the initial capacity for the advanced formulas list and the viewport renderer.
  */
 Spreadsheet *initializeSpreadsheet(int rows, int cols) {
-    Spreadsheet *spreadsheet = malloc(sizeof(Spreadsheet));
+    Spreadsheet *spreadsheet = memAlloc(MEM_CELLS, sizeof(Spreadsheet));
     if (!spreadsheet) {
         perror("Failed to allocate memory for Spreadsheet");
         exit(EXIT_FAILURE);
@@ -1180,96 +2125,117 @@ Spreadsheet *initializeSpreadsheet(int rows, int cols) {
     spreadsheet->time = 0.0;
     spreadsheet->startRow = 0;
     spreadsheet->startCol = 0;
-    spreadsheet->table = malloc(rows * sizeof(Cell *));
-    if (!spreadsheet->table) {
-        perror("Failed to allocate memory for spreadsheet table");
-        exit(EXIT_FAILURE);
-    }
-    Cell *block = malloc(rows * cols * sizeof(Cell));
-    if (!block) {
-        perror("Failed to allocate contiguous cell block");
-        exit(EXIT_FAILURE);
-    }
-    for (int i = 0; i < rows; i++) {
-        spreadsheet->table[i] = block + (i * cols);
-        for (int j = 0; j < cols; j++) {
-            initCell(&spreadsheet->table[i][j], i, j);
-            spreadsheet->table[i][j].selfRow = i;
-            spreadsheet->table[i][j].selfCol = j;
-        }
-    }
+    spreadsheet->quiet = 0;
+    spreadsheet->deferRecalc = 0;
+    spreadsheet->journal = NULL;
+    spreadsheet->pendingCommand = NULL;
+    spreadsheet->statusOut = NULL;
+    spreadsheet->statusOutSize = 0;
+    spreadsheet->deferPublish = 0;
+    spreadsheet->rejectedCount = 0;
+    strcpy(spreadsheet->name, "Sheet1");
+    spreadsheet->workbook = NULL;
+    tileStoreInit(&spreadsheet->store, rows, cols);
+    spreadsheet->rowMap = NULL;
+    spreadsheet->colMap = NULL;
     spreadsheet->advancedFormulasCapacity = 10;
     spreadsheet->advancedFormulasCount = 0;
-    spreadsheet->advancedFormulas = malloc(spreadsheet->advancedFormulasCapacity * sizeof(Cell *));
+    spreadsheet->advancedFormulas = memAlloc(MEM_ADVANCED, spreadsheet->advancedFormulasCapacity * sizeof(Cell *));
     if (!spreadsheet->advancedFormulas) {
         perror("Failed to allocate memory for advanced formulas list");
         exit(EXIT_FAILURE);
     }
+    spreadsheet->renderer = createRenderer(cols);
+    spreadsheet->plane = createValuePlane(rows, cols);
+    spreadsheet->feed = NULL;
+    spreadsheet->components = NULL;
+    spreadsheet->background = NULL;
     return spreadsheet;
 }
 
 /*
- * getColumnLabel generates a column label (like A, B, AA, etc.) based on a zero-indexed column number.
- * It converts the number into letters and stores the result in the provided buffer.
+ * releaseContents frees everything owned by the spreadsheet except the structure itself,
+ * including the dependency trees hanging off each cell.
  */
-void getColumnLabel(int colIndex, char *label) {
-    int i = 0;
-    char temp[4];
-    while (colIndex >= 0) {
-        temp[i++] = 'A' + (colIndex % 26);
-        colIndex = (colIndex / 26) - 1;
-    }
-    temp[i] = '\0';
-    int len = strlen(temp);
-    for (int j = 0; j < len; j++) {
-        label[j] = temp[len - j - 1];
-    }
-    label[len] = '\0';
+static void releaseContents(Spreadsheet *spreadsheet) {
+    tileStoreFree(&spreadsheet->store);
+    indexMapFree(spreadsheet->rowMap, MEM_CELLS);
+    indexMapFree(spreadsheet->colMap, MEM_CELLS);
+    if (spreadsheet->advancedFormulas)
+        memFree(MEM_ADVANCED, spreadsheet->advancedFormulas, spreadsheet->advancedFormulasCapacity * sizeof(Cell *));
+    freeRenderer(spreadsheet->renderer);
 }
 
 /*
- * printSpreadsheet prints a portion of the spreadsheet (up to 10 rows and 10 columns)
- * starting from the current starting row and column.
- * If output is disabled, it simply returns without printing anything.
+ * freeSpreadsheet releases all memory allocated for the spreadsheet.
+ * It frees the cell tiles, the advanced formulas list, the renderer, the value plane (once
+ * its readers are done) and finally the spreadsheet structure itself.
+ * Freeing the home sheet of a workbook frees the other sheets with it.
  */
-void printSpreadsheet(Spreadsheet *spreadsheet) {
-    if (spreadsheet->display == 1)
-        return;
-    int endRow = (spreadsheet->startRow + 10 < spreadsheet->rows) ? spreadsheet->startRow + 10 : spreadsheet->rows;
-    int endCol = (spreadsheet->startCol + 10 < spreadsheet->cols) ? spreadsheet->startCol + 10 : spreadsheet->cols;
-    printf("%4s", "");
-    for (int col = spreadsheet->startCol; col < endCol; col++) {
-        char label[4];
-        getColumnLabel(col, label);
-        printf("%12s", label);
-    }
-    printf("\n");
-    for (int row = spreadsheet->startRow; row < endRow; row++) {
-        printf("%4d", row + 1);
-        for (int col = spreadsheet->startCol; col < endCol; col++) {
-            Cell *cell = &spreadsheet->table[row][col];
-            if (cell->error)
-                printf("%12s", "ERR");
-            else
-                printf("%12d", cell->value);
-        }
-        printf("\n");
+void freeSpreadsheet(Spreadsheet *spreadsheet) {
+    if (spreadsheet) {
+        freeBackgroundRecalc(spreadsheet->background);
+        if (spreadsheet->workbook)
+            freeWorkbook(spreadsheet->workbook, spreadsheet);
+        releaseContents(spreadsheet);
+        freeValuePlane(spreadsheet->plane);
+        freeChangeFeed(spreadsheet->feed);
+        freeComponents(spreadsheet->components);
+        memFree(MEM_CELLS, spreadsheet, sizeof(Spreadsheet));
     }
 }
 
 /*
- * freeSpreadsheet releases all memory allocated for the spreadsheet.
- * It frees the contiguous block of cells, the table pointer array,
- * the advanced formulas list, and finally the spreadsheet structure itself.
+ * adoptSpreadsheet moves the contents of source into target and frees source.
+ * The previous contents of target are released, but its session settings
+ * (output mode, quiet flag, delta rendering, status counters, journal, server hooks,
+ * background worker) and its name and workbook are kept.  So are its component table, rebuilt
+ * before next use, and its value plane, which republishes every tile with the next
+ * publication; views opened before keep reading the old contents.  Change subscribers get the
+ * replacement as a reset.
+ * It is used when a whole sheet is replaced, e.g. by loading a snapshot.
  */
-void freeSpreadsheet(Spreadsheet *spreadsheet) {
-    if (spreadsheet) {
-        if (spreadsheet->table) {
-            free(spreadsheet->table[0]);
-            free(spreadsheet->table);
-        }
-        if (spreadsheet->advancedFormulas)
-            free(spreadsheet->advancedFormulas);
-        free(spreadsheet);
+void adoptSpreadsheet(Spreadsheet *target, Spreadsheet *source) {
+    Spreadsheet old = *target;
+    *target = *source;
+    target->display = old.display;
+    target->quiet = old.quiet;
+    target->time = old.time;
+    target->rejectedCount = old.rejectedCount;
+    target->deferRecalc = old.deferRecalc;
+    target->journal = old.journal;
+    target->pendingCommand = old.pendingCommand;
+    target->statusOut = old.statusOut;
+    target->statusOutSize = old.statusOutSize;
+    target->deferPublish = old.deferPublish;
+    memcpy(target->name, old.name, sizeof(target->name));
+    target->workbook = old.workbook;
+    target->plane = old.plane;
+    target->plane->rebuild = 1;
+    // Changes recorded so far may point into the cells released below; subscribers rescan.
+    target->feed = old.feed;
+    if (homeSheet(target)->feed)
+        changeFeedReset(homeSheet(target)->feed);
+    // The component ids of the new cells are not known yet.
+    target->components = old.components;
+    componentsInvalidate(target);
+    target->background = old.background;
+    setDeltaRendering(target, old.renderer->deltaMode);
+    freeValuePlane(source->plane);
+    freeComponents(source->components);
+    memFree(MEM_CELLS, source, sizeof(Spreadsheet));
+    releaseContents(&old);
+}
+
+/*
+ * packIdleTiles moves the pack hand of every sheet of the workbook of home (see tile_store.h).
+ * It runs once a commit has been published and delivered, when no cell pointer is held on to.
+ */
+void packIdleTiles(Spreadsheet *home) {
+    if (!home->workbook) {
+        tileStoreCompact(&home->store);
+        return;
     }
+    for (int i = 0; i < home->workbook->count; i++)
+        tileStoreCompact(&home->workbook->sheets[i]->store);
 }
@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+
+#ifdef SHEET_STATS
+
+/*
+   ---------------- Instrumentation ----------------
+
+   One phase is current at any time.  statsEnter and statsLeave charge the time since the last
+   switch to the phase being left, so nested phases never count twice and the phases of a
+   command add up to its wall time.
+*/
+
+SheetStats statsLast;
+SheetStats statsTotal;
+
+static int currentPhase = STATS_PHASE_PARSE;
+static unsigned long long phaseMark;
+// Phases entered outside a command (e.g. the first frame) only count calls.
+static int inCommand;
+
+static const char *const phaseNames[STATS_PHASE_COUNT] = {
+    "parse", "cycle_check", "topo_recalc", "advanced_recalc", "render"
+};
+
+static const char *const counterNames[STATS_COUNTER_COUNT] = {
+    "cells_recomputed", "edges_traversed", "bfs_nodes_visited", "range_cells_scanned", "tiles_published",
+    "tiles_packed", "tiles_unpacked"
+};
+
+static unsigned long long nowNanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+/*
+ * chargeCurrent adds the time since the last phase switch to the current phase.
+ */
+static void chargeCurrent(void) {
+    unsigned long long now = nowNanos();
+    if (!inCommand) {
+        phaseMark = now;
+        return;
+    }
+    statsLast.phaseNanos[currentPhase] += now - phaseMark;
+    statsTotal.phaseNanos[currentPhase] += now - phaseMark;
+    phaseMark = now;
+}
+
+/*
+ * statsBeginCommand clears the last-command breakdown and starts timing in the parse phase.
+ */
+void statsBeginCommand(void) {
+    memset(&statsLast, 0, sizeof(statsLast));
+    statsLast.commands = 1;
+    statsTotal.commands++;
+    currentPhase = STATS_PHASE_PARSE;
+    statsLast.phaseCalls[STATS_PHASE_PARSE] = 1;
+    statsTotal.phaseCalls[STATS_PHASE_PARSE]++;
+    inCommand = 1;
+    phaseMark = nowNanos();
+}
+
+void statsEndCommand(void) {
+    chargeCurrent();
+    inCommand = 0;
+}
+
+/*
+ * statsEnter switches to phase and returns the phase to restore with statsLeave.
+ */
+int statsEnter(int phase) {
+    chargeCurrent();
+    int previous = currentPhase;
+    currentPhase = phase;
+    statsLast.phaseCalls[phase]++;
+    statsTotal.phaseCalls[phase]++;
+    return previous;
+}
+
+void statsLeave(int previous) {
+    chargeCurrent();
+    currentPhase = previous;
+}
+
+/*
+ * statsPrint writes the last-command and cumulative breakdowns to stdout.
+ */
+void statsPrint(void) {
+    printf("%-20s %14s %14s %12s\n", "phase", "last_ms", "total_ms", "total_calls");
+    for (int i = 0; i < STATS_PHASE_COUNT; i++) {
+        printf("%-20s %14.3f %14.3f %12llu\n", phaseNames[i],
+               statsLast.phaseNanos[i] / 1e6, statsTotal.phaseNanos[i] / 1e6, statsTotal.phaseCalls[i]);
+    }
+    printf("%-20s %14s %14s\n", "counter", "last", "total");
+    for (int i = 0; i < STATS_COUNTER_COUNT; i++)
+        printf("%-20s %14llu %14llu\n", counterNames[i], statsLast.counters[i], statsTotal.counters[i]);
+    printf("%-20s %14s %14llu\n", "commands", "", statsTotal.commands);
+}
+
+#else
+
+/* ISO C forbids an empty translation unit. */
+typedef int statsDisabled;
+
+#endif  // SHEET_STATS
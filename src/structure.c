@@ -0,0 +1,350 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "structure.h"
+#include "workbook.h"
+#include "components.h"
+#include "value_plane.h"
+#include "change_feed.h"
+#include "avl_tree.h"
+#include "mem_track.h"
+
+/*
+   ---------------- Structural edits ----------------
+
+   Rows and columns are handled alike through an Axis.  A delete of count indices at first is
+   the rotation first..size-1 that sends the block to the end, where it comes back empty; an
+   insert is the rotation that brings the last count indices, checked empty, to first.  Ranges
+   after the edit point only shift: their cells keep their physical rows, so the coverage of
+   the tiles under them stands.  Ranges the edit cuts into gain or lose cells; they are
+   uncovered before the rotation, covered again after it and recalculated.
+*/
+
+typedef struct {
+    Spreadsheet *sheet;
+    int columns;                // 1: the axis is the columns
+    int size;
+    IndexMap **map;
+} Axis;
+
+static Axis axisOf(Spreadsheet *spreadsheet, int columns) {
+    Axis axis = { spreadsheet, columns, columns ? spreadsheet->cols : spreadsheet->rows,
+                  columns ? &spreadsheet->colMap : &spreadsheet->rowMap };
+    return axis;
+}
+
+/*
+ * axisIndex returns the logical index along the axis of cell, a cell of owner.
+ */
+static int axisIndex(const Axis *axis, const Spreadsheet *owner, const Cell *cell) {
+    return axis->columns ? sheetLogicalCol(owner, cell->selfCol) : sheetLogicalRow(owner, cell->selfRow);
+}
+
+static int *rangeLow(const Axis *axis, Cell *formula) {
+    return axis->columns ? &formula->col1 : &formula->row1;
+}
+
+static int *rangeHigh(const Axis *axis, Cell *formula) {
+    return axis->columns ? &formula->col2 : &formula->row2;
+}
+
+typedef int (*CellVisit)(const Axis *axis, Cell *cell, void *data);
+
+/*
+ * packedHolds reports whether a packed tile has a nonzero value in rows row1..row2 and
+ * columns col1..col2, which lie within it.
+ */
+static int packedHolds(const Tile *tile, int row1, int col1, int row2, int col2) {
+    for (int r = row1; r <= row2; r++) {
+        long index = tileCellIndex(tile, r, col1);
+        for (int c = col1; c <= col2; c++, index++) {
+            if (tilePackedValue(tile, index) != 0)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * visitBlock calls visit for every materialized cell of the logical indices first..last of the
+ * axis and returns the first nonzero result, or 0.  A packed tile with nothing but zeros in
+ * the block is passed over; any other is unpacked first.
+ */
+static int visitBlock(const Axis *axis, int first, int last, CellVisit visit, void *data) {
+    TileStore *store = &axis->sheet->store;
+    while (first <= last) {
+        int physical, span = indexMapSpan(*axis->map, first, last, &physical);
+        first += span;
+        int row1 = axis->columns ? 0 : physical, row2 = axis->columns ? store->rows - 1 : physical + span - 1;
+        int col1 = axis->columns ? physical : 0, col2 = axis->columns ? physical + span - 1 : store->cols - 1;
+        for (int tileRow = row1 >> TILE_ROW_BITS; tileRow <= row2 >> TILE_ROW_BITS; tileRow++) {
+            if (!store->bands[tileRow])
+                continue;
+            for (int tileCol = col1 >> TILE_COL_BITS; tileCol <= col2 >> TILE_COL_BITS; tileCol++) {
+                Tile *tile = store->bands[tileRow][tileCol];
+                if (!tile)
+                    continue;
+                int r1 = row1 > tile->row0 ? row1 : tile->row0;
+                int r2 = row2 < tile->row0 + tile->rows - 1 ? row2 : tile->row0 + tile->rows - 1;
+                int c1 = col1 > tile->col0 ? col1 : tile->col0;
+                int c2 = col2 < tile->col0 + tile->cols - 1 ? col2 : tile->col0 + tile->cols - 1;
+                if (tile->packed && !packedHolds(tile, r1, c1, r2, c2))
+                    continue;
+                tileStoreUse(store, tile);
+                for (int r = r1; r <= r2; r++) {
+                    Cell *cells = &tile->cells[tileCellIndex(tile, r, tile->col0)];
+                    for (int c = c1; c <= c2; c++) {
+                        int result = visit(axis, &cells[c - tile->col0], data);
+                        if (result)
+                            return result;
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+typedef struct {
+    const Axis *axis;
+    int first;
+    int last;
+    int outside;
+} BlockCheck;
+
+static void dependent_outside_callback(Cell *dependent, void *data) {
+    BlockCheck *check = (BlockCheck *) data;
+    int index;
+    if (!sheetOwns(check->axis->sheet, dependent) ||
+        (index = axisIndex(check->axis, check->axis->sheet, dependent)) < check->first || index > check->last)
+        check->outside = 1;
+}
+
+/*
+ * readFromOutside is the CellVisit that refuses a delete when a cell of the block has a
+ * dependent outside it.
+ */
+static int readFromOutside(const Axis *axis, Cell *cell, void *data) {
+    BlockCheck *check = (BlockCheck *) data;
+    (void) axis;
+    if (cell->dependents)
+        avl_traverse(cell->dependents, dependent_outside_callback, check);
+    return check->outside ? STRUCTURE_ERR_REFERENCED : 0;
+}
+
+/*
+ * holdsContent is the CellVisit that refuses an insert when a cell to be pushed off the sheet
+ * holds anything or is referred to.
+ */
+static int holdsContent(const Axis *axis, Cell *cell, void *data) {
+    (void) axis;
+    (void) data;
+    return (cell->value != 0 || cell->error || cell->op != OP_NONE || cell->operand1 || cell->operand2 ||
+            cell->dependencies || cell->dependents) ? STRUCTURE_ERR_OCCUPIED : 0;
+}
+
+/*
+ * clearCell is the CellVisit that empties a cell of a deleted block.
+ */
+static int clearCell(const Axis *axis, Cell *cell, void *data) {
+    (void) data;
+    if (cell->value != 0 || cell->error || cell->op != OP_NONE || cell->operand1 || cell->operand2 ||
+        cell->dependencies) {
+        setCellLiteral(axis->sheet, cell, 0);
+        tileStoreTouch(&axis->sheet->store, cell);
+    }
+    return 0;
+}
+
+/*
+ * RangeList holds the range formulas of the workbook whose range lies on the sheet being
+ * edited, the sheet of each, and whether the edit changes which cells the range covers.
+ */
+typedef struct {
+    Cell **formulas;
+    Spreadsheet **owners;
+    unsigned char *reshaped;
+    int count;
+    int capacity;
+} RangeList;
+
+static void gatherRanges(const Axis *axis, RangeList *list) {
+    Spreadsheet *home = homeSheet(axis->sheet);
+    Spreadsheet **sheets = home->workbook ? home->workbook->sheets : &home;
+    int sheetCount = home->workbook ? home->workbook->count : 1;
+    list->capacity = 1;
+    for (int s = 0; s < sheetCount; s++)
+        list->capacity += sheets[s]->advancedFormulasCount;
+    list->formulas = memAlloc(MEM_RECALC, list->capacity * sizeof(Cell *));
+    list->owners = memAlloc(MEM_RECALC, list->capacity * sizeof(Spreadsheet *));
+    list->reshaped = memCalloc(MEM_RECALC, list->capacity, 1);
+    if (!list->formulas || !list->owners || !list->reshaped) {
+        perror("Failed to allocate range list");
+        exit(EXIT_FAILURE);
+    }
+    list->count = 0;
+    for (int s = 0; s < sheetCount; s++) {
+        for (int i = 0; i < sheets[s]->advancedFormulasCount; i++) {
+            Cell *formula = sheets[s]->advancedFormulas[i];
+            if ((formula->rangeSheet ? formula->rangeSheet : sheets[s]) != axis->sheet)
+                continue;
+            list->formulas[list->count] = formula;
+            list->owners[list->count++] = sheets[s];
+        }
+    }
+}
+
+static void releaseRanges(RangeList *list) {
+    memFree(MEM_RECALC, list->formulas, list->capacity * sizeof(Cell *));
+    memFree(MEM_RECALC, list->owners, list->capacity * sizeof(Spreadsheet *));
+    memFree(MEM_RECALC, list->reshaped, list->capacity);
+}
+
+/*
+ * uncoverReshaped takes the reshaped ranges off the coverage while their bounds and the map
+ * are still those they were covered with.
+ */
+static void uncoverReshaped(const RangeList *list) {
+    for (int i = 0; i < list->count; i++) {
+        if (list->reshaped[i])
+            coverRange(list->owners[i], list->formulas[i], -1);
+    }
+}
+
+/*
+ * finishEdit rotates the map of the axis from first..size-1 so that middle comes first, once
+ * the bounds of list have been moved, then covers the reshaped ranges again, recalculates and
+ * propagates them, and tells readers the layout changed.
+ */
+static void finishEdit(const Axis *axis, RangeList *list, int first, int middle, double start) {
+    *axis->map = indexMapRotate(*axis->map, axis->size, first, middle, axis->size, MEM_CELLS);
+    // Which cells the ranges cover has changed; the component table is rebuilt from scratch.
+    componentsInvalidate(axis->sheet);
+    long changed = 0;
+    for (int i = 0; i < list->count; i++) {
+        if (!list->reshaped[i])
+            continue;
+        coverRange(list->owners[i], list->formulas[i], 1);
+        recalc_cell(list->formulas[i], list->owners[i]);
+        list->formulas[changed++] = list->formulas[i];
+    }
+    propagateChanges(axis->sheet, list->formulas, changed, start);
+    // Published versions carry the maps, and subscribers' cells now lie elsewhere.
+    axis->sheet->plane->relayout = 1;
+    Spreadsheet *home = homeSheet(axis->sheet);
+    if (home->feed)
+        changeFeedReset(home->feed);
+}
+
+/*
+ * deleteIndices deletes count rows or columns of the axis at first.
+ */
+static int deleteIndices(const Axis *axis, int first, int count, double start) {
+    if (first < 0 || count < 1 || count > axis->size - first)
+        return STRUCTURE_ERR_BOUNDS;
+    int last = first + count - 1;
+    BlockCheck check = { axis, first, last, 0 };
+    int status = visitBlock(axis, first, last, readFromOutside, &check);
+    if (status != STRUCTURE_OK)
+        return status;
+    RangeList list;
+    gatherRanges(axis, &list);
+    for (int i = 0; i < list.count && status == STRUCTURE_OK; i++) {
+        Cell *formula = list.formulas[i];
+        int index = sheetOwns(axis->sheet, formula) ? axisIndex(axis, axis->sheet, formula) : -1;
+        if (*rangeLow(axis, formula) >= first && *rangeHigh(axis, formula) <= last &&
+            (index < first || index > last))
+            status = STRUCTURE_ERR_REFERENCED;
+    }
+    releaseRanges(&list);
+    if (status != STRUCTURE_OK)
+        return status;
+
+    // Range formulas inside the block go with it, so the list is gathered again.
+    visitBlock(axis, first, last, clearCell, NULL);
+    gatherRanges(axis, &list);
+    for (int i = 0; i < list.count; i++)
+        list.reshaped[i] = *rangeLow(axis, list.formulas[i]) <= last && *rangeHigh(axis, list.formulas[i]) >= first;
+    uncoverReshaped(&list);
+    for (int i = 0; i < list.count; i++) {
+        int *low = rangeLow(axis, list.formulas[i]), *high = rangeHigh(axis, list.formulas[i]);
+        if (*low > last) {
+            *low -= count;
+            *high -= count;
+        } else if (list.reshaped[i]) {
+            if (*low > first)
+                *low = first;
+            *high = *high > last ? *high - count : first - 1;
+        }
+    }
+    finishEdit(axis, &list, first, first + count, start);
+    releaseRanges(&list);
+    return STRUCTURE_OK;
+}
+
+/*
+ * insertIndices inserts count empty rows or columns of the axis at first.
+ */
+static int insertIndices(const Axis *axis, int first, int count, double start) {
+    if (first < 0 || count < 1 || count > axis->size - first)
+        return STRUCTURE_ERR_BOUNDS;
+    int tail = axis->size - count;
+    int status = visitBlock(axis, tail, axis->size - 1, holdsContent, NULL);
+    if (status != STRUCTURE_OK)
+        return status;
+    RangeList list;
+    gatherRanges(axis, &list);
+    for (int i = 0; i < list.count; i++) {
+        if (*rangeLow(axis, list.formulas[i]) >= tail) {
+            releaseRanges(&list);
+            return STRUCTURE_ERR_OCCUPIED;
+        }
+    }
+    // A range cut by the edit point grows; one pushed against the end loses its (empty) tail.
+    for (int i = 0; i < list.count; i++) {
+        int low = *rangeLow(axis, list.formulas[i]), high = *rangeHigh(axis, list.formulas[i]);
+        list.reshaped[i] = high >= first && (low < first || high >= tail);
+    }
+    uncoverReshaped(&list);
+    for (int i = 0; i < list.count; i++) {
+        int *low = rangeLow(axis, list.formulas[i]), *high = rangeHigh(axis, list.formulas[i]);
+        if (*high < first)
+            continue;
+        if (*low >= first)
+            *low += count;
+        *high = *high < tail ? *high + count : axis->size - 1;
+    }
+    finishEdit(axis, &list, first, tail, start);
+    releaseRanges(&list);
+    return STRUCTURE_OK;
+}
+
+/*
+   ---------------- Interface ----------------
+*/
+
+/*
+ * insertRows inserts count empty rows above row, as "insert_row" does.  It returns one of the
+ * STRUCTURE_* codes; a refused edit changes nothing.
+ */
+int insertRows(Spreadsheet *spreadsheet, int row, int count, double start) {
+    Axis axis = axisOf(spreadsheet, 0);
+    return insertIndices(&axis, row, count, start);
+}
+
+/*
+ * deleteRows deletes count rows from row on, as "delete_row" does.
+ */
+int deleteRows(Spreadsheet *spreadsheet, int row, int count, double start) {
+    Axis axis = axisOf(spreadsheet, 0);
+    return deleteIndices(&axis, row, count, start);
+}
+
+int insertColumns(Spreadsheet *spreadsheet, int col, int count, double start) {
+    Axis axis = axisOf(spreadsheet, 1);
+    return insertIndices(&axis, col, count, start);
+}
+
+int deleteColumns(Spreadsheet *spreadsheet, int col, int count, double start) {
+    Axis axis = axisOf(spreadsheet, 1);
+    return deleteIndices(&axis, col, count, start);
+}
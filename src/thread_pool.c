@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "thread_pool.h"
+#include "mem_track.h"
+
+/*
+   ---------------- Thread pool ----------------
+
+   A fixed set of worker threads that execute parallel-for jobs.  threadPoolRun hands out
+   indices one at a time, the calling thread takes part in the work, and the call returns
+   once every index has been processed.  One pool is shared by the whole process.
+*/
+
+/*
+ * runIndices takes indices from the current job until none are left.
+ * It is entered and left with the pool lock held.
+ */
+static void runIndices(ThreadPool *pool) {
+    while (pool->next < pool->count) {
+        long index = pool->next++;
+        ThreadPoolTask task = pool->task;
+        void *arg = pool->arg;
+        pthread_mutex_unlock(&pool->lock);
+        task(arg, index);
+        pthread_mutex_lock(&pool->lock);
+        if (++pool->finished == pool->count)
+            pthread_cond_broadcast(&pool->workDone);
+    }
+}
+
+static void *workerMain(void *arg) {
+    ThreadPool *pool = (ThreadPool *) arg;
+    unsigned long seen = 0;
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->stop && pool->generation == seen)
+            pthread_cond_wait(&pool->workReady, &pool->lock);
+        if (pool->stop)
+            break;
+        seen = pool->generation;
+        runIndices(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/*
+ * createThreadPool starts threadCount workers (at least one).
+ */
+ThreadPool *createThreadPool(int threadCount) {
+    ThreadPool *pool = memCalloc(MEM_OTHER, 1, sizeof(ThreadPool));
+    if (!pool) {
+        perror("Failed to allocate ThreadPool");
+        exit(EXIT_FAILURE);
+    }
+    if (threadCount < 1)
+        threadCount = 1;
+    pool->threads = memAlloc(MEM_OTHER, threadCount * sizeof(pthread_t));
+    if (!pool->threads) {
+        perror("Failed to allocate worker threads");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->workReady, NULL);
+    pthread_cond_init(&pool->workDone, NULL);
+    pool->threadCount = threadCount;
+    for (int i = 0; i < threadCount; i++) {
+        if (pthread_create(&pool->threads[i], NULL, workerMain, pool) != 0) {
+            perror("Failed to start worker thread");
+            exit(EXIT_FAILURE);
+        }
+    }
+    return pool;
+}
+
+/*
+ * threadPoolRun calls task(arg, i) for every i in [0, count) across the pool and waits for all of them.
+ * Jobs are serialized: a second caller waits until the running job has finished.
+ */
+void threadPoolRun(ThreadPool *pool, long count, ThreadPoolTask task, void *arg) {
+    if (count <= 0)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active)
+        pthread_cond_wait(&pool->workDone, &pool->lock);
+    pool->active = 1;
+    pool->task = task;
+    pool->arg = arg;
+    pool->count = count;
+    pool->next = 0;
+    pool->finished = 0;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->workReady);
+    runIndices(pool);
+    while (pool->finished < pool->count)
+        pthread_cond_wait(&pool->workDone, &pool->lock);
+    pool->active = 0;
+    pool->count = 0;
+    pthread_cond_broadcast(&pool->workDone);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * freeThreadPool stops and joins all workers.
+ */
+void freeThreadPool(ThreadPool *pool) {
+    if (!pool)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->workReady);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 0; i < pool->threadCount; i++)
+        pthread_join(pool->threads[i], NULL);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->workReady);
+    pthread_cond_destroy(&pool->workDone);
+    memFree(MEM_OTHER, pool->threads, pool->threadCount * sizeof(pthread_t));
+    memFree(MEM_OTHER, pool, sizeof(ThreadPool));
+}
+
+int threadPoolSize(ThreadPool *pool) {
+    return pool->threadCount + 1;
+}
+
+static ThreadPool *shared = NULL;
+static pthread_once_t sharedOnce = PTHREAD_ONCE_INIT;
+
+static void createShared(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    shared = createThreadPool(cpus > 1 ? (int) cpus - 1 : 1);
+}
+
+/*
+ * sharedThreadPool returns the process-wide pool, creating it on first use with one worker
+ * per online CPU besides the caller.
+ */
+ThreadPool *sharedThreadPool(void) {
+    pthread_once(&sharedOnce, createShared);
+    return shared;
+}
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "tile_backing.h"
+#include "tile_store.h"
+#include "mem_track.h"
+
+/*
+   ---------------- File-backed tiles ----------------
+
+   One file per store.  Slots are handed out from the end of the last chunk and only given back
+   with the store; the part of a slot past its tile is never written, so it takes no space.
+   The bookkeeping is charged to MEM_CELLS; the mapped cells themselves are not heap memory.
+*/
+
+static const char *spillDirectory;      // NULL: stores keep their tiles on the heap
+static long spillMegabytes;
+
+/*
+ * tileBackingConfigure makes every store created from now on keep its cells in a file in
+ * directory (which must outlive them), with a resident budget of residentMegabytes, or
+ * TILE_BACKING_DEFAULT_MB if it is 0.  It returns -1 if files cannot be created there.
+ */
+int tileBackingConfigure(const char *directory, long residentMegabytes) {
+    if (residentMegabytes < 0 || access(directory, W_OK | X_OK) != 0)
+        return -1;
+    spillDirectory = directory;
+    spillMegabytes = residentMegabytes > 0 ? residentMegabytes : TILE_BACKING_DEFAULT_MB;
+    return 0;
+}
+
+/*
+ * createTileBacking opens the file for a new store, or returns NULL if no spill directory was
+ * configured.
+ */
+TileBacking *createTileBacking(void) {
+    if (!spillDirectory)
+        return NULL;
+    TileBacking *backing = memCalloc(MEM_CELLS, 1, sizeof(TileBacking));
+    if (!backing) {
+        perror("Failed to allocate tile backing");
+        exit(EXIT_FAILURE);
+    }
+    char path[4096];
+    if (snprintf(path, sizeof(path), "%s/sheet-tiles-XXXXXX", spillDirectory) >= (int) sizeof(path)) {
+        fprintf(stderr, "Spill directory path is too long\n");
+        exit(EXIT_FAILURE);
+    }
+    backing->fd = mkstemp(path);
+    if (backing->fd < 0) {
+        perror("Failed to create tile file");
+        exit(EXIT_FAILURE);
+    }
+    unlink(path);
+    backing->pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    backing->budget = (spillMegabytes << 20) / (long) (TILE_ROWS * TILE_COLS * sizeof(Cell));
+    if (backing->budget < 1)
+        backing->budget = 1;
+    backing->resident = memAlloc(MEM_CELLS, backing->budget * sizeof(Tile *));
+    if (!backing->resident) {
+        perror("Failed to allocate resident tile set");
+        exit(EXIT_FAILURE);
+    }
+    return backing;
+}
+
+/*
+ * freeTileBacking unmaps and closes the file; the cells in it must no longer be needed.
+ */
+void freeTileBacking(TileBacking *backing) {
+    if (!backing)
+        return;
+    for (int i = 0; i < backing->chunkCount; i++)
+        munmap(backing->chunks[i], TILE_BACKING_CHUNK);
+    close(backing->fd);
+    memFree(MEM_CELLS, backing->chunks, backing->chunkCapacity * sizeof(char *));
+    memFree(MEM_CELLS, backing->resident, backing->budget * sizeof(Tile *));
+    memFree(MEM_CELLS, backing, sizeof(TileBacking));
+}
+
+static size_t tileSlotBytes(const TileBacking *backing, const Tile *tile) {
+    size_t bytes = (size_t) tile->rows * tile->cols * sizeof(Cell);
+    return (bytes + backing->pageSize - 1) / backing->pageSize * backing->pageSize;
+}
+
+/*
+ * mapChunk maps the next chunk of the file at an address aligned to TILE_BACKING_SLOT, so that
+ * every slot is a window of its own for fault-around.
+ */
+static char *mapChunk(TileBacking *backing) {
+    off_t offset = (off_t) backing->chunkCount * TILE_BACKING_CHUNK;
+    if (ftruncate(backing->fd, offset + TILE_BACKING_CHUNK) != 0) {
+        perror("Failed to grow tile file");
+        exit(EXIT_FAILURE);
+    }
+    size_t span = TILE_BACKING_CHUNK + TILE_BACKING_SLOT;
+    char *reserved = mmap(NULL, span, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED) {
+        perror("Failed to map tile file");
+        exit(EXIT_FAILURE);
+    }
+    char *start = (char *) (((uintptr_t) reserved + TILE_BACKING_SLOT - 1) & ~(uintptr_t) (TILE_BACKING_SLOT - 1));
+    void *chunk = mmap(start, TILE_BACKING_CHUNK, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, backing->fd, offset);
+    if (chunk == MAP_FAILED) {
+        perror("Failed to map tile file");
+        exit(EXIT_FAILURE);
+    }
+    if (start > reserved)
+        munmap(reserved, start - reserved);
+    munmap(start + TILE_BACKING_CHUNK, reserved + span - (start + TILE_BACKING_CHUNK));
+    // Pages are wanted a tile at a time: readahead would only bring in the neighbours.
+    madvise(chunk, TILE_BACKING_CHUNK, MADV_RANDOM);
+    return chunk;
+}
+
+/*
+ * tileBackingAlloc returns the slot for a new tile, mapping another chunk when the last one
+ * is full.
+ */
+void *tileBackingAlloc(TileBacking *backing) {
+    if (backing->chunkCount == 0 || backing->chunkUsed == (size_t) TILE_BACKING_CHUNK) {
+        if (backing->chunkCount == backing->chunkCapacity) {
+            int capacity = backing->chunkCapacity ? 2 * backing->chunkCapacity : 8;
+            backing->chunks = memRealloc(MEM_CELLS, backing->chunks, backing->chunkCapacity * sizeof(char *),
+                                         capacity * sizeof(char *));
+            if (!backing->chunks) {
+                perror("Failed to allocate tile file chunks");
+                exit(EXIT_FAILURE);
+            }
+            backing->chunkCapacity = capacity;
+        }
+        backing->chunks[backing->chunkCount++] = mapChunk(backing);
+        backing->chunkUsed = 0;
+    }
+    void *slot = backing->chunks[backing->chunkCount - 1] + backing->chunkUsed;
+    backing->chunkUsed += TILE_BACKING_SLOT;
+    return slot;
+}
+
+/*
+ * tileBackingAdmit adds tile to the resident set.  Over budget, the clock hand lets go of the
+ * first resident tile not referenced since it last came round.
+ */
+
+void tileBackingAdmit(TileBacking *backing, Tile *tile) {
+    tile->resident = 1;
+    if (backing->residentCount < backing->budget) {
+        backing->resident[backing->residentCount++] = tile;
+        return;
+    }
+    while (backing->resident[backing->hand]->referenced) {
+        backing->resident[backing->hand]->referenced = 0;
+        backing->hand = (backing->hand + 1) % backing->budget;
+    }
+    Tile *victim = backing->resident[backing->hand];
+    tileBackingDrop(backing, victim);
+    victim->resident = 0;
+    backing->resident[backing->hand] = tile;
+    backing->hand = (backing->hand + 1) % backing->budget;
+}
+
+/*
+ * tileBackingDrop gives up the pages of tile (its contents stay in the file), without taking
+ * it out of the resident set.
+ */
+void tileBackingDrop(TileBacking *backing, const Tile *tile) {
+    madvise(tile->cells, tileSlotBytes(backing, tile), MADV_DONTNEED);
+}
+
+/*
+ * tileBackingPrefetch starts reading the cells of a tile that is not resident, so that a scan
+ * about to reach it does not wait for every page in turn.
+ */
+void tileBackingPrefetch(TileBacking *backing, const Tile *tile) {
+    madvise(tile->cells, tileSlotBytes(backing, tile), MADV_WILLNEED);
+}
@@ -0,0 +1,330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include "tile_store.h"
+#include "mem_track.h"
+#include "stats.h"
+
+/*
+   ---------------- Tile store ----------------
+
+   Only the band directory and its coverage counterpart are allocated up front (one pointer per
+   TILE_ROWS rows each); bands, tiles and coverage rows appear on first use.  All of it is
+   accounted under MEM_CELLS, except packed values (MEM_PACKED).  The cells of a tile are a
+   block of their own, on the heap or in the file of a file-backed store.
+*/
+
+void tileStoreInit(TileStore *store, int rows, int cols) {
+    store->rows = rows;
+    store->cols = cols;
+    store->bandCount = (rows + TILE_ROWS - 1) >> TILE_ROW_BITS;
+    store->tilesPerBand = (cols + TILE_COLS - 1) >> TILE_COL_BITS;
+    store->bands = memCalloc(MEM_CELLS, store->bandCount, sizeof(Tile **));
+    store->coverage = memCalloc(MEM_CELLS, store->bandCount, sizeof(int *));
+    store->tileCapacity = 16;
+    store->tiles = memAlloc(MEM_CELLS, store->tileCapacity * sizeof(Tile *));
+    store->dirtyCapacity = 16;
+    store->dirty = memAlloc(MEM_CELLS, store->dirtyCapacity * sizeof(Tile *));
+    if (!store->bands || !store->coverage || !store->tiles || !store->dirty) {
+        perror("Failed to allocate tile directory");
+        exit(EXIT_FAILURE);
+    }
+    store->tileCount = 0;
+    store->cellCount = 0;
+    store->dirtyCount = 0;
+    store->backing = createTileBacking();
+    store->packHand = 0;
+    store->packDue = 0;
+    store->packAll = 0;
+}
+
+static size_t cellBytes(const Tile *tile) {
+    return (size_t) tile->rows * tile->cols * sizeof(Cell);
+}
+
+static size_t packedBytes(const Tile *tile, int width) {
+    long count = (long) tile->rows * tile->cols;
+    return sizeof(TilePacked) + (size_t) ((count * width + 63) / 64) * sizeof(uint64_t);
+}
+
+/*
+ * tileStoreFree releases every tile, including the dependency trees of its cells.
+ */
+void tileStoreFree(TileStore *store) {
+    // The cells first: going through them may let go of any tile, so every header must be there.
+    // Packed tiles have no trees to free.
+    for (long t = 0; t < store->tileCount; t++) {
+        Tile *tile = store->tiles[t];
+        long count = (long) tile->rows * tile->cols;
+        if (tile->packed)
+            continue;
+        tileStoreUse(store, tile);
+        for (long i = 0; i < count; i++)
+            freeCell(&tile->cells[i]);
+    }
+    for (long t = 0; t < store->tileCount; t++) {
+        Tile *tile = store->tiles[t];
+        if (tile->packed)
+            memFree(MEM_PACKED, tile->packed, packedBytes(tile, tile->packed->width));
+        else if (!store->backing)
+            memFree(MEM_CELLS, tile->cells, cellBytes(tile));
+        memFree(MEM_CELLS, tile, sizeof(Tile));
+    }
+    for (int b = 0; b < store->bandCount; b++) {
+        if (store->bands[b])
+            memFree(MEM_CELLS, store->bands[b], store->tilesPerBand * sizeof(Tile *));
+        if (store->coverage[b])
+            memFree(MEM_CELLS, store->coverage[b], store->tilesPerBand * sizeof(int));
+    }
+    memFree(MEM_CELLS, store->bands, store->bandCount * sizeof(Tile **));
+    memFree(MEM_CELLS, store->coverage, store->bandCount * sizeof(int *));
+    memFree(MEM_CELLS, store->tiles, store->tileCapacity * sizeof(Tile *));
+    memFree(MEM_CELLS, store->dirty, store->dirtyCapacity * sizeof(Tile *));
+    freeTileBacking(store->backing);
+}
+
+/*
+ * tileStoreMaterialize allocates the tile at (tileRow, tileCol) with every cell empty.
+ * The tile must not exist yet.
+ */
+Tile *tileStoreMaterialize(TileStore *store, int tileRow, int tileCol) {
+    Tile **band = store->bands[tileRow];
+    if (!band) {
+        band = memCalloc(MEM_CELLS, store->tilesPerBand, sizeof(Tile *));
+        if (!band) {
+            perror("Failed to allocate tile band");
+            exit(EXIT_FAILURE);
+        }
+        store->bands[tileRow] = band;
+    }
+    int row0 = tileRow << TILE_ROW_BITS, col0 = tileCol << TILE_COL_BITS;
+    int rows = (store->rows - row0 < TILE_ROWS) ? store->rows - row0 : TILE_ROWS;
+    int cols = (store->cols - col0 < TILE_COLS) ? store->cols - col0 : TILE_COLS;
+    Tile *tile = memAlloc(MEM_CELLS, sizeof(Tile));
+    if (!tile) {
+        perror("Failed to allocate tile");
+        exit(EXIT_FAILURE);
+    }
+    tile->row0 = row0;
+    tile->col0 = col0;
+    tile->rows = rows;
+    tile->cols = cols;
+    tile->ordinal = store->cellCount;
+    tile->dirty = 0;
+    tile->summary.stale = 1;
+    tile->resident = 1;
+    tile->referenced = 1;
+    tile->idle = 0;
+    tile->packed = NULL;
+    if (store->backing) {
+        tile->cells = tileBackingAlloc(store->backing);
+        tileBackingAdmit(store->backing, tile);
+    } else {
+        tile->cells = memAlloc(MEM_CELLS, cellBytes(tile));
+        if (!tile->cells) {
+            perror("Failed to allocate tile cells");
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++)
+            initCell(&tile->cells[tileCellIndex(tile, row0 + r, col0 + c)], row0 + r, col0 + c);
+    }
+    if (store->tileCount == store->tileCapacity) {
+        store->tiles = memRealloc(MEM_CELLS, store->tiles, store->tileCapacity * sizeof(Tile *),
+                                  2 * store->tileCapacity * sizeof(Tile *));
+        if (!store->tiles) {
+            perror("Failed to grow tile list");
+            exit(EXIT_FAILURE);
+        }
+        store->tileCapacity *= 2;
+    }
+    store->tiles[store->tileCount++] = tile;
+    store->cellCount += (long) rows * cols;
+    band[tileCol] = tile;
+    return tile;
+}
+
+/*
+ * tileStoreMarkDirty sets the dirty flag of a clean tile and queues it for publication.
+ */
+void tileStoreMarkDirty(TileStore *store, Tile *tile) {
+    if (store->dirtyCount == store->dirtyCapacity) {
+        store->dirty = memRealloc(MEM_CELLS, store->dirty, store->dirtyCapacity * sizeof(Tile *),
+                                  2 * store->dirtyCapacity * sizeof(Tile *));
+        if (!store->dirty) {
+            perror("Failed to grow dirty tile list");
+            exit(EXIT_FAILURE);
+        }
+        store->dirtyCapacity *= 2;
+    }
+    tile->dirty = 1;
+    store->dirty[store->dirtyCount++] = tile;
+    store->packDue++;
+}
+
+/*
+ * tileStoreSummarize recomputes the summary of tile from its cells.
+ */
+void tileStoreSummarize(const TileStore *store, Tile *tile) {
+    TileSummary *summary = &tile->summary;
+    tileStoreUse(store, tile);
+    long count = (long) tile->rows * tile->cols;
+    summary->sum = 0;
+    summary->sumSquares = 0.0;
+    summary->min = INT_MAX;
+    summary->max = INT_MIN;
+    summary->errors = 0;
+    for (long i = 0; i < count; i++) {
+        int value = tile->cells[i].value;
+        summary->sum += value;
+        summary->sumSquares += (double) value * value;
+        if (value < summary->min)
+            summary->min = value;
+        if (value > summary->max)
+            summary->max = value;
+        summary->errors += tile->cells[i].error;
+    }
+    summary->exact = summary->min >= -TILE_SUMMARY_EXACT_MAX && summary->max <= TILE_SUMMARY_EXACT_MAX;
+    summary->stale = 0;
+}
+
+/*
+ * tileStoreCover adds delta to the coverage of every tile the range row1..row2, col1..col2
+ * overlaps: 1 when a range formula over it appears, -1 when it goes away.
+ */
+void tileStoreCover(TileStore *store, int row1, int col1, int row2, int col2, int delta) {
+    for (int b = row1 >> TILE_ROW_BITS; b <= row2 >> TILE_ROW_BITS; b++) {
+        int *band = store->coverage[b];
+        if (!band) {
+            band = memCalloc(MEM_CELLS, store->tilesPerBand, sizeof(int));
+            if (!band) {
+                perror("Failed to allocate coverage band");
+                exit(EXIT_FAILURE);
+            }
+            store->coverage[b] = band;
+        }
+        for (int t = col1 >> TILE_COL_BITS; t <= col2 >> TILE_COL_BITS; t++)
+            band[t] += delta;
+    }
+}
+
+/*
+   ---------------- Packed tiles ----------------
+
+   The pack hand goes round store->tiles like a clock.  Each pass over a tile that was used
+   since the last one only counts it idle again; a tile idle for TILE_PACK_IDLE passes is packed
+   if all of its cells are plain values.  One that is not is pinned, and skipped until it has
+   been used.  Nothing outside a tile keeps a pointer to a plain cell between commits, so its
+   cells can go.
+*/
+
+/*
+ * packTile packs tile if every cell is a plain value, and returns 1 if it did.
+ */
+static int packTile(TileStore *store, Tile *tile) {
+    long count = (long) tile->rows * tile->cols;
+    // A spilled tile that was let go is not paged in just to be looked at.
+    if (store->backing && !tile->resident)
+        return 0;
+    int minVal = INT_MAX, maxVal = INT_MIN;
+    for (long i = 0; i < count; i++) {
+        const Cell *cell = &tile->cells[i];
+        if (cell->op != OP_NONE || cell->error || cell->dependencies || cell->dependents ||
+            cell->component || cell->rangeSheet)
+            return 0;
+        if (cell->value < minVal)
+            minVal = cell->value;
+        if (cell->value > maxVal)
+            maxVal = cell->value;
+    }
+    if (tile->summary.stale)
+        tileStoreSummarize(store, tile);
+    uint32_t span = (uint32_t) maxVal - (uint32_t) minVal;
+    int width = span ? 32 - __builtin_clz(span) : 0;
+    TilePacked *packed = memCalloc(MEM_PACKED, 1, packedBytes(tile, width));
+    if (!packed) {
+        perror("Failed to allocate packed tile");
+        exit(EXIT_FAILURE);
+    }
+    packed->base = minVal;
+    packed->width = width;
+    for (long i = 0; width > 0 && i < count; i++) {
+        uint64_t offset = (uint32_t) tile->cells[i].value - (uint32_t) minVal;
+        uint64_t bit = (uint64_t) i * (uint64_t) width;
+        int shift = (int) (bit & 63);
+        packed->bits[bit >> 6] |= offset << shift;
+        if (shift + width > 64)
+            packed->bits[(bit >> 6) + 1] |= offset >> (64 - shift);
+    }
+    tile->packed = packed;
+    if (store->backing) {
+        tileBackingDrop(store->backing, tile);
+    } else {
+        memFree(MEM_CELLS, tile->cells, cellBytes(tile));
+        tile->cells = NULL;
+    }
+    STATS_COUNT(STATS_TILES_PACKED, 1);
+    return 1;
+}
+
+/*
+ * tileStoreUnpack gives a packed tile its cells back.  Use tileStoreUse rather than calling
+ * this directly.
+ */
+void tileStoreUnpack(const TileStore *store, Tile *tile) {
+    if (store->backing) {
+        tile->referenced = 1;
+        if (!tile->resident)
+            tileBackingAdmit(store->backing, tile);
+    } else {
+        tile->cells = memAlloc(MEM_CELLS, cellBytes(tile));
+        if (!tile->cells) {
+            perror("Failed to allocate tile cells");
+            exit(EXIT_FAILURE);
+        }
+    }
+    long i = 0;
+    for (int r = 0; r < tile->rows; r++) {
+        for (int c = 0; c < tile->cols; c++, i++) {
+            initCell(&tile->cells[i], tile->row0 + r, tile->col0 + c);
+            tile->cells[i].value = tilePackedValue(tile, i);
+        }
+    }
+    memFree(MEM_PACKED, tile->packed, packedBytes(tile, tile->packed->width));
+    tile->packed = NULL;
+    STATS_COUNT(STATS_TILES_UNPACKED, 1);
+}
+
+/*
+ * tileStoreCompact moves the pack hand over TILE_PACK_SWEEP tiles for every tile marked dirty
+ * since it last ran (at most once round), packing the idle ones that qualify; after
+ * tileStoreMarkCold it goes once round every tile and packs all it can.
+ * It must run between commits, when no one holds on to a cell of a plain tile.
+ */
+void tileStoreCompact(TileStore *store) {
+    long budget = store->packAll ? store->tileCount : store->packDue * TILE_PACK_SWEEP;
+    if (budget > store->tileCount)
+        budget = store->tileCount;
+    store->packDue = 0;
+    for (long n = 0; n < budget; n++) {
+        if (store->packHand >= store->tileCount)
+            store->packHand = 0;
+        Tile *tile = store->tiles[store->packHand++];
+        if (tile->packed || tile->idle == TILE_IDLE_PINNED)
+            continue;
+        if (!store->packAll && ++tile->idle < TILE_PACK_IDLE)
+            continue;
+        if (!packTile(store, tile))
+            tile->idle = TILE_IDLE_PINNED;
+    }
+    store->packAll = 0;
+}
+
+/*
+ * tileStoreMarkCold says that the tiles were just loaded in bulk and are unlikely to be used
+ * again soon: the next tileStoreCompact packs every one it can.
+ */
+void tileStoreMarkCold(TileStore *store) {
+    store->packAll = 1;
+}
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "trace.h"
+#include "render.h"
+#include "mem_track.h"
+
+#ifdef SHEET_STATS
+
+/*
+   ---------------- Span tracing ----------------
+
+   Spans are recorded when they end, into a fixed ring of TraceEvent records; once the ring is
+   full the oldest events are overwritten.  Names are static strings, so recording a span is a
+   clock read and a struct copy.  Only the engine thread records spans.
+*/
+
+#define TRACE_TEXT_MAX 48
+
+typedef struct {
+    const char *name;
+    unsigned long long startNanos;
+    unsigned long long durationNanos;
+    int row;
+    int col;
+    long count;
+    char text[TRACE_TEXT_MAX];
+} TraceEvent;
+
+int traceEnabled;
+
+static TraceEvent *ring;
+static long capacity;
+static long recorded;       // total since trace_on; the ring holds the last min(recorded, capacity)
+static unsigned long long origin;
+
+unsigned long long traceNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long) ts.tv_sec * 1000000000ULL + (unsigned long long) ts.tv_nsec;
+}
+
+static TraceEvent *nextEvent(const char *name, unsigned long long startNanos) {
+    TraceEvent *event = &ring[recorded++ % capacity];
+    event->name = name;
+    event->startNanos = startNanos;
+    event->durationNanos = traceNow() - startNanos;
+    return event;
+}
+
+/*
+ * traceSpan records a span that began at startNanos and ends now.  row and col name the cell
+ * it concerns (-1 for none); count is a span-specific size such as cells in a wave.
+ */
+void traceSpan(const char *name, unsigned long long startNanos, int row, int col, long count) {
+    TraceEvent *event = nextEvent(name, startNanos);
+    event->row = row;
+    event->col = col;
+    event->count = count;
+    event->text[0] = '\0';
+}
+
+/*
+ * traceCommand records the span of a whole command, keeping the start of its text.
+ */
+void traceCommand(unsigned long long startNanos, const char *text) {
+    TraceEvent *event = nextEvent("command", startNanos);
+    event->row = event->col = -1;
+    event->count = -1;
+    strncpy(event->text, text, TRACE_TEXT_MAX - 1);
+    event->text[TRACE_TEXT_MAX - 1] = '\0';
+}
+
+/*
+ * traceStart (re)starts tracing into a fresh ring of the given number of events.
+ */
+int traceStart(long events) {
+    if (events <= 0)
+        return -1;
+    traceStop();
+    memFree(MEM_OTHER, ring, capacity * sizeof(TraceEvent));
+    ring = memAlloc(MEM_OTHER, events * sizeof(TraceEvent));
+    if (!ring) {
+        capacity = 0;
+        return -1;
+    }
+    capacity = events;
+    recorded = 0;
+    origin = traceNow();
+    traceEnabled = 1;
+    return 0;
+}
+
+/*
+ * traceStop stops recording; the events recorded so far can still be dumped.
+ */
+void traceStop(void) {
+    traceEnabled = 0;
+}
+
+static void writeEscaped(FILE *file, const char *text) {
+    for (const char *p = text; *p; p++) {
+        unsigned char c = (unsigned char) *p;
+        if (c == '"' || c == '\\')
+            fprintf(file, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(file, "\\u%04x", c);
+        else
+            fputc(c, file);
+    }
+}
+
+/*
+ * traceDump writes the buffered events, oldest first, as a Chrome trace JSON document.
+ * It returns 0 on success and -1 if nothing was traced or the file cannot be written.
+ */
+int traceDump(const char *path, long *written) {
+    if (!ring)
+        return -1;
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return -1;
+    long kept = recorded < capacity ? recorded : capacity;
+    long first = recorded - kept;
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"otherData\": {\"recorded\": %ld, \"dropped\": %ld},\n"
+                  " \"traceEvents\": [", recorded, first);
+    for (long i = 0; i < kept; i++) {
+        const TraceEvent *event = &ring[(first + i) % capacity];
+        fprintf(file, "%s\n  {\"name\": \"%s\", \"cat\": \"sheet\", \"ph\": \"X\", \"pid\": 1, \"tid\": 1, "
+                      "\"ts\": %.3f, \"dur\": %.3f, \"args\": {",
+                i ? "," : "", event->name,
+                (double) (event->startNanos - origin) / 1e3, (double) event->durationNanos / 1e3);
+        const char *separator = "";
+        if (event->row >= 0) {
+            char label[4];
+            getColumnLabel(event->col, label);
+            fprintf(file, "\"cell\": \"%s%d\"", label, event->row + 1);
+            separator = ", ";
+        }
+        if (event->count >= 0) {
+            fprintf(file, "%s\"n\": %ld", separator, event->count);
+            separator = ", ";
+        }
+        if (event->text[0]) {
+            fprintf(file, "%s\"text\": \"", separator);
+            writeEscaped(file, event->text);
+            fputc('"', file);
+        }
+        fputs("}}", file);
+    }
+    fputs("\n]}\n", file);
+    if (fclose(file) != 0)
+        return -1;
+    if (written)
+        *written = kept;
+    return 0;
+}
+
+#else
+
+/* ISO C forbids an empty translation unit. */
+typedef int traceDisabled;
+
+#endif  // SHEET_STATS
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <sched.h>
+#include "value_plane.h"
+#include "workbook.h"
+#include "stats.h"
+#include "mem_track.h"
+
+/*
+   ---------------- Value plane ----------------
+
+   Version n is published by storing current and then epoch = n.  A reader first pins the
+   epoch it sees and only then loads current, so the version it gets is at least as new as its
+   pin.  A block retired with epoch n is reachable from versions older than n only, so it can be
+   freed once every pin is n or newer.  All of it is accounted under MEM_VERSIONS.
+*/
+
+static size_t tileValuesBytes(int rows, int cols) {
+    return sizeof(TileValues) + (size_t) rows * cols * sizeof(CellValue);
+}
+
+static PlaneVersion *allocVersion(unsigned long number, int rows, int cols) {
+    PlaneVersion *version = memAlloc(MEM_VERSIONS, sizeof(PlaneVersion));
+    if (!version) {
+        perror("Failed to allocate value plane version");
+        exit(EXIT_FAILURE);
+    }
+    version->number = number;
+    version->rows = rows;
+    version->cols = cols;
+    version->bandCount = (rows + TILE_ROWS - 1) >> TILE_ROW_BITS;
+    version->tilesPerBand = (cols + TILE_COLS - 1) >> TILE_COL_BITS;
+    version->rowMap = version->colMap = NULL;
+    version->bands = memCalloc(MEM_VERSIONS, version->bandCount, sizeof(TileValues **));
+    if (!version->bands) {
+        perror("Failed to allocate value plane directory");
+        exit(EXIT_FAILURE);
+    }
+    return version;
+}
+
+/*
+ * createValuePlane returns a plane whose first version shows an empty sheet.
+ */
+ValuePlane *createValuePlane(int rows, int cols) {
+    ValuePlane *plane = memCalloc(MEM_VERSIONS, 1, sizeof(ValuePlane));
+    if (!plane) {
+        perror("Failed to allocate value plane");
+        exit(EXIT_FAILURE);
+    }
+    plane->current = allocVersion(1, rows, cols);
+    plane->epoch = 1;
+    return plane;
+}
+
+static void retire(ValuePlane *plane, void *block, size_t size, unsigned long epoch) {
+    if (plane->retiredCount == plane->retiredCapacity) {
+        long capacity = plane->retiredCapacity ? 2 * plane->retiredCapacity : 64;
+        plane->retired = memRealloc(MEM_VERSIONS, plane->retired, plane->retiredCapacity * sizeof(RetiredBlock),
+                                    capacity * sizeof(RetiredBlock));
+        if (!plane->retired) {
+            perror("Failed to grow retired block list");
+            exit(EXIT_FAILURE);
+        }
+        plane->retiredCapacity = capacity;
+    }
+    RetiredBlock *entry = &plane->retired[plane->retiredCount++];
+    entry->block = block;
+    entry->size = size;
+    entry->epoch = epoch;
+}
+
+static void retireMaps(ValuePlane *plane, PlaneVersion *version, unsigned long epoch) {
+    if (version->rowMap)
+        retire(plane, version->rowMap, indexMapBytes(version->rowMap), epoch);
+    if (version->colMap)
+        retire(plane, version->colMap, indexMapBytes(version->colMap), epoch);
+}
+
+/*
+ * retireVersion retires a version together with everything it references.  Only valid when
+ * nothing in it is shared with the version replacing it.
+ */
+static void retireVersion(ValuePlane *plane, PlaneVersion *version, unsigned long epoch) {
+    for (int b = 0; b < version->bandCount; b++) {
+        TileValues **band = version->bands[b];
+        if (!band)
+            continue;
+        for (int t = 0; t < version->tilesPerBand; t++) {
+            if (band[t])
+                retire(plane, band[t], tileValuesBytes(band[t]->rows, band[t]->cols), epoch);
+        }
+        retire(plane, band, version->tilesPerBand * sizeof(TileValues *), epoch);
+    }
+    retire(plane, version->bands, version->bandCount * sizeof(TileValues **), epoch);
+    retireMaps(plane, version, epoch);
+    retire(plane, version, sizeof(PlaneVersion), epoch);
+}
+
+/*
+ * reclaim frees the retired blocks that no open view can reach any more.
+ */
+static void reclaim(ValuePlane *plane) {
+    unsigned long oldest = ULONG_MAX;
+    for (int i = 0; i < PLANE_READER_SLOTS; i++) {
+        unsigned long pin = __atomic_load_n(&plane->pins[i], __ATOMIC_SEQ_CST);
+        if (pin && pin < oldest)
+            oldest = pin;
+    }
+    long kept = 0;
+    for (long i = 0; i < plane->retiredCount; i++) {
+        RetiredBlock *entry = &plane->retired[i];
+        if (entry->epoch <= oldest)
+            memFree(MEM_VERSIONS, entry->block, entry->size);
+        else
+            plane->retired[kept++] = *entry;
+    }
+    plane->retiredCount = kept;
+}
+
+static TileValues *copyTile(const Tile *tile) {
+    long count = (long) tile->rows * tile->cols;
+    TileValues *values = memAlloc(MEM_VERSIONS, tileValuesBytes(tile->rows, tile->cols));
+    if (!values) {
+        perror("Failed to allocate published tile");
+        exit(EXIT_FAILURE);
+    }
+    values->row0 = tile->row0;
+    values->col0 = tile->col0;
+    values->rows = tile->rows;
+    values->cols = tile->cols;
+    // A packed tile holds plain values only.
+    if (tile->packed) {
+        for (long k = 0; k < count; k++) {
+            values->cells[k].value = tilePackedValue(tile, k);
+            values->cells[k].flags = 0;
+        }
+        return values;
+    }
+    for (long k = 0; k < count; k++) {
+        const Cell *cell = &tile->cells[k];
+        values->cells[k].value = cell->value;
+        values->cells[k].flags = (cell->error ? VALUE_ERROR : 0) |
+                                 ((cell->op != OP_NONE || cell->dependencies) ? VALUE_FORMULA : 0);
+    }
+    return values;
+}
+
+/*
+ * publishValues copies the tiles changed since the last call into a new version and makes it
+ * the one new views see.  Unchanged bands and tiles, and the index maps unless rows or columns
+ * were inserted or deleted, are shared with the previous version.
+ */
+void publishValues(Spreadsheet *spreadsheet) {
+    ValuePlane *plane = spreadsheet->plane;
+    TileStore *store = &spreadsheet->store;
+    if (!plane->rebuild && !plane->relayout && store->dirtyCount == 0)
+        return;
+    PlaneVersion *previous = plane->current;
+    unsigned long number = previous->number + 1;
+    PlaneVersion *next = allocVersion(number, store->rows, store->cols);
+    Tile **tiles = store->dirty;
+    long tileCount = store->dirtyCount;
+    if (plane->rebuild) {
+        retireVersion(plane, previous, number);
+        tiles = store->tiles;
+        tileCount = store->tileCount;
+    } else {
+        memcpy(next->bands, previous->bands, next->bandCount * sizeof(TileValues **));
+        retire(plane, previous->bands, previous->bandCount * sizeof(TileValues **), number);
+        if (plane->relayout)
+            retireMaps(plane, previous, number);
+        retire(plane, previous, sizeof(PlaneVersion), number);
+    }
+    if (plane->rebuild || plane->relayout) {
+        next->rowMap = indexMapCopy(spreadsheet->rowMap, MEM_VERSIONS);
+        next->colMap = indexMapCopy(spreadsheet->colMap, MEM_VERSIONS);
+    } else {
+        next->rowMap = previous->rowMap;
+        next->colMap = previous->colMap;
+    }
+    size_t bandBytes = next->tilesPerBand * sizeof(TileValues *);
+    for (long i = 0; i < tileCount; i++) {
+        Tile *tile = tiles[i];
+        int tileRow = tile->row0 >> TILE_ROW_BITS, tileCol = tile->col0 >> TILE_COL_BITS;
+        TileValues **band = next->bands[tileRow];
+        // A band still shared with the previous version is copied before it is changed.
+        if (!band || (!plane->rebuild && band == previous->bands[tileRow])) {
+            TileValues **copy = memAlloc(MEM_VERSIONS, bandBytes);
+            if (!copy) {
+                perror("Failed to allocate published band");
+                exit(EXIT_FAILURE);
+            }
+            if (band) {
+                memcpy(copy, band, bandBytes);
+                retire(plane, band, bandBytes, number);
+            } else {
+                memset(copy, 0, bandBytes);
+            }
+            band = next->bands[tileRow] = copy;
+        }
+        if (band[tileCol])
+            retire(plane, band[tileCol], tileValuesBytes(band[tileCol]->rows, band[tileCol]->cols), number);
+        if (!tile->packed)
+            tileStoreUse(store, tile);
+        band[tileCol] = copyTile(tile);
+    }
+    STATS_COUNT(STATS_TILES_PUBLISHED, tileCount);
+    for (long i = 0; i < store->dirtyCount; i++)
+        store->dirty[i]->dirty = 0;
+    store->dirtyCount = 0;
+    plane->rebuild = 0;
+    plane->relayout = 0;
+    __atomic_store_n(&plane->current, next, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&plane->epoch, number, __ATOMIC_SEQ_CST);
+    reclaim(plane);
+}
+
+/*
+ * publishWorkbookValues publishes every sheet of the workbook of home: a command on one sheet
+ * can change cells of another through cross-sheet references.
+ */
+void publishWorkbookValues(Spreadsheet *home) {
+    if (!home->workbook) {
+        publishValues(home);
+        return;
+    }
+    for (int i = 0; i < home->workbook->count; i++)
+        publishValues(home->workbook->sheets[i]);
+}
+
+/*
+ * openView pins the latest published version of the plane.  It never blocks on the engine;
+ * it only yields while all PLANE_READER_SLOTS views are open.  Safe on any thread.
+ */
+void openView(ValuePlane *plane, SheetView *view) {
+    for (;;) {
+        for (int i = 0; i < PLANE_READER_SLOTS; i++) {
+            if (__atomic_load_n(&plane->pins[i], __ATOMIC_RELAXED) != 0)
+                continue;
+            unsigned long expected = 0;
+            unsigned long epoch = __atomic_load_n(&plane->epoch, __ATOMIC_SEQ_CST);
+            if (__atomic_compare_exchange_n(&plane->pins[i], &expected, epoch, 0,
+                                            __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                view->plane = plane;
+                view->slot = i;
+                view->version = __atomic_load_n(&plane->current, __ATOMIC_SEQ_CST);
+                return;
+            }
+        }
+        sched_yield();
+    }
+}
+
+/*
+ * closeView releases the version pinned by openView.  The view must not be read afterwards.
+ */
+void closeView(SheetView *view) {
+    __atomic_store_n(&view->plane->pins[view->slot], 0, __ATOMIC_RELEASE);
+    view->version = NULL;
+}
+
+/*
+ * freeValuePlane waits for the views still open on the plane to close, then frees it.
+ */
+void freeValuePlane(ValuePlane *plane) {
+    for (int i = 0; i < PLANE_READER_SLOTS; i++) {
+        while (__atomic_load_n(&plane->pins[i], __ATOMIC_ACQUIRE) != 0)
+            sched_yield();
+    }
+    retireVersion(plane, plane->current, ULONG_MAX);
+    reclaim(plane);
+    memFree(MEM_VERSIONS, plane->retired, plane->retiredCapacity * sizeof(RetiredBlock));
+    memFree(MEM_VERSIONS, plane, sizeof(ValuePlane));
+}
@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "workbook.h"
+#include "avl_tree.h"
+#include "mem_track.h"
+
+/*
+   ---------------- Workbook ----------------
+
+   The sheet list is a plain array searched by name; a workbook holds at most a few hundred
+   sheets and a name is looked up once per reference while a formula is parsed.
+*/
+
+/*
+ * validSheetName accepts 1 to SHEET_NAME_MAX - 1 letters, digits and underscores, starting
+ * with a letter or underscore.
+ */
+int validSheetName(const char *name) {
+    size_t length = strlen(name);
+    if (length == 0 || length >= SHEET_NAME_MAX)
+        return 0;
+    if (!isalpha((unsigned char) name[0]) && name[0] != '_')
+        return 0;
+    for (size_t i = 1; i < length; i++) {
+        if (!isalnum((unsigned char) name[i]) && name[i] != '_')
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * workbookFindSheet returns the sheet called name (length bytes, not necessarily terminated)
+ * in the workbook of spreadsheet, or NULL if there is none.
+ */
+Spreadsheet *workbookFindSheet(Spreadsheet *spreadsheet, const char *name, size_t length) {
+    Spreadsheet **sheets = spreadsheet->workbook ? spreadsheet->workbook->sheets : &spreadsheet;
+    int count = spreadsheet->workbook ? spreadsheet->workbook->count : 1;
+    for (int i = 0; i < count; i++) {
+        if (strlen(sheets[i]->name) == length && memcmp(sheets[i]->name, name, length) == 0)
+            return sheets[i];
+    }
+    return NULL;
+}
+
+/*
+ * workbookAddSheet creates an empty sheet called name in the workbook of home, creating the
+ * workbook on first use.  It returns the new sheet, or NULL if the name is already taken.
+ */
+Spreadsheet *workbookAddSheet(Spreadsheet *home, const char *name, int rows, int cols) {
+    if (workbookFindSheet(home, name, strlen(name)))
+        return NULL;
+    Workbook *workbook = home->workbook;
+    if (!workbook) {
+        workbook = memAlloc(MEM_OTHER, sizeof(Workbook));
+        if (!workbook) {
+            perror("Failed to allocate workbook");
+            exit(EXIT_FAILURE);
+        }
+        workbook->capacity = 4;
+        workbook->sheets = memAlloc(MEM_OTHER, workbook->capacity * sizeof(Spreadsheet *));
+        if (!workbook->sheets) {
+            perror("Failed to allocate sheet list");
+            exit(EXIT_FAILURE);
+        }
+        workbook->sheets[0] = home;
+        workbook->count = 1;
+        workbook->active = home;
+        home->workbook = workbook;
+    }
+    if (workbook->count == workbook->capacity) {
+        workbook->sheets = memRealloc(MEM_OTHER, workbook->sheets, workbook->capacity * sizeof(Spreadsheet *),
+                                      2 * workbook->capacity * sizeof(Spreadsheet *));
+        if (!workbook->sheets) {
+            perror("Failed to grow sheet list");
+            exit(EXIT_FAILURE);
+        }
+        workbook->capacity *= 2;
+    }
+    Spreadsheet *sheet = initializeSpreadsheet(rows, cols);
+    strcpy(sheet->name, name);
+    sheet->workbook = workbook;
+    workbook->sheets[workbook->count++] = sheet;
+    return sheet;
+}
+
+/*
+ * workbookOwner returns the sheet a cell belongs to, trying hint first.
+ */
+Spreadsheet *workbookOwner(Spreadsheet *hint, const Cell *cell) {
+    if (sheetOwns(hint, cell) || !hint->workbook)
+        return hint;
+    for (int i = 0; i < hint->workbook->count; i++) {
+        if (sheetOwns(hint->workbook->sheets[i], cell))
+            return hint->workbook->sheets[i];
+    }
+    return hint;
+}
+
+typedef struct {
+    const Spreadsheet *spreadsheet;
+    int foreign;
+} LinkCheck;
+
+static void foreign_cell_callback(Cell *cell, void *data) {
+    LinkCheck *check = (LinkCheck *) data;
+    if (!sheetOwns(check->spreadsheet, cell))
+        check->foreign = 1;
+}
+
+/*
+ * workbookSheetLinked reports whether any formula crosses the border of the sheet, in either
+ * direction.  Such a sheet cannot be saved to or replaced from a single-sheet snapshot.
+ */
+int workbookSheetLinked(Spreadsheet *spreadsheet) {
+    Workbook *workbook = spreadsheet->workbook;
+    if (!workbook)
+        return 0;
+    LinkCheck check = { spreadsheet, 0 };
+    const TileStore *store = &spreadsheet->store;
+    for (long t = 0; t < store->tileCount && !check.foreign; t++) {
+        Tile *tile = store->tiles[t];
+        if (tile->packed)
+            continue;
+        tileStoreUse(store, tile);
+        long n = (long) tile->rows * tile->cols;
+        for (long k = 0; k < n && !check.foreign; k++) {
+            Cell *cell = &tile->cells[k];
+            if (cell->rangeSheet)
+                return 1;
+            if (cell->dependencies)
+                avl_traverse(cell->dependencies, foreign_cell_callback, &check);
+            if (cell->dependents)
+                avl_traverse(cell->dependents, foreign_cell_callback, &check);
+        }
+    }
+    for (int i = 0; i < workbook->count && !check.foreign; i++) {
+        Spreadsheet *other = workbook->sheets[i];
+        for (int j = 0; j < other->advancedFormulasCount; j++) {
+            if (other->advancedFormulas[j]->rangeSheet == spreadsheet)
+                return 1;
+        }
+    }
+    return check.foreign;
+}
+
+/*
+ * workbookLendSession copies the session state of from into to: parseInput lends the home
+ * sheet's session to the active sheet for one command and takes it back afterwards.
+ */
+void workbookLendSession(Spreadsheet *to, const Spreadsheet *from) {
+    to->display = from->display;
+    to->quiet = from->quiet;
+    to->time = from->time;
+    to->rejectedCount = from->rejectedCount;
+    to->deferRecalc = from->deferRecalc;
+    to->journal = from->journal;
+    to->pendingCommand = from->pendingCommand;
+    to->statusOut = from->statusOut;
+    to->statusOutSize = from->statusOutSize;
+    to->deferPublish = from->deferPublish;
+}
+
+/*
+ * freeWorkbook frees every sheet of the workbook except home, which the caller owns.
+ */
+void freeWorkbook(Workbook *workbook, Spreadsheet *home) {
+    for (int i = 0; i < workbook->count; i++) {
+        if (workbook->sheets[i] == home)
+            continue;
+        workbook->sheets[i]->workbook = NULL;
+        freeSpreadsheet(workbook->sheets[i]);
+    }
+    memFree(MEM_OTHER, workbook->sheets, workbook->capacity * sizeof(Spreadsheet *));
+    memFree(MEM_OTHER, workbook, sizeof(Workbook));
+    home->workbook = NULL;
+}
@@ -0,0 +1,963 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdarg.h>
+
+/*
+   ---------------- Synthetic workload generator ----------------
+
+   workload_gen writes a command file with a parameterized dependency shape:
+
+     chain    one long dependency chain in row-major order, with a few edits at its head
+     fanout   many cells reading one hub cell, with periodic edits of the hub
+     diamond  a lattice where every cell adds its upper and left neighbours
+     ranges   nested, overlapping range formulas over a field of literals
+     mix      a random mix of literals, arithmetic, references and range formulas
+     structure the mix in the upper left of the sheet, interleaved with row and column inserts
+              and deletes
+     rejects  the diamond lattice, with edits at its corner each followed by a range formula
+              that reads its own target (and is rejected) and an edit of that cell's input
+
+   Every formula only references cells that come before its target in row-major order, so no
+   workload can contain a cycle and the final values are a pure function of the last formula
+   in each cell.  That makes an independent reference possible: --expect evaluates the
+   generated commands with a small evaluator that shares no code with the engine (its own
+   parser, dense value arrays and a memoized post-order walk) and writes the expected values
+   in the format of "export_csv_values".  --export appends that command to the workload, so
+   "cmp" on the two files checks any engine mode against the reference.
+
+   The reference follows the engine's integer semantics: 32-bit wrap-around arithmetic,
+   truncating division, ERR on division by zero and on any error inside a range, and the
+   integer-mean rounding used by STDEV.  Structural edits follow the engine's rules (see
+   structure.h), refusals included, on the reference's own arrays.  A range formula over its
+   own target is rejected after the target has lost its inputs, so the reference freezes the
+   cell at the value it has at that command.
+*/
+
+#define GEN_MAX_LINE 128
+
+/* ---------------- Generator ---------------- */
+
+static unsigned long long rngState = 88172645463325252ULL;
+
+static unsigned long long nextRandom(void) {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+    return rngState;
+}
+
+static long randomBelow(long n) {
+    return (long) (nextRandom() % (unsigned long long) n);
+}
+
+static long randomBetween(long lo, long hi) {
+    return lo + randomBelow(hi - lo + 1);
+}
+
+static void cellName(long row, long col, char *out) {
+    char letters[8];
+    int len = 0;
+    for (long c = col + 1; c > 0; c = (c - 1) / 26)
+        letters[len++] = (char) ('A' + (c - 1) % 26);
+    for (int i = 0; i < len; i++)
+        out[i] = letters[len - 1 - i];
+    sprintf(out + len, "%ld", row + 1);
+}
+
+typedef struct {
+    long rows;
+    long cols;
+    long commands;
+    FILE *out;
+    char **lines;        // kept only when the reference needs them
+    long lineCount;
+    long lineCapacity;
+} Generator;
+
+static void emit(Generator *gen, const char *fmt, ...) {
+    char line[GEN_MAX_LINE];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(line, sizeof(line), fmt, args);
+    va_end(args);
+    fprintf(gen->out, "%s\n", line);
+    if (gen->lines) {
+        if (gen->lineCount == gen->lineCapacity) {
+            gen->lineCapacity *= 2;
+            gen->lines = realloc(gen->lines, gen->lineCapacity * sizeof(char *));
+            if (!gen->lines) {
+                perror("Failed to allocate lines");
+                exit(EXIT_FAILURE);
+            }
+        }
+        gen->lines[gen->lineCount++] = strdup(line);
+    }
+}
+
+/*
+ * cellAt maps a position in row-major order to a cell name.
+ */
+static void cellAt(Generator *gen, long index, char *out) {
+    cellName(index / gen->cols, index % gen->cols, out);
+}
+
+static void genChain(Generator *gen) {
+    long total = gen->rows * gen->cols;
+    long length = gen->commands < total ? gen->commands : total;
+    long edits = length / 1000 + 1;
+    char target[16], source[16];
+    cellAt(gen, 0, target);
+    emit(gen, "%s=1", target);
+    for (long i = 1; i < length - edits; i++) {
+        cellAt(gen, i, target);
+        cellAt(gen, i - 1, source);
+        emit(gen, "%s=%s+%ld", target, source, randomBetween(0, 3));
+    }
+    cellAt(gen, 0, target);
+    for (long e = 0; e < edits; e++)
+        emit(gen, "%s=%ld", target, randomBetween(-50, 50));
+}
+
+static void genFanout(Generator *gen) {
+    long total = gen->rows * gen->cols;
+    char hub[16], target[16];
+    cellAt(gen, 0, hub);
+    emit(gen, "%s=7", hub);
+    static const char ops[] = "+-*/";
+    for (long i = 1; i < gen->commands; i++) {
+        if (i % 1000 == 0) {
+            emit(gen, "%s=%ld", hub, randomBetween(-9, 9));
+            continue;
+        }
+        cellAt(gen, 1 + randomBelow(total - 1), target);
+        char op = ops[randomBelow(4)];
+        emit(gen, "%s=%s%c%ld", target, hub, op, op == '/' ? randomBetween(0, 5) : randomBetween(0, 9));
+    }
+}
+
+static void genDiamond(Generator *gen) {
+    char target[16], up[16], left[16];
+    long count = 0;
+    for (long r = 0; r < gen->rows && count < gen->commands; r++) {
+        for (long c = 0; c < gen->cols && count < gen->commands; c++, count++) {
+            cellName(r, c, target);
+            if (r == 0 || c == 0) {
+                emit(gen, "%s=1", target);
+                continue;
+            }
+            cellName(r - 1, c, up);
+            cellName(r, c - 1, left);
+            emit(gen, "%s=%s%c%s", target, up, (r + c) % 2 ? '+' : '-', left);
+        }
+    }
+    // Re-seed the corner so the whole lattice is recomputed.
+    cellName(0, 0, target);
+    emit(gen, "%s=2", target);
+}
+
+static const char *const rangeFunctions[] = { "SUM", "MIN", "MAX", "AVG", "STDEV" };
+
+/*
+ * emitRange writes a range formula for the cell at (row, col) over a rectangle that lies entirely
+ * in the rows above it, at most maxSide cells on each side.
+ */
+static void emitRange(Generator *gen, long row, long col, long maxSide) {
+    char target[16], from[16], to[16];
+    long r2 = randomBelow(row);
+    long r1 = r2 - randomBelow(r2 + 1 < maxSide ? r2 + 1 : maxSide);
+    long c1 = randomBelow(gen->cols);
+    long c2 = c1 + randomBelow(gen->cols - c1 < maxSide ? gen->cols - c1 : maxSide);
+    cellName(row, col, target);
+    cellName(r1, c1, from);
+    cellName(r2, c2, to);
+    emit(gen, "%s=%s(%s:%s)", target, rangeFunctions[randomBelow(5)], from, to);
+}
+
+static void genRanges(Generator *gen) {
+    char target[16];
+    long count = 0;
+    // A band of literals, then rows of range formulas that overlap it and each other.
+    long literalRows = gen->rows / 4 > 0 ? gen->rows / 4 : 1;
+    for (long r = 0; r < literalRows && count < gen->commands; r++) {
+        for (long c = 0; c < gen->cols && count < gen->commands; c++, count++) {
+            cellName(r, c, target);
+            emit(gen, "%s=%ld", target, randomBetween(-100, 100));
+        }
+    }
+    while (count < gen->commands) {
+        long row = randomBetween(literalRows, gen->rows - 1);
+        if (row == 0)
+            break;
+        emitRange(gen, row, randomBelow(gen->cols), 12);
+        count++;
+        if (count % 500 == 0) {
+            cellName(randomBelow(literalRows), randomBelow(gen->cols), target);
+            emit(gen, "%s=%ld", target, randomBetween(-100, 100));
+            count++;
+        }
+    }
+}
+
+static void genMix(Generator *gen) {
+    long total = gen->rows * gen->cols;
+    char target[16], a[16], b[16];
+    static const char ops[] = "+-*/";
+    for (long i = 0; i < gen->commands; i++) {
+        long index = randomBelow(total);
+        long row = index / gen->cols, col = index % gen->cols;
+        cellName(row, col, target);
+        long kind = index == 0 ? 0 : randomBelow(100);
+        if (kind < 40) {
+            emit(gen, "%s=%ld", target, randomBetween(-1000, 1000));
+        } else if (kind < 75) {
+            cellAt(gen, randomBelow(index), a);
+            char op = ops[randomBelow(4)];
+            if (op == '/' || op == '*')
+                emit(gen, "%s=%s%c%ld", target, a, op, randomBetween(0, 9));
+            else if (randomBelow(2))
+                emit(gen, "%s=%s%c%ld", target, a, op, randomBetween(-99, 99));
+            else {
+                cellAt(gen, randomBelow(index), b);
+                emit(gen, "%s=%s%c%s", target, a, op, b);
+            }
+        } else if (kind < 85) {
+            cellAt(gen, randomBelow(index), a);
+            emit(gen, "%s=%s", target, a);
+        } else if (row > 0) {
+            emitRange(gen, row, col, 8);
+        } else {
+            emit(gen, "%s=%ld", target, randomBetween(-1000, 1000));
+        }
+    }
+}
+
+/*
+ * genStructure writes the mix over the upper left three quarters of the sheet, so that inserts
+ * have empty rows and columns to push off, with a row or column insert or delete every twenty
+ * commands.  Edits keep row-major order, so the workload stays acyclic.
+ */
+static void genStructure(Generator *gen) {
+    long rows = gen->rows * 3 / 4 > 1 ? gen->rows * 3 / 4 : 1;
+    long cols = gen->cols * 3 / 4 > 1 ? gen->cols * 3 / 4 : 1;
+    char target[16], a[16], b[16], label[24];
+    long earlier;
+    static const char ops[] = "+-*/";
+    for (long i = 0; i < gen->commands; i++) {
+        if (i % 20 == 19) {
+            int columns = (int) randomBelow(2);
+            long size = columns ? gen->cols : gen->rows;
+            long at = randomBelow(size);
+            long count = randomBetween(1, 3 < size - at ? 3 : size - at);
+            if (columns) {
+                cellName(0, at, label);
+                label[strcspn(label, "0123456789")] = '\0';
+            } else {
+                snprintf(label, sizeof(label), "%ld", at + 1);
+            }
+            emit(gen, "%s_%s %s %ld", randomBelow(2) ? "insert" : "delete", columns ? "col" : "row", label, count);
+            continue;
+        }
+        long row = randomBelow(rows), col = randomBelow(cols);
+        long index = row * cols + col;    // row-major within the corner
+        cellName(row, col, target);
+        long kind = index == 0 ? 0 : randomBelow(100);
+        if (kind < 35) {
+            emit(gen, "%s=%ld", target, randomBetween(-1000, 1000));
+        } else if (kind < 70) {
+            earlier = randomBelow(index);
+            cellName(earlier / cols, earlier % cols, a);
+            char op = ops[randomBelow(4)];
+            if (op == '/' || op == '*' || randomBelow(2)) {
+                emit(gen, "%s=%s%c%ld", target, a, op, randomBetween(0, 9));
+            } else {
+                earlier = randomBelow(index);
+                cellName(earlier / cols, earlier % cols, b);
+                emit(gen, "%s=%s%c%s", target, a, op, b);
+            }
+        } else if (kind < 80) {
+            earlier = randomBelow(index);
+            cellName(earlier / cols, earlier % cols, a);
+            emit(gen, "%s=%s", target, a);
+        } else if (row > 0) {
+            emitRange(gen, row, col, 8);
+        } else {
+            emit(gen, "%s=%ld", target, randomBetween(-1000, 1000));
+        }
+    }
+}
+
+/*
+ * genRejects writes the diamond lattice and then rounds of: a new value at its corner, which
+ * recomputes the whole lattice, a self-referencing range formula for a random cell of it, and a
+ * new value for the cell that cell read.  At the prompt the rejection lands while the corner's
+ * cascade is still running in the background.
+ */
+static void genRejects(Generator *gen) {
+    long limit = gen->commands;
+    gen->commands = gen->rows * gen->cols < limit / 2 ? gen->rows * gen->cols : limit / 2;
+    genDiamond(gen);
+    long count = gen->commands + 1;
+    gen->commands = limit;
+    char target[16], from[16], to[16], up[16];
+    long rows = (count - 1) / gen->cols;     // rows the lattice fills
+    for (; count + 3 <= limit && rows > 1 && gen->cols > 1; count += 3) {
+        long row = randomBetween(1, rows - 1), col = randomBetween(1, gen->cols - 1);
+        cellName(0, 0, target);
+        emit(gen, "%s=%ld", target, randomBetween(-9, 9));
+        cellName(row, col, target);
+        cellName(row - 1, col - 1, from);
+        cellName(row < rows - 1 ? row + 1 : row, col, to);
+        emit(gen, "%s=SUM(%s:%s)", target, from, to);
+        cellName(row - 1, col, up);
+        emit(gen, "%s=%ld", up, randomBetween(-50, 50));
+    }
+}
+
+/* ---------------- Reference evaluator ---------------- */
+
+enum { REF_LITERAL, REF_COPY, REF_BINARY, REF_RANGE, REF_FROZEN };
+
+typedef struct {
+    unsigned char kind;
+    char op;               // '+', '-', '*', '/' or the range function index
+    unsigned char literalMask;  // bit 0: a is a literal, bit 1: b is a literal
+    long a, b;             // cell index or literal value
+    long r1, c1, r2, c2;
+} RefFormula;
+
+typedef struct {
+    long rows, cols;
+    int *value;
+    unsigned char *error;
+    unsigned char *state;  // 0 not visited, 1 inputs pushed, 2 computed
+    long *formula;         // index into formulas, -1 for a literal (or empty) cell
+    RefFormula *formulas;
+    long formulaCount, formulaCapacity;
+    long *stack;
+    long stackSize, stackCapacity;
+} Reference;
+
+static int parseRef(const char *s, long *row, long *col, const char **end) {
+    long c = 0, r = 0;
+    const char *p = s;
+    if (!isupper((unsigned char) *p))
+        return 0;
+    while (isupper((unsigned char) *p))
+        c = c * 26 + (*p++ - 'A' + 1);
+    if (!isdigit((unsigned char) *p))
+        return 0;
+    while (isdigit((unsigned char) *p))
+        r = r * 10 + (*p++ - '0');
+    *row = r - 1;
+    *col = c - 1;
+    *end = p;
+    return 1;
+}
+
+/*
+ * parseOperand reads a cell reference or a (possibly negative) literal.
+ */
+static int parseOperand(Reference *ref, const char *s, long *out, int *isLiteral, const char **end) {
+    long row, col;
+    if (parseRef(s, &row, &col, end)) {
+        if (row < 0 || row >= ref->rows || col < 0 || col >= ref->cols)
+            return 0;
+        *out = row * ref->cols + col;
+        *isLiteral = 0;
+        return 1;
+    }
+    char *numberEnd;
+    *out = strtol(s, &numberEnd, 10);
+    if (numberEnd == s)
+        return 0;
+    *isLiteral = 1;
+    *end = numberEnd;
+    return 1;
+}
+
+/*
+ * operandCell returns the cell index of operand which (0 for a, 1 for b) of f, or -1 if it is a
+ * literal or absent.
+ */
+static long operandCell(const RefFormula *f, int which) {
+    if (f->kind == REF_RANGE || (which == 1 && f->kind != REF_BINARY) || (f->literalMask & (1 << which)))
+        return -1;
+    return which ? f->b : f->a;
+}
+
+typedef struct {
+    int insert;
+    int columns;
+    long at, count;
+    long size;
+} RefEdit;
+
+static long editIndex(const Reference *ref, const RefEdit *edit, long cell) {
+    return edit->columns ? cell % ref->cols : cell / ref->cols;
+}
+
+/*
+ * editMove returns where index of the edited axis lands, or -1 if it leaves the sheet.
+ */
+static long editMove(const RefEdit *edit, long index) {
+    if (edit->insert)
+        return index < edit->at ? index : index + edit->count < edit->size ? index + edit->count : -1;
+    if (index < edit->at)
+        return index;
+    return index >= edit->at + edit->count ? index - edit->count : -1;
+}
+
+static long editCell(const Reference *ref, const RefEdit *edit, long cell) {
+    long row = cell / ref->cols, col = cell % ref->cols;
+    long moved = editMove(edit, edit->columns ? col : row);
+    if (moved < 0)
+        return -1;
+    return edit->columns ? row * ref->cols + moved : moved * ref->cols + col;
+}
+
+/*
+ * editRefused reports whether the engine refuses the edit: a delete when a formula outside the
+ * block reads a cell in it or a range wholly inside it, an insert when a cell pushed off the
+ * sheet holds anything or is read, or a range starts in the rows pushed off.
+ */
+static int editRefused(const Reference *ref, const RefEdit *edit) {
+    long total = ref->rows * ref->cols;
+    long first = edit->insert ? edit->size - edit->count : edit->at;
+    long last = edit->insert ? edit->size - 1 : edit->at + edit->count - 1;
+    for (long i = 0; i < total; i++) {
+        long index = editIndex(ref, edit, i);
+        int inside = index >= first && index <= last;
+        if (edit->insert && inside && (ref->formula[i] >= 0 || ref->value[i] != 0))
+            return 1;
+        if (ref->formula[i] < 0 || (!edit->insert && inside))
+            continue;
+        const RefFormula *f = &ref->formulas[ref->formula[i]];
+        for (int which = 0; which < 2; which++) {
+            long input = operandCell(f, which);
+            long inputIndex = input < 0 ? -1 : editIndex(ref, edit, input);
+            if (inputIndex >= first && inputIndex <= last)
+                return 1;
+        }
+        if (f->kind == REF_RANGE) {
+            long low = edit->columns ? f->c1 : f->r1, high = edit->columns ? f->c2 : f->r2;
+            if (edit->insert ? low >= first : low >= first && high <= last)
+                return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * editRange moves the bounds *low..*high of a range along the edited axis: a range grows with
+ * rows inserted inside it and shrinks with rows deleted from it.
+ */
+static void editRange(const RefEdit *edit, long *low, long *high) {
+    long last = edit->at + edit->count - 1;
+    if (*high < edit->at)
+        return;
+    if (edit->insert) {
+        if (*low >= edit->at)
+            *low += edit->count;
+        *high = *high + edit->count < edit->size ? *high + edit->count : edit->size - 1;
+    } else if (*low > last) {
+        *low -= edit->count;
+        *high -= edit->count;
+    } else {
+        if (*low > edit->at)
+            *low = edit->at;
+        *high = *high > last ? *high - edit->count : edit->at - 1;
+    }
+}
+
+/*
+ * referenceEdit applies "insert_row", "delete_row", "insert_col" or "delete_col" <at> [<count>]
+ * and returns 1, or returns 0 if line is not one of them.  Refused edits change nothing.
+ */
+static int referenceEdit(Reference *ref, const char *line) {
+    RefEdit edit;
+    if (strncmp(line, "insert_", 7) == 0)
+        edit.insert = 1;
+    else if (strncmp(line, "delete_", 7) == 0)
+        edit.insert = 0;
+    else
+        return 0;
+    if (strncmp(line + 7, "row ", 4) != 0 && strncmp(line + 7, "col ", 4) != 0)
+        return 0;
+    edit.columns = line[7] == 'c';
+    edit.size = edit.columns ? ref->cols : ref->rows;
+    const char *p = line + 11;
+    long at = 0;
+    if (edit.columns) {
+        while (isupper((unsigned char) *p))
+            at = at * 26 + (*p++ - 'A' + 1);
+    } else {
+        while (isdigit((unsigned char) *p))
+            at = at * 10 + (*p++ - '0');
+    }
+    edit.at = at - 1;
+    edit.count = *p == ' ' ? strtol(p + 1, NULL, 10) : 1;
+    if (edit.at < 0 || edit.at >= edit.size || edit.count < 1 || edit.count > edit.size - edit.at ||
+        editRefused(ref, &edit))
+        return 1;
+
+    long total = ref->rows * ref->cols;
+    int *value = calloc((size_t) ref->rows * (size_t) ref->cols, sizeof(int));
+    long *formula = malloc((size_t) ref->rows * (size_t) ref->cols * sizeof(long));
+    if (!value || !formula) {
+        perror("Failed to allocate reference sheet");
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < total; i++)
+        formula[i] = -1;
+    for (long i = 0; i < total; i++) {
+        long moved = editCell(ref, &edit, i);
+        if (moved < 0)
+            continue;
+        value[moved] = ref->value[i];
+        formula[moved] = ref->formula[i];
+        if (formula[moved] < 0)
+            continue;
+        RefFormula *f = &ref->formulas[formula[moved]];
+        if (f->kind == REF_RANGE) {
+            if (edit.columns)
+                editRange(&edit, &f->c1, &f->c2);
+            else
+                editRange(&edit, &f->r1, &f->r2);
+            continue;
+        }
+        if (operandCell(f, 0) >= 0)
+            f->a = editCell(ref, &edit, f->a);
+        if (operandCell(f, 1) >= 0)
+            f->b = editCell(ref, &edit, f->b);
+    }
+    free(ref->value);
+    free(ref->formula);
+    ref->value = value;
+    ref->formula = formula;
+    return 1;
+}
+
+static void referenceEvaluate(Reference *ref);
+
+/*
+ * referenceAdd makes f the formula of cell target.
+ */
+static void referenceAdd(Reference *ref, long target, const RefFormula *f) {
+    if (ref->formulaCount == ref->formulaCapacity) {
+        ref->formulaCapacity = ref->formulaCapacity ? ref->formulaCapacity * 2 : 1024;
+        ref->formulas = realloc(ref->formulas, ref->formulaCapacity * sizeof(RefFormula));
+        if (!ref->formulas) {
+            perror("Failed to allocate formulas");
+            exit(EXIT_FAILURE);
+        }
+    }
+    ref->formulas[ref->formulaCount] = *f;
+    ref->formula[target] = ref->formulaCount++;
+}
+
+/*
+ * referenceReject is a rejected formula for target: the engine has already cut the cell off
+ * its inputs, so a formula cell keeps the value (or error) it has now and never changes again.
+ */
+static void referenceReject(Reference *ref, long target) {
+    if (ref->formula[target] < 0)
+        return;
+    referenceEvaluate(ref);
+    RefFormula f;
+    memset(&f, 0, sizeof(f));
+    f.kind = REF_FROZEN;
+    f.literalMask = 3;
+    f.a = ref->value[target];
+    f.b = ref->error[target];
+    referenceAdd(ref, target, &f);
+}
+
+/*
+ * referenceApply records the effect of one command line; anything that is not a cell
+ * assignment or a structural edit is ignored.
+ */
+static void referenceApply(Reference *ref, const char *line) {
+    long row, col;
+    const char *p;
+    if (referenceEdit(ref, line))
+        return;
+    if (!parseRef(line, &row, &col, &p) || *p != '=' || row >= ref->rows || col >= ref->cols)
+        return;
+    long target = row * ref->cols + col;
+    p++;
+    RefFormula f;
+    memset(&f, 0, sizeof(f));
+    const char *paren = strchr(p, '(');
+    if (paren) {
+        int fn;
+        for (fn = 0; fn < 5; fn++) {
+            size_t len = strlen(rangeFunctions[fn]);
+            if ((size_t) (paren - p) == len && strncmp(p, rangeFunctions[fn], len) == 0)
+                break;
+        }
+        const char *q;
+        if (fn == 5 || !parseRef(paren + 1, &f.r1, &f.c1, &q) || *q != ':' || !parseRef(q + 1, &f.r2, &f.c2, &q))
+            return;
+        f.kind = REF_RANGE;
+        f.op = (char) fn;
+        if (row >= f.r1 && row <= f.r2 && col >= f.c1 && col <= f.c2) {
+            referenceReject(ref, target);
+            return;
+        }
+    } else {
+        int lit1, lit2;
+        const char *q;
+        if (*p == '-') {
+            ref->value[target] = (int) strtol(p, NULL, 10);
+            ref->formula[target] = -1;
+            return;
+        }
+        if (!parseOperand(ref, p, &f.a, &lit1, &q))
+            return;
+        if (*q == '\0') {
+            if (lit1) {
+                ref->value[target] = (int) f.a;
+                ref->formula[target] = -1;
+                return;
+            }
+            f.kind = REF_COPY;
+        } else {
+            f.kind = REF_BINARY;
+            f.op = *q;
+            if (!parseOperand(ref, q + 1, &f.b, &lit2, &q))
+                return;
+            f.literalMask = (unsigned char) (lit1 | (lit2 << 1));
+        }
+    }
+    referenceAdd(ref, target, &f);
+}
+
+static int wrapAdd(int a, int b) { return (int) ((unsigned int) a + (unsigned int) b); }
+static int wrapSub(int a, int b) { return (int) ((unsigned int) a - (unsigned int) b); }
+static int wrapMul(int a, int b) { return (int) ((unsigned int) a * (unsigned int) b); }
+
+static void computeCell(Reference *ref, long cell) {
+    RefFormula *f = &ref->formulas[ref->formula[cell]];
+    if (f->kind == REF_FROZEN) {
+        ref->value[cell] = (int) f->a;
+        ref->error[cell] = (unsigned char) f->b;
+        return;
+    }
+    if (f->kind == REF_COPY) {
+        ref->value[cell] = ref->value[f->a];
+        ref->error[cell] = ref->error[f->a];
+        return;
+    }
+    if (f->kind == REF_BINARY) {
+        int x = (f->literalMask & 1) ? (int) f->a : ref->value[f->a];
+        int y = (f->literalMask & 2) ? (int) f->b : ref->value[f->b];
+        if ((!(f->literalMask & 1) && ref->error[f->a]) || (!(f->literalMask & 2) && ref->error[f->b]) ||
+            (f->op == '/' && y == 0)) {
+            ref->value[cell] = 0;
+            ref->error[cell] = 1;
+            return;
+        }
+        ref->value[cell] = f->op == '+' ? wrapAdd(x, y) : f->op == '-' ? wrapSub(x, y) :
+                           f->op == '*' ? wrapMul(x, y) : x / y;
+        ref->error[cell] = 0;
+        return;
+    }
+    long long sum = 0;
+    int total = 0, minVal = INT_MAX, maxVal = INT_MIN;
+    long count = 0;
+    for (long r = f->r1; r <= f->r2; r++) {
+        for (long c = f->c1; c <= f->c2; c++) {
+            long i = r * ref->cols + c;
+            if (ref->error[i]) {
+                ref->error[cell] = 1;
+                return;
+            }
+            int v = ref->value[i];
+            sum += v;
+            total = wrapAdd(total, v);
+            if (v < minVal) minVal = v;
+            if (v > maxVal) maxVal = v;
+            count++;
+        }
+    }
+    int result = 0;
+    switch (f->op) {
+        case 0: result = (int) sum; break;
+        case 1: result = minVal; break;
+        case 2: result = maxVal; break;
+        case 3: result = count > 0 ? (int) (sum / count) : 0; break;
+        default: {
+            if (count <= 1)
+                break;
+            int mean = total / (int) count;
+            double sq = 0.0;
+            for (long r = f->r1; r <= f->r2; r++) {
+                for (long c = f->c1; c <= f->c2; c++) {
+                    double diff = ref->value[r * ref->cols + c] - mean;
+                    sq += diff * diff;
+                }
+            }
+            result = (int) round(sqrt(sq / count));
+        }
+    }
+    ref->value[cell] = result;
+    ref->error[cell] = 0;
+}
+
+/*
+ * pushCell pushes a cell on the evaluation stack, growing it as needed.
+ */
+static void pushCell(Reference *ref, long cell) {
+    if (ref->stackSize == ref->stackCapacity) {
+        ref->stackCapacity *= 2;
+        ref->stack = realloc(ref->stack, ref->stackCapacity * sizeof(long));
+        if (!ref->stack) {
+            perror("Failed to allocate evaluation stack");
+            exit(EXIT_FAILURE);
+        }
+    }
+    ref->stack[ref->stackSize++] = cell;
+}
+
+/*
+ * pushInputs pushes every input of a formula cell that has not been computed yet and returns
+ * how many were pushed.
+ */
+static long pushInputs(Reference *ref, long cell) {
+    RefFormula *f = &ref->formulas[ref->formula[cell]];
+    long before = ref->stackSize;
+    if (f->kind == REF_RANGE) {
+        for (long r = f->r1; r <= f->r2; r++) {
+            for (long c = f->c1; c <= f->c2; c++) {
+                if (ref->state[r * ref->cols + c] != 2)
+                    pushCell(ref, r * ref->cols + c);
+            }
+        }
+    } else {
+        if (!(f->literalMask & 1) && ref->state[f->a] != 2)
+            pushCell(ref, f->a);
+        if (f->kind == REF_BINARY && !(f->literalMask & 2) && ref->state[f->b] != 2)
+            pushCell(ref, f->b);
+    }
+    return ref->stackSize - before;
+}
+
+/*
+ * referenceEvaluate computes every cell with an explicit post-order walk (chains of 10^6 cells
+ * would overflow the call stack).  A cell is expanded the first time it reaches the top of the
+ * stack and computed the second time, once all of its inputs above it are done.  Workloads are
+ * acyclic, so an input is never a cell that is still being expanded.
+ */
+static void referenceEvaluate(Reference *ref) {
+    long total = ref->rows * ref->cols;
+    for (long i = 0; i < total; i++)
+        ref->state[i] = ref->formula[i] < 0 ? 2 : 0;
+    for (long i = 0; i < total; i++) {
+        if (ref->state[i] == 2)
+            continue;
+        pushCell(ref, i);
+        while (ref->stackSize > 0) {
+            long cell = ref->stack[ref->stackSize - 1];
+            if (ref->state[cell] == 2) {
+                ref->stackSize--;
+            } else if (ref->state[cell] == 0 && pushInputs(ref, cell) > 0) {
+                ref->state[cell] = 1;
+            } else {
+                computeCell(ref, cell);
+                ref->state[cell] = 2;
+                ref->stackSize--;
+            }
+        }
+    }
+}
+
+/*
+ * referenceWrite writes the values like export_csv_values: rows after the last populated one and
+ * trailing empty cells are dropped, errors are written as ERR.
+ */
+static int referenceWrite(Reference *ref, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return -1;
+    long pendingLines = 0;
+    for (long r = 0; r < ref->rows; r++) {
+        long last = ref->cols - 1;
+        long base = r * ref->cols;
+        while (last >= 0 && ref->formula[base + last] < 0 && ref->value[base + last] == 0)
+            last--;
+        if (last < 0) {
+            pendingLines++;
+            continue;
+        }
+        for (; pendingLines > 0; pendingLines--)
+            fputc('\n', file);
+        for (long c = 0; c <= last; c++) {
+            long i = base + c;
+            if (c > 0)
+                fputc(',', file);
+            if (ref->formula[i] < 0 && ref->value[i] == 0)
+                continue;
+            if (ref->error[i])
+                fputs("ERR", file);
+            else
+                fprintf(file, "%d", ref->value[i]);
+        }
+        fputc('\n', file);
+    }
+    return fclose(file) == 0 ? 0 : -1;
+}
+
+static int runReference(long rows, long cols, char **lines, long lineCount, const char *path) {
+    Reference ref;
+    memset(&ref, 0, sizeof(ref));
+    long total = rows * cols;
+    ref.rows = rows;
+    ref.cols = cols;
+    ref.value = calloc(total, sizeof(int));
+    ref.error = calloc(total, 1);
+    ref.state = calloc(total, 1);
+    ref.formula = malloc(total * sizeof(long));
+    ref.stackCapacity = 1024;
+    ref.stack = malloc(ref.stackCapacity * sizeof(long));
+    if (!ref.value || !ref.error || !ref.state || !ref.formula || !ref.stack) {
+        perror("Failed to allocate reference sheet");
+        exit(EXIT_FAILURE);
+    }
+    for (long i = 0; i < total; i++)
+        ref.formula[i] = -1;
+    for (long i = 0; i < lineCount; i++)
+        referenceApply(&ref, lines[i]);
+    referenceEvaluate(&ref);
+    int status = referenceWrite(&ref, path);
+    free(ref.value);
+    free(ref.error);
+    free(ref.state);
+    free(ref.formula);
+    free(ref.stack);
+    free(ref.formulas);
+    return status;
+}
+
+static char **readLines(const char *path, long *count) {
+    FILE *file = fopen(path, "r");
+    if (!file)
+        return NULL;
+    long capacity = 1024;
+    char **lines = malloc(capacity * sizeof(char *));
+    char buffer[GEN_MAX_LINE];
+    *count = 0;
+    while (lines && fgets(buffer, sizeof(buffer), file)) {
+        buffer[strcspn(buffer, "\r\n")] = '\0';
+        if (*count == capacity) {
+            capacity *= 2;
+            lines = realloc(lines, capacity * sizeof(char *));
+            if (!lines)
+                break;
+        }
+        lines[(*count)++] = strdup(buffer);
+    }
+    fclose(file);
+    if (!lines) {
+        perror("Failed to allocate lines");
+        exit(EXIT_FAILURE);
+    }
+    return lines;
+}
+
+static void printUsage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s <chain|fanout|diamond|ranges|mix|structure|rejects> <rows> <cols> [--commands N] [--seed S]\n"
+            "          [--export <values.csv>] [--expect <expected.csv>]\n"
+            "       %s --evaluate <commands.txt> <rows> <cols> --expect <expected.csv>\n",
+            program, program);
+}
+
+int main(int argc, char *argv[]) {
+    const char *shape = NULL, *exportPath = NULL, *expectPath = NULL, *evaluatePath = NULL;
+    long positional[2];
+    int positionalCount = 0;
+    long commands = 100000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--commands") == 0 && i + 1 < argc) {
+            commands = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            rngState = strtoull(argv[++i], NULL, 10) * 2654435761ULL + 1;
+        } else if (strcmp(argv[i], "--export") == 0 && i + 1 < argc) {
+            exportPath = argv[++i];
+        } else if (strcmp(argv[i], "--expect") == 0 && i + 1 < argc) {
+            expectPath = argv[++i];
+        } else if (strcmp(argv[i], "--evaluate") == 0 && i + 1 < argc) {
+            evaluatePath = argv[++i];
+        } else if (!shape && !evaluatePath && argv[i][0] != '-') {
+            shape = argv[i];
+        } else if (positionalCount < 2 && isdigit((unsigned char) argv[i][0])) {
+            positional[positionalCount++] = atol(argv[i]);
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (positionalCount != 2 || positional[0] <= 0 || positional[1] <= 0 || commands <= 0 ||
+        (!shape && !evaluatePath) || (evaluatePath && !expectPath)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (evaluatePath) {
+        long lineCount;
+        char **lines = readLines(evaluatePath, &lineCount);
+        if (!lines) {
+            perror(evaluatePath);
+            return 1;
+        }
+        int status = runReference(positional[0], positional[1], lines, lineCount, expectPath);
+        for (long i = 0; i < lineCount; i++)
+            free(lines[i]);
+        free(lines);
+        return status == 0 ? 0 : 1;
+    }
+
+    Generator gen = { positional[0], positional[1], commands, stdout, NULL, 0, 0 };
+    if (expectPath) {
+        gen.lineCapacity = 1024;
+        gen.lines = malloc(gen.lineCapacity * sizeof(char *));
+        if (!gen.lines) {
+            perror("Failed to allocate lines");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (strcmp(shape, "chain") == 0)
+        genChain(&gen);
+    else if (strcmp(shape, "fanout") == 0)
+        genFanout(&gen);
+    else if (strcmp(shape, "diamond") == 0)
+        genDiamond(&gen);
+    else if (strcmp(shape, "ranges") == 0)
+        genRanges(&gen);
+    else if (strcmp(shape, "mix") == 0)
+        genMix(&gen);
+    else if (strcmp(shape, "structure") == 0)
+        genStructure(&gen);
+    else if (strcmp(shape, "rejects") == 0)
+        genRejects(&gen);
+    else {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (exportPath)
+        fprintf(gen.out, "export_csv_values %s\n", exportPath);
+    fflush(gen.out);
+
+    int status = 0;
+    if (expectPath) {
+        status = runReference(gen.rows, gen.cols, gen.lines, gen.lineCount, expectPath);
+        for (long i = 0; i < gen.lineCount; i++)
+            free(gen.lines[i]);
+        free(gen.lines);
+    }
+    return status == 0 ? 0 : 1;
+}